@@ -122,6 +122,111 @@ typedef bool (*edgex_device_handle_put)
   const edgex_device_commandresult *values
 );
 
+/* Asynchronous command handling */
+
+struct edgex_device_command_token;
+typedef struct edgex_device_command_token edgex_device_command_token;
+
+/**
+ * @brief Callback issued to start a GET request for device readings, for
+ *        drivers which complete requests asynchronously. The parameters are as
+ *        for edgex_device_handle_get, and remain valid until the request is
+ *        completed by a call to edgex_device_command_complete.
+ * @param token Identifies the request when calling
+ *              edgex_device_command_complete.
+ * @return true if the request was started, false if it failed immediately. If
+ *         false is returned, edgex_device_command_complete must not be called.
+ */
+
+typedef bool (*edgex_device_handle_get_async)
+(
+  void *impl,
+  const edgex_addressable *devaddr,
+  uint32_t nreadings,
+  const edgex_device_commandrequest *requests,
+  edgex_device_commandresult *readings,
+  edgex_device_command_token *token
+);
+
+/**
+ * @brief Callback issued to start a PUT request for setting device values,
+ *        for drivers which complete requests asynchronously. The parameters
+ *        are as for edgex_device_handle_put, and remain valid until the
+ *        request is completed by a call to edgex_device_command_complete.
+ * @param token Identifies the request when calling
+ *              edgex_device_command_complete.
+ * @return true if the request was started, false if it failed immediately. If
+ *         false is returned, edgex_device_command_complete must not be called.
+ */
+
+typedef bool (*edgex_device_handle_put_async)
+(
+  void *impl,
+  const edgex_addressable *devaddr,
+  uint32_t nvalues,
+  const edgex_device_commandrequest *requests,
+  const edgex_device_commandresult *values,
+  edgex_device_command_token *token
+);
+
+/* Batched command handling */
+
+/**
+ * @brief A GET request for one device, forming part of a batch.
+ */
+
+typedef struct edgex_device_batchrequest
+{
+  /** The address of the device to be queried. */
+  const edgex_addressable *devaddr;
+  /** The number of readings requested. */
+  uint32_t nreadings;
+  /** An array specifying the readings that have been requested. */
+  const edgex_device_commandrequest *requests;
+  /** An array in which to return the requested readings. */
+  edgex_device_commandresult *readings;
+  /** To be set by the implementation if the readings were obtained. */
+  bool success;
+} edgex_device_batchrequest;
+
+/**
+ * @brief Callback issued to handle GET requests for several devices at once.
+ *        When a command is run on all devices, the devices are grouped by
+ *        key (see edgex_device_batch_key) and this function is called once
+ *        for each group. If the command has a deadline and the call has not
+ *        returned by then, each device in the batch fails with a timeout
+ *        and the results of the call are discarded.
+ * @param impl The context data passed in when the service was created.
+ * @param nrequests The number of devices in the batch.
+ * @param requests The requests for each device.
+ * @return false if the batch failed as a whole, true otherwise.
+ */
+
+typedef bool (*edgex_device_handle_get_batch)
+(
+  void *impl,
+  uint32_t nrequests,
+  edgex_device_batchrequest *requests
+);
+
+/**
+ * @brief Callback issued to determine the key by which devices are grouped
+ *        for batched requests, eg the gateway through which a device is
+ *        accessed. The key is also used to limit concurrent requests (see
+ *        the MaxCmdsPerAddressable setting). If this callback is not
+ *        supplied, or returns NULL, the addressable name is used.
+ * @param impl The context data passed in when the service was created.
+ * @param devaddr The address of a device.
+ * @return The key for the device. This should remain valid for as long as
+ *         the addressable exists.
+ */
+
+typedef const char * (*edgex_device_batch_key)
+(
+  void *impl,
+  const edgex_addressable *devaddr
+);
+
 typedef bool (*edgex_device_disconnect_device)
 (
   void *impl,
@@ -146,6 +251,10 @@ typedef struct edgex_device_callbacks
   edgex_device_handle_put puthandler;
   edgex_device_disconnect_device disconnect;
   edgex_device_stop stop;
+  edgex_device_handle_get_async gethandler_async;
+  edgex_device_handle_put_async puthandler_async;
+  edgex_device_handle_get_batch gethandler_batch;
+  edgex_device_batch_key batchkey;
 } edgex_device_callbacks;
 
 /* Device service */
@@ -201,6 +310,48 @@ void edgex_device_service_start
   edgex_error *err
 );
 
+/**
+ * @brief Complete a request started by an asynchronous GET or PUT handler.
+ *        This may be called from any thread. For a GET, the readings array
+ *        passed to the handler should be filled in before this call. The
+ *        token, and the arrays passed to the handler, are no longer valid
+ *        once this function has been called.
+ * @param token The token passed to the handler.
+ * @param success Whether the request succeeded.
+ */
+
+void edgex_device_command_complete
+  (edgex_device_command_token *token, bool success);
+
+/**
+ * @brief Obtain the deadline for a command.
+ * @param token A command token, as passed to an asynchronous handler or
+ *              returned by edgex_device_command_current.
+ * @return The time (milliseconds since the epoch) by which the command should
+ *         complete, or zero if there is no deadline.
+ */
+
+uint64_t edgex_device_command_deadline
+  (const edgex_device_command_token *token);
+
+/**
+ * @brief Determine whether a command has been cancelled because its deadline
+ *        has passed. The result of a cancelled command is discarded, but an
+ *        asynchronous handler must still call edgex_device_command_complete.
+ * @param token A command token.
+ * @return true if the command has been cancelled.
+ */
+
+bool edgex_device_command_cancelled (edgex_device_command_token *token);
+
+/**
+ * @brief Obtain the token for the command being processed by a synchronous
+ *        GET or PUT handler.
+ * @return The token for the command, or NULL if not called from a handler.
+ */
+
+edgex_device_command_token *edgex_device_command_current (void);
+
 /**
  * @brief Post readings to the core-data service. This method allows readings
  *        to be generated other than in response to a device GET invocation.
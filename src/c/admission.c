@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "admission.h"
+#include "map.h"
+
+#include <errno.h>
+
+#define ADMISSION_RETRY_MAX 60
+
+typedef edgex_map(uint32_t) edgex_map_admission_count;
+
+/* Requests which cannot be admitted join a queue of waiters, each with a
+ * condition of its own. When a request completes, the waiters are admitted
+ * in the order in which they arrived, as far as the limits allow; a waiter
+ * blocked only by its key's limit does not hold up those behind it, so
+ * that a busy device does not hold up requests for the others. A new
+ * request is not admitted ahead of waiters for the same key, nor ahead of
+ * any waiter when the overall limit is reached. Per-key counts are only kept
+ * while a key has requests in progress.
+ */
+
+typedef struct admission_waiter
+{
+  const char *key;
+  bool admitted;
+  pthread_cond_t cond;
+  struct admission_waiter *next;
+} admission_waiter;
+
+struct edgex_admission
+{
+  uint32_t maxinflight;
+  uint32_t maxperkey;
+  uint32_t maxqueue;
+  uint64_t maxwaitns;
+  edgex_map_admission_count counts;
+  uint32_t inflight;
+  uint32_t waiting;
+  admission_waiter *head;
+  admission_waiter *tail;
+  uint64_t ewmans;
+  edgex_metric *inflightgauge;
+  edgex_metric *waitinggauge;
+  edgex_metric *admitted;
+  edgex_metric *queued;
+  edgex_metric *rejected;
+  edgex_metric *waittime;
+  edgex_metric *latency;
+  pthread_mutex_t lock;
+  pthread_condattr_t condattr;
+};
+
+/* The metrics are updated under the lock, so need not be sharded */
+
+static edgex_metric *admission_metric
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help
+)
+{
+  return edgex_metrics_family_get
+    (edgex_metrics_family_create (m, type, name, help, NULL, false), NULL);
+}
+
+edgex_admission *edgex_admission_create
+(
+  uint32_t maxinflight,
+  uint32_t maxperkey,
+  uint32_t maxqueue,
+  uint32_t maxwait,
+  edgex_metrics *metrics
+)
+{
+  edgex_admission *adm = malloc (sizeof (edgex_admission));
+
+  memset (adm, 0, sizeof (edgex_admission));
+  adm->maxinflight = maxinflight;
+  adm->maxperkey = maxperkey;
+  adm->maxqueue = maxqueue;
+  adm->maxwaitns = (uint64_t) maxwait * 1000000;
+  edgex_map_init (&adm->counts);
+  pthread_mutex_init (&adm->lock, NULL);
+  pthread_condattr_init (&adm->condattr);
+  pthread_condattr_setclock (&adm->condattr, CLOCK_MONOTONIC);
+
+  adm->inflightgauge = admission_metric
+  (
+    metrics, EDGEX_METRICS_GAUGE, "edgex_commands_inflight",
+    "Device command requests in progress"
+  );
+  adm->waitinggauge = admission_metric
+  (
+    metrics, EDGEX_METRICS_GAUGE, "edgex_commands_waiting",
+    "Device command requests waiting to be admitted"
+  );
+  adm->admitted = admission_metric
+  (
+    metrics, EDGEX_METRICS_COUNTER, "edgex_commands_admitted_total",
+    "Device command requests admitted"
+  );
+  adm->queued = admission_metric
+  (
+    metrics, EDGEX_METRICS_COUNTER, "edgex_commands_queued_total",
+    "Device command requests which waited to be admitted"
+  );
+  adm->rejected = admission_metric
+  (
+    metrics, EDGEX_METRICS_COUNTER, "edgex_commands_rejected_total",
+    "Device command requests refused by admission control"
+  );
+  adm->waittime = admission_metric
+  (
+    metrics, EDGEX_METRICS_HISTOGRAM, "edgex_command_wait_seconds",
+    "Time for which admitted device command requests waited"
+  );
+  adm->latency = admission_metric
+  (
+    metrics, EDGEX_METRICS_HISTOGRAM, "edgex_command_seconds",
+    "Time taken by device command requests once admitted"
+  );
+  return adm;
+}
+
+static bool admission_possible (edgex_admission *adm, const char *key)
+{
+  if (adm->maxinflight && adm->inflight >= adm->maxinflight)
+  {
+    return false;
+  }
+  if (key && adm->maxperkey)
+  {
+    uint32_t *count = edgex_map_get (&adm->counts, key);
+    if (count && *count >= adm->maxperkey)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool admission_key_waiting (edgex_admission *adm, const char *key)
+{
+  if (key && adm->maxperkey)
+  {
+    for (admission_waiter *w = adm->head; w; w = w->next)
+    {
+      if (w->key && strcmp (w->key, key) == 0)
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void admission_count (edgex_admission *adm, const char *key)
+{
+  if (key && adm->maxperkey)
+  {
+    uint32_t *count = edgex_map_get (&adm->counts, key);
+    if (count)
+    {
+      (*count)++;
+    }
+    else
+    {
+      edgex_map_set (&adm->counts, key, 1);
+    }
+  }
+}
+
+static void admission_uncount (edgex_admission *adm, const char *key)
+{
+  if (key && adm->maxperkey)
+  {
+    uint32_t *count = edgex_map_get (&adm->counts, key);
+    if (count && --(*count) == 0)
+    {
+      edgex_map_remove (&adm->counts, key);
+    }
+  }
+}
+
+/* Counts a request as in progress. Called with the lock held. */
+
+static void admission_take (edgex_admission *adm, const char *key)
+{
+  admission_count (adm, key);
+  adm->inflight++;
+  edgex_metric_add (adm->inflightgauge, 1);
+  edgex_metric_add (adm->admitted, 1);
+}
+
+static void admission_unlink (edgex_admission *adm, admission_waiter *w)
+{
+  admission_waiter **pos = &adm->head;
+  admission_waiter *prev = NULL;
+  while (*pos != w)
+  {
+    prev = *pos;
+    pos = &(*pos)->next;
+  }
+  *pos = w->next;
+  if (adm->tail == w)
+  {
+    adm->tail = prev;
+  }
+  adm->waiting--;
+  edgex_metric_add (adm->waitinggauge, -1);
+}
+
+/* Admits waiters in order while the limits allow. Called with the lock
+ * held.
+ */
+
+static void admission_dispatch (edgex_admission *adm)
+{
+  admission_waiter *w = adm->head;
+  while (w && !(adm->maxinflight && adm->inflight >= adm->maxinflight))
+  {
+    admission_waiter *next = w->next;
+    if (admission_possible (adm, w->key))
+    {
+      admission_unlink (adm, w);
+      admission_take (adm, w->key);
+      w->admitted = true;
+      pthread_cond_signal (&w->cond);
+    }
+    w = next;
+  }
+}
+
+bool edgex_admission_enter
+  (edgex_admission *adm, const char *key, uint64_t *ticket)
+{
+  uint64_t start = edgex_metrics_now ();
+
+  pthread_mutex_lock (&adm->lock);
+  if (admission_possible (adm, key) && !admission_key_waiting (adm, key))
+  {
+    admission_take (adm, key);
+  }
+  else
+  {
+    struct timespec deadline;
+    admission_waiter w;
+    uint64_t end = start + adm->maxwaitns;
+
+    if (adm->waiting >= adm->maxqueue)
+    {
+      edgex_metric_add (adm->rejected, 1);
+      pthread_mutex_unlock (&adm->lock);
+      return false;
+    }
+
+    edgex_metric_add (adm->queued, 1);
+    w.key = key;
+    w.admitted = false;
+    w.next = NULL;
+    pthread_cond_init (&w.cond, &adm->condattr);
+    if (adm->tail)
+    {
+      adm->tail->next = &w;
+    }
+    else
+    {
+      adm->head = &w;
+    }
+    adm->tail = &w;
+    adm->waiting++;
+    edgex_metric_add (adm->waitinggauge, 1);
+
+    deadline.tv_sec = end / 1000000000;
+    deadline.tv_nsec = end % 1000000000;
+    while (!w.admitted)
+    {
+      if (adm->maxwaitns == 0)
+      {
+        pthread_cond_wait (&w.cond, &adm->lock);
+      }
+      else if
+      (
+        pthread_cond_timedwait (&w.cond, &adm->lock, &deadline) ==
+          ETIMEDOUT && !w.admitted
+      )
+      {
+        admission_unlink (adm, &w);
+        pthread_cond_destroy (&w.cond);
+        edgex_metric_add (adm->rejected, 1);
+        pthread_mutex_unlock (&adm->lock);
+        return false;
+      }
+    }
+    pthread_cond_destroy (&w.cond);
+    edgex_metric_since (adm->waittime, start);
+  }
+  pthread_mutex_unlock (&adm->lock);
+  *ticket = edgex_metrics_now ();
+  return true;
+}
+
+void edgex_admission_exit
+  (edgex_admission *adm, const char *key, uint64_t ticket)
+{
+  uint64_t latency = edgex_metrics_now () - ticket;
+
+  pthread_mutex_lock (&adm->lock);
+  admission_uncount (adm, key);
+  adm->inflight--;
+  edgex_metric_add (adm->inflightgauge, -1);
+  edgex_metric_record (adm->latency, latency);
+
+  /* Moving average of the latency, weighting recent requests at 1/8 */
+
+  adm->ewmans = adm->ewmans ?
+    adm->ewmans - adm->ewmans / 8 + latency / 8 : latency;
+  admission_dispatch (adm);
+  pthread_mutex_unlock (&adm->lock);
+}
+
+bool edgex_admission_claim (edgex_admission *adm, const char *key)
+{
+  bool result = true;
+
+  if (key && adm->maxperkey)
+  {
+    pthread_mutex_lock (&adm->lock);
+    uint32_t *count = edgex_map_get (&adm->counts, key);
+    result =
+      !(count && *count >= adm->maxperkey) && !admission_key_waiting (adm, key);
+    if (result)
+    {
+      admission_count (adm, key);
+    }
+    else
+    {
+      edgex_metric_add (adm->rejected, 1);
+    }
+    pthread_mutex_unlock (&adm->lock);
+  }
+  return result;
+}
+
+void edgex_admission_release (edgex_admission *adm, const char *key)
+{
+  if (key && adm->maxperkey)
+  {
+    pthread_mutex_lock (&adm->lock);
+    admission_uncount (adm, key);
+    admission_dispatch (adm);
+    pthread_mutex_unlock (&adm->lock);
+  }
+}
+
+uint32_t edgex_admission_retry_after (edgex_admission *adm)
+{
+  uint64_t ns;
+  uint32_t servers;
+
+  pthread_mutex_lock (&adm->lock);
+  servers = adm->maxinflight ? adm->maxinflight : adm->inflight;
+  ns = adm->ewmans * (adm->waiting + 1) / (servers ? servers : 1);
+  pthread_mutex_unlock (&adm->lock);
+
+  ns = (ns + 999999999) / 1000000000;
+  if (ns == 0)
+  {
+    ns = 1;
+  }
+  return (ns > ADMISSION_RETRY_MAX) ? ADMISSION_RETRY_MAX : (uint32_t) ns;
+}
+
+void edgex_admission_free (edgex_admission *adm)
+{
+  if (adm)
+  {
+    edgex_map_deinit (&adm->counts);
+    pthread_condattr_destroy (&adm->condattr);
+    pthread_mutex_destroy (&adm->lock);
+    free (adm);
+  }
+}
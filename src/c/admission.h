@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_ADMISSION_H_
+#define _EDGEX_DEVICE_ADMISSION_H_ 1
+
+#include "edgex/os.h"
+#include "metrics.h"
+
+/* Admission control for device command requests. A request is admitted if
+ * fewer than maxinflight requests are in progress, and fewer than maxperkey
+ * for its key (normally a device name). Otherwise, if fewer than maxqueue
+ * requests are already waiting, it waits for up to maxwait milliseconds to
+ * be admitted; if it is not, it is rejected. Waiting requests are admitted
+ * in the order in which they arrived, except that a request held back by
+ * its key's limit does not delay requests for other keys. Limits of zero
+ * on maxinflight and maxperkey mean unlimited, a maxqueue of zero rejects
+ * requests which cannot be admitted at once, and a maxwait of zero waits
+ * without a time limit. Counts of requests, and their waiting and running
+ * times, are kept in the metrics registry.
+ */
+
+struct edgex_admission;
+typedef struct edgex_admission edgex_admission;
+
+extern edgex_admission *edgex_admission_create
+(
+  uint32_t maxinflight,
+  uint32_t maxperkey,
+  uint32_t maxqueue,
+  uint32_t maxwait,
+  edgex_metrics *metrics
+);
+
+/* Admit a request, waiting if necessary. The key may be NULL for requests
+ * not limited per key. Returns false if the request is rejected; otherwise
+ * the ticket must be passed to edgex_admission_exit with the same key when
+ * the request completes.
+ */
+
+extern bool edgex_admission_enter
+  (edgex_admission *adm, const char *key, uint64_t *ticket);
+
+extern void edgex_admission_exit
+  (edgex_admission *adm, const char *key, uint64_t ticket);
+
+/* Claim a place within the per-key limit for part of a request already
+ * admitted (eg one command of a batch), without counting against the
+ * overall limit. The claim does not wait: it fails if the key is at its
+ * limit or has requests waiting. A successful claim is to be released with
+ * edgex_admission_release.
+ */
+
+extern bool edgex_admission_claim (edgex_admission *adm, const char *key);
+
+extern void edgex_admission_release (edgex_admission *adm, const char *key);
+
+/* An estimate, in seconds, of when a rejected request might succeed. This
+ * is the expected time for the requests now waiting to be served.
+ */
+
+extern uint32_t edgex_admission_retry_after (edgex_admission *adm);
+
+extern void edgex_admission_free (edgex_admission *adm);
+
+#endif
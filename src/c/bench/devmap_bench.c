@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+/* Concurrent stress benchmark for the device registry. Reader threads look
+ * up random devices by id or by name while writer threads continually
+ * replace, remove and re-add devices. The same workload is run against the
+ * lock-free registry and against an edgex_map protected by a rwlock, which
+ * is how devices were previously held.
+ *
+ * Readers check the contents of each device they obtain, so when built with
+ * -fsanitize=address this also exercises the safe reclamation of devices.
+ */
+
+#include "../devmap.h"
+#include "../map.h"
+#include "../edgex_rest.h"
+#include "edgex/os.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+typedef edgex_map(edgex_device *) edgex_map_device;
+
+typedef struct bench
+{
+  uint32_t ndevs;
+  bool locked;
+  bool stop;
+  edgex_devmap *devmap;
+  edgex_map_device map;
+  edgex_map_string names;
+  pthread_rwlock_t lock;
+} bench;
+
+typedef struct worker
+{
+  bench *b;
+  pthread_t thread;
+  unsigned seed;
+  uint64_t ops;
+  uint64_t errors;
+} worker;
+
+static char *bench_id (uint32_t i)
+{
+  char buf[32];
+  sprintf (buf, "id-%u", i);
+  return strdup (buf);
+}
+
+static char *bench_name (uint32_t i)
+{
+  char buf[32];
+  sprintf (buf, "device-%u", i);
+  return strdup (buf);
+}
+
+static edgex_device *bench_device (uint32_t i, uint64_t gen)
+{
+  edgex_device *dev = malloc (sizeof (edgex_device));
+  memset (dev, 0, sizeof (edgex_device));
+  dev->id = bench_id (i);
+  dev->name = bench_name (i);
+  dev->description = strdup ("benchmark device");
+  dev->adminState = strdup ("UNLOCKED");
+  dev->operatingState = strdup ("ENABLED");
+  dev->origin = i;
+  dev->modified = gen;
+  dev->profile = malloc (sizeof (edgex_deviceprofile));
+  memset (dev->profile, 0, sizeof (edgex_deviceprofile));
+  dev->profile->name = strdup ("benchmark profile");
+  return dev;
+}
+
+/* Check that a device is intact and is the one that was asked for */
+
+static bool bench_check (const edgex_device *dev, uint32_t i)
+{
+  char buf[32];
+  sprintf (buf, "device-%u", i);
+  return dev->origin == i && strcmp (dev->name, buf) == 0 &&
+    strcmp (dev->adminState, "UNLOCKED") == 0;
+}
+
+static bool bench_check_rec (const edgex_devrec *dev, uint32_t i)
+{
+  char buf[32];
+  sprintf (buf, "device-%u", i);
+  return dev->origin == i && strcmp (dev->name, buf) == 0 &&
+    dev->adminstate == UNLOCKED;
+}
+
+static edgex_devrec *bench_lookup (bench *b, uint32_t i, bool byname)
+{
+  char *key = byname ? bench_name (i) : bench_id (i);
+  edgex_devrec *dev = byname ?
+    edgex_devmap_device_byname (b->devmap, key) :
+    edgex_devmap_device_byid (b->devmap, key);
+  free (key);
+  return dev;
+}
+
+static void *bench_reader (void *p)
+{
+  worker *w = (worker *) p;
+  bench *b = w->b;
+
+  while (!__atomic_load_n (&b->stop, __ATOMIC_RELAXED))
+  {
+    uint32_t i = rand_r (&w->seed) % b->ndevs;
+    bool byname = rand_r (&w->seed) % 2;
+    if (b->locked)
+    {
+      char *key = byname ? bench_name (i) : bench_id (i);
+      pthread_rwlock_rdlock (&b->lock);
+      edgex_device **dev = NULL;
+      if (byname)
+      {
+        char **id = edgex_map_get_ (&b->names.base, key);
+        if (id)
+        {
+          dev = edgex_map_get_ (&b->map.base, *id);
+        }
+      }
+      else
+      {
+        dev = edgex_map_get_ (&b->map.base, key);
+      }
+      if (dev && !bench_check (*dev, i))
+      {
+        w->errors++;
+      }
+      pthread_rwlock_unlock (&b->lock);
+      free (key);
+    }
+    else
+    {
+      edgex_devrec *dev = bench_lookup (b, i, byname);
+      if (dev)
+      {
+        if (!bench_check_rec (dev, i))
+        {
+          w->errors++;
+        }
+        edgex_devmap_release (dev);
+      }
+    }
+    w->ops++;
+  }
+  return NULL;
+}
+
+static void bench_locked_remove (bench *b, uint32_t i)
+{
+  char *key = bench_id (i);
+  edgex_device **d = edgex_map_get (&b->map, key);
+  if (d)
+  {
+    edgex_device *dev = *d;
+    edgex_map_remove (&b->names, dev->name);
+    edgex_map_remove (&b->map, key);
+    edgex_device_free (dev);
+  }
+  free (key);
+}
+
+static void bench_locked_add (bench *b, edgex_device *dev)
+{
+  edgex_map_set (&b->map, dev->id, dev);
+  edgex_map_set (&b->names, dev->name, dev->id);
+}
+
+static void *bench_writer (void *p)
+{
+  worker *w = (worker *) p;
+  bench *b = w->b;
+  uint64_t gen = 0;
+
+  while (!__atomic_load_n (&b->stop, __ATOMIC_RELAXED))
+  {
+    uint32_t i = rand_r (&w->seed) % b->ndevs;
+    bool remove = (rand_r (&w->seed) % 4) == 0;
+    if (b->locked)
+    {
+      pthread_rwlock_wrlock (&b->lock);
+      bench_locked_remove (b, i);
+      if (!remove)
+      {
+        bench_locked_add (b, bench_device (i, ++gen));
+      }
+      pthread_rwlock_unlock (&b->lock);
+    }
+    else if (remove)
+    {
+      char *key = bench_id (i);
+      edgex_devmap_release (edgex_devmap_remove_byid (b->devmap, key));
+      free (key);
+    }
+    else
+    {
+      edgex_devmap_replace (b->devmap, bench_device (i, ++gen));
+    }
+    w->ops++;
+  }
+  return NULL;
+}
+
+static void bench_run
+  (uint32_t ndevs, uint32_t nreaders, uint32_t nwriters, uint32_t secs, bool locked)
+{
+  bench b;
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  uint64_t errors = 0;
+  uint32_t nworkers = nreaders + nwriters;
+  worker *workers = malloc (nworkers * sizeof (worker));
+
+  memset (&b, 0, sizeof (b));
+  b.ndevs = ndevs;
+  b.locked = locked;
+  b.devmap = edgex_devmap_alloc ();
+  edgex_map_init (&b.map);
+  edgex_map_init (&b.names);
+  pthread_rwlock_init (&b.lock, NULL);
+
+  for (uint32_t i = 0; i < ndevs; i++)
+  {
+    if (locked)
+    {
+      bench_locked_add (&b, bench_device (i, 0));
+    }
+    else
+    {
+      edgex_devmap_replace (b.devmap, bench_device (i, 0));
+    }
+  }
+
+  for (uint32_t i = 0; i < nworkers; i++)
+  {
+    workers[i].b = &b;
+    workers[i].seed = i + 1;
+    workers[i].ops = 0;
+    workers[i].errors = 0;
+    pthread_create
+    (
+      &workers[i].thread, NULL,
+      i < nreaders ? bench_reader : bench_writer, &workers[i]
+    );
+  }
+  sleep (secs);
+  __atomic_store_n (&b.stop, true, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < nworkers; i++)
+  {
+    pthread_join (workers[i].thread, NULL);
+    if (i < nreaders)
+    {
+      reads += workers[i].ops;
+    }
+    else
+    {
+      writes += workers[i].ops;
+    }
+    errors += workers[i].errors;
+  }
+
+  printf
+  (
+    "%-8s %8u devices %3u readers %3u writers: "
+    "%10.0f lookups/s %8.0f updates/s %" PRIu64 " errors\n",
+    locked ? "rwlock" : "devmap", ndevs, nreaders, nwriters,
+    (double) reads / secs, (double) writes / secs, errors
+  );
+
+  const char *key;
+  edgex_map_iter iter = edgex_map_iter (b.map);
+  while ((key = edgex_map_next (&b.map, &iter)))
+  {
+    edgex_device_free (*edgex_map_get (&b.map, key));
+  }
+  edgex_map_deinit (&b.map);
+  edgex_map_deinit (&b.names);
+  pthread_rwlock_destroy (&b.lock);
+  edgex_devmap_free (b.devmap);
+  free (workers);
+}
+
+static void usage (void)
+{
+  printf ("Options:\n");
+  printf ("   -h, --help            : Show this text\n");
+  printf ("   -d, --devices <n>     : Number of devices (default 1000)\n");
+  printf ("   -r, --readers <n>     : Number of reader threads (default 8)\n");
+  printf ("   -w, --writers <n>     : Number of writer threads (default 1)\n");
+  printf ("   -t, --time <secs>     : Duration of each run (default 5)\n");
+}
+
+int main (int argc, char *argv[])
+{
+  uint32_t ndevs = 1000;
+  uint32_t nreaders = 8;
+  uint32_t nwriters = 1;
+  uint32_t secs = 5;
+
+  int n = 1;
+  while (n < argc)
+  {
+    if (strcmp (argv[n], "-h") == 0 || strcmp (argv[n], "--help") == 0)
+    {
+      usage ();
+      return 0;
+    }
+    if (n + 1 < argc)
+    {
+      uint32_t val = strtoul (argv[n + 1], NULL, 10);
+      if (strcmp (argv[n], "-d") == 0 || strcmp (argv[n], "--devices") == 0)
+      {
+        ndevs = val;
+        n += 2;
+        continue;
+      }
+      if (strcmp (argv[n], "-r") == 0 || strcmp (argv[n], "--readers") == 0)
+      {
+        nreaders = val;
+        n += 2;
+        continue;
+      }
+      if (strcmp (argv[n], "-w") == 0 || strcmp (argv[n], "--writers") == 0)
+      {
+        nwriters = val;
+        n += 2;
+        continue;
+      }
+      if (strcmp (argv[n], "-t") == 0 || strcmp (argv[n], "--time") == 0)
+      {
+        secs = val;
+        n += 2;
+        continue;
+      }
+    }
+    printf ("Unknown option %s\n", argv[n]);
+    usage ();
+    return 1;
+  }
+  if (ndevs == 0 || secs == 0)
+  {
+    usage ();
+    return 1;
+  }
+
+  bench_run (ndevs, nreaders, nwriters, secs, true);
+  bench_run (ndevs, nreaders, nwriters, secs, false);
+  return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+/* Memory footprint benchmark for the device registry. A list of devices, as
+ * returned by core-metadata, is built and the heap in use is measured. The
+ * same devices are then loaded into the registry and the list is freed, and
+ * the heap in use by the registry's records is measured for comparison.
+ * Lookups by name are timed against both representations.
+ */
+
+#include "../devmap.h"
+#include "../map.h"
+#include "../edgex_rest.h"
+#include "edgex/os.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <time.h>
+
+typedef edgex_map(edgex_device *) edgex_map_device;
+
+static size_t heap_used (void)
+{
+  struct mallinfo2 mi = mallinfo2 ();
+  return mi.uordblks + mi.hblkhd;
+}
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static edgex_strings *bench_label (const char *str, edgex_strings *next)
+{
+  edgex_strings *l = malloc (sizeof (edgex_strings));
+  l->str = strdup (str);
+  l->next = next;
+  return l;
+}
+
+static edgex_addressable *bench_addressable (const char *name)
+{
+  edgex_addressable *addr = malloc (sizeof (edgex_addressable));
+  memset (addr, 0, sizeof (edgex_addressable));
+  addr->name = strdup (name);
+  addr->address = strdup ("192.168.0.10");
+  addr->method = strdup ("GET");
+  addr->protocol = strdup ("HTTP");
+  addr->path = strdup ("/api/v1/device");
+  addr->port = 49990;
+  return addr;
+}
+
+/* A device as it is received from core-metadata, with its own copy of the
+ * device service. Profiles are shared in both representations, so none is
+ * attached.
+ */
+
+static edgex_device *bench_device (uint32_t i)
+{
+  char buf[64];
+  edgex_device *dev = malloc (sizeof (edgex_device));
+  memset (dev, 0, sizeof (edgex_device));
+  sprintf (buf, "5b9a4f9a9f8fc20001a1%04x", i);
+  dev->id = strdup (buf);
+  sprintf (buf, "sensor-%u", i);
+  dev->name = strdup (buf);
+  sprintf (buf, "sensor-%u_addr", i);
+  dev->addressable = bench_addressable (buf);
+  dev->description = strdup ("Temperature and humidity sensor");
+  dev->adminState = strdup ("UNLOCKED");
+  dev->operatingState = strdup ("ENABLED");
+  dev->labels = bench_label ("temperature", bench_label ("humidity", NULL));
+  dev->origin = i;
+  dev->created = i;
+  dev->modified = i;
+
+  dev->service = malloc (sizeof (edgex_deviceservice));
+  memset (dev->service, 0, sizeof (edgex_deviceservice));
+  dev->service->name = strdup ("device-benchmark");
+  dev->service->id = strdup ("5b9a4f9a9f8fc20001a00000");
+  dev->service->adminState = strdup ("UNLOCKED");
+  dev->service->operatingState = strdup ("ENABLED");
+  dev->service->labels = bench_label ("benchmark", NULL);
+  dev->service->addressable = bench_addressable ("device-benchmark");
+  return dev;
+}
+
+static void usage (void)
+{
+  printf ("Options:\n");
+  printf ("   -h, --help            : Show this text\n");
+  printf ("   -d, --devices <n>     : Number of devices (default 100000)\n");
+}
+
+int main (int argc, char *argv[])
+{
+  uint32_t ndevs = 100000;
+  edgex_device *list = NULL;
+  edgex_device **last = &list;
+  edgex_map_device map;
+  uint64_t start, found;
+  char buf[64];
+
+  if (argc == 3 &&
+    (strcmp (argv[1], "-d") == 0 || strcmp (argv[1], "--devices") == 0))
+  {
+    ndevs = strtoul (argv[2], NULL, 10);
+  }
+  else if (argc != 1)
+  {
+    usage ();
+    return argc == 2 && (strcmp (argv[1], "-h") == 0 ||
+      strcmp (argv[1], "--help") == 0) ? 0 : 1;
+  }
+  if (ndevs == 0)
+  {
+    usage ();
+    return 1;
+  }
+
+  /* Devices as edgex_device structures, indexed by name */
+
+  size_t base = heap_used ();
+  edgex_map_init (&map);
+  for (uint32_t i = 0; i < ndevs; i++)
+  {
+    *last = bench_device (i);
+    edgex_map_set (&map, (*last)->name, *last);
+    last = &(*last)->next;
+  }
+  size_t listsize = heap_used () - base;
+
+  found = 0;
+  start = now_ns ();
+  for (uint32_t i = 0; i < ndevs; i++)
+  {
+    sprintf (buf, "sensor-%u", (i * 7919) % ndevs);
+    edgex_device **dev = edgex_map_get (&map, buf);
+    found += (dev && (*dev)->origin == (i * 7919) % ndevs);
+  }
+  uint64_t listns = now_ns () - start;
+
+  /* The same devices as registry records */
+
+  base = heap_used ();
+  edgex_devmap *devmap = edgex_devmap_alloc ();
+  edgex_devmap_populate (devmap, list);
+  size_t devmapsize = heap_used () - base;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < ndevs; i++)
+  {
+    sprintf (buf, "sensor-%u", (i * 7919) % ndevs);
+    edgex_devrec *rec = edgex_devmap_device_byname (devmap, buf);
+    found += (rec && rec->origin == (i * 7919) % ndevs);
+    edgex_devmap_release (rec);
+  }
+  uint64_t devmapns = now_ns () - start;
+
+  printf ("%u devices\n", ndevs);
+  printf
+  (
+    "edgex_device: %10zu bytes (%5zu per device) %6.0f ns per lookup\n",
+    listsize, listsize / ndevs, (double) listns / ndevs
+  );
+  printf
+  (
+    "devmap:       %10zu bytes (%5zu per device) %6.0f ns per lookup\n",
+    devmapsize, devmapsize / ndevs, (double) devmapns / ndevs
+  );
+  if (found != 2 * (uint64_t) ndevs)
+  {
+    printf ("lookup failures: %zu\n", (size_t) (2 * (uint64_t) ndevs - found));
+  }
+
+  edgex_map_deinit (&map);
+  edgex_device_free (list);
+  edgex_devmap_free (devmap);
+  return found == 2 * (uint64_t) ndevs ? 0 : 1;
+}
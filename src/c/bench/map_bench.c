@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+/* Benchmark for edgex_map. Insertion, successful and unsuccessful lookups,
+ * iteration and removal are timed for maps of increasing size, against both
+ * edgex_map and the chained hash map which it replaced, a copy of which is
+ * included here. The longest single insertion is also reported, as this
+ * includes any resizing of the table. The heap is trimmed before measuring
+ * this, so that the allocator's consolidation of previously freed nodes is
+ * not counted.
+ */
+
+#include "../map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+
+/* The previous implementation: one chained node per entry, djb2-xor hash,
+ * buckets doubled when the node count reaches the bucket count.
+ */
+
+typedef struct chain_node
+{
+  unsigned hash;
+  void *value;
+  struct chain_node *next;
+} chain_node;
+
+typedef struct
+{
+  chain_node **buckets;
+  unsigned nbuckets;
+  unsigned nnodes;
+} chain_map;
+
+static unsigned chain_hash (const char *str)
+{
+  unsigned hash = 5381u;
+  while (*str)
+  {
+    hash = ((hash << 5) + hash) ^ *str++;
+  }
+  return hash;
+}
+
+static void chain_addnode (chain_map *m, chain_node *node)
+{
+  unsigned n = node->hash & (m->nbuckets - 1);
+  node->next = m->buckets[n];
+  m->buckets[n] = node;
+}
+
+static void chain_resize (chain_map *m, unsigned nbuckets)
+{
+  chain_node *nodes = NULL, *node, *next;
+  unsigned i = m->nbuckets;
+  while (i--)
+  {
+    for (node = m->buckets[i]; node; node = next)
+    {
+      next = node->next;
+      node->next = nodes;
+      nodes = node;
+    }
+  }
+  m->buckets = realloc (m->buckets, sizeof (chain_node *) * nbuckets);
+  m->nbuckets = nbuckets;
+  memset (m->buckets, 0, sizeof (chain_node *) * nbuckets);
+  for (node = nodes; node; node = next)
+  {
+    next = node->next;
+    chain_addnode (m, node);
+  }
+}
+
+static chain_node **chain_getref (chain_map *m, const char *key)
+{
+  unsigned hash = chain_hash (key);
+  if (m->nbuckets > 0)
+  {
+    chain_node **next = &m->buckets[hash & (m->nbuckets - 1)];
+    while (*next)
+    {
+      if ((*next)->hash == hash && !strcmp ((char *) (*next + 1), key))
+      {
+        return next;
+      }
+      next = &(*next)->next;
+    }
+  }
+  return NULL;
+}
+
+static void *chain_get (chain_map *m, const char *key)
+{
+  chain_node **next = chain_getref (m, key);
+  return next ? (*next)->value : NULL;
+}
+
+static void chain_set (chain_map *m, const char *key, void *value)
+{
+  chain_node **next = chain_getref (m, key);
+  if (next)
+  {
+    (*next)->value = value;
+    return;
+  }
+  size_t ksize = strlen (key) + 1;
+  chain_node *node = malloc (sizeof (chain_node) + ksize);
+  memcpy (node + 1, key, ksize);
+  node->hash = chain_hash (key);
+  node->value = value;
+  if (m->nnodes >= m->nbuckets)
+  {
+    chain_resize (m, m->nbuckets ? m->nbuckets << 1 : 1);
+  }
+  chain_addnode (m, node);
+  m->nnodes++;
+}
+
+static void chain_remove (chain_map *m, const char *key)
+{
+  chain_node **next = chain_getref (m, key);
+  if (next)
+  {
+    chain_node *node = *next;
+    *next = node->next;
+    free (node);
+    m->nnodes--;
+  }
+}
+
+static void chain_deinit (chain_map *m)
+{
+  for (unsigned i = 0; i < m->nbuckets; i++)
+  {
+    chain_node *node = m->buckets[i];
+    while (node)
+    {
+      chain_node *next = node->next;
+      free (node);
+      node = next;
+    }
+  }
+  free (m->buckets);
+}
+
+/* Timing */
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct
+{
+  double insert;
+  double hit;
+  double miss;
+  double iterate;
+  double remove;
+  double maxinsert;
+  uintptr_t check;
+} bench_result;
+
+static void bench_report (const char *name, uint32_t n, const bench_result *r)
+{
+  printf
+  (
+    "%-9s %8u keys: insert %6.1f  hit %6.1f  miss %6.1f  "
+    "iterate %5.1f  remove %6.1f ns/op  longest insert %8.1f us\n",
+    name, n, r->insert, r->hit, r->miss, r->iterate, r->remove,
+    r->maxinsert / 1000.0
+  );
+}
+
+/* Keys are looked up in a scattered order, so that successive lookups do
+ * not touch neighbouring memory.
+ */
+
+static uint32_t bench_order (uint32_t i, uint32_t n)
+{
+  return (uint32_t) (((uint64_t) i * 2654435761u) % n);
+}
+
+static void bench_new (char **keys, uint32_t n, bench_result *r)
+{
+  edgex_map_void m;
+  uint64_t start;
+  const char *key;
+  uintptr_t check = 0;
+
+  edgex_map_init (&m);
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    edgex_map_set (&m, keys[i], (void *) (uintptr_t) i);
+  }
+  r->insert = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    check += (uintptr_t) *edgex_map_get (&m, keys[bench_order (i, n)]);
+  }
+  r->hit = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    check += (edgex_map_get (&m, keys[n + bench_order (i, n)]) != NULL);
+  }
+  r->miss = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  edgex_map_iter iter = edgex_map_iter (m);
+  while ((key = edgex_map_next (&m, &iter)))
+  {
+    check += key[0];
+  }
+  r->iterate = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    edgex_map_remove (&m, keys[bench_order (i, n)]);
+  }
+  r->remove = (double) (now_ns () - start) / n;
+  r->check = check;
+  edgex_map_deinit (&m);
+
+  r->maxinsert = 0;
+  malloc_trim (0);
+  edgex_map_init (&m);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    start = now_ns ();
+    edgex_map_set (&m, keys[i], (void *) (uintptr_t) i);
+    double t = now_ns () - start;
+    r->maxinsert = t > r->maxinsert ? t : r->maxinsert;
+  }
+  edgex_map_deinit (&m);
+}
+
+static void bench_chain (char **keys, uint32_t n, bench_result *r)
+{
+  chain_map m;
+  uint64_t start;
+  uintptr_t check = 0;
+
+  memset (&m, 0, sizeof (m));
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    chain_set (&m, keys[i], (void *) (uintptr_t) i);
+  }
+  r->insert = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    check += (uintptr_t) chain_get (&m, keys[bench_order (i, n)]);
+  }
+  r->hit = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    check += (chain_get (&m, keys[n + bench_order (i, n)]) != NULL);
+  }
+  r->miss = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t b = 0; b < m.nbuckets; b++)
+  {
+    for (chain_node *node = m.buckets[b]; node; node = node->next)
+    {
+      check += ((char *) (node + 1))[0];
+    }
+  }
+  r->iterate = (double) (now_ns () - start) / n;
+
+  start = now_ns ();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    chain_remove (&m, keys[bench_order (i, n)]);
+  }
+  r->remove = (double) (now_ns () - start) / n;
+  r->check = check;
+  chain_deinit (&m);
+
+  r->maxinsert = 0;
+  malloc_trim (0);
+  memset (&m, 0, sizeof (m));
+  for (uint32_t i = 0; i < n; i++)
+  {
+    start = now_ns ();
+    chain_set (&m, keys[i], (void *) (uintptr_t) i);
+    double t = now_ns () - start;
+    r->maxinsert = t > r->maxinsert ? t : r->maxinsert;
+  }
+  chain_deinit (&m);
+}
+
+int main (int argc, char *argv[])
+{
+  uint32_t max = 1000000;
+  if (argc == 2)
+  {
+    max = strtoul (argv[1], NULL, 10);
+  }
+  else if (argc != 1)
+  {
+    printf ("Usage: %s [max-keys]\n", argv[0]);
+    return 1;
+  }
+
+  /* The first max keys are inserted, the rest are used for misses */
+
+  char **keys = malloc (2 * max * sizeof (char *));
+  for (uint32_t i = 0; i < 2 * max; i++)
+  {
+    char buf[48];
+    sprintf (buf, "5b9a4f9a9f8fc20001a%05x-device-%u", i, i);
+    keys[i] = strdup (buf);
+  }
+
+  for (uint32_t n = 1000; n <= max; n *= 10)
+  {
+    bench_result chain, map;
+    bench_chain (keys, n, &chain);
+    bench_new (keys, n, &map);
+    bench_report ("chained", n, &chain);
+    bench_report ("edgex_map", n, &map);
+    if (chain.check != map.check)
+    {
+      printf ("Result mismatch\n");
+      return 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < 2 * max; i++)
+  {
+    free (keys[i]);
+  }
+  free (keys);
+  return 0;
+}
@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+/* Benchmark for the REST server threading modes. A server is started with a
+ * thread per connection, and then with a pool of threads. In each case a
+ * client process opens a number of keep-alive connections and issues
+ * requests on all of them for a fixed time, reporting the throughput and
+ * latency. Meanwhile the server process samples its thread count and
+ * resident memory, which are reported once the client has finished.
+ *
+ * Some of the connections may instead make requests of a slow handler, as a
+ * device command to an unresponsive device would be. The pooled server is
+ * then also run with the slow handler registered as non-blocking, so that
+ * it runs on the polling threads, to show the effect on the other requests.
+ */
+
+#include "../rest_server.h"
+#include "../errorlist.h"
+#include "microhttpd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BENCH_URL "/api/v1/ping"
+#define BENCH_SLOW_URL "/api/v1/slow"
+#define BENCH_BUFSIZE 1024
+
+static const char *bench_request =
+  "GET " BENCH_URL " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static const char *bench_slow_request =
+  "GET " BENCH_SLOW_URL " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static uint32_t bench_slow_ms = 100;
+
+typedef struct bench_conn
+{
+  int fd;
+  bool slow;
+  uint64_t start;
+  size_t used;
+  char buf[BENCH_BUFSIZE];
+} bench_conn;
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int ping_handler
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  *reply = strdup ("pong");
+  return MHD_HTTP_OK;
+}
+
+static int slow_handler
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  struct timespec delay =
+  {
+    .tv_sec = bench_slow_ms / 1000,
+    .tv_nsec = (bench_slow_ms % 1000) * 1000000
+  };
+  nanosleep (&delay, NULL);
+  *reply = strdup ("done");
+  return MHD_HTTP_OK;
+}
+
+/* Returns the length of the complete response in buf, or zero if more data
+ * is needed.
+ */
+
+static size_t bench_response (const char *buf, size_t used)
+{
+  const char *end = memmem (buf, used, "\r\n\r\n", 4);
+  const char *hdr;
+  size_t hdrlen;
+  size_t len = 0;
+
+  if (end == NULL)
+  {
+    return 0;
+  }
+  hdrlen = end + 4 - buf;
+  for (hdr = buf; hdr < end; hdr = strchr (hdr, '\n') + 1)
+  {
+    if (strncasecmp (hdr, "Content-Length:", 15) == 0)
+    {
+      len = strtoul (hdr + 15, NULL, 10);
+      break;
+    }
+  }
+  return (used >= hdrlen + len) ? hdrlen + len : 0;
+}
+
+static int bench_cmp (const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static bool bench_send (bench_conn *c)
+{
+  const char *request = c->slow ? bench_slow_request : bench_request;
+  c->used = 0;
+  c->start = now_ns ();
+  return write (c->fd, request, strlen (request)) == (ssize_t) strlen (request);
+}
+
+/* Client side, run in a child process. The first nslow connections make
+ * requests of the slow handler; latencies are reported for the others.
+ */
+
+static int bench_client
+  (uint16_t port, uint32_t nclients, uint32_t nslow, uint32_t secs)
+{
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  struct epoll_event events[64];
+  bench_conn *conns = calloc (nclients + nslow, sizeof (bench_conn));
+  uint32_t *lat = NULL;
+  size_t nlat = 0;
+  size_t latsize = 0;
+  uint32_t errors = 0;
+  uint32_t nslowdone = 0;
+  uint64_t start, stop, t;
+  int one = 1;
+  int ep = epoll_create1 (0);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  nclients += nslow;
+  for (uint32_t i = 0; i < nclients; i++)
+  {
+    conns[i].slow = (i < nslow);
+    conns[i].fd = socket (AF_INET, SOCK_STREAM, 0);
+    if (connect (conns[i].fd, (struct sockaddr *) &addr, sizeof (addr)) != 0)
+    {
+      printf ("connect %u: %s\n", i, strerror (errno));
+      return 1;
+    }
+    setsockopt (conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    fcntl (conns[i].fd, F_SETFL, fcntl (conns[i].fd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conns[i];
+    epoll_ctl (ep, EPOLL_CTL_ADD, conns[i].fd, &ev);
+  }
+
+  start = now_ns ();
+  stop = start + (uint64_t) secs * 1000000000;
+  for (uint32_t i = 0; i < nclients; i++)
+  {
+    errors += !bench_send (&conns[i]);
+  }
+
+  while ((t = now_ns ()) < stop)
+  {
+    int n = epoll_wait (ep, events, 64, 100);
+    for (int e = 0; e < n; e++)
+    {
+      bench_conn *c = events[e].data.ptr;
+      ssize_t r = read
+        (c->fd, c->buf + c->used, BENCH_BUFSIZE - 1 - c->used);
+      if (r <= 0)
+      {
+        if (r == 0 || errno != EAGAIN)
+        {
+          epoll_ctl (ep, EPOLL_CTL_DEL, c->fd, NULL);
+          errors++;
+        }
+        continue;
+      }
+      c->used += r;
+      c->buf[c->used] = '\0';
+      if (bench_response (c->buf, c->used))
+      {
+        t = now_ns ();
+        if (c->slow)
+        {
+          nslowdone++;
+        }
+        else
+        {
+          if (nlat == latsize)
+          {
+            latsize = latsize ? latsize * 2 : 65536;
+            lat = realloc (lat, latsize * sizeof (uint32_t));
+          }
+          lat[nlat++] = (t - c->start) / 1000;
+        }
+        if (strncmp (c->buf + 9, "200", 3))
+        {
+          errors++;
+        }
+        errors += !bench_send (c);
+      }
+      else if (c->used == BENCH_BUFSIZE - 1)
+      {
+        epoll_ctl (ep, EPOLL_CTL_DEL, c->fd, NULL);
+        errors++;
+      }
+    }
+  }
+
+  qsort (lat, nlat, sizeof (uint32_t), bench_cmp);
+  printf
+    ("  requests:   %zu (%.0f per second)\n", nlat, nlat * 1e9 / (t - start));
+  if (nlat)
+  {
+    printf
+    (
+      "  latency:    %u us median, %u us p99, %u us max\n",
+      lat[nlat / 2], lat[nlat * 99 / 100], lat[nlat - 1]
+    );
+  }
+  if (nslow)
+  {
+    printf ("  slow:       %u requests\n", nslowdone);
+  }
+  printf ("  errors:     %u\n", errors);
+
+  for (uint32_t i = 0; i < nclients; i++)
+  {
+    close (conns[i].fd);
+  }
+  close (ep);
+  free (conns);
+  free (lat);
+  return errors ? 1 : 0;
+}
+
+/* Reads the thread count and resident memory (in kB) of this process. */
+
+static void bench_usage (uint32_t *threads, uint32_t *rss)
+{
+  char line[128];
+  FILE *f = fopen ("/proc/self/status", "r");
+  if (f)
+  {
+    while (fgets (line, sizeof (line), f))
+    {
+      sscanf (line, "Threads: %u", threads);
+      sscanf (line, "VmRSS: %u", rss);
+    }
+    fclose (f);
+  }
+}
+
+static int bench_mode
+(
+  iot_logging_client *lc,
+  const char *name,
+  uint16_t port,
+  uint32_t threads,
+  uint32_t nclients,
+  uint32_t nslow,
+  bool blocking,
+  uint32_t secs
+)
+{
+  edgex_error err = EDGEX_OK;
+  uint32_t maxthreads = 0;
+  uint32_t maxrss = 0;
+  int status = 1;
+  pid_t pid;
+
+  edgex_rest_server_options opts =
+  {
+    .port = port,
+    .threads = threads,
+    .workers = nslow,
+    .maxconns = nclients + nslow + 16
+  };
+  edgex_rest_server *svr = edgex_rest_server_create (lc, &opts, &err);
+  if (svr == NULL)
+  {
+    printf ("%s: unable to start server on port %u\n", name, port);
+    return 1;
+  }
+  edgex_rest_server_register_handler (svr, BENCH_URL, GET, NULL, ping_handler);
+  if (blocking)
+  {
+    edgex_rest_server_register_blocking_handler
+      (svr, BENCH_SLOW_URL, GET, NULL, slow_handler);
+  }
+  else
+  {
+    edgex_rest_server_register_handler
+      (svr, BENCH_SLOW_URL, GET, NULL, slow_handler);
+  }
+
+  printf ("%s:\n", name);
+  fflush (stdout);
+  pid = fork ();
+  if (pid == 0)
+  {
+    exit (bench_client (port, nclients, nslow, secs));
+  }
+
+  while (waitpid (pid, &status, WNOHANG) == 0)
+  {
+    uint32_t nthreads = 0;
+    uint32_t rss = 0;
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = 100000000 };
+    bench_usage (&nthreads, &rss);
+    maxthreads = (nthreads > maxthreads) ? nthreads : maxthreads;
+    maxrss = (rss > maxrss) ? rss : maxrss;
+    nanosleep (&delay, NULL);
+  }
+  printf ("  threads:    %u\n", maxthreads);
+  printf ("  RSS:        %u kB\n", maxrss);
+
+  edgex_rest_server_destroy (svr);
+  return (WIFEXITED (status) && WEXITSTATUS (status) == 0) ? 0 : 1;
+}
+
+static void usage (void)
+{
+  printf ("Options:\n");
+  printf ("   -h, --help            : Show this text\n");
+  printf ("   -c, --clients <n>     : Concurrent clients (default 1000)\n");
+  printf ("   -t, --threads <n>     : Threads in pooled mode (default 4)\n");
+  printf ("   -d, --duration <n>    : Seconds per mode (default 5)\n");
+  printf ("   -s, --slow <n>        : Slow handler clients (default 4)\n");
+  printf ("   -m, --slow-ms <n>     : Slow handler time, ms (default 100)\n");
+  printf ("   -p, --port <n>        : Port to use (default 49980)\n");
+}
+
+int main (int argc, char *argv[])
+{
+  uint32_t nclients = 1000;
+  uint32_t threads = 4;
+  uint32_t nslow = 4;
+  uint32_t secs = 5;
+  uint16_t port = 49980;
+  struct rlimit lim;
+  int result;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *a = argv[i];
+    if (i + 1 < argc && (!strcmp (a, "-c") || !strcmp (a, "--clients")))
+    {
+      nclients = strtoul (argv[++i], NULL, 10);
+    }
+    else if (i + 1 < argc && (!strcmp (a, "-t") || !strcmp (a, "--threads")))
+    {
+      threads = strtoul (argv[++i], NULL, 10);
+    }
+    else if (i + 1 < argc && (!strcmp (a, "-d") || !strcmp (a, "--duration")))
+    {
+      secs = strtoul (argv[++i], NULL, 10);
+    }
+    else if (i + 1 < argc && (!strcmp (a, "-s") || !strcmp (a, "--slow")))
+    {
+      nslow = strtoul (argv[++i], NULL, 10);
+    }
+    else if (i + 1 < argc && (!strcmp (a, "-m") || !strcmp (a, "--slow-ms")))
+    {
+      bench_slow_ms = strtoul (argv[++i], NULL, 10);
+    }
+    else if (i + 1 < argc && (!strcmp (a, "-p") || !strcmp (a, "--port")))
+    {
+      port = strtoul (argv[++i], NULL, 10);
+    }
+    else
+    {
+      usage ();
+      return (!strcmp (a, "-h") || !strcmp (a, "--help")) ? 0 : 1;
+    }
+  }
+  if (nclients == 0 || threads == 0 || secs == 0)
+  {
+    usage ();
+    return 1;
+  }
+
+  /* Each connection needs a descriptor at both ends */
+
+  if (getrlimit (RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+  {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &lim);
+  }
+  signal (SIGPIPE, SIG_IGN);
+
+  iot_logging_client *lc = iot_logging_client_create ("rest_bench");
+  printf
+  (
+    "%u clients, %u of a %u ms handler, %u seconds per mode\n",
+    nclients, nslow, bench_slow_ms, secs
+  );
+  result = bench_mode
+    (lc, "Thread per connection", port, 0, nclients, nslow, true, secs);
+  result |= bench_mode
+    (lc, "Pooled", port + 1, threads, nclients, nslow, true, secs);
+  if (nslow)
+  {
+    result |= bench_mode
+    (
+      lc, "Pooled, slow handler on polling threads", port + 2, threads,
+      nclients, nslow, false, secs
+    );
+  }
+  iot_logging_client_destroy (lc);
+  return result;
+}
@@ -18,6 +18,7 @@
 int edgex_device_handler_callback
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -43,19 +44,18 @@ int edgex_device_handler_callback
     if (strcmp (action, "DEVICE") == 0)
     {
       const char *id = json_object_get_string (jobj, "id");
-      pthread_rwlock_rdlock (&svc->deviceslock);
-      edgex_device **ourdev = edgex_map_get (&svc->devices, id);
-      pthread_rwlock_unlock (&svc->deviceslock);
+      edgex_devrec *ourdev = edgex_devmap_device_byid (svc->devices, id);
       if (ourdev)
       {
         edgex_device *newdev = edgex_metadata_client_get_device
           (svc->logger, &svc->config.endpoints, id, &err);
         if (newdev)
         {
-          if (strcmp (newdev->adminState, (*ourdev)->adminState))
+          edgex_device_adminstate newstate =
+            strcasecmp (newdev->adminState, "LOCKED") == 0 ? LOCKED : UNLOCKED;
+          if (newstate != ourdev->adminstate)
           {
-            free ((*ourdev)->adminState);
-            (*ourdev)->adminState = strdup (newdev->adminState);
+            edgex_devmap_set_adminstate (svc->devices, id, newstate);
           }
           else
           {
@@ -71,6 +71,7 @@ int edgex_device_handler_callback
           iot_log_error
             (svc->logger, "callback: unable to retrieve updated device %s", id);
         }
+        edgex_devmap_release (ourdev);
       }
       else
       {
@@ -10,10 +10,12 @@
 #define _EDGEX_DEVICE_CALLBACK_H_ 1
 
 #include "edgex/devsdk.h"
+#include "rest_server.h"
 
 extern int edgex_device_handler_callback
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
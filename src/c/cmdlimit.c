@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "cmdlimit.h"
+#include "map.h"
+#include "edgex_time.h"
+
+#include <errno.h>
+
+/* Callers which cannot proceed join the slot's queue of waiters, each with a
+ * condition of its own. A completing call hands its place directly to the
+ * first waiter, so the queue is FIFO, and a waiter whose deadline passes
+ * simply leaves it. A slot is removed once it has no calls in progress, so
+ * slots are only held for keys which are in use.
+ */
+
+typedef struct cmdlimit_waiter
+{
+  bool admitted;
+  pthread_cond_t cond;
+  struct cmdlimit_waiter *next;
+} cmdlimit_waiter;
+
+struct edgex_cmdlimit_slot
+{
+  char *key;
+  uint32_t active;
+  cmdlimit_waiter *head;
+  cmdlimit_waiter *tail;
+};
+
+typedef edgex_map(edgex_cmdlimit_slot *) edgex_map_cmdlimit_slot;
+
+struct edgex_cmdlimit
+{
+  uint32_t limit;
+  edgex_map_cmdlimit_slot slots;
+  pthread_mutex_t lock;
+};
+
+edgex_cmdlimit *edgex_cmdlimit_create (uint32_t limit)
+{
+  edgex_cmdlimit *lim = NULL;
+  if (limit)
+  {
+    lim = malloc (sizeof (edgex_cmdlimit));
+    lim->limit = limit;
+    edgex_map_init (&lim->slots);
+    pthread_mutex_init (&lim->lock, NULL);
+  }
+  return lim;
+}
+
+static void cmdlimit_unlink (edgex_cmdlimit_slot *slot, cmdlimit_waiter *w)
+{
+  cmdlimit_waiter **pos = &slot->head;
+  cmdlimit_waiter *prev = NULL;
+  while (*pos != w)
+  {
+    prev = *pos;
+    pos = &(*pos)->next;
+  }
+  *pos = w->next;
+  if (slot->tail == w)
+  {
+    slot->tail = prev;
+  }
+}
+
+bool edgex_cmdlimit_enter
+(
+  edgex_cmdlimit *lim,
+  const char *key,
+  uint64_t deadline,
+  edgex_cmdlimit_slot **slotout
+)
+{
+  edgex_cmdlimit_slot **found;
+  edgex_cmdlimit_slot *slot;
+  bool result = true;
+
+  *slotout = NULL;
+  if (lim == NULL)
+  {
+    return true;
+  }
+
+  pthread_mutex_lock (&lim->lock);
+  found = edgex_map_get (&lim->slots, key);
+  if (found)
+  {
+    slot = *found;
+  }
+  else
+  {
+    slot = malloc (sizeof (edgex_cmdlimit_slot));
+    slot->key = strdup (key);
+    slot->active = 0;
+    slot->head = NULL;
+    slot->tail = NULL;
+    edgex_map_set (&lim->slots, key, slot);
+  }
+
+  if (slot->head == NULL && slot->active < lim->limit)
+  {
+    slot->active++;
+  }
+  else
+  {
+    struct timespec until;
+    cmdlimit_waiter w;
+
+    w.admitted = false;
+    w.next = NULL;
+    pthread_cond_init (&w.cond, NULL);
+    if (slot->tail)
+    {
+      slot->tail->next = &w;
+    }
+    else
+    {
+      slot->head = &w;
+    }
+    slot->tail = &w;
+
+    until.tv_sec = deadline / EDGEX_MILLIS;
+    until.tv_nsec = (deadline % EDGEX_MILLIS) * 1000000;
+    while (!w.admitted)
+    {
+      if (deadline == 0)
+      {
+        pthread_cond_wait (&w.cond, &lim->lock);
+      }
+      else if
+      (
+        pthread_cond_timedwait (&w.cond, &lim->lock, &until) == ETIMEDOUT &&
+        !w.admitted
+      )
+      {
+        cmdlimit_unlink (slot, &w);
+        result = false;
+        break;
+      }
+    }
+    pthread_cond_destroy (&w.cond);
+  }
+  pthread_mutex_unlock (&lim->lock);
+
+  /* A waiter only times out while the slot has calls in progress, so the
+   * slot remains in use.
+   */
+  if (result)
+  {
+    *slotout = slot;
+  }
+  return result;
+}
+
+void edgex_cmdlimit_exit (edgex_cmdlimit *lim, edgex_cmdlimit_slot *slot)
+{
+  if (lim && slot)
+  {
+    pthread_mutex_lock (&lim->lock);
+    if (slot->head)
+    {
+      cmdlimit_waiter *w = slot->head;
+      slot->head = w->next;
+      if (slot->head == NULL)
+      {
+        slot->tail = NULL;
+      }
+      w->admitted = true;
+      pthread_cond_signal (&w->cond);
+    }
+    else if (--slot->active == 0)
+    {
+      edgex_map_remove (&lim->slots, slot->key);
+      free (slot->key);
+      free (slot);
+    }
+    pthread_mutex_unlock (&lim->lock);
+  }
+}
+
+void edgex_cmdlimit_free (edgex_cmdlimit *lim)
+{
+  if (lim)
+  {
+    const char *key;
+    edgex_map_iter iter = edgex_map_iter (lim->slots);
+    while ((key = edgex_map_next (&lim->slots, &iter)))
+    {
+      edgex_cmdlimit_slot *slot = *edgex_map_get (&lim->slots, key);
+      free (slot->key);
+      free (slot);
+    }
+    edgex_map_deinit (&lim->slots);
+    pthread_mutex_destroy (&lim->lock);
+    free (lim);
+  }
+}
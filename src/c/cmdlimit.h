@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_CMDLIMIT_H_
+#define _EDGEX_DEVICE_CMDLIMIT_H_ 1
+
+#include "edgex/os.h"
+
+/* Limits the number of driver calls in progress for any one key (normally
+ * an addressable). Callers which would exceed the limit wait, and are
+ * admitted in the order in which they arrived. A limit of zero means
+ * unlimited, in which case no limiter is created and the functions below
+ * accept NULL.
+ */
+
+struct edgex_cmdlimit;
+typedef struct edgex_cmdlimit edgex_cmdlimit;
+
+struct edgex_cmdlimit_slot;
+typedef struct edgex_cmdlimit_slot edgex_cmdlimit_slot;
+
+extern edgex_cmdlimit *edgex_cmdlimit_create (uint32_t limit);
+
+/* Wait until a call may proceed for the given key, or until the deadline
+ * (milliseconds since the epoch, zero for none) passes. Returns false if the
+ * deadline passed first. Otherwise the slot returned must be passed to
+ * edgex_cmdlimit_exit when the call completes.
+ */
+
+extern bool edgex_cmdlimit_enter
+(
+  edgex_cmdlimit *lim,
+  const char *key,
+  uint64_t deadline,
+  edgex_cmdlimit_slot **slot
+);
+
+extern void edgex_cmdlimit_exit
+  (edgex_cmdlimit *lim, edgex_cmdlimit_slot *slot);
+
+extern void edgex_cmdlimit_free (edgex_cmdlimit *lim);
+
+#endif
@@ -232,6 +232,7 @@ void edgex_device_populateConfig
 
   svc->config.device.discovery = true;
   svc->config.device.datatransform = true;
+  svc->config.device.allcmdstoponerror = true;
 
   table = toml_table_in (config, "Service");
   if (table)
@@ -243,6 +244,18 @@ void edgex_device_populateConfig
     GET_CONFIG_STRING(StartupMsg, service.startupmsg);
     GET_CONFIG_UINT32(ReadMaxLimit, service.readmaxlimit);
     GET_CONFIG_STRING(CheckInterval, service.checkinterval);
+    GET_CONFIG_UINT32(HttpThreads, service.httpthreads);
+    GET_CONFIG_UINT32(HttpWorkers, service.httpworkers);
+    GET_CONFIG_UINT32(HttpMaxConnections, service.httpmaxconns);
+    GET_CONFIG_UINT32(HttpTimeout, service.httptimeout);
+    GET_CONFIG_UINT32(HttpMaxBodySize, service.httpmaxbody);
+    GET_CONFIG_UINT32(TraceSampleRate, service.tracerate);
+    GET_CONFIG_UINT32(TraceBufferSize, service.tracesize);
+    GET_CONFIG_STRING(TraceFile, service.tracefile);
+    GET_CONFIG_STRING(Socket, service.socket);
+    GET_CONFIG_UINT32(MaxSubscribers, service.maxsubscribers);
+    GET_CONFIG_UINT32(SubscriberQueueLength, service.subscriberqlen);
+    GET_CONFIG_UINT32(SubscriberKeepAlive, service.subscriberkeepalive);
     int n = 0;
     arr = toml_array_in (table, "Labels");
     if (arr)
@@ -267,12 +280,14 @@ void edgex_device_populateConfig
     {
       GET_CONFIG_STRING(Host, endpoints.data.host);
       GET_CONFIG_UINT16(Port, endpoints.data.port);
+      GET_CONFIG_STRING(Socket, endpoints.data.socket);
     }
     table = toml_table_in (subtable, "Metadata");
     if (table)
     {
       GET_CONFIG_STRING(Host, endpoints.metadata.host);
       GET_CONFIG_UINT16(Port, endpoints.metadata.port);
+      GET_CONFIG_STRING(Socket, endpoints.metadata.socket);
     }
   }
 
@@ -289,6 +304,15 @@ void edgex_device_populateConfig
     GET_CONFIG_STRING(RemoveCmdArgs, device.removecmdargs);
     GET_CONFIG_STRING(ProfilesDir, device.profilesdir);
     GET_CONFIG_BOOL(SendReadingsOnChanged, device.sendreadingsonchanged);
+    GET_CONFIG_UINT32(MaxParallelCmds, device.maxparallelcmds);
+    GET_CONFIG_BOOL(AllCmdStopOnError, device.allcmdstoponerror);
+    GET_CONFIG_UINT32(MaxCmdsPerAddressable, device.maxcmdsperaddr);
+    GET_CONFIG_UINT32(CommandTimeout, device.commandtimeout);
+    GET_CONFIG_UINT32(ScheduleMergeWindow, device.schedulemergewindow);
+    GET_CONFIG_UINT32(MaxInFlightCmds, device.maxinflightcmds);
+    GET_CONFIG_UINT32(MaxInFlightCmdsPerDevice, device.maxinflightperdev);
+    GET_CONFIG_UINT32(CmdQueueLength, device.cmdqueuelen);
+    GET_CONFIG_UINT32(CmdQueueTimeout, device.cmdqueuetimeout);
   }
 
   table = toml_table_in (config, "Driver");
@@ -566,6 +590,30 @@ void edgex_device_populateConfigNV
     get_nv_config_uint32 (svc->logger, config, "Service/ReadMaxLimit", err);
   svc->config.service.checkinterval =
     get_nv_config_string (config, "Service/CheckInterval");
+  svc->config.service.httpthreads =
+    get_nv_config_uint32 (svc->logger, config, "Service/HttpThreads", err);
+  svc->config.service.httpworkers =
+    get_nv_config_uint32 (svc->logger, config, "Service/HttpWorkers", err);
+  svc->config.service.httpmaxconns = get_nv_config_uint32
+    (svc->logger, config, "Service/HttpMaxConnections", err);
+  svc->config.service.httptimeout =
+    get_nv_config_uint32 (svc->logger, config, "Service/HttpTimeout", err);
+  svc->config.service.httpmaxbody = get_nv_config_uint32
+    (svc->logger, config, "Service/HttpMaxBodySize", err);
+  svc->config.service.tracerate = get_nv_config_uint32
+    (svc->logger, config, "Service/TraceSampleRate", err);
+  svc->config.service.tracesize = get_nv_config_uint32
+    (svc->logger, config, "Service/TraceBufferSize", err);
+  svc->config.service.tracefile =
+    get_nv_config_string (config, "Service/TraceFile");
+  svc->config.service.socket =
+    get_nv_config_string (config, "Service/Socket");
+  svc->config.service.maxsubscribers = get_nv_config_uint32
+    (svc->logger, config, "Service/MaxSubscribers", err);
+  svc->config.service.subscriberqlen = get_nv_config_uint32
+    (svc->logger, config, "Service/SubscriberQueueLength", err);
+  svc->config.service.subscriberkeepalive = get_nv_config_uint32
+    (svc->logger, config, "Service/SubscriberKeepAlive", err);
 
   char *lstr = get_nv_config_string (config, "Service/Labels");
   if (lstr)
@@ -600,10 +648,14 @@ void edgex_device_populateConfigNV
     get_nv_config_string (config, "Clients/Data/Host");
   svc->config.endpoints.data.port =
     get_nv_config_uint16 (svc->logger, config, "Clients/Data/Port", err);
+  svc->config.endpoints.data.socket =
+    get_nv_config_string (config, "Clients/Data/Socket");
   svc->config.endpoints.metadata.host =
     get_nv_config_string (config, "Clients/Metadata/Host");
   svc->config.endpoints.metadata.port =
     get_nv_config_uint16 (svc->logger, config, "Clients/Metadata/Port", err);
+  svc->config.endpoints.metadata.socket =
+    get_nv_config_string (config, "Clients/Metadata/Socket");
 
   svc->config.device.datatransform =
     get_nv_config_bool (config, "Device/DataTransform", true);
@@ -624,6 +676,24 @@ void edgex_device_populateConfigNV
     get_nv_config_string (config, "Device/ProfilesDir");
   svc->config.device.sendreadingsonchanged =
     get_nv_config_bool (config, "Device/SendReadingsOnChanged", false);
+  svc->config.device.maxparallelcmds =
+    get_nv_config_uint32 (svc->logger, config, "Device/MaxParallelCmds", err);
+  svc->config.device.allcmdstoponerror =
+    get_nv_config_bool (config, "Device/AllCmdStopOnError", true);
+  svc->config.device.maxcmdsperaddr = get_nv_config_uint32
+    (svc->logger, config, "Device/MaxCmdsPerAddressable", err);
+  svc->config.device.commandtimeout = get_nv_config_uint32
+    (svc->logger, config, "Device/CommandTimeout", err);
+  svc->config.device.schedulemergewindow = get_nv_config_uint32
+    (svc->logger, config, "Device/ScheduleMergeWindow", err);
+  svc->config.device.maxinflightcmds = get_nv_config_uint32
+    (svc->logger, config, "Device/MaxInFlightCmds", err);
+  svc->config.device.maxinflightperdev = get_nv_config_uint32
+    (svc->logger, config, "Device/MaxInFlightCmdsPerDevice", err);
+  svc->config.device.cmdqueuelen =
+    get_nv_config_uint32 (svc->logger, config, "Device/CmdQueueLength", err);
+  svc->config.device.cmdqueuetimeout =
+    get_nv_config_uint32 (svc->logger, config, "Device/CmdQueueTimeout", err);
 
   for (const edgex_nvpairs *iter = config; iter; iter = iter->next)
   {
@@ -660,6 +730,18 @@ edgex_nvpairs *edgex_device_getConfig (const edgex_device_service *svc)
   PUT_CONFIG_STRING(Service/StartupMsg, service.startupmsg);
   PUT_CONFIG_UINT(Service/ReadMaxLimit, service.readmaxlimit);
   PUT_CONFIG_STRING(Service/CheckInterval, service.checkinterval);
+  PUT_CONFIG_UINT(Service/HttpThreads, service.httpthreads);
+  PUT_CONFIG_UINT(Service/HttpWorkers, service.httpworkers);
+  PUT_CONFIG_UINT(Service/HttpMaxConnections, service.httpmaxconns);
+  PUT_CONFIG_UINT(Service/HttpTimeout, service.httptimeout);
+  PUT_CONFIG_UINT(Service/HttpMaxBodySize, service.httpmaxbody);
+  PUT_CONFIG_UINT(Service/TraceSampleRate, service.tracerate);
+  PUT_CONFIG_UINT(Service/TraceBufferSize, service.tracesize);
+  PUT_CONFIG_STRING(Service/TraceFile, service.tracefile);
+  PUT_CONFIG_STRING(Service/Socket, service.socket);
+  PUT_CONFIG_UINT(Service/MaxSubscribers, service.maxsubscribers);
+  PUT_CONFIG_UINT(Service/SubscriberQueueLength, service.subscriberqlen);
+  PUT_CONFIG_UINT(Service/SubscriberKeepAlive, service.subscriberkeepalive);
 
   int labellen = 0;
   for (int i = 0; svc->config.service.labels[i]; i++)
@@ -684,8 +766,10 @@ edgex_nvpairs *edgex_device_getConfig (const edgex_device_service *svc)
 
   PUT_CONFIG_STRING(Clients/Data/Host, endpoints.data.host);
   PUT_CONFIG_UINT(Clients/Data/Port, endpoints.data.port);
+  PUT_CONFIG_STRING(Clients/Data/Socket, endpoints.data.socket);
   PUT_CONFIG_STRING(Clients/Metadata/Host, endpoints.metadata.host);
   PUT_CONFIG_UINT(Clients/Metadata/Port, endpoints.metadata.port);
+  PUT_CONFIG_STRING(Clients/Metadata/Socket, endpoints.metadata.socket);
 
   PUT_CONFIG_BOOL(Device/DataTransform, device.datatransform);
   PUT_CONFIG_BOOL(Device/Discovery, device.discovery);
@@ -697,6 +781,15 @@ edgex_nvpairs *edgex_device_getConfig (const edgex_device_service *svc)
   PUT_CONFIG_STRING(Device/RemoveCmdArgs, device.removecmdargs);
   PUT_CONFIG_STRING(Device/ProfilesDir, device.profilesdir);
   PUT_CONFIG_BOOL(Device/SendReadingsOnChanged, device.sendreadingsonchanged);
+  PUT_CONFIG_UINT(Device/MaxParallelCmds, device.maxparallelcmds);
+  PUT_CONFIG_BOOL(Device/AllCmdStopOnError, device.allcmdstoponerror);
+  PUT_CONFIG_UINT(Device/MaxCmdsPerAddressable, device.maxcmdsperaddr);
+  PUT_CONFIG_UINT(Device/CommandTimeout, device.commandtimeout);
+  PUT_CONFIG_UINT(Device/ScheduleMergeWindow, device.schedulemergewindow);
+  PUT_CONFIG_UINT(Device/MaxInFlightCmds, device.maxinflightcmds);
+  PUT_CONFIG_UINT(Device/MaxInFlightCmdsPerDevice, device.maxinflightperdev);
+  PUT_CONFIG_UINT(Device/CmdQueueLength, device.cmdqueuelen);
+  PUT_CONFIG_UINT(Device/CmdQueueTimeout, device.cmdqueuetimeout);
 
   for (edgex_nvpairs *iter = svc->config.driverconf; iter; iter = iter->next)
   {
@@ -797,9 +890,11 @@ void edgex_device_dumpConfig (edgex_device_service *svc)
   DUMP_LIT ("   [Clients.Data]");
   DUMP_STR ("      Host", endpoints.data.host);
   DUMP_UNS ("      Port", endpoints.data.port);
+  DUMP_STR ("      Socket", endpoints.data.socket);
   DUMP_LIT ("   [Clients.Metadata]");
   DUMP_STR ("      Host", endpoints.metadata.host);
   DUMP_UNS ("      Port", endpoints.metadata.port);
+  DUMP_STR ("      Socket", endpoints.metadata.socket);
   DUMP_LIT ("[Logging]");
   DUMP_STR ("   RemoteURL", logging.remoteurl);
   DUMP_STR ("   File", logging.file);
@@ -811,6 +906,18 @@ void edgex_device_dumpConfig (edgex_device_service *svc)
   DUMP_STR ("   StartupMsg", service.startupmsg);
   DUMP_UNS ("   ReadMaxLimit", service.readmaxlimit);
   DUMP_STR ("   CheckInterval", service.checkinterval);
+  DUMP_UNS ("   HttpThreads", service.httpthreads);
+  DUMP_UNS ("   HttpWorkers", service.httpworkers);
+  DUMP_UNS ("   HttpMaxConnections", service.httpmaxconns);
+  DUMP_UNS ("   HttpTimeout", service.httptimeout);
+  DUMP_UNS ("   HttpMaxBodySize", service.httpmaxbody);
+  DUMP_UNS ("   TraceSampleRate", service.tracerate);
+  DUMP_UNS ("   TraceBufferSize", service.tracesize);
+  DUMP_STR ("   TraceFile", service.tracefile);
+  DUMP_STR ("   Socket", service.socket);
+  DUMP_UNS ("   MaxSubscribers", service.maxsubscribers);
+  DUMP_UNS ("   SubscriberQueueLength", service.subscriberqlen);
+  DUMP_UNS ("   SubscriberKeepAlive", service.subscriberkeepalive);
   DUMP_ARR ("   Labels", service.labels);
   DUMP_LIT ("[Device]");
   DUMP_BOO ("   DataTransform", device.datatransform);
@@ -823,6 +930,15 @@ void edgex_device_dumpConfig (edgex_device_service *svc)
   DUMP_STR ("   RemoveCmdArgs", device.removecmdargs);
   DUMP_STR ("   ProfilesDir", device.profilesdir);
   DUMP_BOO ("   SendReadingsOnChanged", device.sendreadingsonchanged);
+  DUMP_UNS ("   MaxParallelCmds", device.maxparallelcmds);
+  DUMP_BOO ("   AllCmdStopOnError", device.allcmdstoponerror);
+  DUMP_UNS ("   MaxCmdsPerAddressable", device.maxcmdsperaddr);
+  DUMP_UNS ("   CommandTimeout", device.commandtimeout);
+  DUMP_UNS ("   ScheduleMergeWindow", device.schedulemergewindow);
+  DUMP_UNS ("   MaxInFlightCmds", device.maxinflightcmds);
+  DUMP_UNS ("   MaxInFlightCmdsPerDevice", device.maxinflightperdev);
+  DUMP_UNS ("   CmdQueueLength", device.cmdqueuelen);
+  DUMP_UNS ("   CmdQueueTimeout", device.cmdqueuetimeout);
 
   edgex_nvpairs *iter = svc->config.driverconf;
   if (iter)
@@ -879,11 +995,15 @@ void edgex_device_freeConfig (edgex_device_service *svc)
   free (svc->config.endpoints.consul.host);
   free (svc->config.endpoints.data.host);
   free (svc->config.endpoints.metadata.host);
+  free (svc->config.endpoints.data.socket);
+  free (svc->config.endpoints.metadata.socket);
   free (svc->config.logging.file);
   free (svc->config.logging.remoteurl);
   free (svc->config.service.host);
   free (svc->config.service.startupmsg);
   free (svc->config.service.checkinterval);
+  free (svc->config.service.tracefile);
+  free (svc->config.service.socket);
   free (svc->config.device.initcmd);
   free (svc->config.device.initcmdargs);
   free (svc->config.device.removecmd);
@@ -937,7 +1057,7 @@ void edgex_device_process_configured_devices
   {
     char *devname;
     const char *raw;
-    char **existing;
+    edgex_devrec *existing;
     char *profile_name;
     char *description;
     edgex_addressable *address;
@@ -952,9 +1072,8 @@ void edgex_device_process_configured_devices
     {
       raw = toml_raw_in (table, "Name");
       toml_rtos2 (raw, &devname);
-      pthread_rwlock_rdlock (&svc->deviceslock);
-      existing = edgex_map_get (&svc->name_to_id, devname);
-      pthread_rwlock_unlock (&svc->deviceslock);
+      existing = edgex_devmap_device_byname (svc->devices, devname);
+      edgex_devmap_release (existing);
       if (existing == NULL)
       {
         /* Addressable */
@@ -23,12 +23,25 @@ typedef struct edgex_device_serviceinfo
   uint32_t readmaxlimit;
   uint32_t timeout;
   char *checkinterval;
+  uint32_t httpthreads;
+  uint32_t httpworkers;
+  uint32_t httpmaxconns;
+  uint32_t httptimeout;
+  uint32_t httpmaxbody;
+  uint32_t tracerate;
+  uint32_t tracesize;
+  char *tracefile;
+  char *socket;
+  uint32_t maxsubscribers;
+  uint32_t subscriberqlen;
+  uint32_t subscriberkeepalive;
 } edgex_device_serviceinfo;
 
 typedef struct edgex_device_service_endpoint
 {
   char *host;
   uint16_t port;
+  char *socket;
 } edgex_device_service_endpoint;
 
 typedef struct edgex_service_endpoints
@@ -51,6 +64,15 @@ typedef struct edgex_device_deviceinfo
   char *removecmdargs;
   char *profilesdir;
   bool sendreadingsonchanged;
+  uint32_t maxparallelcmds;
+  bool allcmdstoponerror;
+  uint32_t maxcmdsperaddr;
+  uint32_t commandtimeout;
+  uint32_t schedulemergewindow;
+  uint32_t maxinflightcmds;
+  uint32_t maxinflightperdev;
+  uint32_t cmdqueuelen;
+  uint32_t cmdqueuetimeout;
 } edgex_device_deviceinfo;
 
 typedef struct edgex_device_logginginfo
@@ -12,31 +12,7 @@
 #include "errorlist.h"
 #include "config.h"
 
-static edgex_reading *readings_dup (const edgex_reading *readings)
-{
-  edgex_reading *result = NULL;
-  edgex_reading **last = &result;
-
-  while (readings)
-  {
-    edgex_reading *tmp = malloc (sizeof (edgex_reading));
-    memset (tmp, 0, sizeof (edgex_reading));
-    tmp->created = readings->created;
-    tmp->modified = readings->modified;
-    tmp->origin = readings->origin;
-    tmp->pushed = readings->pushed;
-    tmp->id = readings->id ? strdup (readings->id) : NULL;
-    tmp->name = readings->name ? strdup (readings->name) : NULL;
-    tmp->value = readings->value ? strdup (readings->value) : NULL;
-    tmp->next = NULL;
-    *last = tmp;
-    last = &tmp->next;
-    readings = readings->next;
-  }
-  return result;
-}
-
-edgex_event *edgex_data_client_add_event
+char *edgex_data_client_add_event
 (
   iot_logging_client *lc,
   edgex_service_endpoints *endpoints,
@@ -46,13 +22,17 @@ edgex_event *edgex_data_client_add_event
   edgex_error *err
 )
 {
-  edgex_event *result = malloc (sizeof (edgex_event));
+  edgex_event event;
   edgex_ctx ctx;
   char url[URL_BUF_SIZE];
   char *json;
 
-  memset (result, 0, sizeof (edgex_event));
+  /* The event is only serialized, so it refers to the caller's strings and
+   * readings rather than copies of them.
+   */
+  memset (&event, 0, sizeof (edgex_event));
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->data.socket;
   snprintf
   (
     url,
@@ -61,15 +41,14 @@ edgex_event *edgex_data_client_add_event
     endpoints->data.host,
     endpoints->data.port
   );
-  result->device = strdup (device);
-  result->origin = origin;
-  result->readings = readings_dup (readings);
-  json = edgex_event_write (result, true);
+  event.device = (char *) device;
+  event.origin = origin;
+  event.readings = (edgex_reading *) readings;
+  json = edgex_event_write (&event, true);
   edgex_http_post (lc, &ctx, url, json, edgex_http_write_cb, err);
-  result->id = ctx.buff;
   free (json);
 
-  return result;
+  return ctx.buff;
 }
 
 edgex_valuedescriptor *edgex_data_client_add_valuedescriptor
@@ -95,6 +74,7 @@ edgex_valuedescriptor *edgex_data_client_add_valuedescriptor
 
   memset (result, 0, sizeof (edgex_valuedescriptor));
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->data.socket;
   snprintf
   (
     url,
@@ -131,6 +111,7 @@ bool edgex_data_client_ping
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->data.socket;
   snprintf
   (
     url,
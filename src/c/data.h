@@ -15,7 +15,11 @@
 
 typedef struct edgex_service_endpoints edgex_service_endpoints;
 
-edgex_event *edgex_data_client_add_event
+/* Post an event to core-data. Returns the id of the new event, which should
+ * be freed by the caller.
+ */
+
+char *edgex_data_client_add_event
 (
   iot_logging_client *lc,
   edgex_service_endpoints *endpoints,
@@ -13,6 +13,9 @@
 #include "data.h"
 #include "edgex_rest.h"
 #include "edgex_time.h"
+#include "fanout.h"
+#include "base64.h"
+#include "watchdog.h"
 
 #include <inttypes.h>
 #include <string.h>
@@ -28,12 +31,18 @@
  * The entry point for the device command is edgex_device_handler_device. This
  * parses the device spec and command name out of the url path and calls either
  * oneCommand or allCommand.
- * Each of these two methods finds the relevant device(s), calls runOne to
- * perform the command(s), uploads any readings and constructs the appropriate
- * JSON response.
- * runOne locates profile resources and calls either runOneGet or runOnePut.
+ * Each of these two methods finds the relevant device(s), calls runOne or
+ * startOne to perform the command(s), and constructs the appropriate JSON
+ * response. For allCommand the devices are processed in parallel using the
+ * service's command thread pool, and if AllCmdStopOnError is not set the
+ * results are streamed to the client as they complete.
+ * startOne locates profile resources and calls either runOneGet or runOnePut.
  * runOneGet and runOnePut construct the required parameters, perform the
- * conversions between strings and values, and call the device implementation.
+ * conversions between strings and values, and call the device implementation
+ * via invokeOne. When the driver has completed, finishOne uploads any readings
+ * and constructs the result. For asynchronous drivers, startOne returns
+ * CMD_PENDING and a completion function is called later; runOne is the
+ * synchronous equivalent.
  */
 
 static const char *methStr (edgex_http_method method)
@@ -370,28 +379,583 @@ static const edgex_command *findCommand
   return cmd;
 }
 
+/* Profiles in the device registry have interned device resource names and
+ * resource operation objects, so these are compared by pointer.
+ */
+
 static edgex_deviceobject *findDevObj
   (edgex_deviceobject *list, const char *name)
 {
-  while (list && strcmp (list->name, name))
+  while (list && list->name != name)
   {
     list = list->next;
   }
   return list;
 }
 
+/* Driver invocation. Each command is described by a token which carries the
+ * request and result arrays through to completion. Drivers supplying the
+ * asynchronous handlers complete a command by calling
+ * edgex_device_command_complete, following which the reply is constructed
+ * and any event uploaded on the command thread pool. Otherwise this happens
+ * in the thread that ran the command.
+ */
+
+typedef void (*cmd_donefn) (void *arg, int status, JSON_Value *reply);
+
+/* Returned by startOne when the command will complete asynchronously */
+
+#define CMD_PENDING 0
+
+struct edgex_device_command_token
+{
+  edgex_device_service *svc;
+  edgex_devrec *dev;
+  edgex_http_method method;
+  uint32_t nops;
+  edgex_device_commandrequest *requests;
+  edgex_device_commandresult *results;
+  JSON_Value *payload;
+  edgex_cmdlimit_slot *slot;
+  bool success;
+  cmd_donefn done;
+  void *donearg;
+  uint64_t deadline;
+  uint64_t timer;
+  uint64_t started;
+  uint64_t trace;
+  edgex_reading **collect;
+  uint32_t refs;
+  bool resolved;
+  bool cancelled;
+  pthread_mutex_t lock;
+};
+
+/* The command being handled by a synchronous driver call in this thread */
+
+static __thread edgex_device_command_token *currentToken = NULL;
+
+/* The trace, if any, of the request being handled in this thread. Tokens
+ * created in this thread carry it to wherever their command completes.
+ */
+
+static __thread uint64_t currentTrace = 0;
+
+/* The clock is only read for the stages of traced requests */
+
+static uint64_t traceStart (uint64_t trace)
+{
+  return trace ? edgex_metrics_now () : 0;
+}
+
+static void traceSpan
+(
+  edgex_device_service *svc,
+  uint64_t trace,
+  const char *stage,
+  const char *detail,
+  uint64_t start
+)
+{
+  if (trace)
+  {
+    edgex_tracer_span
+      (svc->tracer, trace, stage, detail, start, edgex_metrics_now ());
+  }
+}
+
+static edgex_device_command_token *tokenAlloc
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  edgex_http_method method,
+  uint32_t nops
+)
+{
+  edgex_device_command_token *tok =
+    malloc (sizeof (edgex_device_command_token));
+  memset (tok, 0, sizeof (edgex_device_command_token));
+  tok->svc = svc;
+  tok->dev = dev;
+  edgex_devmap_addref (dev);
+  tok->method = method;
+  tok->nops = nops;
+  tok->trace = currentTrace;
+  tok->refs = 1;
+  pthread_mutex_init (&tok->lock, NULL);
+  tok->requests = malloc (nops * sizeof (edgex_device_commandrequest));
+  memset (tok->requests, 0, nops * sizeof (edgex_device_commandrequest));
+  tok->results = malloc (nops * sizeof (edgex_device_commandresult));
+  memset (tok->results, 0, nops * sizeof (edgex_device_commandresult));
+  return tok;
+}
+
+static edgex_device_command_token *tokenNew
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  edgex_http_method method,
+  uint32_t nops,
+  edgex_resourceoperation *ops
+)
+{
+  edgex_device_command_token *tok = tokenAlloc (svc, dev, method, nops);
+  edgex_resourceoperation *op = ops;
+  for (uint32_t i = 0; i < nops; i++)
+  {
+    tok->requests[i].ro = op;
+    tok->requests[i].devobj =
+      findDevObj (dev->profile->device_resources, op->object);
+    op = op->next;
+  }
+  return tok;
+}
+
+static void tokenFree (edgex_device_command_token *tok)
+{
+  if (tok->method != GET)
+  {
+    for (uint32_t i = 0; i < tok->nops; i++)
+    {
+      if (tok->results[i].type == String)
+      {
+        free (tok->results[i].value.string_result);
+      }
+    }
+  }
+  json_value_free (tok->payload);
+  edgex_devmap_release (tok->dev);
+  pthread_mutex_destroy (&tok->lock);
+  free (tok->requests);
+  free (tok->results);
+  free (tok);
+}
+
+static void tokenUnref (edgex_device_command_token *tok)
+{
+  pthread_mutex_lock (&tok->lock);
+  bool last = (--tok->refs == 0);
+  pthread_mutex_unlock (&tok->lock);
+  if (last)
+  {
+    tokenFree (tok);
+  }
+}
+
+/* A command is resolved either by completion or by its deadline passing,
+ * whichever happens first. Returns true if the caller resolved it.
+ */
+
+static bool tokenResolve (edgex_device_command_token *tok, bool timedout)
+{
+  pthread_mutex_lock (&tok->lock);
+  bool first = !tok->resolved;
+  tok->resolved = true;
+  if (first && timedout)
+  {
+    tok->cancelled = true;
+  }
+  pthread_mutex_unlock (&tok->lock);
+  return first;
+}
+
+uint64_t edgex_device_command_deadline
+  (const edgex_device_command_token *token)
+{
+  return token ? token->deadline : 0;
+}
+
+bool edgex_device_command_cancelled (edgex_device_command_token *token)
+{
+  bool result = false;
+  if (token)
+  {
+    pthread_mutex_lock (&token->lock);
+    result = token->cancelled;
+    pthread_mutex_unlock (&token->lock);
+  }
+  return result;
+}
+
+edgex_device_command_token *edgex_device_command_current (void)
+{
+  return currentToken;
+}
+
+bool edgex_device_upload_event
+(
+  edgex_device_service *svc,
+  const char *device,
+  uint64_t origin,
+  const edgex_reading *readings
+)
+{
+  edgex_error err = EDGEX_OK;
+  uint64_t start;
+
+  edgex_eventhub_publish (svc->events, device, origin, readings);
+  start = edgex_metrics_now ();
+  free (edgex_data_client_add_event
+    (svc->logger, &svc->config.endpoints, device, origin, readings, &err));
+  edgex_metric_since (svc->stats.uploadlatency, start);
+  if (err.code)
+  {
+    edgex_metric_add (svc->stats.uploadfailures, 1);
+  }
+  return (err.code == 0);
+}
+
+static int finishGet (edgex_device_command_token *tok, JSON_Value **reply)
+{
+  edgex_device_service *svc = tok->svc;
+  edgex_device_commandrequest *requests = tok->requests;
+  edgex_device_commandresult *results = tok->results;
+  uint32_t nops = tok->nops;
+
+  if (!tok->success)
+  {
+    iot_log_error (svc->logger, "Driver for %s failed on GET", tok->dev->name);
+    return MHD_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  uint64_t timenow = edgex_device_millitime ();
+  uint64_t start = traceStart (tok->trace);
+  edgex_reading *rdgs = malloc (nops * sizeof (edgex_reading));
+  for (uint32_t i = 0; i < nops; i++)
+  {
+    /* TODO: Transform & mapping for results[i] */
+    rdgs[i].created = timenow;
+    rdgs[i].modified = timenow;
+    rdgs[i].pushed = timenow;
+    rdgs[i].name = requests[i].devobj->name;
+    rdgs[i].id = NULL;
+    rdgs[i].value = edgex_value_tostring
+    (
+      results[i].type,
+      results[i].value,
+      svc->config.device.datatransform,
+      requests[i].devobj->properties->value,
+      requests[i].ro->mappings
+    );
+    rdgs[i].origin = results[i].origin;
+    rdgs[i].next = (i == nops - 1) ? NULL : rdgs + i + 1;
+  }
+  traceSpan (svc, tok->trace, "transform", tok->dev->name, start);
+
+  start = traceStart (tok->trace);
+  *reply = json_value_init_object ();
+  JSON_Object *jobj = json_value_get_object (*reply);
+  for (uint32_t i = 0; i < nops; i++)
+  {
+    json_object_set_string (jobj, rdgs[i].name, rdgs[i].value);
+  }
+  traceSpan (svc, tok->trace, "json", tok->dev->name, start);
+
+  if (tok->collect)
+  {
+    if (nops)
+    {
+      *tok->collect = rdgs;
+    }
+    else
+    {
+      free (rdgs);
+    }
+    return MHD_HTTP_OK;
+  }
+
+  start = traceStart (tok->trace);
+  bool uploaded =
+    edgex_device_upload_event (svc, tok->dev->name, timenow, rdgs);
+  traceSpan (svc, tok->trace, "upload", tok->dev->name, start);
+
+  for (uint32_t i = 0; i < nops; i++)
+  {
+    free (rdgs[i].value);
+  }
+  free (rdgs);
+  return uploaded ? MHD_HTTP_OK : MHD_HTTP_INTERNAL_SERVER_ERROR;
+}
+
+static int finishPut (edgex_device_command_token *tok)
+{
+  if (!tok->success)
+  {
+    iot_log_error
+      (tok->svc->logger, "Driver for %s failed on PUT", tok->dev->name);
+    return MHD_HTTP_INTERNAL_SERVER_ERROR;
+  }
+  return MHD_HTTP_OK;
+}
+
+static int finishOne (edgex_device_command_token *tok, JSON_Value **reply)
+{
+  return (tok->method == GET) ? finishGet (tok, reply) : finishPut (tok);
+}
+
+static void finishOneAsync (void *p)
+{
+  edgex_device_command_token *tok = (edgex_device_command_token *) p;
+  JSON_Value *reply = NULL;
+
+  int result = finishOne (tok, &reply);
+  tok->done (tok->donearg, result, reply);
+  tokenUnref (tok);
+}
+
+static void timeoutAsync (void *p)
+{
+  edgex_device_command_token *tok = (edgex_device_command_token *) p;
+  tok->done (tok->donearg, MHD_HTTP_GATEWAY_TIMEOUT, NULL);
+  tokenUnref (tok);
+}
+
+/* Record the time taken by the driver for a command. The histograms are
+ * labelled by device profile rather than by device, so that their number
+ * stays bounded as devices come and go.
+ */
+
+static void driverTime (edgex_device_command_token *tok)
+{
+  edgex_device_service *svc = tok->svc;
+  uint64_t now = edgex_metrics_now ();
+  edgex_metric_record
+  (
+    edgex_metrics_family_get
+    (
+      (tok->method == GET) ? svc->stats.getlatency : svc->stats.putlatency,
+      tok->dev->profile->name
+    ),
+    now - tok->started
+  );
+  if (tok->trace)
+  {
+    edgex_tracer_span
+      (svc->tracer, tok->trace, "driver", tok->dev->name, tok->started, now);
+  }
+}
+
+/* Called by the watchdog when a command's deadline passes. The result is
+ * delivered on a pool of its own, as the watchdog thread must not block and
+ * the other pools may be occupied by the very driver calls which are late.
+ */
+
+static void tokenTimeout (void *p)
+{
+  edgex_device_command_token *tok = (edgex_device_command_token *) p;
+  if (tokenResolve (tok, true))
+  {
+    iot_log_error
+    (
+      tok->svc->logger,
+      "Deadline exceeded for %s command on device %s",
+      methStr (tok->method), tok->dev->name
+    );
+    edgex_metrics_add_work
+      (tok->svc->timeoutpool, tok->svc->stats.timeoutqueue, timeoutAsync, tok);
+  }
+  else
+  {
+    tokenUnref (tok);
+  }
+}
+
+void edgex_device_command_complete
+  (edgex_device_command_token *token, bool success)
+{
+  edgex_device_service *svc = token->svc;
+
+  driverTime (token);
+  edgex_cmdlimit_exit (svc->cmdlimit, token->slot);
+  bool first = tokenResolve (token, false);
+  if (token->deadline && edgex_watchdog_cancel (svc->watchdog, token->timer))
+  {
+    tokenUnref (token);
+  }
+  if (first)
+  {
+    token->success = success;
+    edgex_metrics_add_work
+      (svc->cmdpool, svc->stats.cmdqueue, finishOneAsync, token);
+  }
+  else
+  {
+    tokenUnref (token);
+  }
+}
+
+/* Devices are grouped for batching, and driver calls limited, by their
+ * addressable unless the driver chooses otherwise, as several devices may
+ * share one physical connection.
+ */
+
+static const char *deviceKey (edgex_device_service *svc, const edgex_devrec *dev)
+{
+  const char *key = NULL;
+  if (svc->userfns.batchkey)
+  {
+    key = svc->userfns.batchkey (svc->userdata, &dev->addressable);
+  }
+  if (key == NULL)
+  {
+    key = dev->addressable.name ? dev->addressable.name : dev->name;
+  }
+  return key;
+}
+
+static bool cmdlimitEnter (edgex_device_command_token *tok)
+{
+  edgex_device_service *svc = tok->svc;
+  return edgex_cmdlimit_enter
+    (svc->cmdlimit, deviceKey (svc, tok->dev), tok->deadline, &tok->slot);
+}
+
+static bool deadlinePassed (uint64_t deadline)
+{
+  return deadline && edgex_device_millitime () >= deadline;
+}
+
+static bool hasAsyncHandler (edgex_device_service *svc, edgex_http_method method)
+{
+  return (method == GET) ?
+    svc->userfns.gethandler_async != NULL :
+    svc->userfns.puthandler_async != NULL;
+}
+
+static bool hasSyncHandler (edgex_device_service *svc, edgex_http_method method)
+{
+  return (method == GET) ?
+    svc->userfns.gethandler != NULL :
+    svc->userfns.puthandler != NULL;
+}
+
+static bool invokeSync (edgex_device_command_token *tok)
+{
+  edgex_device_service *svc = tok->svc;
+  const edgex_addressable *addr = &tok->dev->addressable;
+  bool result;
+
+  currentToken = tok;
+  result = (tok->method == GET) ?
+    svc->userfns.gethandler
+      (svc->userdata, addr, tok->nops, tok->requests, tok->results) :
+    svc->userfns.puthandler
+      (svc->userdata, addr, tok->nops, tok->requests, tok->results);
+  currentToken = NULL;
+  return result;
+}
+
+static void invokeSyncAsync (void *p)
+{
+  edgex_device_command_token *tok = (edgex_device_command_token *) p;
+
+  /* If the deadline passed while the call was queued, the watchdog delivers
+   * the timeout and the driver is not called.
+   */
+  if (deadlinePassed (tok->deadline))
+  {
+    edgex_cmdlimit_exit (tok->svc->cmdlimit, tok->slot);
+    tokenUnref (tok);
+    return;
+  }
+  edgex_device_command_complete (tok, invokeSync (tok));
+}
+
+static int invokeLate (edgex_device_command_token *tok)
+{
+  iot_log_error
+  (
+    tok->svc->logger,
+    "Deadline exceeded before %s command on device %s started",
+    methStr (tok->method), tok->dev->name
+  );
+  tokenFree (tok);
+  return MHD_HTTP_GATEWAY_TIMEOUT;
+}
+
+/* Call the driver. If the token has a completion function and either the
+ * driver has an asynchronous handler or the command has a deadline, returns
+ * CMD_PENDING; otherwise the command is completed and its status returned.
+ * Synchronous driver calls with a deadline are made on the driver pool, so
+ * that the result can be delivered when the deadline passes, and so that
+ * calls which hang occupy only that pool.
+ */
+
+static int invokeOne (edgex_device_command_token *tok, JSON_Value **reply)
+{
+  edgex_device_service *svc = tok->svc;
+  const edgex_addressable *addr = &tok->dev->addressable;
+  int result;
+
+  if (deadlinePassed (tok->deadline))
+  {
+    return invokeLate (tok);
+  }
+  uint64_t start = traceStart (tok->trace);
+  bool entered = cmdlimitEnter (tok);
+  traceSpan (svc, tok->trace, "limit", tok->dev->name, start);
+  if (!entered)
+  {
+    return invokeLate (tok);
+  }
+  if (deadlinePassed (tok->deadline))
+  {
+    edgex_cmdlimit_exit (svc->cmdlimit, tok->slot);
+    return invokeLate (tok);
+  }
+
+  tok->started = edgex_metrics_now ();
+  if (tok->done && (tok->deadline || hasAsyncHandler (svc, tok->method)))
+  {
+    if (tok->deadline)
+    {
+      tok->refs++;
+      tok->timer = edgex_watchdog_add
+        (svc->watchdog, tok->deadline, tokenTimeout, tok);
+    }
+    if (hasAsyncHandler (svc, tok->method))
+    {
+      bool started = (tok->method == GET) ?
+        svc->userfns.gethandler_async
+          (svc->userdata, addr, tok->nops, tok->requests, tok->results, tok) :
+        svc->userfns.puthandler_async
+          (svc->userdata, addr, tok->nops, tok->requests, tok->results, tok);
+      if (!started)
+      {
+        edgex_device_command_complete (tok, false);
+      }
+    }
+    else
+    {
+      edgex_metrics_add_work
+        (svc->driverpool, svc->stats.driverqueue, invokeSyncAsync, tok);
+    }
+    return CMD_PENDING;
+  }
+
+  tok->success = invokeSync (tok);
+  driverTime (tok);
+  edgex_cmdlimit_exit (svc->cmdlimit, tok->slot);
+  result = finishOne (tok, reply);
+  tokenFree (tok);
+  return result;
+}
+
 static int runOnePut
 (
   edgex_device_service *svc,
-  edgex_device *dev,
+  edgex_devrec *dev,
   uint32_t nops,
   edgex_resourceoperation *ops,
   const char *data,
-  JSON_Value **reply
+  uint64_t deadline,
+  JSON_Value **reply,
+  cmd_donefn done,
+  void *donearg
 )
 {
   const char *value;
-  int retcode = MHD_HTTP_OK;
+  edgex_device_command_token *tok;
 
   JSON_Value *jval = json_parse_string (data);
   if (jval == NULL)
@@ -402,246 +966,2051 @@ static int runOnePut
 
   JSON_Object *jobj = json_value_get_object (jval);
 
-  edgex_device_commandrequest *reqs =
-    malloc (nops * sizeof (edgex_device_commandrequest));
-  memset (reqs, 0, nops * sizeof (edgex_device_commandrequest));
-  edgex_device_commandresult *results =
-    malloc (nops * sizeof (edgex_device_commandresult));
-  memset (results, 0, nops * sizeof (edgex_device_commandresult));
-  edgex_resourceoperation *op = ops;
-  for (int i = 0; i < nops; i++)
+  tok = tokenNew (svc, dev, PUT, nops, ops);
+  tok->payload = jval;
+  tok->deadline = deadline;
+  tok->done = done;
+  tok->donearg = donearg;
+  for (uint32_t i = 0; i < nops; i++)
   {
-    reqs[i].ro = op;
-    reqs[i].devobj = findDevObj (dev->profile->device_resources, op->object);
-    value = json_object_get_string (jobj, op->object);
+    const char *object = tok->requests[i].ro->object;
+    value = json_object_get_string (jobj, object);
     if (value == NULL)
     {
-      retcode = MHD_HTTP_BAD_REQUEST;
-      iot_log_error (svc->logger, "No value supplied for %s", op->object);
-      break;
+      iot_log_error (svc->logger, "No value supplied for %s", object);
+      tokenFree (tok);
+      return MHD_HTTP_BAD_REQUEST;
     }
     if
     (
       !populateValue
-        (&results[i], value, reqs[i].devobj->properties->value->type)
+      (
+        &tok->results[i], value,
+        tok->requests[i].devobj->properties->value->type
+      )
     )
     {
-      retcode = MHD_HTTP_BAD_REQUEST;
       iot_log_error
-        (svc->logger, "Unable to parse \"%s\" for %s", value, op->object);
-      break;
-    }
-    op = op->next;
-  }
-
-  if (retcode == MHD_HTTP_OK)
-  {
-    if (!svc->userfns.puthandler (svc->userdata, dev->addressable, nops, reqs, results))
-    {
-      retcode = MHD_HTTP_INTERNAL_SERVER_ERROR;
-      iot_log_error (svc->logger, "Driver for %s failed on PUT", dev->name);
-    }
-  }
-
-  for (int i = 0; i < nops; i++)
-  {
-    if (results[i].type == String)
-    {
-      free (results[i].value.string_result);
+        (svc->logger, "Unable to parse \"%s\" for %s", value, object);
+      tokenFree (tok);
+      return MHD_HTTP_BAD_REQUEST;
     }
   }
-  free (reqs);
-  free (results);
-  json_value_free (jval);
 
-  return retcode;
+  return invokeOne (tok, reply);
 }
 
 static int runOneGet
 (
   edgex_device_service *svc,
-  edgex_device *dev,
+  edgex_devrec *dev,
   uint32_t nops,
   edgex_resourceoperation *ops,
-  JSON_Value **reply
+  uint64_t deadline,
+  JSON_Value **reply,
+  edgex_reading **collect,
+  cmd_donefn done,
+  void *donearg
 )
 {
-  edgex_device_commandrequest *requests =
-    malloc (nops * sizeof (edgex_device_commandrequest));
-  memset (requests, 0, nops * sizeof (edgex_device_commandrequest));
-  edgex_device_commandresult *results =
-    malloc (nops * sizeof (edgex_device_commandresult));
-  memset (results, 0, nops * sizeof (edgex_device_commandresult));
-  edgex_resourceoperation *op = ops;
-  for (int i = 0; i < nops; i++)
+  edgex_device_command_token *tok = tokenNew (svc, dev, GET, nops, ops);
+  tok->deadline = deadline;
+  tok->collect = collect;
+  tok->done = done;
+  tok->donearg = donearg;
+  return invokeOne (tok, reply);
+}
+
+/* Check that a command may be run on a device. On success the profile
+ * resource and the number of operations are returned in res and nops.
+ */
+
+static int checkOne
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  const edgex_command *command,
+  edgex_http_method method,
+  edgex_profileresource **resout,
+  uint32_t *nops
+)
+{
+  if (dev->adminstate == LOCKED)
+  {
+    iot_log_error
+    (
+      svc->logger,
+      "Can't run command %s on device %s as it is locked",
+      command->name, dev->addressable.id
+    );
+    return MHD_HTTP_LOCKED;
+  }
+
+  if
+  (
+    (method == GET && command->get == NULL) ||
+    (method != GET && command->put == NULL)
+  )
+  {
+    iot_log_error
+    (
+      svc->logger,
+      "Command %s found for device %s but no %s version",
+      command->name, dev->name, methStr (method)
+    );
+    return MHD_HTTP_NOT_FOUND;
+  }
+
+  edgex_profileresource *res = dev->profile->resources;
+  while (res)
+  {
+    if (strcmp (res->name, command->name) == 0)
+    { break; }
+    res = res->next;
+  }
+  if (res == NULL)
+  {
+    iot_log_error
+    (
+      svc->logger,
+      "Profile resource %s not found for device %s",
+      command->name, dev->name
+    );
+    return MHD_HTTP_NOT_FOUND;
+  }
+
+  edgex_resourceoperation *op;
+  uint32_t n = 0;
+  for (op = (method == GET) ? res->get : res->set; op; op = op->next)
+  {
+    if (findDevObj (dev->profile->device_resources, op->object) == NULL)
+    {
+      iot_log_error
+      (
+        svc->logger,
+        "No device object %s for device %s",
+        op->object, dev->name
+      );
+      return MHD_HTTP_NOT_FOUND;
+    }
+    n++;
+  }
+  if (n > svc->config.device.maxcmdops)
+  {
+    iot_log_error
+    (
+      svc->logger,
+      "MaxCmdOps (%d) exceeded for dev: %s cmd: %s method: %s",
+      svc->config.device.maxcmdops, dev->name, command->name,
+      methStr (method)
+    );
+    return MHD_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  *resout = res;
+  *nops = n;
+  return MHD_HTTP_OK;
+}
+
+/* Validate and start a command. Returns CMD_PENDING if the command will
+ * complete asynchronously, in which case done is called with the result.
+ * Otherwise the command has completed (or failed validation) and its status
+ * is returned. If done is NULL the command always completes synchronously.
+ * If collect is given, the readings of a successful GET are returned there
+ * instead of being uploaded; the caller then owns them.
+ */
+
+static int startOne
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  const edgex_command *command,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  uint64_t deadline,
+  JSON_Value **reply,
+  edgex_reading **collect,
+  cmd_donefn done,
+  void *donearg
+)
+{
+  edgex_profileresource *res;
+  uint32_t n;
+
+  uint64_t start = traceStart (currentTrace);
+  int status = checkOne (svc, dev, command, method, &res, &n);
+  traceSpan (svc, currentTrace, "profile", dev->name, start);
+  if (status != MHD_HTTP_OK)
+  {
+    return status;
+  }
+
+  if (method == GET)
+  {
+    return runOneGet
+      (svc, dev, n, res->get, deadline, reply, collect, done, donearg);
+  }
+  else
+  {
+    if (upload_data_size == 0)
+    {
+      iot_log_error (svc->logger, "PUT command recieved with no data");
+      return MHD_HTTP_BAD_REQUEST;
+    }
+    return runOnePut
+      (svc, dev, n, res->set, upload_data, deadline, reply, done, donearg);
+  }
+}
+
+/* The deadline for a command is set by the CommandTimeout configuration, or
+ * by the X-EdgeX-Timeout request header if that is shorter. Both are in
+ * milliseconds. A deadline of zero means none.
+ */
+
+static uint64_t commandDeadline
+  (edgex_device_service *svc, edgex_rest_request *req)
+{
+  uint64_t timeout = svc->config.device.commandtimeout;
+  const char *hdr = edgex_rest_request_get_header (req, "X-EdgeX-Timeout");
+  if (hdr)
+  {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long val = strtoull (hdr, &end, 10);
+    if (errno || *hdr == '\0' || *end || *hdr == '-' || val == 0)
+    {
+      iot_log_error (svc->logger, "Ignoring invalid timeout header: %s", hdr);
+    }
+    else if (timeout == 0 || val < timeout)
+    {
+      timeout = val;
+    }
+  }
+  return timeout ? edgex_device_millitime () + timeout : 0;
+}
+
+/* Synchronous command execution. Where the driver only supplies an
+ * asynchronous handler, or the command has a deadline, wait for completion.
+ */
+
+typedef struct cmd_waiter
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool done;
+  int status;
+  JSON_Value *reply;
+} cmd_waiter;
+
+static void cmdWaiterDone (void *arg, int status, JSON_Value *reply)
+{
+  cmd_waiter *w = (cmd_waiter *) arg;
+  pthread_mutex_lock (&w->lock);
+  w->status = status;
+  w->reply = reply;
+  w->done = true;
+  pthread_cond_signal (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+}
+
+static void cmdWaiterInit (cmd_waiter *w)
+{
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->cond, NULL);
+  w->done = false;
+}
+
+static int cmdWaiterWait (cmd_waiter *w, int result, JSON_Value **reply)
+{
+  if (result == CMD_PENDING)
+  {
+    pthread_mutex_lock (&w->lock);
+    while (!w->done)
+    {
+      pthread_cond_wait (&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock (&w->lock);
+    result = w->status;
+    *reply = w->reply;
+  }
+  pthread_cond_destroy (&w->cond);
+  pthread_mutex_destroy (&w->lock);
+  return result;
+}
+
+static int runOne
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  const edgex_command *command,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  uint64_t deadline,
+  JSON_Value **reply
+)
+{
+  int result;
+  cmd_waiter w;
+
+  if (deadline == 0 && hasSyncHandler (svc, method))
+  {
+    return startOne
+    (
+      svc, dev, command, method,
+      upload_data, upload_data_size, 0, reply, NULL, NULL, NULL
+    );
+  }
+
+  cmdWaiterInit (&w);
+  result = startOne
+  (
+    svc, dev, command, method,
+    upload_data, upload_data_size, deadline, reply, NULL, cmdWaiterDone, &w
+  );
+  return cmdWaiterWait (&w, result, reply);
+}
+
+struct allcmd_job;
+
+typedef struct allcmd_item
+{
+  edgex_devrec *dev;
+  const edgex_command *cmd;
+  JSON_Value *reply;
+  int status;
+  struct allcmd_job *job;
+  edgex_fanout *fanout;
+} allcmd_item;
+
+/* For batched commands, items are grouped by device key. The group's items
+ * are listed in the order array.
+ */
+
+typedef struct allcmd_group
+{
+  const char *key;
+  uint32_t first;
+  uint32_t count;
+} allcmd_group;
+
+typedef struct allcmd_job
+{
+  edgex_device_service *svc;
+  edgex_http_method method;
+  const char *upload_data;
+  size_t upload_data_size;
+  edgex_devrec **devs;
+  uint32_t ndevs;
+  allcmd_item *items;
+  uint32_t *order;
+  allcmd_group *groups;
+  uint64_t deadline;
+  uint64_t trace;
+  void (*finish) (struct allcmd_job *job, allcmd_item *item);
+} allcmd_job;
+
+static edgex_fanout_result allcmd_finishitem (allcmd_item *item)
+{
+  if (item->job->finish)
+  {
+    item->job->finish (item->job, item);
+  }
+  return (item->status == MHD_HTTP_OK) ?
+    EDGEX_FANOUT_OK : EDGEX_FANOUT_FAILED;
+}
+
+static void allcmd_itemdone (void *arg, int status, JSON_Value *reply)
+{
+  allcmd_item *item = (allcmd_item *) arg;
+  edgex_fanout *f = item->fanout;
+
+  item->status = status;
+  item->reply = reply;
+  edgex_fanout_done (f, allcmd_finishitem (item) == EDGEX_FANOUT_OK);
+}
+
+static edgex_fanout_result allcmd_runitem
+  (void *ctx, uint32_t index, edgex_fanout *f)
+{
+  allcmd_job *job = (allcmd_job *) ctx;
+  allcmd_item *item = &job->items[index];
+  uint64_t trace = currentTrace;
+  item->job = job;
+  item->fanout = f;
+  currentTrace = job->trace;
+  int status = startOne
+  (
+    job->svc, item->dev, item->cmd, job->method,
+    job->upload_data, job->upload_data_size, job->deadline, &item->reply,
+    NULL, allcmd_itemdone, item
+  );
+  currentTrace = trace;
+  if (status == CMD_PENDING)
+  {
+    return EDGEX_FANOUT_PENDING;
+  }
+  item->status = status;
+  return allcmd_finishitem (item);
+}
+
+/* A call to the driver's batch handler for a group of devices. Where the
+ * job has a deadline the call is made on the driver pool with a timer set,
+ * as for single commands: whichever of the call and the timer finishes first
+ * completes the group, and a late result is discarded. The batch holds the
+ * tokens, and so the devices, until both have finished with it.
+ */
+
+typedef struct allcmd_batch
+{
+  edgex_device_service *svc;
+  allcmd_job *job;
+  allcmd_group *group;
+  edgex_fanout *fanout;
+  edgex_device_batchrequest *requests;
+  edgex_device_command_token **toks;
+  allcmd_item **items;
+  uint32_t n;
+  edgex_cmdlimit_slot *slot;
+  uint64_t deadline;
+  uint64_t timer;
+  uint64_t started;
+  bool ok;
+  bool resolved;
+  uint32_t refs;
+  pthread_mutex_t lock;
+} allcmd_batch;
+
+static void allcmd_batchunref (allcmd_batch *b)
+{
+  pthread_mutex_lock (&b->lock);
+  bool last = (--b->refs == 0);
+  pthread_mutex_unlock (&b->lock);
+  if (last)
+  {
+    for (uint32_t i = 0; i < b->n; i++)
+    {
+      tokenFree (b->toks[i]);
+    }
+    pthread_mutex_destroy (&b->lock);
+    free (b->items);
+    free (b->toks);
+    free (b->requests);
+    free (b);
+  }
+}
+
+/* As tokenResolve, marking each device's command cancelled on timeout */
+
+static bool allcmd_batchresolve (allcmd_batch *b, bool timedout)
+{
+  pthread_mutex_lock (&b->lock);
+  bool first = !b->resolved;
+  b->resolved = true;
+  pthread_mutex_unlock (&b->lock);
+  if (first && timedout)
+  {
+    for (uint32_t i = 0; i < b->n; i++)
+    {
+      tokenResolve (b->toks[i], true);
+    }
+  }
+  return first;
+}
+
+static void allcmd_batchcall (allcmd_batch *b)
+{
+  edgex_device_service *svc = b->svc;
+  b->started = edgex_metrics_now ();
+  b->ok = svc->userfns.gethandler_batch (svc->userdata, b->n, b->requests);
+  edgex_cmdlimit_exit (svc->cmdlimit, b->slot);
+}
+
+/* Set the status of each device in the batch from the driver's results */
+
+static void allcmd_batchresults (allcmd_batch *b)
+{
+  for (uint32_t i = 0; i < b->n; i++)
+  {
+    edgex_device_command_token *tok = b->toks[i];
+    tok->started = b->started;
+    driverTime (tok);
+    tok->success = b->ok && b->requests[i].success;
+    b->items[i]->status = finishOne (tok, &b->items[i]->reply);
+  }
+}
+
+/* Finish every item of a group, returning the result for the fanout */
+
+static edgex_fanout_result allcmd_groupdone
+  (allcmd_job *job, allcmd_group *group)
+{
+  edgex_fanout_result result = EDGEX_FANOUT_OK;
+  for (uint32_t i = 0; i < group->count; i++)
+  {
+    allcmd_item *item = &job->items[job->order[group->first + i]];
+    if (allcmd_finishitem (item) != EDGEX_FANOUT_OK)
+    {
+      result = EDGEX_FANOUT_FAILED;
+    }
+  }
+  return result;
+}
+
+/* Completion of a batch, on the command pool. The batch is released before
+ * the fanout is told, as the job may then be freed.
+ */
+
+static void allcmd_batchdone (void *p)
+{
+  allcmd_batch *b = (allcmd_batch *) p;
+  edgex_fanout *f = b->fanout;
+  uint64_t trace = currentTrace;
+
+  currentTrace = b->job->trace;
+  allcmd_batchresults (b);
+  bool ok = (allcmd_groupdone (b->job, b->group) == EDGEX_FANOUT_OK);
+  currentTrace = trace;
+  allcmd_batchunref (b);
+  edgex_fanout_done (f, ok);
+}
+
+static void allcmd_batchlate (void *p)
+{
+  allcmd_batch *b = (allcmd_batch *) p;
+  edgex_fanout *f = b->fanout;
+
+  iot_log_error
+  (
+    b->svc->logger, "Deadline exceeded for batch GET of %u devices (%s)",
+    b->n, b->group->key
+  );
+  for (uint32_t i = 0; i < b->n; i++)
+  {
+    b->items[i]->status = MHD_HTTP_GATEWAY_TIMEOUT;
+  }
+  bool ok = (allcmd_groupdone (b->job, b->group) == EDGEX_FANOUT_OK);
+  allcmd_batchunref (b);
+  edgex_fanout_done (f, ok);
+}
+
+static void allcmd_batchtimeout (void *p)
+{
+  allcmd_batch *b = (allcmd_batch *) p;
+  if (allcmd_batchresolve (b, true))
+  {
+    edgex_metrics_add_work
+      (b->svc->timeoutpool, b->svc->stats.timeoutqueue, allcmd_batchlate, b);
+  }
+  else
+  {
+    allcmd_batchunref (b);
+  }
+}
+
+/* The driver call, on the driver pool. If the deadline passed while the call
+ * was queued, the timer completes the batch and the driver is not called.
+ */
+
+static void allcmd_batchasync (void *p)
+{
+  allcmd_batch *b = (allcmd_batch *) p;
+  edgex_device_service *svc = b->svc;
+
+  if (deadlinePassed (b->deadline))
+  {
+    edgex_cmdlimit_exit (svc->cmdlimit, b->slot);
+    allcmd_batchunref (b);
+    return;
+  }
+  allcmd_batchcall (b);
+  if (allcmd_batchresolve (b, false))
+  {
+    if (edgex_watchdog_cancel (svc->watchdog, b->timer))
+    {
+      allcmd_batchunref (b);
+    }
+    edgex_metrics_add_work
+      (svc->cmdpool, svc->stats.cmdqueue, allcmd_batchdone, b);
+  }
+  else
+  {
+    allcmd_batchunref (b);
+  }
+}
+
+/* Run a GET on a group of devices using a single call to the driver's batch
+ * handler.
+ */
+
+static edgex_fanout_result allcmd_rungroup
+  (void *ctx, uint32_t index, edgex_fanout *f)
+{
+  allcmd_job *job = (allcmd_job *) ctx;
+  allcmd_group *group = &job->groups[index];
+  edgex_device_service *svc = job->svc;
+  allcmd_batch *b = malloc (sizeof (allcmd_batch));
+  edgex_fanout_result result;
+  uint64_t trace = currentTrace;
+
+  memset (b, 0, sizeof (allcmd_batch));
+  b->svc = svc;
+  b->job = job;
+  b->group = group;
+  b->fanout = f;
+  b->deadline = job->deadline;
+  b->refs = 1;
+  pthread_mutex_init (&b->lock, NULL);
+  b->requests = malloc (group->count * sizeof (edgex_device_batchrequest));
+  b->toks = malloc (group->count * sizeof (edgex_device_command_token *));
+  b->items = malloc (group->count * sizeof (allcmd_item *));
+
+  currentTrace = job->trace;
+  for (uint32_t i = 0; i < group->count; i++)
+  {
+    edgex_profileresource *res;
+    uint32_t n;
+    allcmd_item *item = &job->items[job->order[group->first + i]];
+    uint64_t start = traceStart (job->trace);
+    item->job = job;
+    item->status = checkOne (svc, item->dev, item->cmd, GET, &res, &n);
+    traceSpan (svc, job->trace, "profile", item->dev->name, start);
+    if (item->status == MHD_HTTP_OK)
+    {
+      edgex_device_command_token *tok =
+        tokenNew (svc, item->dev, GET, n, res->get);
+      b->toks[b->n] = tok;
+      b->requests[b->n].devaddr = &item->dev->addressable;
+      b->requests[b->n].nreadings = n;
+      b->requests[b->n].requests = tok->requests;
+      b->requests[b->n].readings = tok->results;
+      b->requests[b->n].success = false;
+      b->items[b->n++] = item;
+    }
+  }
+
+  if (b->n)
+  {
+    bool expired = deadlinePassed (job->deadline) ||
+      !edgex_cmdlimit_enter
+        (svc->cmdlimit, group->key, job->deadline, &b->slot) ||
+      deadlinePassed (job->deadline);
+    if (expired)
+    {
+      edgex_cmdlimit_exit (svc->cmdlimit, b->slot);
+      for (uint32_t i = 0; i < b->n; i++)
+      {
+        b->items[i]->status = MHD_HTTP_GATEWAY_TIMEOUT;
+      }
+    }
+    else if (job->deadline)
+    {
+      b->refs++;
+      b->timer = edgex_watchdog_add
+        (svc->watchdog, job->deadline, allcmd_batchtimeout, b);
+      edgex_metrics_add_work
+        (svc->driverpool, svc->stats.driverqueue, allcmd_batchasync, b);
+      currentTrace = trace;
+      return EDGEX_FANOUT_PENDING;
+    }
+    else
+    {
+      allcmd_batchcall (b);
+      allcmd_batchresults (b);
+    }
+  }
+
+  result = allcmd_groupdone (job, group);
+  currentTrace = trace;
+  allcmd_batchunref (b);
+  return result;
+}
+
+typedef struct allcmd_keyed
+{
+  const char *key;
+  uint32_t index;
+} allcmd_keyed;
+
+static int allcmd_cmpkey (const void *a, const void *b)
+{
+  const allcmd_keyed *ka = (const allcmd_keyed *) a;
+  const allcmd_keyed *kb = (const allcmd_keyed *) b;
+  int result = strcmp (ka->key, kb->key);
+  if (result == 0)
+  {
+    result = (ka->index < kb->index) ? -1 : (ka->index > kb->index);
+  }
+  return result;
+}
+
+/* Group the items by device key, returning the number of groups. Each key
+ * is obtained once, as it may come from the driver.
+ */
+
+static uint32_t allcmd_makegroups (allcmd_job *job, uint32_t nitems)
+{
+  uint32_t ngroups = 0;
+  allcmd_keyed *keyed = malloc (nitems * sizeof (allcmd_keyed));
+
+  job->order = malloc (nitems * sizeof (uint32_t));
+  job->groups = malloc (nitems * sizeof (allcmd_group));
+  for (uint32_t i = 0; i < nitems; i++)
+  {
+    keyed[i].key = deviceKey (job->svc, job->items[i].dev);
+    keyed[i].index = i;
+  }
+  qsort (keyed, nitems, sizeof (allcmd_keyed), allcmd_cmpkey);
+
+  for (uint32_t i = 0; i < nitems; i++)
+  {
+    job->order[i] = keyed[i].index;
+    if (ngroups == 0 || strcmp (keyed[i].key, job->groups[ngroups - 1].key))
+    {
+      job->groups[ngroups].key = keyed[i].key;
+      job->groups[ngroups].first = i;
+      job->groups[ngroups].count = 0;
+      ngroups++;
+    }
+    job->groups[ngroups - 1].count++;
+  }
+  free (keyed);
+  return ngroups;
+}
+
+/* Set up the work for a job: either one unit per device, or one per group
+ * of devices if the driver handles batched reads.
+ */
+
+static edgex_fanout_fn allcmd_prepare
+  (allcmd_job *job, uint32_t ndevs, uint32_t *nwork)
+{
+  if (job->method == GET && job->svc->userfns.gethandler_batch)
+  {
+    *nwork = allcmd_makegroups (job, ndevs);
+    return allcmd_rungroup;
+  }
+  *nwork = ndevs;
+  return allcmd_runitem;
+}
+
+static void allcmd_freejob (allcmd_job *job)
+{
+  for (uint32_t i = 0; i < job->ndevs; i++)
+  {
+    edgex_devmap_release (job->devs[i]);
+  }
+  free (job->devs);
+  free (job->items);
+  free (job->order);
+  free (job->groups);
+}
+
+/* In partial-failure mode, devices for which the command failed are reported
+ * in the result array by name and status code.
+ */
+
+static JSON_Value *allcmd_errorvalue (const allcmd_item *item)
+{
+  JSON_Value *val = json_value_init_object ();
+  JSON_Object *obj = json_value_get_object (val);
+  json_object_set_string (obj, "device", item->dev->name);
+  json_object_set_number (obj, "status", item->status);
+  return val;
+}
+
+/* Streamed replies. Commands are run on the command pool and each device's
+ * result is written to the client as soon as it is available, so that the
+ * reply for a large number of devices is never held in memory as a whole.
+ * Results are queued in serialized form. Command threads never wait for the
+ * client: once qmax results are queued no further devices are started until
+ * the client has taken half of them, so a slow client holds only the results
+ * of commands already in progress.
+ */
+
+typedef struct allcmd_result
+{
+  char *json;
+  struct allcmd_result *next;
+} allcmd_result;
+
+typedef struct allcmd_stream
+{
+  allcmd_job job;
+  edgex_fanout *fanout;
+  edgex_rest_stream *stream;
+  char *upload;
+  pthread_mutex_t lock;
+  allcmd_result *qhead;
+  allcmd_result *qtail;
+  uint32_t qcount;
+  uint32_t qmax;
+  bool paused;
+  uint32_t nitems;
+  uint32_t ndone;
+  uint32_t nsent;
+  char *chunk;
+  size_t chunkoff;
+  bool ended;
+  bool closed;
+  uint64_t ticket;
+} allcmd_stream;
+
+static void allcmd_streamitem (allcmd_job *job, allcmd_item *item)
+{
+  allcmd_stream *st = (allcmd_stream *) job;
+  char *result;
+
+  if (item->reply == NULL)
+  {
+    item->reply = allcmd_errorvalue (item);
+  }
+  result = json_serialize_to_string (item->reply);
+  json_value_free (item->reply);
+  item->reply = NULL;
+
+  pthread_mutex_lock (&st->lock);
+  if (!st->closed)
+  {
+    allcmd_result *res = malloc (sizeof (allcmd_result));
+    res->json = result;
+    res->next = NULL;
+    if (st->qtail)
+    {
+      st->qtail->next = res;
+    }
+    else
+    {
+      st->qhead = res;
+    }
+    st->qtail = res;
+    result = NULL;
+    if (++st->qcount >= st->qmax && !st->paused)
+    {
+      st->paused = true;
+      edgex_fanout_pause (st->fanout);
+    }
+  }
+  st->ndone++;
+  pthread_mutex_unlock (&st->lock);
+
+  json_free_serialized_string (result);
+  edgex_rest_stream_notify (st->stream);
+}
+
+static ssize_t allcmd_streamread (void *cls, char *buf, size_t max)
+{
+  allcmd_stream *st = (allcmd_stream *) cls;
+  size_t n = 0;
+
+  pthread_mutex_lock (&st->lock);
+  while (n < max)
+  {
+    if (st->chunk)
+    {
+      size_t len = strlen (st->chunk + st->chunkoff);
+      if (len > max - n)
+      {
+        len = max - n;
+      }
+      memcpy (buf + n, st->chunk + st->chunkoff, len);
+      n += len;
+      st->chunkoff += len;
+      if (st->chunk[st->chunkoff] == '\0')
+      {
+        free (st->chunk);
+        st->chunk = NULL;
+        st->chunkoff = 0;
+      }
+    }
+    else if (st->qhead)
+    {
+      allcmd_result *res = st->qhead;
+      st->qhead = res->next;
+      if (st->qhead == NULL)
+      {
+        st->qtail = NULL;
+      }
+      if (--st->qcount <= st->qmax / 2 && st->paused)
+      {
+        st->paused = false;
+        edgex_fanout_resume (st->fanout);
+      }
+      st->chunk = malloc (strlen (res->json) + 2);
+      st->chunk[0] = st->nsent++ ? ',' : '[';
+      strcpy (st->chunk + 1, res->json);
+      json_free_serialized_string (res->json);
+      free (res);
+    }
+    else if (st->ndone == st->nitems && !st->ended)
+    {
+      st->chunk = strdup (st->nsent ? "]" : "[]");
+      st->ended = true;
+    }
+    else
+    {
+      break;
+    }
+  }
+  pthread_mutex_unlock (&st->lock);
+
+  return (n == 0 && st->ended) ? -1 : (ssize_t) n;
+}
+
+static void allcmd_streamfree (void *cls)
+{
+  allcmd_stream *st = (allcmd_stream *) cls;
+
+  /* Discard further results, and wait for commands already in progress to
+   * complete.
+   */
+  pthread_mutex_lock (&st->lock);
+  st->closed = true;
+  pthread_mutex_unlock (&st->lock);
+  edgex_fanout_stop (st->fanout);
+  edgex_fanout_wait (st->fanout);
+  edgex_fanout_free (st->fanout);
+  edgex_admission_exit (st->job.svc->admission, NULL, st->ticket);
+
+  while (st->qhead)
+  {
+    allcmd_result *res = st->qhead;
+    st->qhead = res->next;
+    json_free_serialized_string (res->json);
+    free (res);
+  }
+  free (st->chunk);
+  free (st->upload);
+  allcmd_freejob (&st->job);
+  pthread_mutex_destroy (&st->lock);
+  free (st);
+}
+
+static int allCommandStream
+(
+  edgex_device_service *svc,
+  edgex_rest_request *req,
+  allcmd_job *job,
+  uint32_t ndevs,
+  uint64_t ticket
+)
+{
+  uint32_t maxpar = svc->config.device.maxparallelcmds;
+  allcmd_stream *st = malloc (sizeof (allcmd_stream));
+  memset (st, 0, sizeof (allcmd_stream));
+
+  st->stream = edgex_rest_request_stream
+    (req, "application/json", allcmd_streamread, allcmd_streamfree, st);
+  if (st->stream == NULL)
+  {
+    free (st);
+    return MHD_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  /* The upload data belongs to the REST server and is not retained after
+   * the handler returns, so take a copy.
+   */
+  st->job = *job;
+  st->job.finish = allcmd_streamitem;
+  if (job->upload_data_size)
+  {
+    st->upload = malloc (job->upload_data_size + 1);
+    memcpy (st->upload, job->upload_data, job->upload_data_size);
+    st->upload[job->upload_data_size] = '\0';
+    st->job.upload_data = st->upload;
+  }
+  st->nitems = ndevs;
+  st->ticket = ticket;
+  st->qmax = 2 * maxpar;
+  pthread_mutex_init (&st->lock, NULL);
+  uint32_t nwork;
+  edgex_fanout_fn fn = allcmd_prepare (&st->job, ndevs, &nwork);
+
+  /* Results may arrive before the fanout is recorded, so hold the lock */
+
+  pthread_mutex_lock (&st->lock);
+  st->fanout = edgex_fanout_start
+    (svc->cmdpool, svc->stats.cmdqueue, nwork, maxpar, false, fn, &st->job);
+  pthread_mutex_unlock (&st->lock);
+  return MHD_HTTP_OK;
+}
+
+/* Rejects a request refused by admission control, suggesting when the client
+ * should try again.
+ */
+
+static int admissionReject (edgex_device_service *svc, edgex_rest_request *req)
+{
+  char retry[16];
+  sprintf (retry, "%u", edgex_admission_retry_after (svc->admission));
+  edgex_rest_request_header (req, "Retry-After", retry);
+  iot_log_debug (svc->logger, "Command rejected: service busy");
+  return MHD_HTTP_SERVICE_UNAVAILABLE;
+}
+
+/* Serializes a reply into a buffer obtained from the REST server, which is
+ * recycled once the reply has been sent.
+ */
+
+static char *serializeReply (edgex_rest_request *req, const JSON_Value *val)
+{
+  size_t size = json_serialization_size (val);
+  char *buf = NULL;
+
+  if (size)
+  {
+    buf = edgex_rest_request_buffer (req, size);
+    if (json_serialize_to_buffer (val, buf, size) != JSONSuccess)
+    {
+      buf[0] = '\0';
+    }
+  }
+  return buf;
+}
+
+/* Paging. Devices are ordered by name, and the cursor returned with a page
+ * encodes the name of the last device in that page. Names are encoded using
+ * the URL-safe base64 alphabet without padding so that a cursor may be used
+ * in a query string as-is.
+ */
+
+static int allcmd_cmpitem (const void *a, const void *b)
+{
+  return strcmp
+    (((const allcmd_item *) a)->dev->name, ((const allcmd_item *) b)->dev->name);
+}
+
+static char *allcmd_cursor_encode (const char *name)
+{
+  size_t sz = edgex_b64_encodesize (strlen (name));
+  char *result = malloc (sz);
+  edgex_b64_encode (name, strlen (name), result, sz);
+  for (char *c = result; *c; c++)
+  {
+    if (*c == '+') { *c = '-'; }
+    else if (*c == '/') { *c = '_'; }
+    else if (*c == '=') { *c = '\0'; break; }
+  }
+  return result;
+}
+
+static char *allcmd_cursor_decode (const char *cursor)
+{
+  char *enc = strdup (cursor);
+  for (char *c = enc; *c; c++)
+  {
+    if (*c == '-') { *c = '+'; }
+    else if (*c == '_') { *c = '/'; }
+  }
+  size_t sz = edgex_b64_maxdecodesize (enc);
+  char *result = malloc (sz + 1);
+  if (edgex_b64_decode (enc, result, &sz) && memchr (result, 0, sz) == NULL)
+  {
+    result[sz] = '\0';
+  }
+  else
+  {
+    free (result);
+    result = NULL;
+  }
+  free (enc);
+  return result;
+}
+
+/* Select the page of devices requested, moving it to the start of the items
+ * array. Returns the number of devices in the page, or -1 if the paging
+ * arguments are invalid. GET requests are limited to ReadMaxLimit devices
+ * per page if set; requests other than via REST are not paged.
+ */
+
+static int64_t allcmd_selectpage
+(
+  edgex_device_service *svc,
+  edgex_rest_request *req,
+  edgex_http_method method,
+  allcmd_item *items,
+  uint32_t ndevs
+)
+{
+  uint32_t start = 0;
+  uint32_t count;
+  uint32_t limit = (method == GET) ? svc->config.service.readmaxlimit : 0;
+  const char *arg;
+
+  if (req == NULL)
+  {
+    return ndevs;
+  }
+
+  qsort (items, ndevs, sizeof (allcmd_item), allcmd_cmpitem);
+
+  arg = edgex_rest_request_arg (req, "limit");
+  if (arg)
+  {
+    char *end = NULL;
+    errno = 0;
+    unsigned long n = strtoul (arg, &end, 10);
+    if (errno || *arg == '\0' || *end || *arg == '-' || n == 0)
+    {
+      iot_log_error (svc->logger, "Invalid limit specified: %s", arg);
+      return -1;
+    }
+    if (limit == 0 || n < limit)
+    {
+      limit = (n > UINT32_MAX) ? UINT32_MAX : n;
+    }
+  }
+
+  arg = edgex_rest_request_arg (req, "cursor");
+  if (arg)
+  {
+    char *after = allcmd_cursor_decode (arg);
+    if (after == NULL)
+    {
+      iot_log_error (svc->logger, "Invalid cursor specified: %s", arg);
+      return -1;
+    }
+    while (start < ndevs && strcmp (items[start].dev->name, after) <= 0)
+    {
+      start++;
+    }
+    free (after);
+  }
+
+  count = ndevs - start;
+  if (limit && count > limit)
+  {
+    count = limit;
+  }
+  if (start + count < ndevs)
+  {
+    char *next = allcmd_cursor_encode (items[start + count - 1].dev->name);
+    edgex_rest_request_header (req, "X-EdgeX-Next-Cursor", next);
+    free (next);
+  }
+  if (start)
+  {
+    memmove (items, items + start, count * sizeof (allcmd_item));
+  }
+  return count;
+}
+
+/* Run a command on all devices which have it, or on those devices with the
+ * given label, profile or addressable. Devices are found using the
+ * registry's secondary indices.
+ */
+
+static int allCommand
+(
+  edgex_device_service *svc,
+  edgex_rest_request *req,
+  edgex_devmap_index index,
+  const char *key,
+  const char *cmd,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  edgex_devrec *dev;
+  const edgex_command *command;
+  int ret = MHD_HTTP_NOT_FOUND;
+  JSON_Value *jresult;
+  JSON_Array *jarray;
+  allcmd_job job;
+  uint32_t ndevs = 0;
+  bool stoponerr = svc->config.device.allcmdstoponerror;
+
+  if (index == DEVMAP_BYCOMMAND)
+  {
+    iot_log_debug
+      (svc->logger, "Incoming %s command %s for all", methStr (method), cmd);
+  }
+  else
+  {
+    iot_log_debug
+    (
+      svc->logger, "Incoming %s command %s for %s %s", methStr (method), cmd,
+      index == DEVMAP_BYLABEL ? "label" :
+        index == DEVMAP_BYPROFILE ? "profile" : "addressable", key
+    );
+  }
+
+  job.svc = svc;
+  job.method = method;
+  job.upload_data = upload_data;
+  job.upload_data_size = upload_data_size;
+  job.finish = NULL;
+  job.order = NULL;
+  job.groups = NULL;
+  job.deadline = commandDeadline (svc, req);
+  job.trace = currentTrace;
+
+  /* The job holds a reference to every device until it is freed */
+
+  job.devs = edgex_devmap_copyindexed (svc->devices, index, key, &job.ndevs);
+  job.items = malloc (sizeof (allcmd_item) * job.ndevs);
+  for (uint32_t i = 0; i < job.ndevs; i++)
+  {
+    dev = job.devs[i];
+    command = findCommand (cmd, dev->profile->commands);
+    if (command)
+    {
+      job.items[ndevs].dev = dev;
+      job.items[ndevs].cmd = command;
+      job.items[ndevs].reply = NULL;
+      job.items[ndevs].status = MHD_HTTP_NOT_FOUND;
+      ndevs++;
+    }
+  }
+
+  if (ndevs == 0)
+  {
+    allcmd_freejob (&job);
+    return ret;
+  }
+
+  /* Only the devices in the requested page are accessed */
+
+  int64_t npage = allcmd_selectpage (svc, req, method, job.items, ndevs);
+  if (npage <= 0)
+  {
+    allcmd_freejob (&job);
+    if (npage == 0)
+    {
+      edgex_rest_request_reply_static (req, "[]", "application/json");
+      return MHD_HTTP_OK;
+    }
+    return MHD_HTTP_BAD_REQUEST;
+  }
+  ndevs = npage;
+
+  /* REST requests are subject to admission control. A request for several
+   * devices counts once against the overall limit.
+   */
+
+  uint64_t ticket = 0;
+  uint64_t start = traceStart (currentTrace);
+  if (req && !edgex_admission_enter (svc->admission, NULL, &ticket))
+  {
+    allcmd_freejob (&job);
+    return admissionReject (svc, req);
+  }
+  if (req)
+  {
+    traceSpan (svc, currentTrace, "admission", key, start);
+  }
+
+  /* In partial-failure mode the status does not depend on the results, so
+   * REST requests are answered with a stream of results in completion order.
+   */
+
+  if (req && !stoponerr)
+  {
+    ret = allCommandStream (svc, req, &job, ndevs, ticket);
+    if (ret != MHD_HTTP_OK)
+    {
+      allcmd_freejob (&job);
+      edgex_admission_exit (svc->admission, NULL, ticket);
+    }
+    return ret;
+  }
+
+  /* Run the command on each device (or group of devices for batched
+   * reads), up to MaxParallelCmds at once
+   */
+
+  uint32_t nwork;
+  edgex_fanout_fn fn = allcmd_prepare (&job, ndevs, &nwork);
+  edgex_fanout_run
+  (
+    svc->cmdpool, svc->stats.cmdqueue, nwork,
+    svc->config.device.maxparallelcmds, stoponerr, fn, &job
+  );
+
+  /* Gather the results in page order */
+
+  uint32_t nok = 0;
+  int failstatus = 0;
+
+  jresult = json_value_init_array ();
+  jarray = json_value_get_array (jresult);
+  for (uint32_t i = 0; i < ndevs; i++)
+  {
+    allcmd_item *item = &job.items[i];
+    if (item->status == MHD_HTTP_OK)
+    {
+      nok++;
+    }
+    else if (failstatus == 0)
+    {
+      failstatus = item->status;
+    }
+    if (item->reply == NULL && item->status != MHD_HTTP_OK && !stoponerr)
+    {
+      item->reply = allcmd_errorvalue (item);
+    }
+    if (item->reply)
+    {
+      json_array_append_value (jarray, item->reply);
+    }
+  }
+
+  /* Without stop-on-error, partial success is reported as success. The
+   * failures will have been logged by runOne.
+   */
+  ret = (nok == ndevs || (nok && !stoponerr)) ? MHD_HTTP_OK : failstatus;
+
+  if (ret == MHD_HTTP_OK)
+  {
+    start = traceStart (currentTrace);
+    *reply = serializeReply (req, jresult);
+    *reply_type = "application/json";
+    traceSpan (svc, currentTrace, "serialize", key, start);
+  }
+  json_value_free (jresult);
+  allcmd_freejob (&job);
+  if (req)
+  {
+    edgex_admission_exit (svc->admission, NULL, ticket);
+  }
+  return ret;
+}
+
+static int oneCommand
+(
+  edgex_device_service *svc,
+  edgex_rest_request *req,
+  const char *id,
+  bool byName,
+  const char *cmd,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  int result = MHD_HTTP_NOT_FOUND;
+  edgex_devrec *dev;
+  uint64_t start;
+
+  iot_log_debug
+  (
+    svc->logger,
+    "Incoming command for device {%s}: %s (%s)",
+    id, cmd, methStr (method)
+  );
+
+  start = traceStart (currentTrace);
+  dev = byName ? edgex_devmap_device_byname (svc->devices, id) :
+    edgex_devmap_device_byid (svc->devices, id);
+  if (dev)
+  {
+    const edgex_command *command = findCommand (cmd, dev->profile->commands);
+    uint64_t ticket = 0;
+    bool admitted = true;
+    traceSpan (svc, currentTrace, "lookup", dev->name, start);
+    if (command && req)
+    {
+      start = traceStart (currentTrace);
+      admitted = edgex_admission_enter (svc->admission, dev->name, &ticket);
+      traceSpan (svc, currentTrace, "admission", dev->name, start);
+    }
+    if (!admitted)
+    {
+      result = admissionReject (svc, req);
+    }
+    else if (command)
+    {
+      JSON_Value *jreply = NULL;
+      result = runOne
+      (
+        svc, dev, command, method,
+        upload_data, upload_data_size, commandDeadline (svc, req), &jreply
+      );
+      if (jreply)
+      {
+        start = traceStart (currentTrace);
+        *reply = serializeReply (req, jreply);
+        *reply_type = "application/json";
+        json_value_free (jreply);
+        traceSpan (svc, currentTrace, "serialize", dev->name, start);
+      }
+      if (req)
+      {
+        edgex_admission_exit (svc->admission, dev->name, ticket);
+      }
+    }
+    else
+    {
+      iot_log_error
+        (svc->logger, "Command %s not found for device %s", cmd, dev->name);
+    }
+    edgex_devmap_release (dev);
+  }
+  else
+  {
+    iot_log_error (svc->logger, "No such device {%s}", id);
+  }
+  return result;
+}
+
+/* Merging of scheduled reads. When ScheduleMergeWindow is set, a scheduled
+ * GET of a single device is not run immediately. Instead the command is
+ * recorded against the device, and when the window expires the resource
+ * operations of all the commands recorded in the meantime are combined into
+ * a single driver call, producing a single event.
+ */
+
+typedef struct mergedread
+{
+  edgex_device_service *svc;
+  char *devid;
+  edgex_strings *cmds;
+} mergedread;
+
+static void mergedreadFree (mergedread *m)
+{
+  edgex_strings_free (m->cmds);
+  free (m->devid);
+  free (m);
+}
+
+/* Look up a device by id, or by name if the spec starts with "name/". The
+ * device returned must be released.
+ */
+
+static edgex_devrec *lookupDevice
+  (edgex_device_service *svc, const char *spec, size_t len)
+{
+  edgex_devrec *dev;
+  bool byName = (len > 5 && strncmp (spec, "name/", 5) == 0);
+  char *id = byName ? strndup (spec + 5, len - 5) : strndup (spec, len);
+
+  dev = byName ? edgex_devmap_device_byname (svc->devices, id) :
+    edgex_devmap_device_byid (svc->devices, id);
+  free (id);
+  return dev;
+}
+
+static void runMergedChunk
+(
+  edgex_device_service *svc,
+  edgex_devrec *dev,
+  edgex_resourceoperation **ops,
+  uint32_t nops
+)
+{
+  int result;
+  cmd_waiter w;
+  JSON_Value *reply = NULL;
+  edgex_device_command_token *tok = tokenAlloc (svc, dev, GET, nops);
+  for (uint32_t i = 0; i < nops; i++)
+  {
+    tok->requests[i].ro = ops[i];
+    tok->requests[i].devobj =
+      findDevObj (dev->profile->device_resources, ops[i]->object);
+  }
+  tok->deadline = commandDeadline (svc, NULL);
+
+  if (tok->deadline || !hasSyncHandler (svc, GET))
+  {
+    cmdWaiterInit (&w);
+    tok->done = cmdWaiterDone;
+    tok->donearg = &w;
+    result = cmdWaiterWait (&w, invokeOne (tok, &reply), &reply);
+  }
+  else
+  {
+    result = invokeOne (tok, &reply);
+  }
+  if (result != MHD_HTTP_OK)
+  {
+    iot_log_error
+    (
+      svc->logger,
+      "Merged scheduled read of device %s: HTTP %d", dev->name, result
+    );
+  }
+  json_value_free (reply);
+}
+
+static void runMergedRead (void *p)
+{
+  mergedread *m = (mergedread *) p;
+  edgex_device_service *svc = m->svc;
+  edgex_resourceoperation **ops = NULL;
+  uint32_t nops = 0;
+  uint32_t maxops = 0;
+  uint32_t ncmds = 0;
+  edgex_strings *c;
+
+  edgex_devrec *dev = lookupDevice (svc, m->devid, strlen (m->devid));
+  if (dev == NULL)
+  {
+    iot_log_error (svc->logger, "No such device {%s}", m->devid);
+    mergedreadFree (m);
+    return;
+  }
+
+  /* Collect the distinct resource operations of the commands */
+
+  for (c = m->cmds; c; c = c->next)
+  {
+    edgex_profileresource *res;
+    uint32_t n;
+    const edgex_command *command = findCommand (c->str, dev->profile->commands);
+    if (command == NULL)
+    {
+      iot_log_error
+        (svc->logger, "Command %s not found for device %s", c->str, dev->name);
+      continue;
+    }
+    if (checkOne (svc, dev, command, GET, &res, &n) != MHD_HTTP_OK)
+    {
+      continue;
+    }
+    ncmds++;
+    maxops += n;
+    ops = realloc (ops, maxops * sizeof (edgex_resourceoperation *));
+    for (edgex_resourceoperation *op = res->get; op; op = op->next)
+    {
+      uint32_t i;
+      for (i = 0; i < nops; i++)
+      {
+        if (ops[i]->object == op->object)
+        {
+          break;
+        }
+      }
+      if (i == nops)
+      {
+        ops[nops++] = op;
+      }
+    }
+  }
+
+  /* The merged operations are read in as few driver calls as MaxCmdOps
+   * allows, each producing an event.
+   */
+  uint32_t chunk = svc->config.device.maxcmdops;
+  if (chunk == 0 || chunk > nops)
+  {
+    chunk = nops;
+  }
+  if (nops)
+  {
+    iot_log_debug
+    (
+      svc->logger, "Merged read of %u commands on %s in %u calls",
+      ncmds, dev->name, (nops + chunk - 1) / chunk
+    );
+  }
+  for (uint32_t first = 0; first < nops; first += chunk)
+  {
+    runMergedChunk
+      (svc, dev, ops + first, (nops - first < chunk) ? nops - first : chunk);
+  }
+
+  free (ops);
+  edgex_devmap_release (dev);
+  mergedreadFree (m);
+}
+
+static void mergeWindowExpired (void *p)
+{
+  mergedread *m = (mergedread *) p;
+  edgex_device_service *svc = m->svc;
+
+  pthread_mutex_lock (&svc->mergelock);
+  edgex_map_remove (&svc->mergedreads, m->devid);
+  pthread_mutex_unlock (&svc->mergelock);
+  edgex_metrics_add_work (svc->thpool, svc->stats.thqueue, runMergedRead, m);
+}
+
+bool edgex_device_merge_read (edgex_device_service *svc, const char *url)
+{
+  const char *cmd;
+  edgex_devrec *dev;
+  mergedread **found;
+  mergedread *m;
+
+  if
+  (
+    svc->config.device.schedulemergewindow == 0 ||
+    strncmp (url, "all/", 4) == 0 ||
+    strncmp (url, "label/", 6) == 0 ||
+    strncmp (url, "profile/", 8) == 0 ||
+    strncmp (url, "addressable/", 12) == 0 ||
+    (cmd = strrchr (url, '/')) == NULL || cmd[1] == '\0'
+  )
+  {
+    return false;
+  }
+
+  dev = lookupDevice (svc, url, cmd - url);
+  if (dev == NULL)
+  {
+    return false;
+  }
+  cmd++;
+
+  pthread_mutex_lock (&svc->mergelock);
+  found = edgex_map_get (&svc->mergedreads, dev->id);
+  if (found)
+  {
+    m = *found;
+  }
+  else
+  {
+    m = malloc (sizeof (mergedread));
+    m->svc = svc;
+    m->devid = strdup (dev->id);
+    m->cmds = NULL;
+    edgex_map_set (&svc->mergedreads, m->devid, m);
+    edgex_watchdog_add
+    (
+      svc->watchdog,
+      edgex_device_millitime () + svc->config.device.schedulemergewindow,
+      mergeWindowExpired,
+      m
+    );
+  }
+  edgex_strings *c = m->cmds;
+  while (c && strcmp (c->str, cmd))
+  {
+    c = c->next;
+  }
+  if (c == NULL)
+  {
+    c = malloc (sizeof (edgex_strings));
+    c->str = strdup (cmd);
+    c->next = m->cmds;
+    m->cmds = c;
+  }
+  pthread_mutex_unlock (&svc->mergelock);
+  edgex_devmap_release (dev);
+  return true;
+}
+
+void edgex_device_merge_fini (edgex_device_service *svc)
+{
+  const char *key;
+  edgex_map_iter iter = edgex_map_iter (svc->mergedreads);
+  while ((key = edgex_map_next (&svc->mergedreads, &iter)))
+  {
+    mergedreadFree (*edgex_map_get (&svc->mergedreads, key));
+  }
+  edgex_map_deinit (&svc->mergedreads);
+}
+
+/* Batched commands. A POST to device/batch carries a JSON array of
+ * commands, each naming a device by id or name, a command, a method and for
+ * PUTs a body. The commands are run concurrently, up to MaxParallelCmds at
+ * once, and the reply is an array giving the status and any reply of each
+ * command in request order. The batch counts once against the overall
+ * admission limit, and each command against the per-device limit; a command
+ * for a device at its limit is not queued, but refused with status 503.
+ *
+ * Normally each GET uploads its own event. With upload=combined the readings
+ * are instead gathered, and once all the commands have completed a single
+ * event is uploaded for each device, holding the readings of all the GETs of
+ * that device.
+ */
+
+typedef struct batch_item
+{
+  edgex_devrec *dev;
+  const edgex_command *cmd;
+  edgex_http_method method;
+  const char *body;
+  char *bodybuf;
+  JSON_Value *reply;
+  edgex_reading *readings;
+  int32_t next;
+  int status;
+  edgex_fanout *fanout;
+  edgex_admission *admission;
+} batch_item;
+
+typedef struct batch_job
+{
+  edgex_device_service *svc;
+  batch_item *items;
+  uint32_t nitems;
+  uint32_t *uploads;
+  uint64_t deadline;
+  uint64_t trace;
+  bool combine;
+  bool admit;
+} batch_job;
+
+/* For combined uploads, the items which read each device are chained by
+ * index, starting from the item listed in the job's uploads.
+ */
+
+static batch_item *batchNext (batch_job *job, const batch_item *item)
+{
+  return (item->next < 0) ? NULL : &job->items[item->next];
+}
+
+/* Release an item's place within its device's admission limit */
+
+static void batch_release (batch_item *item)
+{
+  if (item->admission)
+  {
+    edgex_admission_release (item->admission, item->dev->name);
+    item->admission = NULL;
+  }
+}
+
+static void batch_itemdone (void *arg, int status, JSON_Value *reply)
+{
+  batch_item *item = (batch_item *) arg;
+
+  batch_release (item);
+  item->status = status;
+  item->reply = reply;
+  edgex_fanout_done (item->fanout, status == MHD_HTTP_OK);
+}
+
+static edgex_fanout_result batch_runitem
+  (void *ctx, uint32_t index, edgex_fanout *f)
+{
+  batch_job *job = (batch_job *) ctx;
+  batch_item *item = &job->items[index];
+  uint64_t trace = currentTrace;
+  int status;
+
+  if (item->status)
+  {
+    return EDGEX_FANOUT_FAILED;
+  }
+  if (job->admit)
+  {
+    if (!edgex_admission_claim (job->svc->admission, item->dev->name))
+    {
+      iot_log_debug
+      (
+        job->svc->logger, "Batch command for device %s rejected: device busy",
+        item->dev->name
+      );
+      item->status = MHD_HTTP_SERVICE_UNAVAILABLE;
+      return EDGEX_FANOUT_FAILED;
+    }
+    item->admission = job->svc->admission;
+  }
+  item->fanout = f;
+  currentTrace = job->trace;
+  status = startOne
+  (
+    job->svc, item->dev, item->cmd, item->method,
+    item->body, item->body ? strlen (item->body) : 0, job->deadline,
+    &item->reply, job->combine ? &item->readings : NULL,
+    batch_itemdone, item
+  );
+  currentTrace = trace;
+  if (status == CMD_PENDING)
+  {
+    return EDGEX_FANOUT_PENDING;
+  }
+  batch_release (item);
+  item->status = status;
+  return (status == MHD_HTTP_OK) ? EDGEX_FANOUT_OK : EDGEX_FANOUT_FAILED;
+}
+
+/* Upload the combined readings of a device. The readings of its items are
+ * copied (without their values) into a single list for the event.
+ */
+
+static edgex_fanout_result batch_upload
+  (void *ctx, uint32_t index, edgex_fanout *f)
+{
+  batch_job *job = (batch_job *) ctx;
+  edgex_device_service *svc = job->svc;
+  batch_item *first = &job->items[job->uploads[index]];
+  batch_item *item;
+  edgex_reading *r;
+  edgex_reading *rdgs;
+  uint32_t n = 0;
+  bool ok;
+
+  for (item = first; item; item = batchNext (job, item))
+  {
+    for (r = item->readings; r; r = r->next)
+    {
+      n++;
+    }
+  }
+  rdgs = malloc (n * sizeof (edgex_reading));
+  n = 0;
+  for (item = first; item; item = batchNext (job, item))
+  {
+    for (r = item->readings; r; r = r->next)
+    {
+      rdgs[n] = *r;
+      rdgs[n].next = rdgs + n + 1;
+      n++;
+    }
+  }
+  rdgs[n - 1].next = NULL;
+
+  uint64_t start = traceStart (job->trace);
+  ok = edgex_device_upload_event
+    (svc, first->dev->name, edgex_device_millitime (), rdgs);
+  traceSpan (svc, job->trace, "upload", first->dev->name, start);
+  free (rdgs);
+
+  if (!ok)
+  {
+    for (item = first; item; item = batchNext (job, item))
+    {
+      item->status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+  return ok ? EDGEX_FANOUT_OK : EDGEX_FANOUT_FAILED;
+}
+
+/* Group the items which read each device, returning the number of devices */
+
+static uint32_t batchGroup (batch_job *job)
+{
+  uint32_t n = 0;
+
+  job->uploads = malloc (job->nitems * sizeof (uint32_t));
+  for (uint32_t i = 0; i < job->nitems; i++)
+  {
+    batch_item *item = &job->items[i];
+    uint32_t g;
+    if (item->readings == NULL)
+    {
+      continue;
+    }
+    for (g = 0; g < n; g++)
+    {
+      if (strcmp (job->items[job->uploads[g]].dev->name, item->dev->name) == 0)
+      {
+        break;
+      }
+    }
+    if (g == n)
+    {
+      job->uploads[n++] = i;
+    }
+    else
+    {
+      batch_item *last = &job->items[job->uploads[g]];
+      while (last->next >= 0)
+      {
+        last = &job->items[last->next];
+      }
+      last->next = i;
+    }
+  }
+  return n;
+}
+
+/* Set up an item from its JSON description. Returns zero if the item is to
+ * be run, otherwise the status to report for it.
+ */
+
+static int batchParseItem
+  (edgex_device_service *svc, const JSON_Object *obj, batch_item *item)
+{
+  const char *id = json_object_get_string (obj, "device");
+  const char *name = json_object_get_string (obj, "name");
+  const char *cmd = json_object_get_string (obj, "command");
+  const char *method = json_object_get_string (obj, "method");
+  JSON_Value *body = json_object_get_value (obj, "body");
+
+  item->next = -1;
+  if ((id == NULL && name == NULL) || cmd == NULL)
+  {
+    iot_log_error
+      (svc->logger, "Batch command requires a device and a command");
+    return MHD_HTTP_BAD_REQUEST;
+  }
+  if (method == NULL || strcasecmp (method, "get") == 0)
+  {
+    item->method = GET;
+  }
+  else if (strcasecmp (method, "put") == 0)
+  {
+    item->method = PUT;
+  }
+  else
+  {
+    iot_log_error (svc->logger, "Unknown method %s in batch command", method);
+    return MHD_HTTP_BAD_REQUEST;
+  }
+  if (body)
+  {
+    item->body = (json_value_get_type (body) == JSONString) ?
+      json_value_get_string (body) :
+      (item->bodybuf = json_serialize_to_string (body));
+  }
+
+  item->dev = id ? edgex_devmap_device_byid (svc->devices, id) :
+    edgex_devmap_device_byname (svc->devices, name);
+  if (item->dev == NULL)
   {
-    requests[i].ro = op;
-    requests[i].devobj =
-      findDevObj (dev->profile->device_resources, op->object);
-    op = op->next;
+    iot_log_error (svc->logger, "No such device {%s}", id ? id : name);
+    return MHD_HTTP_NOT_FOUND;
+  }
+  item->cmd = findCommand (cmd, item->dev->profile->commands);
+  if (item->cmd == NULL)
+  {
+    iot_log_error
+      (svc->logger, "Command %s not found for device %s", cmd, item->dev->name);
+    return MHD_HTTP_NOT_FOUND;
   }
+  return 0;
+}
 
-  if
-  (
-    svc->userfns.gethandler
-      (svc->userdata, dev->addressable, nops, requests, results)
-  )
+static void batchFree (batch_job *job)
+{
+  for (uint32_t i = 0; i < job->nitems; i++)
   {
-    edgex_error err = EDGEX_OK;
-    uint64_t timenow = edgex_device_millitime ();
-    edgex_reading *rdgs = malloc (nops * sizeof (edgex_reading));
-    *reply = json_value_init_object ();
-    JSON_Object *jobj = json_value_get_object (*reply);
-    for (uint32_t i = 0; i < nops; i++)
-    {
-      /* TODO: Transform & mapping for results[i] */
-      rdgs[i].created = timenow;
-      rdgs[i].modified = timenow;
-      rdgs[i].pushed = timenow;
-      rdgs[i].name = requests[i].devobj->name;
-      rdgs[i].id = NULL;
-      rdgs[i].value = edgex_value_tostring
-      (
-        results[i].type,
-        results[i].value,
-        svc->config.device.datatransform,
-        requests[i].devobj->properties->value,
-        requests[i].ro->mappings
-      );
-      rdgs[i].origin = results[i].origin;
-      rdgs[i].next = (i == nops - 1) ? NULL : rdgs + i + 1;
-      json_object_set_string (jobj, rdgs[i].name, rdgs[i].value);
+    batch_item *item = &job->items[i];
+    for (edgex_reading *r = item->readings; r; r = r->next)
+    {
+      free (r->value);
     }
-    edgex_event_free (edgex_data_client_add_event
-                        (svc->logger, &svc->config.endpoints, dev->name,
-                         timenow, rdgs, &err));
-
-    for (uint32_t i = 0; i < nops; i++)
+    free (item->readings);
+    json_value_free (item->reply);
+    json_free_serialized_string (item->bodybuf);
+    if (item->dev)
     {
-      free (rdgs[i].value);
+      edgex_devmap_release (item->dev);
     }
-    free (rdgs);
-    free (results);
-    free (requests);
-    return (err.code == 0) ? MHD_HTTP_OK : MHD_HTTP_INTERNAL_SERVER_ERROR;
-  }
-  else
-  {
-    free (results);
-    free (requests);
-    return MHD_HTTP_INTERNAL_SERVER_ERROR;
   }
+  free (job->items);
+  free (job->uploads);
 }
 
-static int runOne
+static int batchCommand
 (
   edgex_device_service *svc,
-  edgex_device *dev,
-  const edgex_command *command,
+  edgex_rest_request *req,
   edgex_http_method method,
   const char *upload_data,
   size_t upload_data_size,
-  JSON_Value **reply
+  char **reply,
+  const char **reply_type
 )
 {
-  if (strcasecmp ("LOCKED", dev->adminState) == 0)
+  const char *upload = edgex_rest_request_arg (req, "upload");
+  uint32_t maxpar = svc->config.device.maxparallelcmds;
+  JSON_Value *jval;
+  JSON_Array *jarray;
+  JSON_Value *jresult;
+  batch_job job;
+
+  if (method != POST)
   {
-    iot_log_error
-    (
-      svc->logger,
-      "Can't run command %s on device %s as it is locked",
-      command->name, dev->addressable->id
-    );
-    return MHD_HTTP_LOCKED;
+    iot_log_error (svc->logger, "Batch commands must use POST");
+    return MHD_HTTP_METHOD_NOT_ALLOWED;
   }
-
-  if
-  (
-    (method == GET && command->get == NULL) ||
-    (method != GET && command->put == NULL)
-  )
+  if (upload && strcmp (upload, "combined") && strcmp (upload, "command"))
   {
-    iot_log_error
-    (
-      svc->logger,
-      "Command %s found for device %s but no %s version",
-      command->name, dev->name, methStr (method)
-    );
-    return MHD_HTTP_NOT_FOUND;
+    iot_log_error (svc->logger, "Unknown batch upload mode %s", upload);
+    return MHD_HTTP_BAD_REQUEST;
+  }
+  jval = upload_data_size ? json_parse_string (upload_data) : NULL;
+  jarray = json_value_get_array (jval);
+  if (jarray == NULL)
+  {
+    iot_log_error (svc->logger, "Batch command payload is not a JSON array");
+    json_value_free (jval);
+    return MHD_HTTP_BAD_REQUEST;
   }
 
-  edgex_profileresource *res = dev->profile->resources;
-  while (res)
+  uint64_t ticket = 0;
+  uint64_t start = traceStart (currentTrace);
+  if (req && !edgex_admission_enter (svc->admission, NULL, &ticket))
   {
-    if (strcmp (res->name, command->name) == 0)
-    { break; }
-    res = res->next;
+    json_value_free (jval);
+    return admissionReject (svc, req);
   }
-  if (res == NULL)
+  if (req)
   {
-    iot_log_error
-    (
-      svc->logger,
-      "Profile resource %s not found for device %s",
-      command->name, dev->name
-    );
-    return MHD_HTTP_NOT_FOUND;
+    traceSpan (svc, currentTrace, "admission", "batch", start);
   }
 
-  edgex_resourceoperation *op;
-  uint32_t n = 0;
-  for (op = (method == GET) ? res->get : res->set; op; op = op->next)
+  memset (&job, 0, sizeof (batch_job));
+  job.svc = svc;
+  job.nitems = json_array_get_count (jarray);
+  job.items = calloc (job.nitems ? job.nitems : 1, sizeof (batch_item));
+  job.deadline = commandDeadline (svc, req);
+  job.trace = currentTrace;
+  job.combine = upload && strcmp (upload, "combined") == 0;
+  job.admit = (req != NULL);
+  iot_log_debug (svc->logger, "Incoming batch of %u commands", job.nitems);
+
+  start = traceStart (currentTrace);
+  for (uint32_t i = 0; i < job.nitems; i++)
   {
-    if (findDevObj (dev->profile->device_resources, op->object) == NULL)
-    {
-      iot_log_error
-      (
-        svc->logger,
-        "No device object %s for device %s",
-        op->object, dev->name
-      );
-      return MHD_HTTP_NOT_FOUND;
-    }
-    n++;
+    job.items[i].status = batchParseItem
+      (svc, json_array_get_object (jarray, i), &job.items[i]);
   }
-  if (n > svc->config.device.maxcmdops)
+  traceSpan (svc, currentTrace, "lookup", "batch", start);
+
+  edgex_fanout_run
+  (
+    svc->cmdpool, svc->stats.cmdqueue, job.nitems, maxpar, false,
+    batch_runitem, &job
+  );
+  if (job.combine)
   {
-    iot_log_error
+    edgex_fanout_run
     (
-      svc->logger,
-      "MaxCmdOps (%d) exceeded for dev: %s cmd: %s method: %s",
-      svc->config.device.maxcmdops, dev->name, command->name,
-      methStr (method)
+      svc->cmdpool, svc->stats.cmdqueue, batchGroup (&job), maxpar, false,
+      batch_upload, &job
     );
-    return MHD_HTTP_INTERNAL_SERVER_ERROR;
   }
-
-  if (method == GET)
+  if (req)
   {
-    return runOneGet (svc, dev, n, res->get, reply);
+    edgex_admission_exit (svc->admission, NULL, ticket);
   }
-  else
+
+  jresult = json_value_init_array ();
+  for (uint32_t i = 0; i < job.nitems; i++)
   {
-    if (upload_data_size == 0)
+    batch_item *item = &job.items[i];
+    JSON_Value *val = json_value_init_object ();
+    JSON_Object *obj = json_value_get_object (val);
+    json_object_set_number (obj, "status", item->status);
+    if (item->reply)
     {
-      iot_log_error (svc->logger, "PUT command recieved with no data");
-      return MHD_HTTP_BAD_REQUEST;
+      json_object_set_value (obj, "reply", item->reply);
+      item->reply = NULL;
     }
-    return runOnePut (svc, dev, n, res->set, upload_data, reply);
+    json_array_append_value (json_value_get_array (jresult), val);
   }
+
+  start = traceStart (currentTrace);
+  *reply = serializeReply (req, jresult);
+  *reply_type = "application/json";
+  traceSpan (svc, currentTrace, "serialize", "batch", start);
+
+  json_value_free (jresult);
+  batchFree (&job);
+  json_value_free (jval);
+  return MHD_HTTP_OK;
 }
 
-typedef struct devlist
-{
-   edgex_device *dev;
-   const edgex_command *cmd;
-   struct devlist *next;
-} devlist;
+/* Reports the service metrics. */
 
-static int allCommand
+int edgex_device_handler_metrics
 (
-  edgex_device_service *svc,
-  const char *cmd,
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
   edgex_http_method method,
   const char *upload_data,
   size_t upload_data_size,
@@ -649,77 +3018,44 @@ static int allCommand
   const char **reply_type
 )
 {
-  const char *key;
-  edgex_device *dev;
-  const edgex_command *command;
-  int ret = MHD_HTTP_NOT_FOUND;
-  JSON_Value *jresult;
-  JSON_Array *jarray;
-  devlist *devs = NULL;
-  devlist *d;
-
-  iot_log_debug
-    (svc->logger, "Incoming %s command %s for all", methStr (method), cmd);
-
-  jresult = json_value_init_array ();
-  jarray = json_value_get_array (jresult);
-
-  pthread_rwlock_rdlock (&svc->deviceslock);
-  edgex_map_iter iter = edgex_map_iter (svc->devices);
-  while ((key = edgex_map_next (&svc->devices, &iter)))
-  {
-    dev = *edgex_map_get (&svc->devices, key);
-    command = findCommand (cmd, dev->profile->commands);
-    if (command)
-    {
-      d = malloc (sizeof (devlist));
-      d->dev = dev;
-      d->cmd = command;
-      d->next = devs;
-      devs = d;
-    }
-  }
-  pthread_rwlock_unlock (&svc->deviceslock);
+  edgex_device_service *svc = (edgex_device_service *) ctx;
+  const char *format = edgex_rest_request_arg (req, "format");
+  const char *accept = edgex_rest_request_get_header (req, "Accept");
 
-  uint32_t nret = 0;
-  uint32_t maxret = svc->config.service.readmaxlimit;
+  /* Prometheus scrapers ask for text/plain; otherwise JSON is the default */
 
-  for (d = devs; d; d = d->next)
+  if
+  (
+    format ? strcmp (format, "prometheus") == 0 :
+      (accept && strstr (accept, "text/plain"))
+  )
   {
-    JSON_Value *jreply = NULL;
-    ret = runOne
-      (svc, d->dev, d->cmd, method, upload_data, upload_data_size, &jreply);
-    if (jreply && (maxret == 0 || nret++ < maxret))
-    {
-      json_array_append_value (jarray, jreply);
-    }
-    if (ret != MHD_HTTP_OK)
-    {
-      break;
-    }
+    *reply = edgex_metrics_write_prometheus (svc->metrics);
+    *reply_type = "text/plain; version=0.0.4";
   }
-
-  if (ret == MHD_HTTP_OK)
+  else if (format == NULL || strcmp (format, "json") == 0)
   {
-    *reply = json_serialize_to_string (jresult);
+    *reply = edgex_metrics_write_json (svc->metrics);
     *reply_type = "application/json";
   }
-  json_value_free (jresult);
-  while (devs)
+  else
   {
-    d = devs->next;
-    free (devs);
-    devs = d;
+    iot_log_error (svc->logger, "Unknown metrics format %s", format);
+    return MHD_HTTP_BAD_REQUEST;
   }
-  return ret;
+  return MHD_HTTP_OK;
 }
 
-static int oneCommand
+/* Subscribes to events. Server-sent events are used if requested by the
+ * format parameter or by an Accept header including text/event-stream, and
+ * otherwise lines of JSON.
+ */
+
+int edgex_device_handler_events
 (
-  edgex_device_service *svc,
-  const char *id,
-  bool byName,
-  const char *cmd,
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
   edgex_http_method method,
   const char *upload_data,
   size_t upload_data_size,
@@ -727,61 +3063,46 @@ static int oneCommand
   const char **reply_type
 )
 {
-  int result = MHD_HTTP_NOT_FOUND;
-  edgex_device **dev = NULL;
-
-  iot_log_debug
-  (
-    svc->logger,
-    "Incoming command for device {%s}: %s (%s)",
-    id, cmd, methStr (method)
-  );
+  edgex_device_service *svc = (edgex_device_service *) ctx;
+  const char *format = edgex_rest_request_arg (req, "format");
+  const char *accept = edgex_rest_request_get_header (req, "Accept");
+  bool sse;
 
-  pthread_rwlock_rdlock (&svc->deviceslock);
-  if (byName)
+  if (format)
   {
-    char **found = edgex_map_get (&svc->name_to_id, id);
-    if (found)
+    if (strcmp (format, "sse") && strcmp (format, "jsonl"))
     {
-      dev = edgex_map_get (&svc->devices, *found);
+      iot_log_error (svc->logger, "Unknown events format %s", format);
+      return MHD_HTTP_BAD_REQUEST;
     }
+    sse = (strcmp (format, "sse") == 0);
   }
   else
   {
-    dev = edgex_map_get (&svc->devices, id);
-  }
-  pthread_rwlock_unlock (&svc->deviceslock);
-  if (dev)
-  {
-    const edgex_command *command = findCommand (cmd, (*dev)->profile->commands);
-    if (command)
-    {
-      JSON_Value *jreply = NULL;
-      result = runOne
-        (svc, *dev, command, method, upload_data, upload_data_size, &jreply);
-      if (jreply)
-      {
-        *reply = json_serialize_to_string (jreply);
-        *reply_type = "application/json";
-        json_value_free (jreply);
-      }
-    }
-    else
-    {
-      iot_log_error
-        (svc->logger, "Command %s not found for device %s", cmd, (*dev)->name);
-    }
+    sse = accept && strstr (accept, "text/event-stream");
   }
-  else
+
+  if
+  (
+    !edgex_eventhub_subscribe
+    (
+      svc->events, req, edgex_rest_request_arg (req, "device"),
+      edgex_rest_request_arg (req, "resource"), sse
+    )
+  )
   {
-    iot_log_error (svc->logger, "No such device {%s}", id);
+    return MHD_HTTP_SERVICE_UNAVAILABLE;
   }
-  return result;
+  edgex_rest_request_header (req, "Cache-Control", "no-cache");
+  return MHD_HTTP_OK;
 }
 
-int edgex_device_handler_device
+/* Reports the spans recorded by request tracing. */
+
+int edgex_device_handler_trace
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -790,9 +3111,27 @@ int edgex_device_handler_device
   const char **reply_type
 )
 {
-  char *cmd;
   edgex_device_service *svc = (edgex_device_service *) ctx;
 
+  *reply = edgex_tracer_write (svc->tracer);
+  *reply_type = "application/json";
+  return MHD_HTTP_OK;
+}
+
+static int deviceRequest
+(
+  edgex_device_service *svc,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  char *cmd;
+
   if (strlen (url) == 0)
   {
     iot_log_error (svc->logger, "No device specified in url");
@@ -805,7 +3144,11 @@ int edgex_device_handler_device
     if (strlen (cmd))
     {
       return allCommand
-        (svc, cmd, method, upload_data, upload_data_size, reply, reply_type);
+      (
+        svc, req, DEVMAP_BYCOMMAND, cmd, cmd, method,
+        upload_data, upload_data_size,
+        reply, reply_type
+      );
     }
     else
     {
@@ -813,6 +3156,42 @@ int edgex_device_handler_device
       return MHD_HTTP_NOT_FOUND;
     }
   }
+  else if
+  (
+    strncmp (url, "label/", 6) == 0 || strncmp (url, "profile/", 8) == 0 ||
+    strncmp (url, "addressable/", 12) == 0
+  )
+  {
+    edgex_devmap_index index = (url[0] == 'l') ? DEVMAP_BYLABEL :
+      (url[0] == 'p') ? DEVMAP_BYPROFILE : DEVMAP_BYADDRESS;
+    char *key = strchr (url, '/') + 1;
+    cmd = strchr (key, '/');
+    if (cmd == key)
+    {
+      iot_log_error
+        (svc->logger, "No label, profile or addressable specified in url");
+      return MHD_HTTP_NOT_FOUND;
+    }
+    if (cmd == NULL || strlen (cmd + 1) == 0)
+    {
+      iot_log_error (svc->logger, "No command specified in url");
+      return MHD_HTTP_NOT_FOUND;
+    }
+    *cmd++ = '\0';
+    return allCommand
+    (
+      svc, req, index, key, cmd, method,
+      upload_data, upload_data_size,
+      reply, reply_type
+    );
+  }
+  else if (strcmp (url, "batch") == 0)
+  {
+    return batchCommand
+    (
+      svc, req, method, upload_data, upload_data_size, reply, reply_type
+    );
+  }
   else
   {
     bool byName = false;
@@ -830,10 +3209,61 @@ int edgex_device_handler_device
     *cmd++ = '\0';
     return oneCommand
     (
-      svc,
+      svc, req,
       url, byName, cmd, method,
       upload_data, upload_data_size,
       reply, reply_type
     );
   }
 }
+
+/* Device commands are traced from when the request began to be received.
+ * The url is copied for the trace as it is modified in handling.
+ */
+
+#define TRACE_PATH_LEN 48
+
+int edgex_device_handler_device
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  edgex_device_service *svc = (edgex_device_service *) ctx;
+  uint64_t trace = edgex_tracer_sample (svc->tracer);
+  uint64_t start;
+  char path[TRACE_PATH_LEN];
+  int result;
+
+  if (trace == 0)
+  {
+    return deviceRequest
+    (
+      svc, req, url, method,
+      upload_data, upload_data_size, reply, reply_type
+    );
+  }
+
+  start = edgex_metrics_now ();
+  if (req)
+  {
+    edgex_tracer_span
+    (
+      svc->tracer, trace, "http", methStr (method),
+      edgex_rest_request_started (req), start
+    );
+  }
+  snprintf (path, sizeof (path), "%s", url);
+  currentTrace = trace;
+  result = deviceRequest
+    (svc, req, url, method, upload_data, upload_data_size, reply, reply_type);
+  currentTrace = 0;
+  traceSpan (svc, trace, "request", path, start);
+  return result;
+}
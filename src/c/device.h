@@ -10,10 +10,12 @@
 #define _EDGEX_DEVICE_DEVICE_H_ 1
 
 #include "edgex/devsdk.h"
+#include "rest_server.h"
 
 extern int edgex_device_handler_device
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -22,6 +24,64 @@ extern int edgex_device_handler_device
   const char **reply_type
 );
 
+extern int edgex_device_handler_metrics
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+);
+
+extern int edgex_device_handler_trace
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+);
+
+extern int edgex_device_handler_events
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+);
+
+/* Upload an event to core-data, recording the time taken and any failure
+ * in the service's metrics. The event is first published to subscribers.
+ * Returns false if the upload failed.
+ */
+
+extern bool edgex_device_upload_event
+(
+  edgex_device_service *svc,
+  const char *device,
+  uint64_t origin,
+  const edgex_reading *readings
+);
+
+/* Schedule a read for merging with other scheduled reads of the same device.
+ * Returns false if the read should be run immediately instead.
+ */
+
+extern bool edgex_device_merge_read
+  (edgex_device_service *svc, const char *url);
+
+extern void edgex_device_merge_fini (edgex_device_service *svc);
+
 extern char *edgex_value_tostring
 (
   edgex_device_resulttype vtype,
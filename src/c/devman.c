@@ -30,16 +30,14 @@ char * edgex_device_add_device
 )
 {
   const char *postfix = "_addr";
-  char **dev_id;
+  edgex_devrec *existing = edgex_devmap_device_byname (svc->devices, name);
 
-  pthread_rwlock_rdlock (&svc->deviceslock);
-  dev_id = edgex_map_get (&svc->name_to_id, name);
-  pthread_rwlock_unlock (&svc->deviceslock);
-
-  if (dev_id)
+  if (existing)
   {
+    char *result = strdup (existing->id);
     iot_log_info (svc->logger, "Device %s already present", name);
-    return strdup (*dev_id);
+    edgex_devmap_release (existing);
+    return result;
   }
 
   edgex_addressable *newaddr = edgex_addressable_dup (address);
@@ -96,17 +94,15 @@ char * edgex_device_add_device
       (svc, newdev->profile->name, err);
     if (profile)
     {
-      free (newdev->profile->name);
-      free (newdev->profile);
-      newdev->profile = profile;
+      /* The registry substitutes the shared profile for the placeholder */
+
+      edgex_devmap_release_profile (profile);
       free (newdev->addressable->name);
       free (newdev->addressable);
       newdev->addressable = newaddr;
-      pthread_rwlock_wrlock (&svc->deviceslock);
-      edgex_map_set (&svc->devices, newdev->id, newdev);
-      edgex_map_set (&svc->name_to_id, name, newdev->id);
-      pthread_rwlock_unlock (&svc->deviceslock);
-      return strdup (newdev->id);
+      char *result = strdup (newdev->id);
+      edgex_devmap_replace (svc->devices, newdev);
+      return result;
     }
     else
     {
@@ -144,28 +140,7 @@ edgex_device * edgex_device_devices
     return NULL;
   }
 
-  pthread_rwlock_wrlock (&svc->deviceslock);
-  for (edgex_device *d = result; d; d = d->next)
-  {
-    if (edgex_map_get (&svc->name_to_id, d->name) == NULL)
-    {
-      edgex_device *dup = edgex_device_dup (d);
-      edgex_map_set (&svc->devices, dup->id, dup);
-      edgex_map_set (&svc->name_to_id, dup->name, dup->id);
-    }
-  }
-  pthread_rwlock_unlock (&svc->deviceslock);
-
-  pthread_mutex_lock (&svc->profileslock);
-  for (edgex_device *d = result; d; d = d->next)
-  {
-    if (edgex_map_get (&svc->profiles, d->profile->name) == NULL)
-    {
-      edgex_deviceprofile *dup = edgex_deviceprofile_dup (d->profile);
-      edgex_map_set (&svc->profiles, dup->name, dup);
-    }
-  }
-  pthread_mutex_unlock (&svc->profileslock);
+  edgex_devmap_populate (svc->devices, result);
 
   return result;
 }
@@ -177,29 +152,21 @@ void edgex_device_remove_device
     (svc->logger, &svc->config.endpoints, id, err);
   if (err->code == 0)
   {
-    pthread_rwlock_wrlock (&svc->deviceslock);
-    edgex_device **d = edgex_map_get (&svc->devices, id);
-    edgex_device *dev = d ? *d : NULL;
-    if (d)
-    {
-      edgex_map_remove (&svc->name_to_id, dev->name);
-      edgex_map_remove (&svc->devices, id);
-    }
-    pthread_rwlock_unlock (&svc->deviceslock);
+    edgex_devrec *dev = edgex_devmap_remove_byid (svc->devices, id);
     if (dev)
     {
       edgex_metadata_client_delete_addressable
-        (svc->logger, &svc->config.endpoints, dev->addressable->name, err);
+        (svc->logger, &svc->config.endpoints, dev->addressable.name, err);
       if (err->code)
       {
         iot_log_error
         (
           svc->logger,
           "Unable to remove addressable %s from metadata",
-          (*d)->addressable->name
+          dev->addressable.name
         );
       }
-      edgex_device_free (dev);
+      edgex_devmap_release (dev);
     }
   }
   else
@@ -215,30 +182,21 @@ void edgex_device_remove_device_byname
     (svc->logger, &svc->config.endpoints, name, err);
   if (err->code == 0)
   {
-    pthread_rwlock_wrlock (&svc->deviceslock);
-    char **id = edgex_map_get (&svc->name_to_id, name);
-    edgex_device **d = edgex_map_get (&svc->devices, *id);
-    edgex_device *dev = d ? *d : NULL;
-    if (id)
-    {
-      edgex_map_remove (&svc->name_to_id, name); 
-      edgex_map_remove (&svc->devices, *id);
-    }
-    pthread_rwlock_unlock (&svc->deviceslock);
+    edgex_devrec *dev = edgex_devmap_remove_byname (svc->devices, name);
     if (dev)
     {
       edgex_metadata_client_delete_addressable
-        (svc->logger, &svc->config.endpoints, dev->addressable->name, err);
+        (svc->logger, &svc->config.endpoints, dev->addressable.name, err);
       if (err->code)
       {
         iot_log_error
         (
           svc->logger,
           "Unable to remove addressable %s from metadata",
-          dev->addressable->name
+          dev->addressable.name
         );
       }
-      edgex_device_free (dev);
+      edgex_devmap_release (dev);
     }
   }
   else
@@ -259,9 +217,6 @@ void edgex_device_update_device
   edgex_error *err
 )
 {
-  edgex_device *olddev = NULL;
-  edgex_device **od = NULL;
-
   *err = EDGEX_OK;
   edgex_metadata_client_update_device
   (
@@ -276,38 +231,6 @@ void edgex_device_update_device
   );
   if (err->code == 0)
   {
-    pthread_rwlock_wrlock (&svc->deviceslock);
-    if (id)
-    {
-      od = edgex_map_get (&svc->devices, id);
-      if (od)
-      {
-        olddev = *od;
-        edgex_map_remove (&svc->name_to_id, olddev->name);
-        edgex_map_remove (&svc->devices, id);
-      }
-    }
-    else
-    {
-      char **eid = edgex_map_get (&svc->name_to_id, name);
-      if (eid)
-      {
-        od = edgex_map_get (&svc->devices, *eid);
-        if (od)
-        {
-          olddev = *od;
-        }
-        edgex_map_remove (&svc->devices, *eid);
-        edgex_map_remove (&svc->name_to_id, name);
-      }
-    }
-    pthread_rwlock_unlock (&svc->deviceslock);
-
-    if (olddev)
-    {
-      edgex_device_free (olddev);
-    }
-
     edgex_device *newdev;
     if (id)
     {
@@ -328,13 +251,15 @@ void edgex_device_update_device
         "Unable to retrieve device %s following update",
         name ? name : id
       );
+      edgex_devmap_release
+      (
+        id ? edgex_devmap_remove_byid (svc->devices, id) :
+        edgex_devmap_remove_byname (svc->devices, name)
+      );
     }
     else
     {
-      pthread_rwlock_wrlock (&svc->deviceslock);
-      edgex_map_set (&svc->devices, newdev->id, newdev);
-      edgex_map_set (&svc->name_to_id, newdev->name, newdev->id);
-      pthread_rwlock_unlock (&svc->deviceslock);
+      edgex_devmap_replace (svc->devices, newdev);
     }
   }
   else
@@ -0,0 +1,1135 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "devmap.h"
+#include "pmap.h"
+#include "edgex_rest.h"
+#include "intern.h"
+#include "edgex/os.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* Registry entries are device records (see devmap.h). The names of a
+ * profile's device resources and the objects of its resource operations are
+ * interned, so that these may be compared by pointer. Interned strings are
+ * never freed, so only strings with few distinct values are interned.
+ */
+
+/* A shared profile. Each device in the registry holds a reference to the
+ * profile of its name, as does the snapshot's profile table. A pinned
+ * profile is also referenced from the registry's list of pinned profiles.
+ */
+
+typedef struct devmap_profile
+{
+  edgex_deviceprofile prof;
+  uint32_t refs;
+  bool pinned;
+  struct devmap_profile *nextpinned;
+} devmap_profile;
+
+/* A set of devices in a secondary index, which maps device ids to records.
+ * Sets are shared between snapshots, and are only modified while referenced
+ * by a single unpublished snapshot. Their reference counts are only used by
+ * writers, under the write lock. The records in a set are those of the
+ * snapshot's byid map, so the set holds no references to them.
+ */
+
+typedef struct devmap_set
+{
+  uint32_t refs;
+  edgex_pmap devs;
+  char key[];
+} devmap_set;
+
+#define DEVMAP_NINDEX (DEVMAP_BYADDRESS + 1)
+
+/* The maps of a snapshot are persistent (see pmap.h), so a new snapshot
+ * shares all but the changed paths of the maps of the one it replaces, and
+ * each write costs O(log n) rather than a copy of the registry. Records and
+ * profiles in the maps hold no references; index sets are counted.
+ *
+ * A snapshot is never modified once published. When a snapshot is replaced,
+ * the entries which were removed in doing so are recorded against it, and
+ * the registry's references to them are released when it is reclaimed.
+ * Snapshots are reclaimed oldest first, so no older snapshot can still refer
+ * to those entries at that point. A replaced profile is handled likewise.
+ */
+
+typedef struct devmap_snapshot
+{
+  edgex_pmap byid;
+  edgex_pmap byname;
+  edgex_pmap profiles;
+  edgex_pmap index[DEVMAP_NINDEX];
+  edgex_devrec **removed;
+  uint32_t nremoved;
+  devmap_profile *oldprofile;
+  struct devmap_snapshot *next;
+} devmap_snapshot;
+
+/* Hazard records are claimed by readers for the duration of a lookup. They
+ * are never freed while the registry exists, so the list may be traversed
+ * without locking.
+ */
+
+typedef struct devmap_hazard
+{
+  devmap_snapshot *snap;
+  bool active;
+  struct devmap_hazard *next;
+} devmap_hazard;
+
+struct edgex_devmap
+{
+  devmap_snapshot *current;
+  devmap_hazard *hazards;
+  devmap_snapshot *retired;
+  devmap_snapshot *lastretired;
+  devmap_profile *pinned;
+  pthread_mutex_t writelock;
+};
+
+static devmap_snapshot *devmap_snapshot_alloc (void)
+{
+  devmap_snapshot *snap = malloc (sizeof (devmap_snapshot));
+  memset (snap, 0, sizeof (devmap_snapshot));
+  edgex_pmap_init (&snap->byid);
+  edgex_pmap_init (&snap->byname);
+  edgex_pmap_init (&snap->profiles);
+  for (unsigned i = 0; i < DEVMAP_NINDEX; i++)
+  {
+    edgex_pmap_init (&snap->index[i]);
+  }
+  return snap;
+}
+
+static void devmap_set_addref (void *p)
+{
+  ((devmap_set *) p)->refs++;
+}
+
+static void devmap_set_release (void *p)
+{
+  devmap_set *set = (devmap_set *) p;
+  if (--set->refs == 0)
+  {
+    edgex_pmap_deinit (&set->devs, NULL);
+    free (set);
+  }
+}
+
+static const edgex_pmap_ops devmap_setops =
+  { devmap_set_addref, devmap_set_release };
+
+static void devmap_snapshot_free (devmap_snapshot *snap)
+{
+  for (uint32_t i = 0; i < snap->nremoved; i++)
+  {
+    edgex_devmap_release (snap->removed[i]);
+  }
+  free (snap->removed);
+  if (snap->oldprofile)
+  {
+    edgex_devmap_release_profile (&snap->oldprofile->prof);
+  }
+  edgex_pmap_deinit (&snap->byid, NULL);
+  edgex_pmap_deinit (&snap->byname, NULL);
+  edgex_pmap_deinit (&snap->profiles, NULL);
+  for (unsigned i = 0; i < DEVMAP_NINDEX; i++)
+  {
+    edgex_pmap_deinit (&snap->index[i], &devmap_setops);
+  }
+  free (snap);
+}
+
+static edgex_devrec *devmap_find
+  (devmap_snapshot *snap, const char *key, bool byname)
+{
+  return edgex_pmap_get (byname ? &snap->byname : &snap->byid, key);
+}
+
+static devmap_profile *devmap_findprofile
+  (devmap_snapshot *snap, const char *name)
+{
+  return edgex_pmap_get (&snap->profiles, name);
+}
+
+static devmap_snapshot *devmap_snapshot_copy (devmap_snapshot *from)
+{
+  devmap_snapshot *snap = devmap_snapshot_alloc ();
+  edgex_pmap_copy (&snap->byid, &from->byid);
+  edgex_pmap_copy (&snap->byname, &from->byname);
+  edgex_pmap_copy (&snap->profiles, &from->profiles);
+  for (unsigned i = 0; i < DEVMAP_NINDEX; i++)
+  {
+    edgex_pmap_copy (&snap->index[i], &from->index[i]);
+  }
+  return snap;
+}
+
+/* Secondary index maintenance, for a snapshot being built */
+
+static devmap_set *devmap_set_new (const char *key)
+{
+  size_t len = strlen (key) + 1;
+  devmap_set *set = malloc (sizeof (devmap_set) + len);
+  set->refs = 1;
+  edgex_pmap_init (&set->devs);
+  memcpy (set->key, key, len);
+  return set;
+}
+
+/* Obtain the set for a key, to be modified. A set which is shared with
+ * another snapshot is replaced by a copy, which shares its members.
+ */
+
+static devmap_set *devmap_set_private
+  (devmap_snapshot *snap, edgex_devmap_index idx, const char *key)
+{
+  devmap_set *set =
+    edgex_pmap_get_private (&snap->index[idx], key, &devmap_setops);
+  if (set && set->refs > 1)
+  {
+    devmap_set *copy = devmap_set_new (key);
+    edgex_pmap_copy (&copy->devs, &set->devs);
+    edgex_pmap_set (&snap->index[idx], copy->key, copy, &devmap_setops);
+    set = copy;
+  }
+  return set;
+}
+
+static void devmap_set_add
+(
+  devmap_snapshot *snap,
+  edgex_devmap_index idx,
+  const char *key,
+  edgex_devrec *e
+)
+{
+  devmap_set *set = devmap_set_private (snap, idx, key);
+  if (set == NULL)
+  {
+    set = devmap_set_new (key);
+    edgex_pmap_set (&snap->index[idx], set->key, set, &devmap_setops);
+  }
+  edgex_pmap_set (&set->devs, e->id, e, NULL);
+}
+
+static void devmap_set_remove
+(
+  devmap_snapshot *snap,
+  edgex_devmap_index idx,
+  const char *key,
+  edgex_devrec *e
+)
+{
+  devmap_set *set = devmap_set_private (snap, idx, key);
+  if (set && edgex_pmap_remove (&set->devs, e->id, NULL) &&
+    set->devs.size == 0)
+  {
+    edgex_pmap_remove (&snap->index[idx], key, &devmap_setops);
+  }
+}
+
+/* Add or remove a device from each of the indices. A device is listed once
+ * under each key, even if its profile or labels repeat it.
+ */
+
+static void devmap_index (devmap_snapshot *snap, edgex_devrec *e, bool add)
+{
+  void (*fn)
+    (devmap_snapshot *, edgex_devmap_index, const char *, edgex_devrec *) =
+      add ? devmap_set_add : devmap_set_remove;
+
+  if (e->profile)
+  {
+    fn (snap, DEVMAP_BYPROFILE, e->profile->name, e);
+    for (const edgex_command *c = e->profile->commands; c; c = c->next)
+    {
+      const edgex_command *prev = e->profile->commands;
+      while (prev != c && strcmp (prev->name, c->name))
+      {
+        prev = prev->next;
+      }
+      if (prev == c)
+      {
+        fn (snap, DEVMAP_BYCOMMAND, c->name, e);
+      }
+    }
+  }
+  for (uint16_t i = 0; i < e->nlabels; i++)
+  {
+    uint16_t prev = 0;
+    while (prev < i && e->labels[prev] != e->labels[i])
+    {
+      prev++;
+    }
+    if (prev == i)
+    {
+      fn (snap, DEVMAP_BYLABEL, e->labels[i], e);
+    }
+  }
+  if (e->addressable.name)
+  {
+    fn (snap, DEVMAP_BYADDRESS, e->addressable.name, e);
+  }
+}
+
+static void devmap_link (devmap_snapshot *snap, edgex_devrec *e)
+{
+  edgex_pmap_set (&snap->byid, e->id, e, NULL);
+  edgex_pmap_set (&snap->byname, e->name, e, NULL);
+  devmap_index (snap, e, true);
+}
+
+static void devmap_unlink (devmap_snapshot *snap, edgex_devrec *e)
+{
+  edgex_pmap_remove (&snap->byid, e->id, NULL);
+  edgex_pmap_remove (&snap->byname, e->name, NULL);
+  devmap_index (snap, e, false);
+}
+
+static edgex_deviceprofile *devmap_profile_ref (devmap_profile *p)
+{
+  __atomic_add_fetch (&p->refs, 1, __ATOMIC_RELAXED);
+  return &p->prof;
+}
+
+/* Intern a profile's object names, or clear them before it is freed */
+
+static void devmap_profile_names (edgex_deviceprofile *dp, bool intern)
+{
+  for (edgex_deviceobject *o = dp->device_resources; o; o = o->next)
+  {
+    if (intern)
+    {
+      edgex_intern_replace (&o->name);
+    }
+    else
+    {
+      o->name = NULL;
+    }
+  }
+  for (edgex_profileresource *r = dp->resources; r; r = r->next)
+  {
+    for (unsigned i = 0; i < 2; i++)
+    {
+      for (edgex_resourceoperation *op = i ? r->set : r->get; op; op = op->next)
+      {
+        if (intern)
+        {
+          edgex_intern_replace (&op->object);
+        }
+        else
+        {
+          op->object = NULL;
+        }
+      }
+    }
+  }
+}
+
+/* Add a profile to the table of a new snapshot. The table's reference is
+ * the one the profile is created with.
+ */
+
+static devmap_profile *devmap_profile_new
+  (devmap_snapshot *snap, edgex_deviceprofile *dp)
+{
+  devmap_profile *p = malloc (sizeof (devmap_profile));
+  p->prof = *dp;
+  p->refs = 1;
+  p->pinned = false;
+  p->nextpinned = NULL;
+  free (dp);
+  devmap_profile_names (&p->prof, true);
+  edgex_pmap_set (&snap->profiles, p->prof.name, p, NULL);
+  return p;
+}
+
+/* Obtain a reference to the shared version of a profile, which is created
+ * from a copy of the given one if not present.
+ */
+
+static edgex_deviceprofile *devmap_profile_share
+  (devmap_snapshot *snap, const edgex_deviceprofile *dp)
+{
+  devmap_profile *p = devmap_findprofile (snap, dp->name);
+  if (p == NULL)
+  {
+    p = devmap_profile_new
+      (snap, edgex_deviceprofile_dup ((edgex_deviceprofile *) dp));
+  }
+  return devmap_profile_ref (p);
+}
+
+/* Device records. Labels and the method and protocol of the addressable
+ * take few distinct values, so are interned. The remaining strings, which
+ * are mostly unique to the device and include the addressable's password,
+ * are held in the record's own allocation, following the labels.
+ */
+
+#define DEVMAP_NSTRINGS 11
+
+static void devmap_rec_fields
+  (const edgex_devrec *e, const char *const *fields[DEVMAP_NSTRINGS])
+{
+  const edgex_addressable *a = &e->addressable;
+  fields[0] = &e->id;
+  fields[1] = &e->name;
+  fields[2] = &e->description;
+  fields[3] = (const char *const *) &a->address;
+  fields[4] = (const char *const *) &a->id;
+  fields[5] = (const char *const *) &a->name;
+  fields[6] = (const char *const *) &a->password;
+  fields[7] = (const char *const *) &a->path;
+  fields[8] = (const char *const *) &a->publisher;
+  fields[9] = (const char *const *) &a->topic;
+  fields[10] = (const char *const *) &a->user;
+}
+
+static size_t devmap_rec_strsize (const edgex_devrec *e)
+{
+  const char *const *fields[DEVMAP_NSTRINGS];
+  size_t size = 0;
+  devmap_rec_fields (e, fields);
+  for (unsigned i = 0; i < DEVMAP_NSTRINGS; i++)
+  {
+    if (*fields[i])
+    {
+      size += strlen (*fields[i]) + 1;
+    }
+  }
+  return size;
+}
+
+static size_t devmap_rec_size (const edgex_devrec *e)
+{
+  return sizeof (edgex_devrec) + e->nlabels * sizeof (char *) +
+    devmap_rec_strsize (e);
+}
+
+/* Copy the strings to which a record refers into its allocation */
+
+static void devmap_rec_pack (edgex_devrec *e)
+{
+  const char *const *fields[DEVMAP_NSTRINGS];
+  char *area = (char *) &e->labels[e->nlabels];
+  devmap_rec_fields (e, fields);
+  for (unsigned i = 0; i < DEVMAP_NSTRINGS; i++)
+  {
+    if (*fields[i])
+    {
+      size_t len = strlen (*fields[i]) + 1;
+      memcpy (area, *fields[i], len);
+      *(const char **) fields[i] = area;
+      area += len;
+    }
+  }
+}
+
+/* Create a record for a device, sharing the given profile */
+
+static edgex_devrec *devmap_rec_copy
+  (const edgex_device *dev, edgex_deviceprofile *profile)
+{
+  edgex_devrec hdr;
+  uint16_t n = 0;
+  for (const edgex_strings *l = dev->labels; l && n < UINT16_MAX; l = l->next)
+  {
+    n++;
+  }
+  memset (&hdr, 0, sizeof (hdr));
+  hdr.nlabels = n;
+  hdr.id = dev->id;
+  hdr.name = dev->name;
+  hdr.description = dev->description;
+  if (dev->addressable)
+  {
+    hdr.addressable = *dev->addressable;
+    hdr.addressable.method = (char *) edgex_intern (hdr.addressable.method);
+    hdr.addressable.protocol =
+      (char *) edgex_intern (hdr.addressable.protocol);
+  }
+  hdr.profile = profile;
+  hdr.origin = dev->origin;
+  hdr.created = dev->created;
+  hdr.modified = dev->modified;
+  hdr.lastConnected = dev->lastConnected;
+  hdr.lastReported = dev->lastReported;
+  hdr.refs = 1;
+  hdr.adminstate = (dev->adminState &&
+    strcasecmp (dev->adminState, "LOCKED") == 0) ? LOCKED : UNLOCKED;
+  hdr.opstate = (dev->operatingState &&
+    strcasecmp (dev->operatingState, "DISABLED") == 0) ? DISABLED : ENABLED;
+
+  edgex_devrec *e = malloc (devmap_rec_size (&hdr));
+  memcpy (e, &hdr, sizeof (hdr));
+  n = 0;
+  for (const edgex_strings *l = dev->labels; n < e->nlabels; l = l->next)
+  {
+    e->labels[n++] = edgex_intern (l->str);
+  }
+  devmap_rec_pack (e);
+  return e;
+}
+
+/* Copy a record, substituting the given profile */
+
+static edgex_devrec *devmap_rec_dup
+  (const edgex_devrec *from, edgex_deviceprofile *profile)
+{
+  const char *const *fields[DEVMAP_NSTRINGS];
+  const char *const *copied[DEVMAP_NSTRINGS];
+  size_t size = devmap_rec_size (from);
+  edgex_devrec *e = malloc (size);
+  memcpy (e, from, size);
+  e->profile = profile;
+  e->refs = 1;
+
+  /* Point the copy's strings into its own allocation */
+
+  devmap_rec_fields (from, fields);
+  devmap_rec_fields (e, copied);
+  for (unsigned i = 0; i < DEVMAP_NSTRINGS; i++)
+  {
+    if (*fields[i])
+    {
+      *(const char **) copied[i] =
+        (const char *) e + (*fields[i] - (const char *) from);
+    }
+  }
+  return e;
+}
+
+/* Switch the devices of a snapshot which use one version of a profile to
+ * another, adding the records replaced to the removed list.
+ */
+
+static void devmap_profile_switch
+(
+  devmap_snapshot *snap,
+  devmap_profile *old,
+  devmap_profile *p,
+  edgex_devrec ***removed,
+  uint32_t *nremoved
+)
+{
+  devmap_set *users =
+    edgex_pmap_get (&snap->index[DEVMAP_BYPROFILE], p->prof.name);
+  if (users)
+  {
+    edgex_pmap_iter iter;
+    void *e;
+    uint32_t first = *nremoved;
+    *removed = realloc
+      (*removed, (first + users->devs.size) * sizeof (edgex_devrec *));
+    edgex_pmap_iter_init (&users->devs, &iter);
+    while (edgex_pmap_next (&iter, &e))
+    {
+      if (((edgex_devrec *) e)->profile == &old->prof)
+      {
+        (*removed)[(*nremoved)++] = e;
+      }
+    }
+    for (uint32_t i = first; i < *nremoved; i++)
+    {
+      edgex_devrec *e = (*removed)[i];
+      edgex_devrec *copy = devmap_rec_dup (e, devmap_profile_ref (p));
+      devmap_unlink (snap, e);
+      devmap_link (snap, copy);
+    }
+  }
+}
+
+/* As devmap_profile_share, but the given profile is consumed. A profile
+ * which is newer than the shared profile of its name replaces it, and the
+ * devices using the previous version are switched to it; the previous
+ * version is then returned in *old. Profiles which only name the shared
+ * profile have no modification time, so never replace it.
+ */
+
+static edgex_deviceprofile *devmap_profile_adopt
+(
+  devmap_snapshot *snap,
+  edgex_deviceprofile *dp,
+  devmap_profile **old,
+  edgex_devrec ***removed,
+  uint32_t *nremoved
+)
+{
+  devmap_profile *p = devmap_findprofile (snap, dp->name);
+  if (p && dp->modified <= p->prof.modified)
+  {
+    edgex_deviceprofile_free (dp);
+  }
+  else
+  {
+    *old = p;
+    p = devmap_profile_new (snap, dp);
+    if (*old)
+    {
+      devmap_profile_switch (snap, *old, p, removed, nremoved);
+    }
+  }
+  return devmap_profile_ref (p);
+}
+
+static edgex_devrec *devmap_rec_new
+(
+  devmap_snapshot *snap,
+  edgex_device *dev,
+  devmap_profile **oldprofile,
+  edgex_devrec ***removed,
+  uint32_t *nremoved
+)
+{
+  edgex_deviceprofile *profile = NULL;
+  if (dev->profile)
+  {
+    profile = devmap_profile_adopt
+      (snap, dev->profile, oldprofile, removed, nremoved);
+    dev->profile = NULL;
+  }
+  edgex_devrec *e = devmap_rec_copy (dev, profile);
+  dev->next = NULL;
+  edgex_device_free (dev);
+  return e;
+}
+
+static void devmap_rec_free (edgex_devrec *e)
+{
+  edgex_devmap_release_profile (e->profile);
+  free (e);
+}
+
+edgex_device *edgex_devmap_todevice (const edgex_devrec *e)
+{
+  edgex_strings **last;
+  edgex_device *dev = malloc (sizeof (edgex_device));
+  memset (dev, 0, sizeof (edgex_device));
+  dev->id = strdup (e->id);
+  dev->name = strdup (e->name);
+  dev->description = e->description ? strdup (e->description) : NULL;
+  if (e->profile)
+  {
+    dev->profile = edgex_deviceprofile_dup (e->profile);
+  }
+  dev->addressable = edgex_addressable_dup
+    ((edgex_addressable *) &e->addressable);
+  dev->origin = e->origin;
+  dev->created = e->created;
+  dev->modified = e->modified;
+  dev->lastConnected = e->lastConnected;
+  dev->lastReported = e->lastReported;
+  dev->adminState = strdup (e->adminstate == LOCKED ? "LOCKED" : "UNLOCKED");
+  dev->operatingState =
+    strdup (e->opstate == DISABLED ? "DISABLED" : "ENABLED");
+  last = &dev->labels;
+  for (uint16_t i = 0; i < e->nlabels; i++)
+  {
+    *last = malloc (sizeof (edgex_strings));
+    (*last)->str = strdup (e->labels[i]);
+    (*last)->next = NULL;
+    last = &(*last)->next;
+  }
+  return dev;
+}
+
+/* Reader side */
+
+static devmap_hazard *devmap_hazard_acquire (edgex_devmap *map)
+{
+  devmap_hazard *h;
+  bool inactive;
+
+  for (h = __atomic_load_n (&map->hazards, __ATOMIC_ACQUIRE); h; h = h->next)
+  {
+    inactive = false;
+    if
+    (
+      !__atomic_load_n (&h->active, __ATOMIC_RELAXED) &&
+      __atomic_compare_exchange_n
+        (&h->active, &inactive, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+    )
+    {
+      return h;
+    }
+  }
+
+  h = malloc (sizeof (devmap_hazard));
+  h->snap = NULL;
+  h->active = true;
+  h->next = __atomic_load_n (&map->hazards, __ATOMIC_RELAXED);
+  while
+  (
+    !__atomic_compare_exchange_n
+      (&map->hazards, &h->next, h, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+  );
+  return h;
+}
+
+static devmap_snapshot *devmap_protect (edgex_devmap *map, devmap_hazard **hp)
+{
+  devmap_hazard *h = devmap_hazard_acquire (map);
+  devmap_snapshot *snap = __atomic_load_n (&map->current, __ATOMIC_ACQUIRE);
+  devmap_snapshot *check;
+
+  /* The snapshot is safe to use once it is published in the hazard record
+   * and is still current, as the writer scans the hazards after replacing it.
+   */
+  while (true)
+  {
+    __atomic_store_n (&h->snap, snap, __ATOMIC_SEQ_CST);
+    check = __atomic_load_n (&map->current, __ATOMIC_SEQ_CST);
+    if (check == snap)
+    {
+      break;
+    }
+    snap = check;
+  }
+  *hp = h;
+  return snap;
+}
+
+static void devmap_unprotect (devmap_hazard *h)
+{
+  __atomic_store_n (&h->snap, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n (&h->active, false, __ATOMIC_RELEASE);
+}
+
+static edgex_devrec *devmap_lookup
+  (edgex_devmap *map, const char *key, bool byname)
+{
+  devmap_hazard *h;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+  edgex_devrec *e = devmap_find (snap, key, byname);
+  if (e)
+  {
+    __atomic_add_fetch (&e->refs, 1, __ATOMIC_RELAXED);
+  }
+  devmap_unprotect (h);
+  return e;
+}
+
+edgex_devrec *edgex_devmap_device_byid (edgex_devmap *map, const char *id)
+{
+  return devmap_lookup (map, id, false);
+}
+
+edgex_devrec *edgex_devmap_device_byname (edgex_devmap *map, const char *name)
+{
+  return devmap_lookup (map, name, true);
+}
+
+/* Take references to the records of a map */
+
+static edgex_devrec **devmap_copyrecs (const edgex_pmap *recs, uint32_t *ndevs)
+{
+  edgex_devrec **result = NULL;
+  edgex_pmap_iter iter;
+  void *e;
+  uint32_t n = 0;
+
+  if (recs->size)
+  {
+    result = malloc (recs->size * sizeof (edgex_devrec *));
+    edgex_pmap_iter_init (recs, &iter);
+    while (edgex_pmap_next (&iter, &e))
+    {
+      __atomic_add_fetch (&((edgex_devrec *) e)->refs, 1, __ATOMIC_RELAXED);
+      result[n++] = e;
+    }
+  }
+  *ndevs = n;
+  return result;
+}
+
+edgex_devrec **edgex_devmap_copydevices (edgex_devmap *map, uint32_t *ndevs)
+{
+  devmap_hazard *h;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+  edgex_devrec **result = devmap_copyrecs (&snap->byid, ndevs);
+  devmap_unprotect (h);
+  return result;
+}
+
+edgex_devrec **edgex_devmap_copyindexed
+(
+  edgex_devmap *map,
+  edgex_devmap_index index,
+  const char *key,
+  uint32_t *ndevs
+)
+{
+  devmap_hazard *h;
+  edgex_devrec **result = NULL;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+
+  devmap_set *set = edgex_pmap_get (&snap->index[index], key);
+  if (set)
+  {
+    result = devmap_copyrecs (&set->devs, ndevs);
+  }
+  else
+  {
+    *ndevs = 0;
+  }
+  devmap_unprotect (h);
+  return result;
+}
+
+uint32_t edgex_devmap_size (edgex_devmap *map)
+{
+  devmap_hazard *h;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+  uint32_t result = snap->byid.size;
+  devmap_unprotect (h);
+  return result;
+}
+
+void edgex_devmap_addref (edgex_devrec *dev)
+{
+  __atomic_add_fetch (&dev->refs, 1, __ATOMIC_RELAXED);
+}
+
+void edgex_devmap_release (edgex_devrec *dev)
+{
+  if (dev && __atomic_sub_fetch (&dev->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    devmap_rec_free (dev);
+  }
+}
+
+edgex_deviceprofile *edgex_devmap_profile (edgex_devmap *map, const char *name)
+{
+  devmap_hazard *h;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+  devmap_profile *p = devmap_findprofile (snap, name);
+  edgex_deviceprofile *result = p ? devmap_profile_ref (p) : NULL;
+  devmap_unprotect (h);
+  return result;
+}
+
+edgex_deviceprofile **edgex_devmap_copyprofiles
+  (edgex_devmap *map, uint32_t *nprofs)
+{
+  devmap_hazard *h;
+  edgex_deviceprofile **result = NULL;
+  uint32_t n = 0;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+
+  if (snap->profiles.size)
+  {
+    edgex_pmap_iter iter;
+    void *p;
+    result = malloc (snap->profiles.size * sizeof (edgex_deviceprofile *));
+    edgex_pmap_iter_init (&snap->profiles, &iter);
+    while (edgex_pmap_next (&iter, &p))
+    {
+      result[n++] = devmap_profile_ref (p);
+    }
+  }
+  devmap_unprotect (h);
+  *nprofs = n;
+  return result;
+}
+
+uint32_t edgex_devmap_nprofiles (edgex_devmap *map)
+{
+  devmap_hazard *h;
+  devmap_snapshot *snap = devmap_protect (map, &h);
+  uint32_t result = snap->profiles.size;
+  devmap_unprotect (h);
+  return result;
+}
+
+void edgex_devmap_release_profile (edgex_deviceprofile *dp)
+{
+  devmap_profile *p = (devmap_profile *) dp;
+  if (dp && __atomic_sub_fetch (&p->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    devmap_profile_names (dp, false);
+    edgex_deviceprofile_free (dp);
+  }
+}
+
+/* Writer side. Called with the write lock held. */
+
+static bool devmap_hazardous (edgex_devmap *map, const devmap_snapshot *snap)
+{
+  devmap_hazard *h;
+  for (h = __atomic_load_n (&map->hazards, __ATOMIC_ACQUIRE); h; h = h->next)
+  {
+    if (__atomic_load_n (&h->snap, __ATOMIC_SEQ_CST) == snap)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void devmap_reclaim (edgex_devmap *map)
+{
+  while (map->retired && !devmap_hazardous (map, map->retired))
+  {
+    devmap_snapshot *snap = map->retired;
+    map->retired = snap->next;
+    if (map->retired == NULL)
+    {
+      map->lastretired = NULL;
+    }
+    devmap_snapshot_free (snap);
+  }
+}
+
+static void devmap_publish
+(
+  edgex_devmap *map,
+  devmap_snapshot *snap,
+  edgex_devrec **removed,
+  uint32_t nremoved,
+  devmap_profile *oldprofile
+)
+{
+  devmap_snapshot *old = map->current;
+  old->removed = removed;
+  old->nremoved = nremoved;
+  old->oldprofile = oldprofile;
+  __atomic_store_n (&map->current, snap, __ATOMIC_SEQ_CST);
+
+  if (map->lastretired)
+  {
+    map->lastretired->next = old;
+  }
+  else
+  {
+    map->retired = old;
+  }
+  map->lastretired = old;
+  devmap_reclaim (map);
+}
+
+void edgex_devmap_replace (edgex_devmap *map, edgex_device *dev)
+{
+  edgex_devrec **removed = malloc (2 * sizeof (edgex_devrec *));
+  edgex_devrec *old;
+  uint32_t nremoved = 0;
+  devmap_profile *oldprofile = NULL;
+
+  pthread_mutex_lock (&map->writelock);
+  devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+  if ((old = devmap_find (snap, dev->id, false)))
+  {
+    devmap_unlink (snap, old);
+    removed[nremoved++] = old;
+  }
+  if ((old = devmap_find (snap, dev->name, true)))
+  {
+    devmap_unlink (snap, old);
+    removed[nremoved++] = old;
+  }
+  edgex_devrec *e =
+    devmap_rec_new (snap, dev, &oldprofile, &removed, &nremoved);
+  devmap_link (snap, e);
+  devmap_publish (map, snap, removed, nremoved, oldprofile);
+  pthread_mutex_unlock (&map->writelock);
+}
+
+uint32_t edgex_devmap_populate (edgex_devmap *map, const edgex_device *devs)
+{
+  uint32_t added = 0;
+
+  pthread_mutex_lock (&map->writelock);
+  devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+  for (const edgex_device *d = devs; d; d = d->next)
+  {
+    if (devmap_find (snap, d->name, true) == NULL)
+    {
+      edgex_devrec *e = devmap_rec_copy
+        (d, d->profile ? devmap_profile_share (snap, d->profile) : NULL);
+      devmap_link (snap, e);
+      added++;
+    }
+  }
+  if (added)
+  {
+    devmap_publish (map, snap, NULL, 0, NULL);
+  }
+  else
+  {
+    devmap_snapshot_free (snap);
+  }
+  pthread_mutex_unlock (&map->writelock);
+  return added;
+}
+
+static edgex_devrec *devmap_remove
+  (edgex_devmap *map, const char *key, bool byname)
+{
+  edgex_devrec *e;
+
+  pthread_mutex_lock (&map->writelock);
+  e = devmap_find (map->current, key, byname);
+  if (e)
+  {
+    edgex_devrec **removed = malloc (sizeof (edgex_devrec *));
+    devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+    devmap_unlink (snap, e);
+    removed[0] = e;
+    __atomic_add_fetch (&e->refs, 1, __ATOMIC_RELAXED);
+    devmap_publish (map, snap, removed, 1, NULL);
+  }
+  pthread_mutex_unlock (&map->writelock);
+  return e;
+}
+
+edgex_devrec *edgex_devmap_remove_byid (edgex_devmap *map, const char *id)
+{
+  return devmap_remove (map, id, false);
+}
+
+edgex_devrec *edgex_devmap_remove_byname
+  (edgex_devmap *map, const char *name)
+{
+  return devmap_remove (map, name, true);
+}
+
+edgex_deviceprofile *edgex_devmap_add_profile
+  (edgex_devmap *map, edgex_deviceprofile *dp)
+{
+  edgex_deviceprofile *result;
+
+  pthread_mutex_lock (&map->writelock);
+  devmap_profile *p = devmap_findprofile (map->current, dp->name);
+  if (p)
+  {
+    edgex_deviceprofile_free (dp);
+    result = devmap_profile_ref (p);
+  }
+  else
+  {
+    devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+    result = devmap_profile_ref (devmap_profile_new (snap, dp));
+    devmap_publish (map, snap, NULL, 0, NULL);
+  }
+  pthread_mutex_unlock (&map->writelock);
+  return result;
+}
+
+void edgex_devmap_replace_profile (edgex_devmap *map, edgex_deviceprofile *dp)
+{
+  edgex_devrec **removed = NULL;
+  uint32_t nremoved = 0;
+
+  pthread_mutex_lock (&map->writelock);
+  devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+  devmap_profile *old = devmap_findprofile (snap, dp->name);
+  devmap_profile *p = devmap_profile_new (snap, dp);
+
+  /* Devices using the previous version are replaced by copies which use the
+   * new one.
+   */
+  if (old)
+  {
+    devmap_profile_switch (snap, old, p, &removed, &nremoved);
+  }
+  devmap_publish (map, snap, removed, nremoved, old);
+  pthread_mutex_unlock (&map->writelock);
+}
+
+void edgex_devmap_pin_profile (edgex_devmap *map, edgex_deviceprofile *dp)
+{
+  devmap_profile *p = (devmap_profile *) dp;
+  pthread_mutex_lock (&map->writelock);
+  if (!p->pinned)
+  {
+    p->pinned = true;
+    p->nextpinned = map->pinned;
+    map->pinned = p;
+    devmap_profile_ref (p);
+  }
+  pthread_mutex_unlock (&map->writelock);
+}
+
+bool edgex_devmap_set_adminstate
+  (edgex_devmap *map, const char *id, edgex_device_adminstate state)
+{
+  pthread_mutex_lock (&map->writelock);
+  edgex_devrec *old = devmap_find (map->current, id, false);
+  if (old && old->adminstate != state)
+  {
+    edgex_devrec **removed = malloc (sizeof (edgex_devrec *));
+    devmap_snapshot *snap = devmap_snapshot_copy (map->current);
+    edgex_devrec *e = devmap_rec_dup
+    (
+      old,
+      old->profile ? devmap_profile_ref ((devmap_profile *) old->profile) : NULL
+    );
+    e->adminstate = state;
+    devmap_unlink (snap, old);
+    devmap_link (snap, e);
+    removed[0] = old;
+    devmap_publish (map, snap, removed, 1, NULL);
+  }
+  pthread_mutex_unlock (&map->writelock);
+  return old != NULL;
+}
+
+edgex_devmap *edgex_devmap_alloc (void)
+{
+  edgex_devmap *map = malloc (sizeof (edgex_devmap));
+  memset (map, 0, sizeof (edgex_devmap));
+  map->current = devmap_snapshot_alloc ();
+  pthread_mutex_init (&map->writelock, NULL);
+  return map;
+}
+
+void edgex_devmap_free (edgex_devmap *map)
+{
+  devmap_snapshot *snap;
+  edgex_pmap_iter iter;
+  void *e;
+
+  if (map)
+  {
+    while ((snap = map->retired))
+    {
+      map->retired = snap->next;
+      devmap_snapshot_free (snap);
+    }
+    snap = map->current;
+    edgex_pmap_iter_init (&snap->byid, &iter);
+    while (edgex_pmap_next (&iter, &e))
+    {
+      edgex_devmap_release (e);
+    }
+    edgex_pmap_iter_init (&snap->profiles, &iter);
+    while (edgex_pmap_next (&iter, &e))
+    {
+      edgex_devmap_release_profile (&((devmap_profile *) e)->prof);
+    }
+    while (map->pinned)
+    {
+      devmap_profile *p = map->pinned;
+      map->pinned = p->nextpinned;
+      edgex_devmap_release_profile (&p->prof);
+    }
+    devmap_snapshot_free (snap);
+    while (map->hazards)
+    {
+      devmap_hazard *h = map->hazards;
+      map->hazards = h->next;
+      free (h);
+    }
+    pthread_mutex_destroy (&map->writelock);
+    free (map);
+  }
+}
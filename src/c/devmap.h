@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_DEVMAP_H_
+#define _EDGEX_DEVICE_DEVMAP_H_ 1
+
+#include "edgex/edgex.h"
+#include "state.h"
+
+/* The device registry. Devices are indexed by id and by name in an immutable
+ * snapshot, which writers replace. Snapshots share their unchanged parts, so
+ * a write costs O(log n) in the number of devices. Lookups take no locks: a
+ * reader publishes the snapshot it is using in a hazard pointer, and a
+ * snapshot is only reclaimed once no reader has it published.
+ *
+ * Devices are held as compact records rather than as edgex_device
+ * structures. Records returned by the lookup functions are reference counted
+ * and must be released with edgex_devmap_release. A record which is removed
+ * or replaced remains valid until its last reference is released. Records
+ * must not be modified; to change a device, obtain a copy of it with
+ * edgex_devmap_todevice and replace it.
+ *
+ * The registry also holds a single shared copy of each device profile, and
+ * every device in the registry refers to the shared copy of its profile.
+ * Profiles are likewise reference counted and immutable.
+ *
+ * The labels of device records are interned (see intern.h), as are the
+ * device resource names and resource operation objects of their profiles.
+ * Other strings, which are mostly unique to a device, are held in the
+ * record's allocation.
+ *
+ * Secondary indices list the devices which have a given command, profile,
+ * label or addressable (by name). They are maintained as part of each
+ * snapshot, so are always consistent with the primary indices.
+ */
+
+/* A device record is a single allocation. The service to which a device
+ * belongs is not recorded, as every device in the registry belongs to this
+ * service. The states hold edgex_device_adminstate and
+ * edgex_device_operatingstate values.
+ */
+
+typedef struct edgex_devrec
+{
+  const char *id;
+  const char *name;
+  const char *description;
+  edgex_deviceprofile *profile;
+  edgex_addressable addressable;
+  uint64_t origin;
+  uint64_t created;
+  uint64_t modified;
+  uint64_t lastConnected;
+  uint64_t lastReported;
+  uint32_t refs;
+  uint8_t adminstate;
+  uint8_t opstate;
+  uint16_t nlabels;
+  const char *labels[];
+} edgex_devrec;
+
+struct edgex_devmap;
+typedef struct edgex_devmap edgex_devmap;
+
+typedef enum
+{
+  DEVMAP_BYCOMMAND,
+  DEVMAP_BYPROFILE,
+  DEVMAP_BYLABEL,
+  DEVMAP_BYADDRESS
+} edgex_devmap_index;
+
+extern edgex_devmap *edgex_devmap_alloc (void);
+
+/* Free the registry and release its references. There must be no
+ * concurrent access.
+ */
+
+extern void edgex_devmap_free (edgex_devmap *map);
+
+/* Lookup functions. The record returned, if any, must be released. */
+
+extern edgex_devrec *edgex_devmap_device_byid
+  (edgex_devmap *map, const char *id);
+
+extern edgex_devrec *edgex_devmap_device_byname
+  (edgex_devmap *map, const char *name);
+
+/* Obtain all of the devices in the registry. Each must be released, and the
+ * array freed, by the caller. Returns NULL if there are no devices.
+ */
+
+extern edgex_devrec **edgex_devmap_copydevices
+  (edgex_devmap *map, uint32_t *ndevs);
+
+/* Obtain the devices listed under a key in one of the secondary indices, in
+ * no particular order. As for edgex_devmap_copydevices, each must be
+ * released and the array freed.
+ */
+
+extern edgex_devrec **edgex_devmap_copyindexed
+(
+  edgex_devmap *map,
+  edgex_devmap_index index,
+  const char *key,
+  uint32_t *ndevs
+);
+
+extern uint32_t edgex_devmap_size (edgex_devmap *map);
+
+/* Reference counting for records obtained from the registry. */
+
+extern void edgex_devmap_addref (edgex_devrec *dev);
+
+extern void edgex_devmap_release (edgex_devrec *dev);
+
+/* Create a device structure from a record, to be freed with
+ * edgex_device_free. Its strings and profile are copies; its service is NULL.
+ */
+
+extern edgex_device *edgex_devmap_todevice (const edgex_devrec *dev);
+
+/* Add a device, replacing any existing device with the same id or name. The
+ * device is converted to a record and freed, so it must not be part of a
+ * list. The device's profile becomes the shared profile of that name if
+ * there is none yet, or if it was modified more recently than the shared
+ * profile, in which case it replaces the shared profile as for
+ * edgex_devmap_replace_profile. Otherwise it is freed in favour of the
+ * shared profile.
+ */
+
+extern void edgex_devmap_replace (edgex_devmap *map, edgex_device *dev);
+
+/* Add copies of those devices in the list which are not already present
+ * (by name). Returns the number of devices added.
+ */
+
+extern uint32_t edgex_devmap_populate
+  (edgex_devmap *map, const edgex_device *devs);
+
+/* Set the administrative state of a device. The record is replaced under
+ * the write lock, so a concurrent update of the device is not lost. Returns
+ * false if there is no device with the given id.
+ */
+
+extern bool edgex_devmap_set_adminstate
+  (edgex_devmap *map, const char *id, edgex_device_adminstate state);
+
+/* Remove a device. The removed record is returned, and must be released by
+ * the caller.
+ */
+
+extern edgex_devrec *edgex_devmap_remove_byid
+  (edgex_devmap *map, const char *id);
+
+extern edgex_devrec *edgex_devmap_remove_byname
+  (edgex_devmap *map, const char *name);
+
+/* Profile lookup. The profile returned, if any, must be released. */
+
+extern edgex_deviceprofile *edgex_devmap_profile
+  (edgex_devmap *map, const char *name);
+
+/* Obtain all of the profiles in the registry. Each must be released, and the
+ * array freed, by the caller. Returns NULL if there are no profiles.
+ */
+
+extern edgex_deviceprofile **edgex_devmap_copyprofiles
+  (edgex_devmap *map, uint32_t *nprofs);
+
+extern void edgex_devmap_release_profile (edgex_deviceprofile *dp);
+
+/* Keep a profile obtained from the registry until the registry is freed,
+ * for callers which cannot release it. A profile is only kept once,
+ * however often it is pinned.
+ */
+
+extern void edgex_devmap_pin_profile
+  (edgex_devmap *map, edgex_deviceprofile *dp);
+
+extern uint32_t edgex_devmap_nprofiles (edgex_devmap *map);
+
+/* Add a profile if there is none of that name. The registry takes ownership
+ * of the profile, and a reference to the shared profile is returned.
+ */
+
+extern edgex_deviceprofile *edgex_devmap_add_profile
+  (edgex_devmap *map, edgex_deviceprofile *dp);
+
+/* Add or replace a profile. Devices which use an existing profile of the
+ * same name are switched to the new one.
+ */
+
+extern void edgex_devmap_replace_profile
+  (edgex_devmap *map, edgex_deviceprofile *dp);
+
+#endif
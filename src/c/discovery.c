@@ -20,6 +20,7 @@
 int edgex_device_handler_discovery
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -37,18 +38,22 @@ int edgex_device_handler_discovery
 
   if (!svc->config.device.discovery)
   {
-    *reply = strdup ("Discovery disabled by configuration\n");
+    edgex_rest_request_reply_static
+      (req, "Discovery disabled by configuration\n", NULL);
     return MHD_HTTP_SERVICE_UNAVAILABLE;
   }
 
   if (pthread_mutex_trylock (&svc->discolock) == 0)
   {
-    thpool_add_work (svc->thpool, edgex_device_handler_do_discovery, svc);
+    edgex_metrics_add_work
+    (
+      svc->thpool, svc->stats.thqueue, edgex_device_handler_do_discovery, svc
+    );
     pthread_mutex_unlock (&svc->discolock);
   }
   // else discovery was already running; ignore this request
 
-  *reply = strdup ("Running discovery\n");
+  edgex_rest_request_reply_static (req, "Running discovery\n", NULL);
   return MHD_HTTP_OK;
 }
 
@@ -10,12 +10,14 @@
 #define _EDGEX_DEVICE_DISCOVERY_H_ 1
 
 #include "edgex/devsdk.h"
+#include "rest_server.h"
 
 #include <stddef.h>
 
 extern int edgex_device_handler_discovery
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
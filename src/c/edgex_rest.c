@@ -1050,19 +1050,23 @@ static JSON_Value *deviceservice_write_name (const edgex_deviceservice *e)
 
 edgex_deviceservice *edgex_deviceservice_dup (const edgex_deviceservice *e)
 {
-  edgex_deviceservice *res = malloc (sizeof (edgex_deviceservice));
-  res->name = strdup (e->name);
-  res->id = strdup (e->id);
-  res->description = strdup (e->description);
-  res->labels = edgex_strings_dup (e->labels);
-  res->addressable = edgex_addressable_dup (e->addressable);
-  res->adminState = strdup (e->adminState);
-  res->operatingState = strdup (e->operatingState);
-  res->origin = e->origin;
-  res->created = e->created;
-  res->modified = e->modified;
-  res->lastConnected = e->lastConnected;
-  res->lastReported = e->lastReported;
+  edgex_deviceservice *res = NULL;
+  if (e)
+  {
+    res = malloc (sizeof (edgex_deviceservice));
+    res->name = strdup (e->name);
+    res->id = strdup (e->id);
+    res->description = strdup (e->description);
+    res->labels = edgex_strings_dup (e->labels);
+    res->addressable = edgex_addressable_dup (e->addressable);
+    res->adminState = strdup (e->adminState);
+    res->operatingState = strdup (e->operatingState);
+    res->origin = e->origin;
+    res->created = e->created;
+    res->modified = e->modified;
+    res->lastConnected = e->lastConnected;
+    res->lastReported = e->lastReported;
+  }
   return res;
 }
 
@@ -1116,16 +1120,19 @@ edgex_deviceprofile *edgex_deviceprofile_dup (edgex_deviceprofile *dp)
 
 void edgex_deviceprofile_free (edgex_deviceprofile *e)
 {
-  free (e->id);
-  free (e->name);
-  free (e->description);
-  free (e->manufacturer);
-  free (e->model);
-  edgex_strings_free (e->labels);
-  deviceobject_free (e->device_resources);
-  command_free (e->commands);
-  profileresource_free (e->resources);
-  free (e);
+  if (e)
+  {
+    free (e->id);
+    free (e->name);
+    free (e->description);
+    free (e->manufacturer);
+    free (e->model);
+    edgex_strings_free (e->labels);
+    deviceobject_free (e->device_resources);
+    command_free (e->commands);
+    profileresource_free (e->resources);
+    free (e);
+  }
 }
 
 edgex_deviceservice *edgex_deviceservice_read (const char *json)
@@ -11,5 +11,7 @@
 
 uint64_t edgex_device_millitime()
 {
-  return (uint64_t)time (NULL) * EDGEX_MILLIS;
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * EDGEX_MILLIS + ts.tv_nsec / 1000000;
 }
@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "eventhub.h"
+#include "edgex_rest.h"
+
+#define EVENTHUB_DEFAULT_QLEN 64
+#define EVENTHUB_SEGMENTS 3
+
+/* Serialized events are shared between subscribers' queues */
+
+typedef struct hub_msg
+{
+  uint32_t refs;
+  size_t len;
+  char *json;
+} hub_msg;
+
+/* Each event is written to a subscriber as a frame of three segments: a
+ * prefix, the event and a suffix. Keepalives are frames without an event.
+ * The frame being written is given by seg and off; seg is EVENTHUB_SEGMENTS
+ * when no frame is in progress.
+ */
+
+typedef struct hub_sub
+{
+  struct edgex_eventhub *hub;
+  edgex_rest_stream *stream;
+  edgex_strings *devices;
+  edgex_strings *resources;
+  bool sse;
+  hub_msg **queue;
+  uint32_t qhead;
+  uint32_t qcount;
+  hub_msg *current;
+  const char *frame[EVENTHUB_SEGMENTS];
+  size_t framelen[EVENTHUB_SEGMENTS];
+  uint32_t seg;
+  size_t off;
+  bool keepalive;
+  bool dropped;
+  bool closed;
+  pthread_mutex_t lock;
+  struct hub_sub *next;
+} hub_sub;
+
+/* The hub lock protects the list of subscribers and their dropped and closed
+ * flags; each subscriber's lock protects its queue. Streams are notified
+ * under the hub lock, so that a subscriber is never notified after it has
+ * been unlinked by the stream's free function.
+ */
+
+struct edgex_eventhub
+{
+  iot_logging_client *lc;
+  uint32_t maxsubs;
+  uint32_t qlen;
+  uint32_t nsubs;
+  bool closed;
+  hub_sub *subs;
+  edgex_metric *subscribers;
+  edgex_metric *events;
+  edgex_metric *dropped;
+  pthread_mutex_t lock;
+};
+
+static edgex_metric *hub_metric
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help
+)
+{
+  return edgex_metrics_family_get
+    (edgex_metrics_family_create (m, type, name, help, NULL, false), NULL);
+}
+
+edgex_eventhub *edgex_eventhub_create
+(
+  iot_logging_client *lc,
+  uint32_t maxsubs,
+  uint32_t qlen,
+  edgex_metrics *metrics
+)
+{
+  edgex_eventhub *hub = malloc (sizeof (edgex_eventhub));
+
+  memset (hub, 0, sizeof (edgex_eventhub));
+  hub->lc = lc;
+  hub->maxsubs = maxsubs;
+  hub->qlen = qlen ? qlen : EVENTHUB_DEFAULT_QLEN;
+  pthread_mutex_init (&hub->lock, NULL);
+  hub->subscribers = hub_metric
+  (
+    metrics, EDGEX_METRICS_GAUGE, "edgex_subscribers",
+    "Clients subscribed to events"
+  );
+  hub->events = hub_metric
+  (
+    metrics, EDGEX_METRICS_COUNTER, "edgex_subscriber_events_total",
+    "Events queued for subscribers"
+  );
+  hub->dropped = hub_metric
+  (
+    metrics, EDGEX_METRICS_COUNTER, "edgex_subscribers_dropped_total",
+    "Subscribers dropped for not keeping up with events"
+  );
+  return hub;
+}
+
+static edgex_strings *hub_parselist (const char *list)
+{
+  edgex_strings *result = NULL;
+
+  if (list)
+  {
+    char *ctx;
+    char *copy = strdup (list);
+    char *s = strtok_r (copy, ",", &ctx);
+    while (s)
+    {
+      edgex_strings *elem = malloc (sizeof (edgex_strings));
+      elem->str = strdup (s);
+      elem->next = result;
+      result = elem;
+      s = strtok_r (NULL, ",", &ctx);
+    }
+    free (copy);
+  }
+  return result;
+}
+
+static bool hub_match (const edgex_strings *list, const char *name)
+{
+  if (list == NULL)
+  {
+    return true;
+  }
+  for (; list; list = list->next)
+  {
+    if (strcmp (list->str, name) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static hub_msg *hub_msg_create
+  (const char *device, uint64_t origin, const edgex_reading *readings)
+{
+  edgex_event event;
+  hub_msg *msg = malloc (sizeof (hub_msg));
+
+  memset (&event, 0, sizeof (edgex_event));
+  event.device = (char *) device;
+  event.origin = origin;
+  event.readings = (edgex_reading *) readings;
+  msg->json = edgex_event_write (&event, true);
+  msg->len = strlen (msg->json);
+  msg->refs = 1;
+  return msg;
+}
+
+/* Create a message holding only the readings selected by a filter. Returns
+ * NULL if there are none.
+ */
+
+static hub_msg *hub_msg_filtered
+(
+  const char *device,
+  uint64_t origin,
+  const edgex_reading *readings,
+  const edgex_strings *filter
+)
+{
+  const edgex_reading *r;
+  edgex_reading *rdgs;
+  hub_msg *msg = NULL;
+  uint32_t n = 0;
+
+  for (r = readings; r; r = r->next)
+  {
+    n += hub_match (filter, r->name) ? 1 : 0;
+  }
+  if (n)
+  {
+    rdgs = malloc (n * sizeof (edgex_reading));
+    n = 0;
+    for (r = readings; r; r = r->next)
+    {
+      if (hub_match (filter, r->name))
+      {
+        rdgs[n] = *r;
+        rdgs[n].next = rdgs + n + 1;
+        n++;
+      }
+    }
+    rdgs[n - 1].next = NULL;
+    msg = hub_msg_create (device, origin, rdgs);
+    free (rdgs);
+  }
+  return msg;
+}
+
+static void hub_msg_unref (hub_msg *msg)
+{
+  if (__atomic_sub_fetch (&msg->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    free (msg->json);
+    free (msg);
+  }
+}
+
+static void hub_frame (hub_sub *sub, hub_msg *msg)
+{
+  sub->current = msg;
+  if (msg)
+  {
+    sub->frame[0] = sub->sse ? "data: " : "";
+    sub->frame[1] = msg->json;
+    sub->frame[2] = sub->sse ? "\n\n" : "\n";
+  }
+  else
+  {
+    sub->frame[0] = sub->sse ? ":\n\n" : "\n";
+    sub->frame[1] = "";
+    sub->frame[2] = "";
+  }
+  sub->framelen[0] = strlen (sub->frame[0]);
+  sub->framelen[1] = msg ? msg->len : 0;
+  sub->framelen[2] = strlen (sub->frame[2]);
+  sub->seg = 0;
+  sub->off = 0;
+}
+
+static size_t hub_copy (hub_sub *sub, char *buf, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max && sub->seg < EVENTHUB_SEGMENTS)
+  {
+    size_t len = sub->framelen[sub->seg] - sub->off;
+    if (len > max - n)
+    {
+      len = max - n;
+    }
+    memcpy (buf + n, sub->frame[sub->seg] + sub->off, len);
+    n += len;
+    sub->off += len;
+    if (sub->off == sub->framelen[sub->seg])
+    {
+      sub->seg++;
+      sub->off = 0;
+    }
+  }
+  return n;
+}
+
+static ssize_t hub_read (void *cls, char *buf, size_t max)
+{
+  hub_sub *sub = (hub_sub *) cls;
+  size_t n = 0;
+  bool end = false;
+
+  pthread_mutex_lock (&sub->lock);
+  while (n < max)
+  {
+    if (sub->seg < EVENTHUB_SEGMENTS)
+    {
+      n += hub_copy (sub, buf + n, max - n);
+      continue;
+    }
+    if (sub->current)
+    {
+      hub_msg_unref (sub->current);
+      sub->current = NULL;
+    }
+    if (sub->closed || sub->dropped)
+    {
+      end = true;
+      break;
+    }
+    if (sub->qcount)
+    {
+      hub_frame (sub, sub->queue[sub->qhead]);
+      sub->qhead = (sub->qhead + 1) % sub->hub->qlen;
+      sub->qcount--;
+      sub->keepalive = false;
+    }
+    else if (sub->keepalive)
+    {
+      hub_frame (sub, NULL);
+      sub->keepalive = false;
+    }
+    else
+    {
+      break;
+    }
+  }
+  pthread_mutex_unlock (&sub->lock);
+
+  return (n == 0 && end) ? -1 : (ssize_t) n;
+}
+
+static void hub_subfree (void *cls)
+{
+  hub_sub *sub = (hub_sub *) cls;
+  edgex_eventhub *hub = sub->hub;
+
+  pthread_mutex_lock (&hub->lock);
+  for (hub_sub **p = &hub->subs; *p; p = &(*p)->next)
+  {
+    if (*p == sub)
+    {
+      *p = sub->next;
+      break;
+    }
+  }
+  __atomic_sub_fetch (&hub->nsubs, 1, __ATOMIC_RELAXED);
+  edgex_metric_add (hub->subscribers, -1);
+  pthread_mutex_unlock (&hub->lock);
+
+  while (sub->qcount)
+  {
+    hub_msg_unref (sub->queue[sub->qhead]);
+    sub->qhead = (sub->qhead + 1) % hub->qlen;
+    sub->qcount--;
+  }
+  if (sub->current)
+  {
+    hub_msg_unref (sub->current);
+  }
+  edgex_strings_free (sub->devices);
+  edgex_strings_free (sub->resources);
+  pthread_mutex_destroy (&sub->lock);
+  free (sub->queue);
+  free (sub);
+}
+
+bool edgex_eventhub_subscribe
+(
+  edgex_eventhub *hub,
+  edgex_rest_request *req,
+  const char *devices,
+  const char *resources,
+  bool sse
+)
+{
+  hub_sub *sub = NULL;
+
+  pthread_mutex_lock (&hub->lock);
+  if (hub->closed)
+  {
+    iot_log_error (hub->lc, "Service is stopping, subscription refused");
+  }
+  else if (hub->maxsubs && hub->nsubs >= hub->maxsubs)
+  {
+    iot_log_error
+    (
+      hub->lc, "MaxSubscribers (%u) reached, subscription refused",
+      hub->maxsubs
+    );
+  }
+  else
+  {
+    sub = malloc (sizeof (hub_sub));
+    memset (sub, 0, sizeof (hub_sub));
+    sub->hub = hub;
+    sub->sse = sse;
+    sub->seg = EVENTHUB_SEGMENTS;
+    sub->queue = malloc (hub->qlen * sizeof (hub_msg *));
+    pthread_mutex_init (&sub->lock, NULL);
+    sub->stream = edgex_rest_request_stream
+    (
+      req, sse ? "text/event-stream" : "application/x-ndjson",
+      hub_read, hub_subfree, sub
+    );
+    if (sub->stream)
+    {
+      sub->devices = hub_parselist (devices);
+      sub->resources = hub_parselist (resources);
+      sub->next = hub->subs;
+      hub->subs = sub;
+      __atomic_add_fetch (&hub->nsubs, 1, __ATOMIC_RELAXED);
+      edgex_metric_add (hub->subscribers, 1);
+    }
+    else
+    {
+      pthread_mutex_destroy (&sub->lock);
+      free (sub->queue);
+      free (sub);
+      sub = NULL;
+    }
+  }
+  pthread_mutex_unlock (&hub->lock);
+  return (sub != NULL);
+}
+
+/* Queue a message for a subscriber, taking a reference to it, or drop the
+ * subscriber if its queue is full. Called under the hub lock.
+ */
+
+static void hub_enqueue (edgex_eventhub *hub, hub_sub *sub, hub_msg *msg)
+{
+  pthread_mutex_lock (&sub->lock);
+  if (sub->qcount == hub->qlen)
+  {
+    sub->dropped = true;
+  }
+  else
+  {
+    __atomic_add_fetch (&msg->refs, 1, __ATOMIC_RELAXED);
+    sub->queue[(sub->qhead + sub->qcount) % hub->qlen] = msg;
+    sub->qcount++;
+  }
+  pthread_mutex_unlock (&sub->lock);
+
+  if (sub->dropped)
+  {
+    iot_log_info
+      (hub->lc, "Subscriber queue full (%u events), dropping", hub->qlen);
+    edgex_metric_add (hub->dropped, 1);
+  }
+  else
+  {
+    edgex_metric_add (hub->events, 1);
+  }
+  edgex_rest_stream_notify (sub->stream);
+}
+
+void edgex_eventhub_publish
+(
+  edgex_eventhub *hub,
+  const char *device,
+  uint64_t origin,
+  const edgex_reading *readings
+)
+{
+  hub_msg *all = NULL;
+
+  if (hub == NULL || __atomic_load_n (&hub->nsubs, __ATOMIC_RELAXED) == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock (&hub->lock);
+  for (hub_sub *sub = hub->subs; sub; sub = sub->next)
+  {
+    if (sub->dropped || sub->closed || !hub_match (sub->devices, device))
+    {
+      continue;
+    }
+    if (sub->resources)
+    {
+      hub_msg *msg =
+        hub_msg_filtered (device, origin, readings, sub->resources);
+      if (msg)
+      {
+        hub_enqueue (hub, sub, msg);
+        hub_msg_unref (msg);
+      }
+    }
+    else
+    {
+      if (all == NULL)
+      {
+        all = hub_msg_create (device, origin, readings);
+      }
+      hub_enqueue (hub, sub, all);
+    }
+  }
+  pthread_mutex_unlock (&hub->lock);
+
+  if (all)
+  {
+    hub_msg_unref (all);
+  }
+}
+
+void edgex_eventhub_keepalive (edgex_eventhub *hub)
+{
+  pthread_mutex_lock (&hub->lock);
+  for (hub_sub *sub = hub->subs; sub; sub = sub->next)
+  {
+    bool idle;
+    pthread_mutex_lock (&sub->lock);
+    idle = (sub->qcount == 0);
+    sub->keepalive = idle;
+    pthread_mutex_unlock (&sub->lock);
+    if (idle)
+    {
+      edgex_rest_stream_notify (sub->stream);
+    }
+  }
+  pthread_mutex_unlock (&hub->lock);
+}
+
+void edgex_eventhub_close (edgex_eventhub *hub)
+{
+  pthread_mutex_lock (&hub->lock);
+  hub->closed = true;
+  for (hub_sub *sub = hub->subs; sub; sub = sub->next)
+  {
+    pthread_mutex_lock (&sub->lock);
+    sub->closed = true;
+    pthread_mutex_unlock (&sub->lock);
+    edgex_rest_stream_notify (sub->stream);
+  }
+  pthread_mutex_unlock (&hub->lock);
+}
+
+void edgex_eventhub_free (edgex_eventhub *hub)
+{
+  if (hub)
+  {
+    pthread_mutex_destroy (&hub->lock);
+    free (hub);
+  }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_EVENTHUB_H_
+#define _EDGEX_DEVICE_EVENTHUB_H_ 1
+
+#include "edgex/edgex.h"
+#include "edgex/edgex_logging.h"
+#include "rest_server.h"
+#include "metrics.h"
+
+/* Event subscriptions. Each event published to the hub is streamed to the
+ * subscribers whose filters it matches, either as server-sent events or as
+ * lines of JSON. An event is serialized once and the text shared between
+ * subscribers, unless a subscriber's resource filter selects only some of
+ * its readings.
+ *
+ * Each subscriber has a queue of qlen events. A subscriber whose queue is
+ * full when an event is published is dropped: its stream is ended once any
+ * partly written event is complete, so that publishers never wait for slow
+ * consumers. A maxsubs of zero does not limit the number of subscribers.
+ */
+
+struct edgex_eventhub;
+typedef struct edgex_eventhub edgex_eventhub;
+
+extern edgex_eventhub *edgex_eventhub_create
+(
+  iot_logging_client *lc,
+  uint32_t maxsubs,
+  uint32_t qlen,
+  edgex_metrics *metrics
+);
+
+/* Stream events to the client of a request. The devices and resources are
+ * comma-separated lists of names to accept, or NULL to accept any. Returns
+ * false if the subscriber cannot be added.
+ */
+
+extern bool edgex_eventhub_subscribe
+(
+  edgex_eventhub *hub,
+  edgex_rest_request *req,
+  const char *devices,
+  const char *resources,
+  bool sse
+);
+
+/* Publish an event. This does nothing if there are no subscribers. */
+
+extern void edgex_eventhub_publish
+(
+  edgex_eventhub *hub,
+  const char *device,
+  uint64_t origin,
+  const edgex_reading *readings
+);
+
+/* Send a keepalive to subscribers with nothing queued, so that clients
+ * which have gone away are noticed.
+ */
+
+extern void edgex_eventhub_keepalive (edgex_eventhub *hub);
+
+/* End all subscriptions, discarding any queued events, and refuse further
+ * ones. This must be called before the REST server is destroyed, as that
+ * waits for streams to end.
+ */
+
+extern void edgex_eventhub_close (edgex_eventhub *hub);
+
+extern void edgex_eventhub_free (edgex_eventhub *hub);
+
+#endif
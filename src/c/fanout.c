@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "fanout.h"
+
+struct edgex_fanout
+{
+  edgex_fanout_fn fn;
+  void *ctx;
+  threadpool pool;
+  edgex_metric *depth;
+  uint32_t nitems;
+  uint32_t maxpar;
+  uint32_t next;
+  uint32_t running;
+  uint32_t workers;
+  uint32_t refs;
+  bool stoponfail;
+  bool stopped;
+  bool paused;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Called with the lock held, on completion of an item */
+
+static void fanout_itemdone (edgex_fanout *f, bool ok)
+{
+  f->running--;
+  if (!ok && f->stoponfail)
+  {
+    f->stopped = true;
+  }
+  pthread_cond_broadcast (&f->cond);
+}
+
+static bool fanout_claimable (const edgex_fanout *f)
+{
+  return
+  (
+    !f->stopped && !f->paused &&
+    f->next < f->nitems && f->running < f->maxpar
+  );
+}
+
+static void fanout_runitems (edgex_fanout *f)
+{
+  uint32_t i;
+  edgex_fanout_result res;
+
+  pthread_mutex_lock (&f->lock);
+  while (fanout_claimable (f))
+  {
+    i = f->next++;
+    f->running++;
+    pthread_mutex_unlock (&f->lock);
+    res = f->fn (f->ctx, i, f);
+    pthread_mutex_lock (&f->lock);
+    if (res != EDGEX_FANOUT_PENDING)
+    {
+      fanout_itemdone (f, res == EDGEX_FANOUT_OK);
+    }
+  }
+  pthread_mutex_unlock (&f->lock);
+}
+
+static void fanout_unref (edgex_fanout *f)
+{
+  pthread_mutex_lock (&f->lock);
+  bool last = (--f->refs == 0);
+  pthread_mutex_unlock (&f->lock);
+  if (last)
+  {
+    pthread_cond_destroy (&f->cond);
+    pthread_mutex_destroy (&f->lock);
+    free (f);
+  }
+}
+
+static void fanout_worker (void *p)
+{
+  edgex_fanout *f = (edgex_fanout *) p;
+  fanout_runitems (f);
+  pthread_mutex_lock (&f->lock);
+  f->workers--;
+  pthread_mutex_unlock (&f->lock);
+  fanout_unref (f);
+}
+
+/* Called with the lock held. Workers hold a reference each. */
+
+static void fanout_addworkers (edgex_fanout *f, uint32_t nworkers)
+{
+  f->workers += nworkers;
+  f->refs += nworkers;
+  for (uint32_t i = 0; i < nworkers; i++)
+  {
+    edgex_metrics_add_work (f->pool, f->depth, fanout_worker, f);
+  }
+}
+
+static edgex_fanout *fanout_create
+(
+  threadpool pool,
+  edgex_metric *depth,
+  uint32_t nitems,
+  uint32_t maxpar,
+  uint32_t nworkers,
+  bool stoponfail,
+  edgex_fanout_fn fn,
+  void *ctx
+)
+{
+  edgex_fanout *f = malloc (sizeof (edgex_fanout));
+  memset (f, 0, sizeof (edgex_fanout));
+  f->fn = fn;
+  f->ctx = ctx;
+  f->pool = pool;
+  f->depth = depth;
+  f->nitems = nitems;
+  f->maxpar = maxpar ? maxpar : 1;
+  f->stoponfail = stoponfail;
+  f->refs = 1;
+  pthread_mutex_init (&f->lock, NULL);
+  pthread_cond_init (&f->cond, NULL);
+  pthread_mutex_lock (&f->lock);
+  fanout_addworkers (f, nworkers);
+  pthread_mutex_unlock (&f->lock);
+  return f;
+}
+
+edgex_fanout *edgex_fanout_start
+(
+  threadpool pool,
+  edgex_metric *depth,
+  uint32_t nitems,
+  uint32_t maxpar,
+  bool stoponfail,
+  edgex_fanout_fn fn,
+  void *ctx
+)
+{
+  uint32_t nworkers = (maxpar < nitems) ? maxpar : nitems;
+  return fanout_create
+    (pool, depth, nitems, maxpar, nworkers, stoponfail, fn, ctx);
+}
+
+void edgex_fanout_done (edgex_fanout *f, bool ok)
+{
+  /* Hold a reference while claiming further items, as a waiter may release
+   * the fanout as soon as the item is marked done.
+   */
+  pthread_mutex_lock (&f->lock);
+  fanout_itemdone (f, ok);
+  f->refs++;
+  pthread_mutex_unlock (&f->lock);
+  fanout_runitems (f);
+  fanout_unref (f);
+}
+
+bool edgex_fanout_wait (edgex_fanout *f)
+{
+  bool result;
+
+  pthread_mutex_lock (&f->lock);
+  while (true)
+  {
+    if (fanout_claimable (f))
+    {
+      pthread_mutex_unlock (&f->lock);
+      fanout_runitems (f);
+      pthread_mutex_lock (&f->lock);
+    }
+    else if (f->running)
+    {
+      pthread_cond_wait (&f->cond, &f->lock);
+    }
+    else
+    {
+      break;
+    }
+  }
+  result = (f->next == f->nitems);
+  pthread_mutex_unlock (&f->lock);
+  return result;
+}
+
+void edgex_fanout_stop (edgex_fanout *f)
+{
+  pthread_mutex_lock (&f->lock);
+  f->stopped = true;
+  pthread_mutex_unlock (&f->lock);
+}
+
+void edgex_fanout_pause (edgex_fanout *f)
+{
+  pthread_mutex_lock (&f->lock);
+  f->paused = true;
+  pthread_mutex_unlock (&f->lock);
+}
+
+void edgex_fanout_resume (edgex_fanout *f)
+{
+  pthread_mutex_lock (&f->lock);
+  if (f->paused)
+  {
+    /* Workers which found nothing to claim have returned to the pool, so
+     * replace them.
+     */
+    uint32_t want = f->nitems - f->next;
+    uint32_t idle = f->maxpar - f->running;
+    want = (idle < want) ? idle : want;
+    f->paused = false;
+    if (!f->stopped && want > f->workers)
+    {
+      fanout_addworkers (f, want - f->workers);
+    }
+  }
+  pthread_mutex_unlock (&f->lock);
+}
+
+void edgex_fanout_free (edgex_fanout *f)
+{
+  edgex_fanout_stop (f);
+  fanout_unref (f);
+}
+
+bool edgex_fanout_run
+(
+  threadpool pool,
+  edgex_metric *depth,
+  uint32_t nitems,
+  uint32_t maxpar,
+  bool stoponfail,
+  edgex_fanout_fn fn,
+  void *ctx
+)
+{
+  /* The calling thread counts towards maxpar */
+
+  uint32_t nworkers = (maxpar < nitems) ? maxpar : nitems;
+  if (nworkers)
+  {
+    nworkers--;
+  }
+  edgex_fanout *f = fanout_create
+    (pool, depth, nitems, maxpar, nworkers, stoponfail, fn, ctx);
+  bool result = edgex_fanout_wait (f);
+  edgex_fanout_free (f);
+  return result;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_FANOUT_H_
+#define _EDGEX_DEVICE_FANOUT_H_ 1
+
+#include "edgex/os.h"
+#include "thpool.h"
+#include "metrics.h"
+
+/* A fanout runs a fixed number of independent work items on a thread pool.
+ * Items are claimed in index order, and at most maxpar items are in progress
+ * at any time. A thread which waits for completion also runs items, so
+ * progress is made even if every thread in the pool is busy.
+ *
+ * An item may complete asynchronously, in which case its function returns
+ * EDGEX_FANOUT_PENDING and edgex_fanout_done is called when it has finished.
+ * The thread calling edgex_fanout_done goes on to run further items.
+ *
+ * Work added to the pool is counted in the depth gauge, if one is given,
+ * until a thread takes it up.
+ */
+
+struct edgex_fanout;
+typedef struct edgex_fanout edgex_fanout;
+
+typedef enum
+{
+  EDGEX_FANOUT_OK,
+  EDGEX_FANOUT_FAILED,
+  EDGEX_FANOUT_PENDING
+} edgex_fanout_result;
+
+typedef edgex_fanout_result (*edgex_fanout_fn)
+  (void *ctx, uint32_t index, edgex_fanout *f);
+
+extern edgex_fanout *edgex_fanout_start
+(
+  threadpool pool,
+  edgex_metric *depth,
+  uint32_t nitems,
+  uint32_t maxpar,
+  bool stoponfail,
+  edgex_fanout_fn fn,
+  void *ctx
+);
+
+/* Completion of an item for which EDGEX_FANOUT_PENDING was returned. */
+
+extern void edgex_fanout_done (edgex_fanout *f, bool ok);
+
+/* Run items in the calling thread until none are left, then wait for items
+ * running elsewhere to complete. Returns false if the fanout was stopped
+ * before all items were claimed.
+ */
+
+extern bool edgex_fanout_wait (edgex_fanout *f);
+
+/* Prevent any further items from being claimed. */
+
+extern void edgex_fanout_stop (edgex_fanout *f);
+
+/* Stop claiming items until edgex_fanout_resume is called, eg while a
+ * consumer of the results catches up. Items in progress are unaffected.
+ */
+
+extern void edgex_fanout_pause (edgex_fanout *f);
+
+extern void edgex_fanout_resume (edgex_fanout *f);
+
+/* Release the caller's reference. Must follow edgex_fanout_wait. */
+
+extern void edgex_fanout_free (edgex_fanout *f);
+
+/* Run all items and wait for them to complete. The calling thread is one of
+ * the maxpar threads used.
+ */
+
+extern bool edgex_fanout_run
+(
+  threadpool pool,
+  edgex_metric *depth,
+  uint32_t nitems,
+  uint32_t maxpar,
+  bool stoponfail,
+  edgex_fanout_fn fn,
+  void *ctx
+);
+
+#endif
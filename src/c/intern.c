@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "intern.h"
+
+/* The table is split into independently locked shards, selected by hash, so
+ * that threads interning different strings rarely contend. Each shard is a
+ * chained hash table which doubles in size as it fills. Strings are stored
+ * inline in their nodes, and nodes are never moved or freed, so the pointers
+ * handed out remain valid.
+ */
+
+#define INTERN_SHARDS 16
+#define INTERN_INITIAL 64
+
+typedef struct intern_node
+{
+  struct intern_node *next;
+  uint32_t hash;
+  char str[];
+} intern_node;
+
+typedef struct intern_shard
+{
+  pthread_mutex_t lock;
+  intern_node **buckets;
+  uint32_t nbuckets;
+  uint32_t nnodes;
+} intern_shard;
+
+static intern_shard shards[INTERN_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void intern_init (void)
+{
+  for (unsigned i = 0; i < INTERN_SHARDS; i++)
+  {
+    pthread_mutex_init (&shards[i].lock, NULL);
+    shards[i].nbuckets = INTERN_INITIAL;
+    shards[i].buckets = calloc (INTERN_INITIAL, sizeof (intern_node *));
+  }
+}
+
+/* FNV-1a */
+
+static uint32_t intern_hash (const char *str, size_t *len)
+{
+  uint32_t hash = 2166136261u;
+  const char *s = str;
+  while (*s)
+  {
+    hash = (hash ^ (unsigned char) *s++) * 16777619u;
+  }
+  *len = s - str;
+  return hash;
+}
+
+static void intern_grow (intern_shard *sh)
+{
+  uint32_t n = sh->nbuckets * 2;
+  intern_node **buckets = calloc (n, sizeof (intern_node *));
+  for (uint32_t i = 0; i < sh->nbuckets; i++)
+  {
+    intern_node *node = sh->buckets[i];
+    while (node)
+    {
+      intern_node *next = node->next;
+      uint32_t b = (node->hash / INTERN_SHARDS) & (n - 1);
+      node->next = buckets[b];
+      buckets[b] = node;
+      node = next;
+    }
+  }
+  free (sh->buckets);
+  sh->buckets = buckets;
+  sh->nbuckets = n;
+}
+
+const char *edgex_intern (const char *str)
+{
+  size_t len;
+  uint32_t hash;
+  intern_shard *sh;
+  intern_node *node;
+
+  if (str == NULL)
+  {
+    return NULL;
+  }
+  pthread_once (&shards_once, intern_init);
+  hash = intern_hash (str, &len);
+  sh = &shards[hash % INTERN_SHARDS];
+
+  pthread_mutex_lock (&sh->lock);
+  node = sh->buckets[(hash / INTERN_SHARDS) & (sh->nbuckets - 1)];
+  while (node && (node->hash != hash || strcmp (node->str, str)))
+  {
+    node = node->next;
+  }
+  if (node == NULL)
+  {
+    if (sh->nnodes >= sh->nbuckets)
+    {
+      intern_grow (sh);
+    }
+    uint32_t b = (hash / INTERN_SHARDS) & (sh->nbuckets - 1);
+    node = malloc (sizeof (intern_node) + len + 1);
+    node->hash = hash;
+    memcpy (node->str, str, len + 1);
+    node->next = sh->buckets[b];
+    sh->buckets[b] = node;
+    sh->nnodes++;
+  }
+  pthread_mutex_unlock (&sh->lock);
+  return node->str;
+}
+
+void edgex_intern_replace (char **str)
+{
+  char *orig = *str;
+  *str = (char *) edgex_intern (orig);
+  free (orig);
+}
+
+uint32_t edgex_intern_count (void)
+{
+  uint32_t result = 0;
+  pthread_once (&shards_once, intern_init);
+  for (unsigned i = 0; i < INTERN_SHARDS; i++)
+  {
+    pthread_mutex_lock (&shards[i].lock);
+    result += shards[i].nnodes;
+    pthread_mutex_unlock (&shards[i].lock);
+  }
+  return result;
+}
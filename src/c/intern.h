@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_INTERN_H_
+#define _EDGEX_DEVICE_INTERN_H_ 1
+
+#include "edgex/os.h"
+
+/* String interning. edgex_intern returns the single stored copy of a string,
+ * adding it if it is not present, so that equal interned strings are
+ * identical pointers. Interned strings are never freed, and must not be
+ * modified or passed to free(). NULL is returned unchanged.
+ */
+
+extern const char *edgex_intern (const char *str);
+
+/* Replace an allocated string by its interned copy, freeing the original. */
+
+extern void edgex_intern_replace (char **str);
+
+/* The number of strings interned. */
+
+extern uint32_t edgex_intern_count (void);
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 /* Based on rxi's type-safe hashmap implementation */
 
@@ -12,21 +14,75 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+/* Control byte values. A full slot holds the low seven bits of its node's
+ * hash, so has the top bit clear. Slots are examined in aligned groups of
+ * eight, which are probed in triangular order. A lookup can stop at a group
+ * which contains an empty slot, since an insertion would never have passed
+ * over it.
+ *
+ * Control bytes are stored with the top bit inverted, so that a zeroed
+ * group is empty. Tables are allocated with calloc, which for large tables
+ * defers the clearing of their memory until it is first used.
+ */
+
+#define MAP_EMPTY 0x80
+#define MAP_DELETED 0xfe
+#define MAP_STORED(c) ((unsigned char) ((c) ^ 0x80))
+#define MAP_GROUP 8
+#define MAP_LSBS 0x0101010101010101ull
+#define MAP_MSBS 0x8080808080808080ull
+
+/* The number of groups of the previous table moved per insertion during a
+ * resize. A table grows when it is 7/8 full and at least doubles, so moving
+ * one group per insertion would suffice to finish before the new table
+ * fills. Removals do not move nodes, as they may be made while iterating:
+ * a node moved into the new table could land in a slot already visited.
+ */
+
+#define MAP_MIGRATE_STEP 2
+
 typedef struct edgex_map_node
 {
-  unsigned hash;
+  uint32_t hash;
   void *value;
-  edgex_map_node *next;
 } edgex_map_node;
 
-static unsigned edgex_hash (const char *str)
+struct edgex_map_group
 {
-  unsigned hash = 5381u;
-  while (*str)
+  unsigned char ctrl[MAP_GROUP];
+  edgex_map_node *slots[MAP_GROUP];
+};
+
+/* MurmurHash64A, which consumes the key eight bytes at a time. Its final
+ * mixing ensures that both the low bits stored in the control bytes and the
+ * higher bits which select a group are well distributed.
+ */
+
+uint32_t edgex_map_hash (const char *str)
+{
+  const uint64_t mul = 0xc6a4a7935bd1e995ull;
+  size_t len = strlen (str);
+  uint64_t hash = 0x5bd1e9955bd1e995ull ^ (len * mul);
+  uint64_t k;
+
+  for (; len >= 8; len -= 8, str += 8)
+  {
+    memcpy (&k, str, 8);
+    k *= mul;
+    k ^= k >> 47;
+    k *= mul;
+    hash = (hash ^ k) * mul;
+  }
+  if (len)
   {
-    hash = ((hash << 5) + hash) ^ *str++;
+    k = 0;
+    memcpy (&k, str, len);
+    hash = (hash ^ k) * mul;
   }
-  return hash;
+  hash ^= hash >> 47;
+  hash *= mul;
+  hash ^= hash >> 47;
+  return (uint32_t) hash;
 }
 
 static edgex_map_node *edgex_map_newnode
@@ -39,181 +95,324 @@ static edgex_map_node *edgex_map_newnode
   if (!node)
   { return NULL; }
   memcpy (node + 1, key, ksize);
-  node->hash = edgex_hash (key);
+  node->hash = edgex_map_hash (key);
   node->value = ((char *) (node + 1)) + voffset;
   memcpy (node->value, value, vsize);
   return node;
 }
 
-static int edgex_map_bucketidx (edgex_map_base *m, unsigned hash)
+/* Group operations. The eight control bytes of a group are loaded as a word,
+ * with the first slot in the low byte, and the matching functions return a
+ * word with the top bit of each matching byte set.
+ */
+
+static uint64_t edgex_map_ctrlword (const edgex_map_group *grp)
 {
-  /* If the implementation is changed to allow a non-power-of-2 bucket count,
-   * the line below should be changed to use mod instead of AND
-   */
-  return hash & (m->nbuckets - 1);
+  uint64_t g;
+  memcpy (&g, grp->ctrl, sizeof (g));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  g = __builtin_bswap64 (g);
+#endif
+  return g ^ MAP_MSBS;
 }
 
-static void edgex_map_addnode (edgex_map_base *m, edgex_map_node *node)
+static unsigned char edgex_map_ctrl (const edgex_map_group *grp, unsigned i)
 {
-  int n = edgex_map_bucketidx (m, node->hash);
-  node->next = m->buckets[n];
-  m->buckets[n] = node;
+  return MAP_STORED (grp->ctrl[i]);
 }
 
-static int edgex_map_resize (edgex_map_base *m, int nbuckets)
+/* This may report a false match in a byte following a true match, so the
+ * node's hash and key are always checked.
+ */
+
+static uint64_t edgex_map_match (uint64_t g, uint32_t hash)
 {
-  edgex_map_node *nodes, *node, *next;
-  edgex_map_node **buckets;
-  int i;
-  /* Chain all nodes together */
-  nodes = NULL;
-  i = m->nbuckets;
-  while (i--)
+  uint64_t x = g ^ (MAP_LSBS * (hash & 0x7f));
+  return (x - MAP_LSBS) & ~x & MAP_MSBS;
+}
+
+static uint64_t edgex_map_match_empty (uint64_t g)
+{
+  return g & ~(g << 6) & MAP_MSBS;
+}
+
+static uint64_t edgex_map_match_free (uint64_t g)
+{
+  return g & MAP_MSBS;
+}
+
+static unsigned edgex_map_matchidx (uint64_t match)
+{
+  return __builtin_ctzll (match) >> 3;
+}
+
+static void edgex_map_addnode (edgex_map_base *m, edgex_map_node *node)
+{
+  unsigned mask = m->nslots / MAP_GROUP - 1;
+  unsigned group = (node->hash >> 7) & mask;
+  edgex_map_group *grp = &m->groups[group];
+  uint64_t match;
+  unsigned step = 0;
+  while ((match = edgex_map_match_free (edgex_map_ctrlword (grp))) == 0)
   {
-    node = (m->buckets)[i];
-    while (node)
-    {
-      next = node->next;
-      node->next = nodes;
-      nodes = node;
-      node = next;
-    }
+    group = (group + ++step) & mask;
+    grp = &m->groups[group];
   }
-  /* Reset buckets */
-  buckets = realloc (m->buckets, sizeof (*m->buckets) * nbuckets);
-  if (buckets != NULL)
+  unsigned i = edgex_map_matchidx (match);
+  if (edgex_map_ctrl (grp, i) == MAP_DELETED)
   {
-    m->buckets = buckets;
-    m->nbuckets = nbuckets;
+    m->ndeleted--;
   }
-  if (m->buckets)
+  grp->ctrl[i] = MAP_STORED (node->hash & 0x7f);
+  grp->slots[i] = node;
+}
+
+/* Find a key in one of the tables, returning the slot and its group */
+
+static edgex_map_node **edgex_map_find
+(
+  edgex_map_group *groups,
+  unsigned nslots,
+  uint32_t hash,
+  const char *key,
+  edgex_map_group **grpout
+)
+{
+  if (nslots > 0)
   {
-    memset (m->buckets, 0, sizeof (*m->buckets) * m->nbuckets);
-    /* Re-add nodes to buckets */
-    node = nodes;
-    while (node)
+    unsigned mask = nslots / MAP_GROUP - 1;
+    unsigned group = (hash >> 7) & mask;
+    for (unsigned step = 1; ; step++)
     {
-      next = node->next;
-      edgex_map_addnode (m, node);
-      node = next;
+      edgex_map_group *grp = &groups[group];
+      uint64_t g = edgex_map_ctrlword (grp);
+      uint64_t match;
+      for (match = edgex_map_match (g, hash); match; match &= match - 1)
+      {
+        edgex_map_node **ref = &grp->slots[edgex_map_matchidx (match)];
+        if ((*ref)->hash == hash && !strcmp ((char *) (*ref + 1), key))
+        {
+          *grpout = grp;
+          return ref;
+        }
+      }
+      if (edgex_map_match_empty (g) || step > mask)
+      {
+        break;
+      }
+      group = (group + step) & mask;
     }
   }
-  /* Return error code if realloc() failed */
-  return (buckets == NULL) ? -1 : 0;
+  return NULL;
 }
 
 static edgex_map_node **edgex_map_getref (edgex_map_base *m, const char *key)
 {
-  unsigned hash = edgex_hash (key);
-  if (m->nbuckets > 0)
+  edgex_map_node **ref = NULL;
+  edgex_map_group *grp;
+  if (m->nnodes > 0)
+  {
+    uint32_t hash = edgex_map_hash (key);
+    ref = edgex_map_find (m->groups, m->nslots, hash, key, &grp);
+    if (ref == NULL)
+    {
+      ref = edgex_map_find (m->oldgroups, m->oldnslots, hash, key, &grp);
+    }
+  }
+  return ref;
+}
+
+/* Empty a slot. It may only become empty if its group already has an empty
+ * slot, otherwise a lookup could stop short of a node placed beyond it.
+ * Returns true if the slot was marked as deleted.
+ */
+
+static bool edgex_map_clear (edgex_map_group *grp, edgex_map_node **ref)
+{
+  bool deleted = (edgex_map_match_empty (edgex_map_ctrlword (grp)) == 0);
+  grp->ctrl[ref - grp->slots] = MAP_STORED (deleted ? MAP_DELETED : MAP_EMPTY);
+  return deleted;
+}
+
+/* Move up to the given number of groups from the previous table */
+
+static void edgex_map_migrate (edgex_map_base *m, unsigned ngroups)
+{
+  unsigned total = m->oldnslots / MAP_GROUP;
+  for (; ngroups && m->migrated < total; ngroups--)
   {
-    edgex_map_node **next = &m->buckets[edgex_map_bucketidx (m, hash)];
-    while (*next)
+    edgex_map_group *grp = &m->oldgroups[m->migrated++];
+    for (unsigned i = 0; i < MAP_GROUP; i++)
     {
-      if ((*next)->hash == hash && !strcmp ((char *) (*next + 1), key))
+      if (edgex_map_ctrl (grp, i) < MAP_EMPTY)
       {
-        return next;
+        edgex_map_addnode (m, grp->slots[i]);
+        grp->ctrl[i] = MAP_STORED (MAP_DELETED);
       }
-      next = &(*next)->next;
     }
   }
-  return NULL;
+  if (m->migrated == total)
+  {
+    free (m->oldgroups);
+    m->oldgroups = NULL;
+    m->oldnslots = 0;
+    m->migrated = 0;
+  }
+}
+
+/* Start using a new table with the given number of slots, which also clears
+ * any deleted slots. If a previous resize is still in progress it is
+ * completed first.
+ */
+
+static int edgex_map_resize (edgex_map_base *m, unsigned nslots)
+{
+  edgex_map_group *groups =
+    calloc (nslots / MAP_GROUP, sizeof (edgex_map_group));
+  if (groups == NULL)
+  {
+    return -1;
+  }
+  if (m->oldgroups)
+  {
+    edgex_map_migrate (m, m->oldnslots / MAP_GROUP);
+  }
+  if (m->nnodes > 0)
+  {
+    m->oldgroups = m->groups;
+    m->oldnslots = m->nslots;
+  }
+  else
+  {
+    free (m->groups);
+  }
+  m->groups = groups;
+  m->nslots = nslots;
+  m->ndeleted = 0;
+  return 0;
 }
 
 void edgex_map_deinit_ (edgex_map_base *m)
 {
-  edgex_map_node *next, *node;
-  int i;
-  i = m->nbuckets;
-  while (i--)
+  for (unsigned i = 0; i < m->nslots; i++)
+  {
+    edgex_map_group *grp = &m->groups[i / MAP_GROUP];
+    if (edgex_map_ctrl (grp, i % MAP_GROUP) < MAP_EMPTY)
+    {
+      free (grp->slots[i % MAP_GROUP]);
+    }
+  }
+  for (unsigned i = 0; i < m->oldnslots; i++)
   {
-    node = m->buckets[i];
-    while (node)
+    edgex_map_group *grp = &m->oldgroups[i / MAP_GROUP];
+    if (edgex_map_ctrl (grp, i % MAP_GROUP) < MAP_EMPTY)
     {
-      next = node->next;
-      free (node);
-      node = next;
+      free (grp->slots[i % MAP_GROUP]);
     }
   }
-  free (m->buckets);
+  free (m->groups);
+  free (m->oldgroups);
 }
 
 void *edgex_map_get_ (edgex_map_base *m, const char *key)
 {
-  edgex_map_node **next = edgex_map_getref (m, key);
-  return next ? (*next)->value : NULL;
+  edgex_map_node **ref = edgex_map_getref (m, key);
+  return ref ? (*ref)->value : NULL;
 }
 
 int edgex_map_set_ (edgex_map_base *m, const char *key, void *value, int vsize)
 {
-  int n, err;
-  edgex_map_node **next, *node;
+  edgex_map_node **ref, *node;
   /* Find & replace existing node */
-  next = edgex_map_getref (m, key);
-  if (next)
+  ref = edgex_map_getref (m, key);
+  if (ref)
   {
-    memcpy ((*next)->value, value, vsize);
+    memcpy ((*ref)->value, value, vsize);
     return 0;
   }
+  /* Keep at least one slot in eight empty, growing unless the table is
+   * mostly deleted slots
+   */
+  if (m->nnodes + m->ndeleted >= m->nslots - m->nslots / MAP_GROUP)
+  {
+    unsigned n = m->nslots;
+    if (n == 0)
+    {
+      n = MAP_GROUP;
+    }
+    else if (m->nnodes >= n / 2)
+    {
+      n <<= 1;
+    }
+    if (edgex_map_resize (m, n))
+    {
+      return -1;
+    }
+  }
   /* Add new node */
   node = edgex_map_newnode (key, value, vsize);
   if (node == NULL)
-  { goto fail; }
-  if (m->nnodes >= m->nbuckets)
   {
-    n = (m->nbuckets > 0) ? (m->nbuckets << 1) : 1;
-    err = edgex_map_resize (m, n);
-    if (err)
-    { goto fail; }
+    return -1;
   }
   edgex_map_addnode (m, node);
   m->nnodes++;
+  if (m->oldgroups)
+  {
+    edgex_map_migrate (m, MAP_MIGRATE_STEP);
+  }
   return 0;
-  fail:
-  if (node)
-  { free (node); }
-  return -1;
 }
 
 void edgex_map_remove_ (edgex_map_base *m, const char *key)
 {
-  edgex_map_node **next = edgex_map_getref (m, key);
-  if (next)
+  edgex_map_node **ref;
+  edgex_map_group *grp;
+  if (m->nnodes > 0)
   {
-    edgex_map_node *node = *next;
-    *next = (*next)->next;
-    free (node);
-    m->nnodes--;
+    uint32_t hash = edgex_map_hash (key);
+    if ((ref = edgex_map_find (m->groups, m->nslots, hash, key, &grp)))
+    {
+      free (*ref);
+      if (edgex_map_clear (grp, ref))
+      {
+        m->ndeleted++;
+      }
+    }
+    else if
+      ((ref = edgex_map_find (m->oldgroups, m->oldnslots, hash, key, &grp)))
+    {
+      free (*ref);
+      edgex_map_clear (grp, ref);
+    }
+    if (ref)
+    {
+      m->nnodes--;
+    }
   }
 }
 
 edgex_map_iter edgex_map_iter_ (void)
 {
   edgex_map_iter iter;
-  iter.bucketidx = -1;
-  iter.node = NULL;
+  iter.slotidx = -1;
   return iter;
 }
 
+/* The new table is visited first, then the previous table */
+
 const char *edgex_map_next_ (edgex_map_base *m, edgex_map_iter *iter)
 {
-  if (iter->node)
+  while (++iter->slotidx < m->nslots + m->oldnslots)
   {
-    iter->node = iter->node->next;
-    if (iter->node == NULL)
-    { goto nextBucket; }
-  }
-  else
-  {
-    nextBucket:
-    do
+    unsigned i = iter->slotidx;
+    edgex_map_group *grp = (i < m->nslots) ?
+      &m->groups[i / MAP_GROUP] : &m->oldgroups[(i - m->nslots) / MAP_GROUP];
+    if (edgex_map_ctrl (grp, i % MAP_GROUP) < MAP_EMPTY)
     {
-      if (++iter->bucketidx >= m->nbuckets)
-      {
-        return NULL;
-      }
-      iter->node = m->buckets[iter->bucketidx];
-    } while (iter->node == NULL);
+      return (char *) (grp->slots[i % MAP_GROUP] + 1);
+    }
   }
-  return (char *) (iter->node + 1);
+  iter->slotidx = m->nslots + m->oldnslots;
+  return NULL;
 }
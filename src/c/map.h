@@ -1,6 +1,8 @@
 #ifndef _EDGEX_DEVICE_MAP_H_
 #define _EDGEX_DEVICE_MAP_H_ 1
 
+#include <stdint.h>
+
 /* Based on rxi's type-safe hashmap implementation */
 
 /**
@@ -10,20 +12,38 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
-struct edgex_map_node;
-typedef struct edgex_map_node edgex_map_node;
+/* The map is an open-addressing table of pointers to nodes, which hold the
+ * key and value. Slots are arranged in groups of eight, each group starting
+ * with a control byte per slot, recording whether the slot is empty, deleted
+ * or full, and for full slots seven bits of the key's hash. Lookups scan the
+ * control bytes of a group at once, and only visit nodes whose hash bits
+ * match. Nodes are never moved, so a pointer to a value remains valid until
+ * that key is removed, and the key being visited may be removed during
+ * iteration.
+ *
+ * When the table is resized, the previous table is kept, and its nodes are
+ * moved into the new table a few groups at a time by subsequent insertions.
+ * Until then, lookups search both tables. Lookups and removals do not move
+ * nodes between the tables.
+ */
+
+struct edgex_map_group;
+typedef struct edgex_map_group edgex_map_group;
 
 typedef struct
 {
-  edgex_map_node **buckets;
-  unsigned nbuckets;
+  edgex_map_group *groups;
+  unsigned nslots;
   unsigned nnodes;
+  unsigned ndeleted;
+  edgex_map_group *oldgroups;
+  unsigned oldnslots;
+  unsigned migrated;
 } edgex_map_base;
 
 typedef struct
 {
-  unsigned bucketidx;
-  edgex_map_node *node;
+  unsigned slotidx;
 } edgex_map_iter;
 
 #define edgex_map(T) \
@@ -63,6 +83,10 @@ extern edgex_map_iter edgex_map_iter_ (void);
 
 extern const char *edgex_map_next_ (edgex_map_base *m, edgex_map_iter *iter);
 
+/* The hash function used for keys, also used by the persistent maps. */
+
+extern uint32_t edgex_map_hash (const char *str);
+
 typedef edgex_map(void*) edgex_map_void;
 typedef edgex_map(char*) edgex_map_string;
 typedef edgex_map(int) edgex_map_int;
@@ -143,6 +143,7 @@ edgex_deviceprofile *edgex_metadata_client_get_deviceprofile
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   ename = curl_easy_escape (NULL, name, 0);
 
   snprintf
@@ -194,6 +195,7 @@ void edgex_metadata_client_set_device_opstate
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -222,6 +224,7 @@ void edgex_metadata_client_set_device_adminstate
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -250,6 +253,7 @@ char *edgex_metadata_client_create_deviceprofile
   char *json;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -276,6 +280,7 @@ char *edgex_metadata_client_create_deviceprofile_file
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -302,6 +307,7 @@ edgex_deviceservice *edgex_metadata_client_get_deviceservice
   long rc;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -345,6 +351,7 @@ char *edgex_metadata_client_create_deviceservice
   char *json;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -372,6 +379,7 @@ edgex_device *edgex_metadata_client_get_devices
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -408,6 +416,7 @@ edgex_scheduleevent *edgex_metadata_client_get_scheduleevents
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -451,6 +460,7 @@ edgex_scheduleevent *edgex_metadata_client_create_scheduleevent
 
   memset (result, 0, sizeof (edgex_scheduleevent));
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -502,6 +512,7 @@ edgex_schedule *edgex_metadata_client_get_schedule
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -545,6 +556,7 @@ edgex_schedule *edgex_metadata_client_create_schedule
 
   memset (result, 0, sizeof (edgex_schedule));
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -602,6 +614,7 @@ edgex_device *edgex_metadata_client_add_device
 
   memset (result, 0, sizeof (edgex_device));
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -659,6 +672,7 @@ edgex_device *edgex_metadata_client_get_device
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -695,6 +709,7 @@ edgex_device *edgex_metadata_client_get_device_byname
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -735,6 +750,7 @@ void edgex_metadata_client_update_device
   char *json;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -774,6 +790,7 @@ void edgex_metadata_client_delete_device
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -801,6 +818,7 @@ void edgex_metadata_client_delete_device_byname
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -830,6 +848,7 @@ edgex_addressable *edgex_metadata_client_get_addressable
   long rc;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -871,6 +890,7 @@ char *edgex_metadata_client_create_addressable
   char *json;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -898,6 +918,7 @@ void edgex_metadata_client_update_addressable
   char *json;
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -924,6 +945,7 @@ void edgex_metadata_client_delete_addressable
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -950,6 +972,7 @@ bool edgex_metadata_client_ping
   char url[URL_BUF_SIZE];
 
   memset (&ctx, 0, sizeof (edgex_ctx));
+  ctx.socket = endpoints->metadata.socket;
   snprintf
   (
     url,
@@ -0,0 +1,813 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "metrics.h"
+#include "parson.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define METRICS_SHARDS 8
+#define METRICS_CACHELINE 64
+#define METRICS_TABLE_MIN 8
+
+/* Histogram buckets. Values, in microseconds, below METRICS_SUB have a
+ * bucket each; above that each power of two is split into METRICS_SUB
+ * buckets. Values of 2^(METRICS_MAXBIT + 1) microseconds and more are
+ * counted in the last bucket.
+ */
+
+#define METRICS_SUBBITS 3
+#define METRICS_SUB (1 << METRICS_SUBBITS)
+#define METRICS_MAXBIT 31
+#define METRICS_NBUCKETS ((METRICS_MAXBIT - METRICS_SUBBITS + 2) * METRICS_SUB)
+
+/* Bucket bounds for Prometheus: powers of four from 16us to about 17s. These
+ * fall on bucket boundaries, so the counts reported are exact.
+ */
+
+#define METRICS_LE_MIN 4
+#define METRICS_LE_MAX 24
+#define METRICS_LE_STEP 2
+
+typedef union metrics_cell
+{
+  int64_t value;
+  char pad[METRICS_CACHELINE];
+} metrics_cell;
+
+typedef struct metrics_hist
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[METRICS_NBUCKETS];
+} metrics_hist;
+
+struct edgex_metric
+{
+  edgex_metrics_family *family;
+  char *value;
+  metrics_cell *cells;
+  metrics_hist **hists;
+};
+
+/* The metrics of a family are held in an open-addressing table which is
+ * never more than half full, so that lookups need no lock. Additions are
+ * made under the family's lock; when the table fills, a larger copy is
+ * published and the old one is retained until the registry is freed.
+ */
+
+typedef struct metrics_table
+{
+  struct metrics_table *retired;
+  uint32_t size;
+  uint32_t count;
+  edgex_metric *slots[];
+} metrics_table;
+
+struct edgex_metrics_family
+{
+  edgex_metrics_type type;
+  char *name;
+  char *help;
+  char *label;
+  uint32_t nshards;
+  edgex_metrics_observe_fn observe;
+  void *ctx;
+  metrics_table *table;
+  pthread_mutex_t lock;
+  struct edgex_metrics_family *next;
+};
+
+struct edgex_metrics
+{
+  edgex_metrics_family *families;
+  edgex_metrics_family **tail;
+  pthread_mutex_t lock;
+};
+
+typedef struct metrics_work
+{
+  void (*fn) (void *);
+  void *arg;
+  edgex_metric *depth;
+} metrics_work;
+
+typedef struct metrics_buf
+{
+  char *str;
+  size_t len;
+  size_t size;
+} metrics_buf;
+
+/* A histogram's shards summed */
+
+typedef struct metrics_snapshot
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[METRICS_NBUCKETS];
+} metrics_snapshot;
+
+/* Threads are numbered as they first update a sharded metric, and use the
+ * shard given by their number.
+ */
+
+static uint32_t metrics_nthreads = 0;
+static __thread uint32_t metrics_thread = 0;
+
+static uint32_t metrics_shard (uint32_t nshards)
+{
+  if (nshards == 1)
+  {
+    return 0;
+  }
+  if (metrics_thread == 0)
+  {
+    metrics_thread =
+      __atomic_add_fetch (&metrics_nthreads, 1, __ATOMIC_RELAXED);
+  }
+  return metrics_thread % nshards;
+}
+
+uint64_t edgex_metrics_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *metrics_alloc (size_t size)
+{
+  void *result;
+  if (posix_memalign (&result, METRICS_CACHELINE, size) != 0)
+  {
+    return NULL;
+  }
+  memset (result, 0, size);
+  return result;
+}
+
+/* FNV-1a */
+
+static uint32_t metrics_hash (const char *str)
+{
+  uint32_t hash = 2166136261u;
+  while (str && *str)
+  {
+    hash = (hash ^ (unsigned char) *str++) * 16777619u;
+  }
+  return hash;
+}
+
+static bool metrics_matches (const edgex_metric *metric, const char *value)
+{
+  return (metric->value && value) ?
+    strcmp (metric->value, value) == 0 : metric->value == value;
+}
+
+static metrics_table *table_alloc (uint32_t size)
+{
+  metrics_table *t =
+    calloc (1, sizeof (metrics_table) + size * sizeof (edgex_metric *));
+  t->size = size;
+  return t;
+}
+
+static edgex_metric *table_find
+  (metrics_table *t, const char *value, uint32_t hash)
+{
+  for (uint32_t i = hash & (t->size - 1); ; i = (i + 1) & (t->size - 1))
+  {
+    edgex_metric *metric = __atomic_load_n (&t->slots[i], __ATOMIC_ACQUIRE);
+    if (metric == NULL || metrics_matches (metric, value))
+    {
+      return metric;
+    }
+  }
+}
+
+static void table_insert (metrics_table *t, edgex_metric *metric)
+{
+  uint32_t i = metrics_hash (metric->value) & (t->size - 1);
+  while (t->slots[i])
+  {
+    i = (i + 1) & (t->size - 1);
+  }
+  __atomic_store_n (&t->slots[i], metric, __ATOMIC_RELEASE);
+  t->count++;
+}
+
+static edgex_metric *metric_alloc
+  (edgex_metrics_family *f, const char *value)
+{
+  edgex_metric *metric = malloc (sizeof (edgex_metric));
+  metric->family = f;
+  metric->value = value ? strdup (value) : NULL;
+  metric->cells = NULL;
+  metric->hists = NULL;
+  if (f->type == EDGEX_METRICS_HISTOGRAM)
+  {
+    metric->hists = malloc (f->nshards * sizeof (metrics_hist *));
+    for (uint32_t i = 0; i < f->nshards; i++)
+    {
+      metric->hists[i] = metrics_alloc (sizeof (metrics_hist));
+    }
+  }
+  else
+  {
+    metric->cells = metrics_alloc (f->nshards * sizeof (metrics_cell));
+  }
+  return metric;
+}
+
+static void metric_free (edgex_metric *metric)
+{
+  if (metric->hists)
+  {
+    for (uint32_t i = 0; i < metric->family->nshards; i++)
+    {
+      free (metric->hists[i]);
+    }
+    free (metric->hists);
+  }
+  free (metric->cells);
+  free (metric->value);
+  free (metric);
+}
+
+edgex_metrics *edgex_metrics_create (void)
+{
+  edgex_metrics *m = malloc (sizeof (edgex_metrics));
+  m->families = NULL;
+  m->tail = &m->families;
+  pthread_mutex_init (&m->lock, NULL);
+  return m;
+}
+
+edgex_metrics_family *edgex_metrics_family_create
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help,
+  const char *label,
+  bool sharded
+)
+{
+  edgex_metrics_family *f;
+
+  pthread_mutex_lock (&m->lock);
+  for (f = m->families; f; f = f->next)
+  {
+    if (strcmp (f->name, name) == 0)
+    {
+      break;
+    }
+  }
+  if (f == NULL)
+  {
+    f = malloc (sizeof (edgex_metrics_family));
+    f->type = type;
+    f->name = strdup (name);
+    f->help = strdup (help);
+    f->label = label ? strdup (label) : NULL;
+    f->nshards = sharded ? METRICS_SHARDS : 1;
+    f->observe = NULL;
+    f->ctx = NULL;
+    f->table = table_alloc (METRICS_TABLE_MIN);
+    pthread_mutex_init (&f->lock, NULL);
+    f->next = NULL;
+    *m->tail = f;
+    m->tail = &f->next;
+  }
+  pthread_mutex_unlock (&m->lock);
+  return f;
+}
+
+edgex_metric *edgex_metrics_family_get
+  (edgex_metrics_family *f, const char *value)
+{
+  uint32_t hash;
+  metrics_table *t;
+  edgex_metric *metric;
+
+  if (f == NULL)
+  {
+    return NULL;
+  }
+  if (f->label == NULL)
+  {
+    value = NULL;
+  }
+  hash = metrics_hash (value);
+  t = __atomic_load_n (&f->table, __ATOMIC_ACQUIRE);
+  metric = table_find (t, value, hash);
+  if (metric == NULL)
+  {
+    pthread_mutex_lock (&f->lock);
+    t = f->table;
+    metric = table_find (t, value, hash);
+    if (metric == NULL)
+    {
+      metric = metric_alloc (f, value);
+      if (2 * (t->count + 1) > t->size)
+      {
+        metrics_table *bigger = table_alloc (t->size * 2);
+        for (uint32_t i = 0; i < t->size; i++)
+        {
+          if (t->slots[i])
+          {
+            table_insert (bigger, t->slots[i]);
+          }
+        }
+        table_insert (bigger, metric);
+        bigger->retired = t;
+        __atomic_store_n (&f->table, bigger, __ATOMIC_RELEASE);
+      }
+      else
+      {
+        table_insert (t, metric);
+      }
+    }
+    pthread_mutex_unlock (&f->lock);
+  }
+  return metric;
+}
+
+edgex_metric *edgex_metrics_metric_create
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help
+)
+{
+  return edgex_metrics_family_get
+    (edgex_metrics_family_create (m, type, name, help, NULL, true), NULL);
+}
+
+void edgex_metrics_observe
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help,
+  edgex_metrics_observe_fn fn,
+  void *ctx
+)
+{
+  edgex_metrics_family *f =
+    edgex_metrics_family_create (m, type, name, help, NULL, false);
+  f->observe = fn;
+  f->ctx = ctx;
+}
+
+void edgex_metric_add (edgex_metric *metric, int64_t n)
+{
+  if (metric)
+  {
+    metrics_cell *cell =
+      &metric->cells[metrics_shard (metric->family->nshards)];
+    __atomic_add_fetch (&cell->value, n, __ATOMIC_RELAXED);
+  }
+}
+
+static uint32_t metrics_bucket (uint64_t us)
+{
+  uint32_t msb;
+  if (us < METRICS_SUB)
+  {
+    return us;
+  }
+  if (us >> (METRICS_MAXBIT + 1))
+  {
+    return METRICS_NBUCKETS - 1;
+  }
+  msb = 63 - __builtin_clzll (us);
+  return (msb - METRICS_SUBBITS + 1) * METRICS_SUB +
+    ((us >> (msb - METRICS_SUBBITS)) & (METRICS_SUB - 1));
+}
+
+/* The upper bound of a bucket, exclusive, in microseconds */
+
+static uint64_t metrics_bucket_limit (uint32_t i)
+{
+  uint32_t msb;
+  if (i < METRICS_SUB)
+  {
+    return i + 1;
+  }
+  msb = i / METRICS_SUB + METRICS_SUBBITS - 1;
+  return (uint64_t) (METRICS_SUB + i % METRICS_SUB + 1) <<
+    (msb - METRICS_SUBBITS);
+}
+
+void edgex_metric_record (edgex_metric *metric, uint64_t ns)
+{
+  metrics_hist *h;
+  uint64_t max;
+
+  if (metric == NULL)
+  {
+    return;
+  }
+  h = metric->hists[metrics_shard (metric->family->nshards)];
+  __atomic_add_fetch
+    (&h->buckets[metrics_bucket (ns / 1000)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&h->sum, ns, __ATOMIC_RELAXED);
+  max = __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+  while
+  (
+    ns > max &&
+    !__atomic_compare_exchange_n
+      (&h->max, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+  );
+}
+
+void edgex_metric_since (edgex_metric *metric, uint64_t start)
+{
+  if (metric)
+  {
+    edgex_metric_record (metric, edgex_metrics_now () - start);
+  }
+}
+
+static void metrics_work_run (void *p)
+{
+  metrics_work w = *(metrics_work *) p;
+  free (p);
+  edgex_metric_add (w.depth, -1);
+  w.fn (w.arg);
+}
+
+void edgex_metrics_add_work
+  (threadpool pool, edgex_metric *depth, void (*fn) (void *), void *arg)
+{
+  if (depth)
+  {
+    metrics_work *w = malloc (sizeof (metrics_work));
+    w->fn = fn;
+    w->arg = arg;
+    w->depth = depth;
+    edgex_metric_add (depth, 1);
+    thpool_add_work (pool, metrics_work_run, w);
+  }
+  else
+  {
+    thpool_add_work (pool, fn, arg);
+  }
+}
+
+/* Reading values. Shards are read without synchronization, so a value may
+ * miss updates in progress, but no update is lost.
+ */
+
+static double metrics_value (const edgex_metric *metric)
+{
+  int64_t total = 0;
+  for (uint32_t i = 0; i < metric->family->nshards; i++)
+  {
+    total += __atomic_load_n (&metric->cells[i].value, __ATOMIC_RELAXED);
+  }
+  return total;
+}
+
+static void metrics_snap (const edgex_metric *metric, metrics_snapshot *s)
+{
+  memset (s, 0, sizeof (metrics_snapshot));
+  for (uint32_t i = 0; i < metric->family->nshards; i++)
+  {
+    metrics_hist *h = metric->hists[i];
+    uint64_t max = __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+    s->sum += __atomic_load_n (&h->sum, __ATOMIC_RELAXED);
+    s->max = (max > s->max) ? max : s->max;
+    for (uint32_t b = 0; b < METRICS_NBUCKETS; b++)
+    {
+      s->buckets[b] += __atomic_load_n (&h->buckets[b], __ATOMIC_RELAXED);
+    }
+  }
+
+  /* Count from the buckets, so that the count and cumulative bucket counts
+   * are consistent
+   */
+  for (uint32_t b = 0; b < METRICS_NBUCKETS; b++)
+  {
+    s->count += s->buckets[b];
+  }
+}
+
+/* The value below which the given fraction of recorded values lie, in
+ * seconds. This is the upper bound of the bucket in which it falls, capped
+ * by the largest value recorded.
+ */
+
+static double metrics_quantile (const metrics_snapshot *s, double q)
+{
+  uint64_t target = (uint64_t) (q * s->count + 0.5);
+  uint64_t seen = 0;
+  uint64_t limit = 0;
+
+  if (target == 0)
+  {
+    target = 1;
+  }
+  for (uint32_t b = 0; b < METRICS_NBUCKETS; b++)
+  {
+    seen += s->buckets[b];
+    if (seen >= target)
+    {
+      limit = metrics_bucket_limit (b) * 1000;
+      break;
+    }
+  }
+  return ((limit && limit < s->max) ? limit : s->max) / 1e9;
+}
+
+/* Copy the metrics of a family, sorted by label value */
+
+static int metrics_cmp (const void *a, const void *b)
+{
+  const edgex_metric *x = *(const edgex_metric **) a;
+  const edgex_metric *y = *(const edgex_metric **) b;
+  if (x->value == NULL || y->value == NULL)
+  {
+    return (x->value != NULL) - (y->value != NULL);
+  }
+  return strcmp (x->value, y->value);
+}
+
+static edgex_metric **metrics_list (edgex_metrics_family *f, uint32_t *n)
+{
+  metrics_table *t;
+  edgex_metric **result;
+
+  pthread_mutex_lock (&f->lock);
+  t = f->table;
+  *n = 0;
+  result = malloc ((t->count + 1) * sizeof (edgex_metric *));
+  for (uint32_t i = 0; i < t->size; i++)
+  {
+    if (t->slots[i])
+    {
+      result[(*n)++] = t->slots[i];
+    }
+  }
+  pthread_mutex_unlock (&f->lock);
+  qsort (result, *n, sizeof (edgex_metric *), metrics_cmp);
+  return result;
+}
+
+static const char *metrics_typename (edgex_metrics_type type)
+{
+  switch (type)
+  {
+    case EDGEX_METRICS_COUNTER: return "counter";
+    case EDGEX_METRICS_GAUGE: return "gauge";
+    default: return "histogram";
+  }
+}
+
+/* Prometheus text format */
+
+static void buf_printf (metrics_buf *b, const char *fmt, ...)
+{
+  va_list args;
+  int n;
+
+  va_start (args, fmt);
+  n = vsnprintf (b->str + b->len, b->size - b->len, fmt, args);
+  va_end (args);
+  if ((size_t) n >= b->size - b->len)
+  {
+    while ((size_t) n >= b->size - b->len)
+    {
+      b->size *= 2;
+    }
+    b->str = realloc (b->str, b->size);
+    va_start (args, fmt);
+    vsnprintf (b->str + b->len, b->size - b->len, fmt, args);
+    va_end (args);
+  }
+  b->len += n;
+}
+
+/* Writes the label of a metric as name="value", escaping the value */
+
+static void buf_label (metrics_buf *b, const edgex_metric *metric)
+{
+  buf_printf (b, "%s=\"", metric->family->label);
+  for (const char *c = metric->value; *c; c++)
+  {
+    switch (*c)
+    {
+      case '\\': buf_printf (b, "\\\\"); break;
+      case '"': buf_printf (b, "\\\""); break;
+      case '\n': buf_printf (b, "\\n"); break;
+      default: buf_printf (b, "%c", *c);
+    }
+  }
+  buf_printf (b, "\"");
+}
+
+static void buf_labels (metrics_buf *b, const edgex_metric *metric)
+{
+  if (metric->value)
+  {
+    buf_printf (b, "{");
+    buf_label (b, metric);
+    buf_printf (b, "}");
+  }
+}
+
+static void buf_histogram (metrics_buf *b, const edgex_metric *metric)
+{
+  const char *name = metric->family->name;
+  metrics_snapshot s;
+  uint64_t cumulative = 0;
+  uint32_t b0 = 0;
+
+  metrics_snap (metric, &s);
+  for (uint32_t k = METRICS_LE_MIN; k <= METRICS_LE_MAX; k += METRICS_LE_STEP)
+  {
+    uint32_t end = (k - METRICS_SUBBITS + 1) * METRICS_SUB;
+    while (b0 < end)
+    {
+      cumulative += s.buckets[b0++];
+    }
+    buf_printf (b, "%s_bucket{", name);
+    if (metric->value)
+    {
+      buf_label (b, metric);
+      buf_printf (b, ",");
+    }
+    buf_printf (b, "le=\"%g\"} %" PRIu64 "\n", (1 << k) / 1e6, cumulative);
+  }
+  buf_printf (b, "%s_bucket{", name);
+  if (metric->value)
+  {
+    buf_label (b, metric);
+    buf_printf (b, ",");
+  }
+  buf_printf (b, "le=\"+Inf\"} %" PRIu64 "\n", s.count);
+  buf_printf (b, "%s_sum", name);
+  buf_labels (b, metric);
+  buf_printf (b, " %.9g\n", s.sum / 1e9);
+  buf_printf (b, "%s_count", name);
+  buf_labels (b, metric);
+  buf_printf (b, " %" PRIu64 "\n", s.count);
+}
+
+char *edgex_metrics_write_prometheus (edgex_metrics *m)
+{
+  metrics_buf b = { .str = malloc (4096), .len = 0, .size = 4096 };
+
+  b.str[0] = '\0';
+  for (edgex_metrics_family *f = m->families; f; f = f->next)
+  {
+    uint32_t n;
+    edgex_metric **list;
+
+    buf_printf (&b, "# HELP %s %s\n", f->name, f->help);
+    buf_printf (&b, "# TYPE %s %s\n", f->name, metrics_typename (f->type));
+    if (f->observe)
+    {
+      buf_printf (&b, "%s %.9g\n", f->name, f->observe (f->ctx));
+      continue;
+    }
+    list = metrics_list (f, &n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+      if (f->type == EDGEX_METRICS_HISTOGRAM)
+      {
+        buf_histogram (&b, list[i]);
+      }
+      else
+      {
+        buf_printf (&b, "%s", f->name);
+        buf_labels (&b, list[i]);
+        buf_printf (&b, " %.0f\n", metrics_value (list[i]));
+      }
+    }
+    free (list);
+  }
+  return b.str;
+}
+
+/* JSON. Each family is an object holding its type, help text and metrics.
+ * Histograms are summarized by their count, sum, mean, maximum and some
+ * quantiles, in seconds.
+ */
+
+static JSON_Value *json_metric (const edgex_metric *metric)
+{
+  JSON_Value *val = json_value_init_object ();
+  JSON_Object *obj = json_value_get_object (val);
+
+  if (metric->value)
+  {
+    json_object_set_string (obj, metric->family->label, metric->value);
+  }
+  if (metric->family->type == EDGEX_METRICS_HISTOGRAM)
+  {
+    metrics_snapshot s;
+    metrics_snap (metric, &s);
+    json_object_set_number (obj, "count", s.count);
+    json_object_set_number (obj, "sum", s.sum / 1e9);
+    json_object_set_number (obj, "mean", s.count ? s.sum / 1e9 / s.count : 0);
+    json_object_set_number (obj, "p50", metrics_quantile (&s, 0.5));
+    json_object_set_number (obj, "p90", metrics_quantile (&s, 0.9));
+    json_object_set_number (obj, "p99", metrics_quantile (&s, 0.99));
+    json_object_set_number (obj, "p999", metrics_quantile (&s, 0.999));
+    json_object_set_number (obj, "max", s.max / 1e9);
+  }
+  else
+  {
+    json_object_set_number (obj, "value", metrics_value (metric));
+  }
+  return val;
+}
+
+char *edgex_metrics_write_json (edgex_metrics *m)
+{
+  char *result;
+  JSON_Value *val = json_value_init_object ();
+  JSON_Object *obj = json_value_get_object (val);
+
+  for (edgex_metrics_family *f = m->families; f; f = f->next)
+  {
+    JSON_Value *fval = json_value_init_object ();
+    JSON_Object *fobj = json_value_get_object (fval);
+    JSON_Value *aval = json_value_init_array ();
+    JSON_Array *arr = json_value_get_array (aval);
+
+    json_object_set_string (fobj, "type", metrics_typename (f->type));
+    json_object_set_string (fobj, "help", f->help);
+    if (f->observe)
+    {
+      JSON_Value *mval = json_value_init_object ();
+      json_object_set_number
+        (json_value_get_object (mval), "value", f->observe (f->ctx));
+      json_array_append_value (arr, mval);
+    }
+    else
+    {
+      uint32_t n;
+      edgex_metric **list = metrics_list (f, &n);
+      for (uint32_t i = 0; i < n; i++)
+      {
+        json_array_append_value (arr, json_metric (list[i]));
+      }
+      free (list);
+    }
+    json_object_set_value (fobj, "metrics", aval);
+    json_object_set_value (obj, f->name, fval);
+  }
+  result = json_serialize_to_string (val);
+  json_value_free (val);
+  return result;
+}
+
+void edgex_metrics_free (edgex_metrics *m)
+{
+  if (m == NULL)
+  {
+    return;
+  }
+  while (m->families)
+  {
+    edgex_metrics_family *f = m->families;
+    metrics_table *t = f->table;
+    for (uint32_t i = 0; i < t->size; i++)
+    {
+      if (t->slots[i])
+      {
+        metric_free (t->slots[i]);
+      }
+    }
+    while (t)
+    {
+      metrics_table *retired = t->retired;
+      free (t);
+      t = retired;
+    }
+    m->families = f->next;
+    pthread_mutex_destroy (&f->lock);
+    free (f->name);
+    free (f->help);
+    free (f->label);
+    free (f);
+  }
+  pthread_mutex_destroy (&m->lock);
+  free (m);
+}
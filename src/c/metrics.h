@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_METRICS_H_
+#define _EDGEX_DEVICE_METRICS_H_ 1
+
+#include "edgex/os.h"
+#include "thpool.h"
+
+/* A registry of metrics, for export in the Prometheus text format or as
+ * JSON. Metrics are grouped in families, which share a name and help text,
+ * and within a family are distinguished by the value of a single label (eg
+ * a device name). Families without a label have a single metric.
+ *
+ * Counters and gauges hold a signed total. Histograms record durations in
+ * nanoseconds, in log-linear buckets of 1/8 of a power of two (so that any
+ * value is known to within 12.5%) from one microsecond to about an hour.
+ *
+ * Sharded metrics spread their updates over several cache lines, selected
+ * by the updating thread, so that frequent updates from many threads do not
+ * contend; reads sum the shards. This costs memory, so rarely updated
+ * metrics are not sharded.
+ *
+ * Metrics are never removed, and remain valid until the registry is freed,
+ * so labels should take a bounded set of values (eg profile names rather
+ * than device names). The update functions accept NULL, in which case they
+ * do nothing.
+ */
+
+typedef enum
+{
+  EDGEX_METRICS_COUNTER,
+  EDGEX_METRICS_GAUGE,
+  EDGEX_METRICS_HISTOGRAM
+} edgex_metrics_type;
+
+struct edgex_metrics;
+typedef struct edgex_metrics edgex_metrics;
+
+struct edgex_metrics_family;
+typedef struct edgex_metrics_family edgex_metrics_family;
+
+struct edgex_metric;
+typedef struct edgex_metric edgex_metric;
+
+/* Values of observed metrics are obtained when the registry is exported */
+
+typedef double (*edgex_metrics_observe_fn) (void *ctx);
+
+extern edgex_metrics *edgex_metrics_create (void);
+
+/* Create a family of metrics, or return the existing family of that name.
+ * The label is the label name, or NULL for a family with a single metric.
+ */
+
+extern edgex_metrics_family *edgex_metrics_family_create
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help,
+  const char *label,
+  bool sharded
+);
+
+/* Find or create the metric for a label value. Lookups do not lock. */
+
+extern edgex_metric *edgex_metrics_family_get
+  (edgex_metrics_family *f, const char *value);
+
+/* Create a sharded metric without a label. */
+
+extern edgex_metric *edgex_metrics_metric_create
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help
+);
+
+/* Add a counter or gauge whose value is obtained by calling fn. */
+
+extern void edgex_metrics_observe
+(
+  edgex_metrics *m,
+  edgex_metrics_type type,
+  const char *name,
+  const char *help,
+  edgex_metrics_observe_fn fn,
+  void *ctx
+);
+
+/* Update a counter or gauge. */
+
+extern void edgex_metric_add (edgex_metric *metric, int64_t n);
+
+/* Record a duration in a histogram. */
+
+extern void edgex_metric_record (edgex_metric *metric, uint64_t ns);
+
+/* Record the time since start (as returned by edgex_metrics_now). */
+
+extern void edgex_metric_since (edgex_metric *metric, uint64_t start);
+
+/* Monotonic time in nanoseconds. */
+
+extern uint64_t edgex_metrics_now (void);
+
+/* Add work to a thread pool, counting it in a gauge until it starts. */
+
+extern void edgex_metrics_add_work
+  (threadpool pool, edgex_metric *depth, void (*fn) (void *), void *arg);
+
+/* Export the registry. The string returned is to be freed by the caller. */
+
+extern char *edgex_metrics_write_prometheus (edgex_metrics *m);
+
+extern char *edgex_metrics_write_json (edgex_metrics *m);
+
+/* Free the registry. There must be no concurrent access. */
+
+extern void edgex_metrics_free (edgex_metrics *m);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "pmap.h"
+#include "map.h"
+
+/* Each level of the trie consumes five bits of the key's hash. A branch
+ * node has a bitmap of the values of those bits which are present, and an
+ * entry for each, in order. An entry is either a leaf, holding a key and
+ * value, or (with a NULL key) a child node. Keys whose hashes are entirely
+ * equal are held in a collision node below the last level, which is a list
+ * of leaves.
+ *
+ * A node other than the root never holds a single leaf, as such a node is
+ * replaced by its leaf in the parent.
+ */
+
+#define PMAP_BITS 5
+#define PMAP_MASK 31
+#define PMAP_HASHBITS 32
+
+typedef struct pmap_entry
+{
+  const char *key;
+  void *value;
+  uint32_t hash;
+} pmap_entry;
+
+typedef struct edgex_pmap_node
+{
+  uint32_t refs;
+  uint32_t bitmap;
+  uint32_t n;
+  pmap_entry e[];
+} edgex_pmap_node;
+
+static uint32_t pmap_bit (uint32_t hash, unsigned shift)
+{
+  return 1u << ((hash >> shift) & PMAP_MASK);
+}
+
+static uint32_t pmap_index (uint32_t bitmap, uint32_t bit)
+{
+  return __builtin_popcount (bitmap & (bit - 1));
+}
+
+static size_t pmap_size (uint32_t n)
+{
+  return sizeof (edgex_pmap_node) + n * sizeof (pmap_entry);
+}
+
+static edgex_pmap_node *pmap_node_alloc (uint32_t n)
+{
+  edgex_pmap_node *node = malloc (pmap_size (n));
+  node->refs = 1;
+  node->bitmap = 0;
+  node->n = n;
+  return node;
+}
+
+/* The index of a key in a collision node, or n if absent */
+
+static uint32_t pmap_scan (const edgex_pmap_node *node, const char *key)
+{
+  uint32_t i = 0;
+  while (i < node->n && strcmp (node->e[i].key, key))
+  {
+    i++;
+  }
+  return i;
+}
+
+static void pmap_release (edgex_pmap_node *node, const edgex_pmap_ops *ops)
+{
+  if (node && --node->refs == 0)
+  {
+    for (uint32_t i = 0; i < node->n; i++)
+    {
+      if (node->e[i].key == NULL)
+      {
+        pmap_release (node->e[i].value, ops);
+      }
+      else if (ops)
+      {
+        ops->release (node->e[i].value);
+      }
+    }
+    free (node);
+  }
+}
+
+static void pmap_release_value (const pmap_entry *e, const edgex_pmap_ops *ops)
+{
+  if (ops)
+  {
+    ops->release (e->value);
+  }
+}
+
+/* Obtain a private version of a node, to be stored in place of the given
+ * one, with room for a further entry if grow is set. A shared node is
+ * copied, and the copy takes its own references to the node's entries.
+ */
+
+static edgex_pmap_node *pmap_own
+  (edgex_pmap_node *node, bool grow, const edgex_pmap_ops *ops)
+{
+  size_t size = pmap_size (node->n + (grow ? 1 : 0));
+  edgex_pmap_node *copy;
+
+  if (node->refs == 1)
+  {
+    return grow ? realloc (node, size) : node;
+  }
+  copy = malloc (size);
+  memcpy (copy, node, pmap_size (node->n));
+  copy->refs = 1;
+  for (uint32_t i = 0; i < copy->n; i++)
+  {
+    if (copy->e[i].key == NULL)
+    {
+      ((edgex_pmap_node *) copy->e[i].value)->refs++;
+    }
+    else if (ops)
+    {
+      ops->addref (copy->e[i].value);
+    }
+  }
+  node->refs--;
+  return copy;
+}
+
+/* Make a node holding two leaves whose hashes agree below the given shift */
+
+static edgex_pmap_node *pmap_pair
+  (unsigned shift, const pmap_entry *a, const pmap_entry *b)
+{
+  edgex_pmap_node *node;
+
+  if (shift >= PMAP_HASHBITS)
+  {
+    node = pmap_node_alloc (2);
+    node->e[0] = *a;
+    node->e[1] = *b;
+    return node;
+  }
+
+  uint32_t abit = pmap_bit (a->hash, shift);
+  uint32_t bbit = pmap_bit (b->hash, shift);
+  if (abit == bbit)
+  {
+    node = pmap_node_alloc (1);
+    node->e[0].key = NULL;
+    node->e[0].value = pmap_pair (shift + PMAP_BITS, a, b);
+    node->e[0].hash = 0;
+  }
+  else
+  {
+    node = pmap_node_alloc (2);
+    node->e[abit < bbit ? 0 : 1] = *a;
+    node->e[abit < bbit ? 1 : 0] = *b;
+  }
+  node->bitmap = abit | bbit;
+  return node;
+}
+
+static edgex_pmap_node *pmap_insert
+(
+  edgex_pmap_node *node,
+  unsigned shift,
+  const pmap_entry *e,
+  const edgex_pmap_ops *ops,
+  bool *added
+)
+{
+  uint32_t i;
+
+  if (shift >= PMAP_HASHBITS)
+  {
+    i = pmap_scan (node, e->key);
+    node = pmap_own (node, i == node->n, ops);
+    if (i == node->n)
+    {
+      node->n++;
+      *added = true;
+    }
+    else
+    {
+      pmap_release_value (&node->e[i], ops);
+    }
+    node->e[i] = *e;
+    return node;
+  }
+
+  uint32_t bit = pmap_bit (e->hash, shift);
+  i = pmap_index (node->bitmap, bit);
+  if ((node->bitmap & bit) == 0)
+  {
+    node = pmap_own (node, true, ops);
+    memmove
+      (node->e + i + 1, node->e + i, (node->n - i) * sizeof (pmap_entry));
+    node->e[i] = *e;
+    node->n++;
+    node->bitmap |= bit;
+    *added = true;
+    return node;
+  }
+
+  node = pmap_own (node, false, ops);
+  pmap_entry *slot = &node->e[i];
+  if (slot->key == NULL)
+  {
+    slot->value = pmap_insert (slot->value, shift + PMAP_BITS, e, ops, added);
+  }
+  else if (slot->hash == e->hash && strcmp (slot->key, e->key) == 0)
+  {
+    pmap_release_value (slot, ops);
+    *slot = *e;
+  }
+  else
+  {
+    pmap_entry old = *slot;
+    slot->key = NULL;
+    slot->value = pmap_pair (shift + PMAP_BITS, &old, e);
+    slot->hash = 0;
+    *added = true;
+  }
+  return node;
+}
+
+/* Remove a key which is known to be present */
+
+static edgex_pmap_node *pmap_delete
+(
+  edgex_pmap_node *node,
+  unsigned shift,
+  uint32_t hash,
+  const char *key,
+  const edgex_pmap_ops *ops
+)
+{
+  uint32_t i;
+
+  node = pmap_own (node, false, ops);
+  if (shift >= PMAP_HASHBITS)
+  {
+    i = pmap_scan (node, key);
+    pmap_release_value (&node->e[i], ops);
+    node->e[i] = node->e[--node->n];
+  }
+  else
+  {
+    uint32_t bit = pmap_bit (hash, shift);
+    i = pmap_index (node->bitmap, bit);
+    pmap_entry *slot = &node->e[i];
+    if (slot->key == NULL)
+    {
+      edgex_pmap_node *child =
+        pmap_delete (slot->value, shift + PMAP_BITS, hash, key, ops);
+      if (child->n == 1 && child->e[0].key)
+      {
+        *slot = child->e[0];
+        free (child);
+      }
+      else
+      {
+        slot->value = child;
+      }
+      return node;
+    }
+    pmap_release_value (slot, ops);
+    memmove
+      (node->e + i, node->e + i + 1, (node->n - i - 1) * sizeof (pmap_entry));
+    node->n--;
+    node->bitmap &= ~bit;
+  }
+  if (node->n == 0)
+  {
+    free (node);
+    node = NULL;
+  }
+  return node;
+}
+
+static edgex_pmap_node *pmap_ownpath
+(
+  edgex_pmap_node *node,
+  unsigned shift,
+  uint32_t hash,
+  const char *key,
+  const edgex_pmap_ops *ops,
+  void **value
+)
+{
+  node = pmap_own (node, false, ops);
+  if (shift >= PMAP_HASHBITS)
+  {
+    *value = node->e[pmap_scan (node, key)].value;
+  }
+  else
+  {
+    pmap_entry *slot =
+      &node->e[pmap_index (node->bitmap, pmap_bit (hash, shift))];
+    if (slot->key == NULL)
+    {
+      slot->value =
+        pmap_ownpath (slot->value, shift + PMAP_BITS, hash, key, ops, value);
+    }
+    else
+    {
+      *value = slot->value;
+    }
+  }
+  return node;
+}
+
+void edgex_pmap_init (edgex_pmap *map)
+{
+  map->root = NULL;
+  map->size = 0;
+}
+
+void edgex_pmap_deinit (edgex_pmap *map, const edgex_pmap_ops *ops)
+{
+  pmap_release (map->root, ops);
+  edgex_pmap_init (map);
+}
+
+void edgex_pmap_copy (edgex_pmap *to, const edgex_pmap *from)
+{
+  *to = *from;
+  if (to->root)
+  {
+    to->root->refs++;
+  }
+}
+
+void *edgex_pmap_get (const edgex_pmap *map, const char *key)
+{
+  uint32_t hash = edgex_map_hash (key);
+  const edgex_pmap_node *node = map->root;
+
+  for (unsigned shift = 0; node; shift += PMAP_BITS)
+  {
+    if (shift >= PMAP_HASHBITS)
+    {
+      uint32_t i = pmap_scan (node, key);
+      return (i < node->n) ? node->e[i].value : NULL;
+    }
+    uint32_t bit = pmap_bit (hash, shift);
+    if ((node->bitmap & bit) == 0)
+    {
+      break;
+    }
+    const pmap_entry *e = &node->e[pmap_index (node->bitmap, bit)];
+    if (e->key)
+    {
+      return (e->hash == hash && strcmp (e->key, key) == 0) ? e->value : NULL;
+    }
+    node = e->value;
+  }
+  return NULL;
+}
+
+void *edgex_pmap_get_private
+  (edgex_pmap *map, const char *key, const edgex_pmap_ops *ops)
+{
+  void *result = NULL;
+  if (edgex_pmap_get (map, key))
+  {
+    map->root = pmap_ownpath
+      (map->root, 0, edgex_map_hash (key), key, ops, &result);
+  }
+  return result;
+}
+
+bool edgex_pmap_set
+(
+  edgex_pmap *map,
+  const char *key,
+  void *value,
+  const edgex_pmap_ops *ops
+)
+{
+  bool added = false;
+  pmap_entry e = { .key = key, .value = value, .hash = edgex_map_hash (key) };
+
+  if (map->root)
+  {
+    map->root = pmap_insert (map->root, 0, &e, ops, &added);
+  }
+  else
+  {
+    map->root = pmap_node_alloc (1);
+    map->root->bitmap = pmap_bit (e.hash, 0);
+    map->root->e[0] = e;
+    added = true;
+  }
+  if (added)
+  {
+    map->size++;
+  }
+  return added;
+}
+
+bool edgex_pmap_remove
+  (edgex_pmap *map, const char *key, const edgex_pmap_ops *ops)
+{
+  if (edgex_pmap_get (map, key) == NULL)
+  {
+    return false;
+  }
+  map->root = pmap_delete (map->root, 0, edgex_map_hash (key), key, ops);
+  map->size--;
+  return true;
+}
+
+void edgex_pmap_iter_init (const edgex_pmap *map, edgex_pmap_iter *iter)
+{
+  iter->nodes[0] = map->root;
+  iter->pos[0] = 0;
+  iter->depth = map->root ? 1 : 0;
+}
+
+const char *edgex_pmap_next (edgex_pmap_iter *iter, void **value)
+{
+  while (iter->depth)
+  {
+    unsigned d = iter->depth - 1;
+    const edgex_pmap_node *node = iter->nodes[d];
+    if (iter->pos[d] == node->n)
+    {
+      iter->depth--;
+      continue;
+    }
+    const pmap_entry *e = &node->e[iter->pos[d]++];
+    if (e->key)
+    {
+      if (value)
+      {
+        *value = e->value;
+      }
+      return e->key;
+    }
+    iter->nodes[d + 1] = e->value;
+    iter->pos[d + 1] = 0;
+    iter->depth++;
+  }
+  return NULL;
+}
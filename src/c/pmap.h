@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_PMAP_H_
+#define _EDGEX_DEVICE_PMAP_H_ 1
+
+#include "edgex/os.h"
+
+/* Persistent maps from strings to pointers, held as hash array mapped tries.
+ * A version of a map is copied in constant time, and updating a version
+ * copies only the nodes on the path to the changed entry, so versions share
+ * all of their unchanged nodes. A node is updated in place only if it is
+ * reachable from no other version, so a version which has been copied is
+ * never modified and may be read without locking.
+ *
+ * Nodes are reference counted without atomic operations: copying, updating
+ * and deinitializing versions of a map must be serialized by the caller.
+ *
+ * Keys are not copied, and must remain valid while any version holds them.
+ * Values must not be NULL.
+ * Values may be reference counted by supplying an edgex_pmap_ops: the map
+ * then holds a reference to a value for each node in which it appears. A
+ * value passed to edgex_pmap_set transfers a reference to the map.
+ */
+
+struct edgex_pmap_node;
+
+typedef struct edgex_pmap
+{
+  struct edgex_pmap_node *root;
+  uint32_t size;
+} edgex_pmap;
+
+typedef struct edgex_pmap_ops
+{
+  void (*addref) (void *value);
+  void (*release) (void *value);
+} edgex_pmap_ops;
+
+/* The depth of a trie is bounded by the width of the hash. */
+
+#define EDGEX_PMAP_DEPTH 8
+
+typedef struct edgex_pmap_iter
+{
+  const struct edgex_pmap_node *nodes[EDGEX_PMAP_DEPTH];
+  uint32_t pos[EDGEX_PMAP_DEPTH];
+  unsigned depth;
+} edgex_pmap_iter;
+
+extern void edgex_pmap_init (edgex_pmap *map);
+
+/* Release a version of a map, and any nodes held by no other version. */
+
+extern void edgex_pmap_deinit (edgex_pmap *map, const edgex_pmap_ops *ops);
+
+/* Make a new version of a map, initially sharing all of its nodes. */
+
+extern void edgex_pmap_copy (edgex_pmap *to, const edgex_pmap *from);
+
+extern void *edgex_pmap_get (const edgex_pmap *map, const char *key);
+
+/* As edgex_pmap_get, but first make the path to the entry private to this
+ * version. A reference counted value which then has a single reference is
+ * held by no other version, and may be modified in place.
+ */
+
+extern void *edgex_pmap_get_private
+  (edgex_pmap *map, const char *key, const edgex_pmap_ops *ops);
+
+/* Add or replace an entry. Returns true if the key was not present. */
+
+extern bool edgex_pmap_set
+(
+  edgex_pmap *map,
+  const char *key,
+  void *value,
+  const edgex_pmap_ops *ops
+);
+
+/* Remove an entry. Returns false if the key was not present. */
+
+extern bool edgex_pmap_remove
+  (edgex_pmap *map, const char *key, const edgex_pmap_ops *ops);
+
+/* Iteration, in no particular order. The version iterated must not be
+ * updated meanwhile.
+ */
+
+extern void edgex_pmap_iter_init (const edgex_pmap *map, edgex_pmap_iter *iter);
+
+extern const char *edgex_pmap_next (edgex_pmap_iter *iter, void **value);
+
+#endif
@@ -236,14 +236,7 @@ void edgex_device_profiles_upload
         {
           iot_log_debug
             (lc, "DeviceProfile %s already exists: skipped", profname);
-          if (edgex_map_get (&svc->profiles, profname))
-          {
-            edgex_deviceprofile_free (dp);
-          }
-          else
-          {
-            edgex_map_set (&svc->profiles, profname, dp);
-          }
+          edgex_devmap_replace_profile (svc->devices, dp);
         }
         else
         {
@@ -272,7 +265,7 @@ void edgex_device_profiles_upload
               iot_log_debug
                 (lc, "Generating value descriptors DeviceProfile %s", profname);
               generate_value_descriptors (svc, dp);
-              edgex_map_set (&svc->profiles, profname, dp);
+              edgex_devmap_replace_profile (svc->devices, dp);
             }
             else
             {
@@ -314,25 +307,16 @@ edgex_deviceprofile *edgex_deviceprofile_get
   edgex_error *err
 )
 {
-  edgex_deviceprofile **dpp;
-  edgex_deviceprofile *dp;
-
-  pthread_mutex_lock (&svc->profileslock);
-  dpp = edgex_map_get (&svc->profiles, name);
-  if (dpp == NULL)
+  edgex_deviceprofile *dp = edgex_devmap_profile (svc->devices, name);
+  if (dp == NULL)
   {
     dp = edgex_metadata_client_get_deviceprofile
       (svc->logger, &svc->config.endpoints, name, err);
     if (dp)
     {
-      edgex_map_set (&svc->profiles, name, edgex_deviceprofile_dup (dp));
+      dp = edgex_devmap_add_profile (svc->devices, dp);
     }
   }
-  else
-  {
-    dp = edgex_deviceprofile_dup (*dpp);
-  }
-  pthread_mutex_unlock (&svc->profileslock);
   return dp;
 }
 
@@ -343,22 +327,20 @@ void edgex_device_service_getprofiles
   edgex_deviceprofile **profiles
 )
 {
-  edgex_map_iter iter = edgex_map_iter (svc->profiles);
-  uint32_t i = 0;
-  pthread_mutex_lock (&svc->profileslock);
-  while (edgex_map_next (&svc->profiles, &iter))
-  {
-    i++;
-  }
-  *count = i;
-  *profiles = malloc (i * sizeof (edgex_deviceprofile));
+  edgex_deviceprofile **shared =
+    edgex_devmap_copyprofiles (svc->devices, count);
+
+  /* The array holds shallow copies, as before. The caller only frees the
+   * array, so the profiles are pinned, to remain valid even if they are
+   * replaced.
+   */
 
-  const char *key;
-  i = 0;
-  iter = edgex_map_iter (svc->profiles);
-  while ((key = edgex_map_next (&svc->profiles, &iter)))
+  *profiles = malloc (*count * sizeof (edgex_deviceprofile));
+  for (uint32_t i = 0; i < *count; i++)
   {
-    (*profiles)[i++] = **edgex_map_get (&svc->profiles, key);
+    (*profiles)[i] = *shared[i];
+    edgex_devmap_pin_profile (svc->devices, shared[i]);
+    edgex_devmap_release_profile (shared[i]);
   }
-  pthread_mutex_unlock (&svc->profileslock);
+  free (shared);
 }
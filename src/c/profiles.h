@@ -17,6 +17,11 @@ extern void edgex_device_profiles_upload
   edgex_error *err
 );
 
+/* Obtain the shared copy of a profile, retrieving it from metadata if it is
+ * not yet known. The profile must be released with
+ * edgex_devmap_release_profile.
+ */
+
 edgex_deviceprofile *edgex_deviceprofile_get
 (
   edgex_device_service *svc,
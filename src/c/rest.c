@@ -143,6 +143,10 @@ long edgex_http_get (iot_logging_client *lc, edgex_ctx *ctx, const char *url,
   curl_easy_setopt(hnd, CURLOPT_URL, url);
   curl_easy_setopt(hnd, CURLOPT_NOPROGRESS, 1L);
   curl_easy_setopt(hnd, CURLOPT_USERAGENT, "edgex");
+  if (ctx->socket && *ctx->socket)
+  {
+    curl_easy_setopt(hnd, CURLOPT_UNIX_SOCKET_PATH, ctx->socket);
+  }
   if (slist)
   {
     curl_easy_setopt(hnd, CURLOPT_HTTPHEADER, slist);
@@ -258,6 +262,10 @@ long edgex_http_delete (iot_logging_client *lc, edgex_ctx *ctx, const char *url,
   curl_easy_setopt(hnd, CURLOPT_URL, url);
   curl_easy_setopt(hnd, CURLOPT_NOPROGRESS, 1L);
   curl_easy_setopt(hnd, CURLOPT_USERAGENT, "edgex");
+  if (ctx->socket && *ctx->socket)
+  {
+    curl_easy_setopt(hnd, CURLOPT_UNIX_SOCKET_PATH, ctx->socket);
+  }
   curl_easy_setopt(hnd, CURLOPT_CUSTOMREQUEST, "DELETE");
   if (slist)
   {
@@ -387,6 +395,10 @@ long edgex_http_post
   curl_easy_setopt(hnd, CURLOPT_URL, url);
   curl_easy_setopt(hnd, CURLOPT_NOPROGRESS, 1L);
   curl_easy_setopt(hnd, CURLOPT_USERAGENT, "edgex");
+  if (ctx->socket && *ctx->socket)
+  {
+    curl_easy_setopt(hnd, CURLOPT_UNIX_SOCKET_PATH, ctx->socket);
+  }
   curl_easy_setopt(hnd, CURLOPT_HTTPHEADER, slist);
   curl_easy_setopt(hnd, CURLOPT_CUSTOMREQUEST, "POST");
   curl_easy_setopt(hnd, CURLOPT_POST, 1L);
@@ -550,6 +562,10 @@ edgex_http_postfile (iot_logging_client *lc, edgex_ctx *ctx, const char *url,
   curl_easy_setopt(hnd, CURLOPT_URL, url);
   curl_easy_setopt(hnd, CURLOPT_NOPROGRESS, 1L);
   curl_easy_setopt(hnd, CURLOPT_USERAGENT, "edgex");
+  if (ctx->socket && *ctx->socket)
+  {
+    curl_easy_setopt(hnd, CURLOPT_UNIX_SOCKET_PATH, ctx->socket);
+  }
   curl_easy_setopt(hnd, CURLOPT_HTTPHEADER, slist);
   //FIXME: we should always to TLS peer auth
   if (ctx->verify_peer && ctx->cacerts_file)
@@ -692,6 +708,10 @@ long edgex_http_put
   curl_easy_setopt(hnd, CURLOPT_URL, url);
   curl_easy_setopt(hnd, CURLOPT_NOPROGRESS, 1L);
   curl_easy_setopt(hnd, CURLOPT_USERAGENT, "edgex");
+  if (ctx->socket && *ctx->socket)
+  {
+    curl_easy_setopt(hnd, CURLOPT_UNIX_SOCKET_PATH, ctx->socket);
+  }
   curl_easy_setopt(hnd, CURLOPT_HTTPHEADER, slist);
   curl_easy_setopt(hnd, CURLOPT_UPLOAD, 1L);
 
@@ -19,6 +19,7 @@ typedef struct edgex_ctx
   char *tls_cert;       // Location of PEM encoded X509 cert to use for TLS client auth
   char *tls_key;        // Location of PEM encoded priv key to use for TLS client auth
   char *jwt_token;      // access_token provided by server for authenticating REST calls
+  const char *socket;   // Unix domain socket to connect via, instead of TCP
   char *buff;           // used during curl processing
   size_t size;
 } edgex_ctx;
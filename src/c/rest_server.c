@@ -9,10 +9,37 @@
 #include "rest_server.h"
 #include "microhttpd.h"
 #include "errorlist.h"
+#include "edgex_rest.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define STREAM_BLOCK_SIZE 4096
+
+#define REST_PATH_BUFSIZE 256
+
+/* Request bodies are collected in buffers cached per thread. Buffers larger
+ * than REST_POOL_MAXBUF are not cached, and no more than REST_PREALLOC_MAX is
+ * allocated up front on the strength of a Content-Length header alone.
+ */
+
+#define REST_POOL_SIZE 4
+#define REST_POOL_MAXBUF 65536
+#define REST_PREALLOC_MAX 1048576
+#define REST_BUF_MIN 1024
+
+/* Reply buffers carry their allocated size ahead of the reply, so that they
+ * can be returned to the pool once libmicrohttpd has sent them. The offset
+ * keeps the reply suitably aligned.
+ */
+
+#define REST_REPLY_OFFSET 16
 
 typedef struct handler_list
 {
@@ -20,23 +47,297 @@ typedef struct handler_list
   uint32_t methods;
   void *context;
   http_method_handler_fn handler;
+  edgex_metric *latency;
+  bool blocking;
   struct handler_list *next;
 } handler_list;
 
+/* Requests are routed by a radix trie, compiled from the handler list each
+ * time a handler is registered and published atomically. Nodes are held in
+ * a single array, the children of each node being contiguous. A route ends
+ * at the node whose label completes its url; routes whose url ends in '/'
+ * match any url of which they are a prefix, and the longest such route is
+ * used. Replaced routers are retained until the server is destroyed, as
+ * lookups may still be using them; registration only happens at startup.
+ */
+
+typedef struct rest_trie_node
+{
+  const char *label;
+  uint32_t len;
+  uint32_t child;
+  uint32_t nchild;
+  const handler_list *route;
+  bool prefix;
+} rest_trie_node;
+
+struct edgex_rest_response
+{
+  struct MHD_Response *response;
+  const char *reply;
+  const char *reply_type;
+  struct edgex_rest_response *next;
+};
+
+typedef struct rest_router
+{
+  struct rest_router *retired;
+  char *listing;
+  edgex_rest_response list;
+  uint32_t nroutes;
+  uint32_t nnodes;
+  const handler_list **routes;
+  rest_trie_node nodes[];
+} rest_router;
+
 struct edgex_rest_server
 {
   iot_logging_client *lc;
   struct MHD_Daemon *daemon;
+  struct MHD_Daemon *localdaemon;
+  char *socket;
+  bool pooled;
+  threadpool workers;
+  bool stopping;
+  size_t maxbody;
   handler_list *handlers;
+  rest_router *router;
+  edgex_rest_response *responses;
+  struct MHD_Response *empty;
+  edgex_metrics_family *latency;
+  pthread_mutex_t lock;
+};
+
+typedef struct rest_buffer
+{
+  char *data;
+  size_t size;
+} rest_buffer;
+
+typedef struct rest_buffer_pool
+{
+  uint32_t count;
+  rest_buffer bufs[REST_POOL_SIZE];
+} rest_buffer_pool;
+
+static pthread_key_t rest_pool_key;
+static pthread_once_t rest_pool_once = PTHREAD_ONCE_INIT;
+
+struct edgex_rest_stream
+{
+  edgex_rest_stream_reader reader;
+  edgex_rest_stream_free freefn;
+  void *cls;
+  const char *reply_type;
+  uint64_t signals;
+  struct MHD_Connection *conn;
+  bool suspended;
   pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct edgex_rest_request
+{
+  struct MHD_Connection *conn;
+  bool pooled;
+  edgex_rest_stream *stream;
+  edgex_nvpairs *headers;
+  const char *fixed;
+  const char *fixed_type;
+  const edgex_rest_response *response;
+  char *buffer;
+  uint64_t started;
 };
 
+/* Per-connection state. The body is collected here, and for requests whose
+ * handler runs on a worker thread, so are the handler's results.
+ */
+
 typedef struct http_context_s
 {
   char *m_data;
   size_t m_size;
+  size_t m_alloc;
+  bool m_rejected;
+  uint64_t m_started;
+  const handler_list *m_handler;
+  edgex_http_method m_method;
+  char *m_path;
+  edgex_rest_request m_req;
+  int m_status;
+  char *m_reply;
+  const char *m_reply_type;
+  bool m_done;
 } http_context_t;
 
+const char *edgex_rest_request_arg (edgex_rest_request *req, const char *name)
+{
+  return req ?
+    MHD_lookup_connection_value (req->conn, MHD_GET_ARGUMENT_KIND, name) : NULL;
+}
+
+const char *edgex_rest_request_get_header
+  (edgex_rest_request *req, const char *name)
+{
+  return req ?
+    MHD_lookup_connection_value (req->conn, MHD_HEADER_KIND, name) : NULL;
+}
+
+void edgex_rest_request_header
+  (edgex_rest_request *req, const char *name, const char *value)
+{
+  if (req)
+  {
+    edgex_nvpairs *hdr = malloc (sizeof (edgex_nvpairs));
+    hdr->name = strdup (name);
+    hdr->value = strdup (value);
+    hdr->next = req->headers;
+    req->headers = hdr;
+  }
+}
+
+edgex_rest_stream *edgex_rest_request_stream
+(
+  edgex_rest_request *req,
+  const char *reply_type,
+  edgex_rest_stream_reader reader,
+  edgex_rest_stream_free freefn,
+  void *cls
+)
+{
+  edgex_rest_stream *stream;
+
+  if (req == NULL || req->stream)
+  {
+    return NULL;
+  }
+  stream = malloc (sizeof (edgex_rest_stream));
+  stream->reader = reader;
+  stream->freefn = freefn;
+  stream->cls = cls;
+  stream->reply_type = reply_type;
+  stream->signals = 0;
+  stream->conn = req->pooled ? req->conn : NULL;
+  stream->suspended = false;
+  pthread_mutex_init (&stream->lock, NULL);
+  pthread_cond_init (&stream->cond, NULL);
+  req->stream = stream;
+  return stream;
+}
+
+void edgex_rest_request_reply_static
+  (edgex_rest_request *req, const char *reply, const char *reply_type)
+{
+  if (req)
+  {
+    req->fixed = reply;
+    req->fixed_type = reply_type;
+  }
+}
+
+void edgex_rest_request_response
+  (edgex_rest_request *req, const edgex_rest_response *response)
+{
+  if (req)
+  {
+    req->response = response;
+  }
+}
+
+/* Creates a response which libmicrohttpd may send any number of times. */
+
+static struct MHD_Response *response_build
+  (const char *reply, const char *reply_type)
+{
+  struct MHD_Response *response = MHD_create_response_from_buffer
+    (strlen (reply), (void *) reply, MHD_RESPMEM_PERSISTENT);
+  MHD_add_response_header (response, "Content-Type", reply_type);
+  return response;
+}
+
+edgex_rest_response *edgex_rest_response_create
+  (edgex_rest_server *svr, const char *reply, const char *reply_type)
+{
+  edgex_rest_response *resp = malloc (sizeof (edgex_rest_response));
+  resp->reply = reply;
+  resp->reply_type = reply_type ? reply_type : "text/plain";
+  resp->response = response_build (resp->reply, resp->reply_type);
+  pthread_mutex_lock (&svr->lock);
+  resp->next = svr->responses;
+  svr->responses = resp;
+  pthread_mutex_unlock (&svr->lock);
+  return resp;
+}
+
+void edgex_rest_stream_notify (edgex_rest_stream *stream)
+{
+  pthread_mutex_lock (&stream->lock);
+  stream->signals++;
+  if (stream->suspended)
+  {
+    stream->suspended = false;
+    MHD_resume_connection (stream->conn);
+  }
+  pthread_cond_broadcast (&stream->cond);
+  pthread_mutex_unlock (&stream->lock);
+}
+
+static ssize_t stream_read (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  edgex_rest_stream *stream = (edgex_rest_stream *) cls;
+  uint64_t seen;
+  ssize_t result;
+
+  /* The reader is called without holding the stream lock, so that producers
+   * may call notify while holding locks of their own.
+   */
+  while (true)
+  {
+    pthread_mutex_lock (&stream->lock);
+    seen = stream->signals;
+    pthread_mutex_unlock (&stream->lock);
+
+    result = stream->reader (stream->cls, buf, max);
+    if (result)
+    {
+      break;
+    }
+
+    /* In pooled mode the thread must not block, as it services other
+     * connections. Instead the connection is suspended until notified.
+     */
+    pthread_mutex_lock (&stream->lock);
+    if (stream->conn)
+    {
+      if (stream->signals == seen)
+      {
+        MHD_suspend_connection (stream->conn);
+        stream->suspended = true;
+        pthread_mutex_unlock (&stream->lock);
+        return 0;
+      }
+    }
+    else
+    {
+      while (stream->signals == seen)
+      {
+        pthread_cond_wait (&stream->cond, &stream->lock);
+      }
+    }
+    pthread_mutex_unlock (&stream->lock);
+  }
+  return (result < 0) ? MHD_CONTENT_READER_END_OF_STREAM : result;
+}
+
+static void stream_free (void *cls)
+{
+  edgex_rest_stream *stream = (edgex_rest_stream *) cls;
+  stream->freefn (stream->cls);
+  pthread_cond_destroy (&stream->cond);
+  pthread_mutex_destroy (&stream->lock);
+  free (stream);
+}
+
 static edgex_http_method method_from_string (const char *str)
 {
   if (strcmp (str, "GET") == 0)
@@ -52,25 +353,567 @@ static edgex_http_method method_from_string (const char *str)
   return UNKNOWN;
 }
 
-static char *normalizeUrl (const char *url)
+static int router_cmp (const void *a, const void *b)
+{
+  return strcmp
+    ((*(const handler_list **) a)->url, (*(const handler_list **) b)->url);
+}
+
+/* Builds the children of node n from the routes [lo, hi), which are sorted
+ * and share their first depth characters. Returns the next free node.
+ */
+
+static uint32_t router_build
+(
+  rest_router *r,
+  uint32_t n,
+  uint32_t lo,
+  uint32_t hi,
+  size_t depth,
+  uint32_t next
+)
+{
+  rest_trie_node *node = &r->nodes[n];
+  uint32_t first;
+
+  if (lo < hi && r->routes[lo]->url[depth] == '\0')
+  {
+    node->route = r->routes[lo++];
+    node->prefix = (depth && node->route->url[depth - 1] == '/');
+  }
+
+  /* Reserve a node for each distinct next character */
+
+  node->child = next;
+  for (uint32_t i = lo; i < hi; i++)
+  {
+    if (i == lo || r->routes[i]->url[depth] != r->routes[i - 1]->url[depth])
+    {
+      node->nchild++;
+    }
+  }
+  next += node->nchild;
+
+  first = lo;
+  for (uint32_t c = node->child; c < node->child + node->nchild; c++)
+  {
+    uint32_t last = first;
+    const char *a = r->routes[first]->url;
+    size_t end = depth + 1;
+
+    while (last + 1 < hi && r->routes[last + 1]->url[depth] == a[depth])
+    {
+      last++;
+    }
+    while (a[end] && a[end] == r->routes[last]->url[end])
+    {
+      end++;
+    }
+    r->nodes[c].label = a + depth;
+    r->nodes[c].len = end - depth;
+    next = router_build (r, c, first, last + 1, end, next);
+    first = last + 1;
+  }
+  return next;
+}
+
+/* Compiles the router for the current handler list. Where a url has been
+ * registered more than once, the latest registration is used.
+ */
+
+static rest_router *router_create (const handler_list *handlers)
+{
+  rest_router *r;
+  uint32_t n = 0;
+  size_t nodesize;
+
+  for (const handler_list *h = handlers; h; h = h->next)
+  {
+    n++;
+  }
+  nodesize = (2 * n + 1) * sizeof (rest_trie_node);
+  r = malloc (sizeof (rest_router) + nodesize + n * sizeof (handler_list *));
+  memset (r, 0, sizeof (rest_router) + nodesize);
+  r->routes = (const handler_list **) ((char *) r->nodes + nodesize);
+
+  for (const handler_list *h = handlers; h; h = h->next)
+  {
+    uint32_t i = 0;
+    while (i < r->nroutes && strcmp (r->routes[i]->url, h->url))
+    {
+      i++;
+    }
+    if (i == r->nroutes)
+    {
+      r->routes[r->nroutes++] = h;
+    }
+  }
+  qsort (r->routes, r->nroutes, sizeof (handler_list *), router_cmp);
+  r->nnodes = router_build (r, 0, 0, r->nroutes, 0, 1);
+
+  /* The list of handlers, as returned for "/" */
+
+  size_t lsize = 1;
+  for (uint32_t i = 0; i < r->nroutes; i++)
+  {
+    lsize += strlen (r->routes[i]->url) + 1;
+  }
+  r->listing = malloc (lsize);
+  r->listing[0] = '\0';
+  for (uint32_t i = 0; i < r->nroutes; i++)
+  {
+    strcat (r->listing, r->routes[i]->url);
+    strcat (r->listing, "\n");
+  }
+  r->list.reply = r->listing;
+  r->list.reply_type = "text/plain";
+  r->list.response = response_build (r->list.reply, r->list.reply_type);
+  r->list.next = NULL;
+  return r;
+}
+
+static void router_free (rest_router *r)
+{
+  MHD_destroy_response (r->list.response);
+  free (r->listing);
+  free (r);
+}
+
+/* Finds the route for a url, matching in place. Repeated '/' characters in
+ * the url are treated as one. On success, *rest is set to the remainder of
+ * the url following the route.
+ */
+
+static const handler_list *router_match
+  (const rest_router *r, const char *url, const char **rest)
+{
+  const rest_trie_node *node = &r->nodes[0];
+  const handler_list *best = NULL;
+  const char *pos = url;
+
+  while (true)
+  {
+    const rest_trie_node *child;
+    const rest_trie_node *end;
+
+    if (node->route && (node->prefix || *pos == '\0'))
+    {
+      best = node->route;
+      *rest = pos;
+    }
+    if (*pos == '\0')
+    {
+      break;
+    }
+
+    child = &r->nodes[node->child];
+    end = child + node->nchild;
+    while (child < end && child->label[0] != *pos)
+    {
+      child++;
+    }
+    if (child == end)
+    {
+      break;
+    }
+    for (uint32_t i = 0; i < child->len; i++)
+    {
+      if (*pos != child->label[i])
+      {
+        return best;
+      }
+      if (*pos++ == '/')
+      {
+        while (*pos == '/')
+        {
+          pos++;
+        }
+      }
+    }
+    node = child;
+  }
+  return best;
+}
+
+/* Copies the remainder of a url for a handler, deduplicating '/'. */
+
+static void copyPath (char *dest, const char *src)
+{
+  while (*src)
+  {
+    if ((*dest++ = *src++) == '/')
+    {
+      while (*src == '/')
+      {
+        src++;
+      }
+    }
+  }
+  *dest = '\0';
+}
+
+static void buffer_pool_free (void *p)
+{
+  rest_buffer_pool *pool = (rest_buffer_pool *) p;
+  for (uint32_t i = 0; i < pool->count; i++)
+  {
+    free (pool->bufs[i].data);
+  }
+  free (pool);
+}
+
+static void buffer_pool_init (void)
+{
+  pthread_key_create (&rest_pool_key, buffer_pool_free);
+}
+
+/* Obtains a buffer of at least the given size, preferring the smallest
+ * suitable buffer from this thread's pool.
+ */
+
+static char *buffer_get (size_t need, size_t *size)
+{
+  rest_buffer_pool *pool = pthread_getspecific (rest_pool_key);
+  char *result;
+
+  if (need < REST_BUF_MIN)
+  {
+    need = REST_BUF_MIN;
+  }
+  if (pool && pool->count)
+  {
+    uint32_t best = pool->count;
+    for (uint32_t i = 0; i < pool->count; i++)
+    {
+      if
+      (
+        pool->bufs[i].size >= need &&
+        (best == pool->count || pool->bufs[i].size < pool->bufs[best].size)
+      )
+      {
+        best = i;
+      }
+    }
+    if (best < pool->count)
+    {
+      *size = pool->bufs[best].size;
+      result = pool->bufs[best].data;
+      pool->bufs[best] = pool->bufs[--pool->count];
+      return result;
+    }
+  }
+  *size = need;
+  return malloc (need);
+}
+
+/* Returns a buffer to this thread's pool, or frees it if it is too large or
+ * the pool is full.
+ */
+
+static void buffer_put (char *data, size_t size)
+{
+  rest_buffer_pool *pool = pthread_getspecific (rest_pool_key);
+
+  if (data == NULL)
+  {
+    return;
+  }
+  if (pool == NULL && size <= REST_POOL_MAXBUF)
+  {
+    pool = malloc (sizeof (rest_buffer_pool));
+    pool->count = 0;
+    pthread_setspecific (rest_pool_key, pool);
+  }
+  if (pool && pool->count < REST_POOL_SIZE && size <= REST_POOL_MAXBUF)
+  {
+    pool->bufs[pool->count].data = data;
+    pool->bufs[pool->count++].size = size;
+  }
+  else
+  {
+    free (data);
+  }
+}
+
+uint64_t edgex_rest_request_started (edgex_rest_request *req)
+{
+  return req ? req->started : 0;
+}
+
+char *edgex_rest_request_buffer (edgex_rest_request *req, size_t size)
+{
+  size_t alloc;
+  char *raw;
+
+  if (req == NULL)
+  {
+    return malloc (size);
+  }
+  if (req->buffer)
+  {
+    raw = req->buffer - REST_REPLY_OFFSET;
+    buffer_put (raw, *(size_t *) raw);
+  }
+  raw = buffer_get (size + REST_REPLY_OFFSET, &alloc);
+  *(size_t *) raw = alloc;
+  req->buffer = raw + REST_REPLY_OFFSET;
+  return req->buffer;
+}
+
+static void reply_buffer_free (void *buf)
+{
+  char *raw = (char *) buf - REST_REPLY_OFFSET;
+  buffer_put (raw, *(size_t *) raw);
+}
+
+/* Frees the context, including any results not sent */
+
+static void http_context_free (http_context_t *ctx)
+{
+  if (ctx->m_reply && ctx->m_reply != ctx->m_req.buffer)
+  {
+    free (ctx->m_reply);
+  }
+  if (ctx->m_req.buffer)
+  {
+    reply_buffer_free (ctx->m_req.buffer);
+  }
+  if (ctx->m_req.stream)
+  {
+    stream_free (ctx->m_req.stream);
+  }
+  edgex_nvpairs_free (ctx->m_req.headers);
+  free (ctx->m_path);
+  buffer_put (ctx->m_data, ctx->m_alloc);
+  free (ctx);
+}
+
+/* Called by libmicrohttpd when a request is finished with, including when
+ * the client goes away before the request is handled.
+ */
+
+static void http_completed
+(
+  void *cls,
+  struct MHD_Connection *conn,
+  void **context,
+  enum MHD_RequestTerminationCode toe
+)
+{
+  if (*context)
+  {
+    http_context_free ((http_context_t *) *context);
+    *context = NULL;
+  }
+}
+
+/* Appends upload data to the request body, returning false if the body
+ * exceeds the size limit.
+ */
+
+static bool http_upload
+  (edgex_rest_server *svr, http_context_t *ctx, const char *data, size_t size)
 {
-  /* Only deduplication of '/' is performed */
+  size_t need = ctx->m_size + size + 1;
 
-  char *res = malloc (strlen (url) + 1);
-  const char *upos = url;
-  char *rpos = res;
-  while (*upos)
+  if (svr->maxbody && ctx->m_size + size > svr->maxbody)
   {
-    if ((*rpos++ = *upos++) == '/')
+    return false;
+  }
+  if (need > ctx->m_alloc)
+  {
+    if (ctx->m_data == NULL)
     {
-      while (*upos == '/')
+      ctx->m_data = buffer_get (need, &ctx->m_alloc);
+    }
+    else
+    {
+      size_t newsize = ctx->m_alloc * 2;
+      if (newsize < need)
       {
-        upos++;
+        newsize = need;
       }
+      ctx->m_data = realloc (ctx->m_data, newsize);
+      ctx->m_alloc = newsize;
     }
   }
-  *rpos = '\0';
-  return res;
+  memcpy (ctx->m_data + ctx->m_size, data, size);
+  ctx->m_size += size;
+  ctx->m_data[ctx->m_size] = '\0';
+  return true;
+}
+
+static int http_reject
+  (edgex_rest_server *svr, struct MHD_Connection *conn, int status)
+{
+  return MHD_queue_response (conn, status, svr->empty);
+}
+
+/* Runs the handler for a request, leaving its results in the context */
+
+static void http_invoke (http_context_t *ctx, char *path)
+{
+  const handler_list *h = ctx->m_handler;
+  uint64_t start = h->latency ? edgex_metrics_now () : 0;
+
+  ctx->m_status = h->handler
+  (
+    h->context,
+    &ctx->m_req,
+    path,
+    ctx->m_method,
+    ctx->m_size ? ctx->m_data : NULL,
+    ctx->m_size,
+    &ctx->m_reply,
+    &ctx->m_reply_type
+  );
+  edgex_metric_since (h->latency, start);
+}
+
+/* Runs a blocking handler on a worker thread. The connection was suspended
+ * when the work was added; resuming it has libmicrohttpd call http_handler
+ * again, which sends the reply.
+ */
+
+static void http_work (void *p)
+{
+  http_context_t *ctx = (http_context_t *) p;
+  http_invoke (ctx, ctx->m_path);
+  ctx->m_done = true;
+  MHD_resume_connection (ctx->m_req.conn);
+}
+
+/* Hands a request to the worker threads. Returns false if the server is
+ * stopping, in which case the caller runs the handler itself.
+ */
+
+static bool http_defer
+(
+  edgex_rest_server *svr,
+  struct MHD_Connection *conn,
+  http_context_t *ctx,
+  const char *rest
+)
+{
+  bool result = false;
+
+  pthread_mutex_lock (&svr->lock);
+  if (!svr->stopping)
+  {
+    ctx->m_path = malloc (strlen (rest) + 1);
+    copyPath (ctx->m_path, rest);
+    MHD_suspend_connection (conn);
+    thpool_add_work (svr->workers, http_work, ctx);
+    result = true;
+  }
+  pthread_mutex_unlock (&svr->lock);
+  return result;
+}
+
+/* Sends the reply held in the context, and frees the context. Returns the
+ * result of queueing the response. Where possible no copy of the reply is
+ * made: static and prebuilt replies are sent as they are, and reply buffers
+ * are recycled once sent (libmicrohttpd before 0.9.61 copies them instead).
+ * Prebuilt and empty replies are shared between requests unless headers are
+ * to be added.
+ */
+
+static int http_respond
+  (edgex_rest_server *svr, struct MHD_Connection *conn, http_context_t *ctx)
+{
+  int result;
+  edgex_rest_request *req = &ctx->m_req;
+  struct MHD_Response *response = NULL;
+  char *reply = ctx->m_reply;
+  const char *reply_type = ctx->m_reply_type;
+  bool shared = false;
+  bool recycle;
+
+  if (reply && (req->stream || req->response || req->fixed))
+  {
+    if (reply != req->buffer)
+    {
+      free (reply);
+    }
+    reply = NULL;
+  }
+  if (req->buffer && reply != req->buffer)
+  {
+    reply_buffer_free (req->buffer);
+  }
+  recycle = (reply && reply == req->buffer);
+  ctx->m_reply = NULL;
+  req->buffer = NULL;
+
+  if (req->stream)
+  {
+    reply_type = req->stream->reply_type;
+    response = MHD_create_response_from_callback
+    (
+      MHD_SIZE_UNKNOWN, STREAM_BLOCK_SIZE, stream_read, req->stream,
+      stream_free
+    );
+    req->stream = NULL;
+  }
+  else if (req->response && req->headers == NULL)
+  {
+    response = req->response->response;
+    shared = true;
+  }
+  else if (req->response || req->fixed)
+  {
+    const char *fixed = req->response ? req->response->reply : req->fixed;
+    reply_type = req->response ? req->response->reply_type : req->fixed_type;
+    response = MHD_create_response_from_buffer
+      (strlen (fixed), (void *) fixed, MHD_RESPMEM_PERSISTENT);
+  }
+  else if (recycle)
+  {
+#if MHD_VERSION >= 0x00096100
+    response = MHD_create_response_from_buffer_with_free_callback
+      (strlen (reply), reply, reply_buffer_free);
+#else
+    /* Older libmicrohttpd cannot hand the buffer back, so it is copied */
+    response = MHD_create_response_from_buffer
+      (strlen (reply), reply, MHD_RESPMEM_MUST_COPY);
+    reply_buffer_free (reply);
+#endif
+  }
+  else if (reply)
+  {
+    response = MHD_create_response_from_buffer
+      (strlen (reply), reply, MHD_RESPMEM_MUST_FREE);
+  }
+  else if (reply_type == NULL && req->headers == NULL)
+  {
+    response = svr->empty;
+    shared = true;
+  }
+  else
+  {
+    response = MHD_create_response_from_buffer
+      (0, "", MHD_RESPMEM_PERSISTENT);
+  }
+
+  if (!shared)
+  {
+    if (reply_type == NULL)
+    {
+      reply_type = "text/plain";
+    }
+    MHD_add_response_header (response, "Content-Type", reply_type);
+    for (edgex_nvpairs *hdr = req->headers; hdr; hdr = hdr->next)
+    {
+      MHD_add_response_header (response, hdr->name, hdr->value);
+    }
+  }
+  result = MHD_queue_response (conn, ctx->m_status, response);
+  if (!shared)
+  {
+    MHD_destroy_response (response);
+  }
+  http_context_free (ctx);
+  return result;
 }
 
 static int http_handler
@@ -85,149 +928,302 @@ static int http_handler
   void **context
 )
 {
-  int status = MHD_HTTP_OK;
   http_context_t *ctx = (http_context_t *) *context;
   edgex_rest_server *svr = (edgex_rest_server *) this;
-  struct MHD_Response *response = NULL;
-  char *reply = NULL;
-  const char *reply_type = NULL;
-  handler_list *h;
+  const handler_list *h;
+  const rest_router *router;
 
-  /* First call used to create call context */
+  /* First call used to create call context. If the body length is given,
+   * it is checked against the limit and a buffer is allocated for it. A
+   * body over the limit is refused once it has been received, as
+   * libmicrohttpd does not accept a response while the upload is running.
+   */
 
   if (ctx == 0)
   {
-    ctx = (http_context_t *) malloc (sizeof (*ctx));
-    ctx->m_size = 0;
-    ctx->m_data = NULL;
+    const char *lenstr = MHD_lookup_connection_value
+      (conn, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+    ctx = (http_context_t *) calloc (1, sizeof (*ctx));
+    ctx->m_started = edgex_metrics_now ();
     *context = (void *) ctx;
+    if (lenstr)
+    {
+      unsigned long long len = strtoull (lenstr, NULL, 10);
+      if (svr->maxbody && len > svr->maxbody)
+      {
+        iot_log_error
+          (svr->lc, "Request body of %llu bytes exceeds limit", len);
+        ctx->m_rejected = true;
+      }
+      else if (len)
+      {
+        ctx->m_data = buffer_get
+        (
+          (len < REST_PREALLOC_MAX) ? len + 1 : REST_PREALLOC_MAX,
+          &ctx->m_alloc
+        );
+      }
+    }
     return MHD_YES;
   }
 
-  /* Subsequent calls transfer data */
+  /* A request handled by a worker thread is complete */
+
+  if (ctx->m_done)
+  {
+    *context = 0;
+    return http_respond (svr, conn, ctx);
+  }
+
+  /* Subsequent calls transfer data. Once the body is rejected any further
+   * data is discarded.
+   */
 
   if (*upload_data_size)
   {
-    ctx->m_data = (char *) realloc
-      (ctx->m_data, ctx->m_size + (*upload_data_size) + 1);
-    memcpy (ctx->m_data + ctx->m_size, upload_data, (*upload_data_size) + 1);
-    ctx->m_size += *upload_data_size;
+    if
+    (
+      !ctx->m_rejected &&
+      !http_upload (svr, ctx, upload_data, *upload_data_size)
+    )
+    {
+      iot_log_error (svr->lc, "Request body exceeds limit");
+      ctx->m_rejected = true;
+    }
     *upload_data_size = 0;
     return MHD_YES;
   }
-  *context = 0;
+  if (ctx->m_rejected)
+  {
+    return http_reject (svr, conn, MHD_HTTP_PAYLOAD_TOO_LARGE);
+  }
 
   /* Last call with no data handles request */
 
-  edgex_http_method method = method_from_string (methodname);
+  ctx->m_req = (edgex_rest_request)
+    { .conn = conn, .pooled = svr->pooled, .started = ctx->m_started };
+  ctx->m_method = method_from_string (methodname);
+  ctx->m_status = MHD_HTTP_OK;
+  router = __atomic_load_n (&svr->router, __ATOMIC_ACQUIRE);
 
   if (strlen (url) == 0 || strcmp (url, "/") == 0)
   {
-    if (method == GET)
+    if (ctx->m_method == GET)
     {
-      /* List available handlers */
-      int rsize = 1;
-      pthread_mutex_lock (&svr->lock);
-      for (h = svr->handlers; h; h = h->next)
-      {
-        rsize += strlen (h->url) + 1;
-      }
-      reply = malloc (rsize);
-      reply[0] = '\0';
-      for (h = svr->handlers; h; h = h->next)
-      {
-        strcat (reply, h->url);
-        strcat (reply, "\n");
-      }
-      pthread_mutex_unlock (&svr->lock);
+      /* List available handlers, using the router's prebuilt response */
+      ctx->m_req.response = &router->list;
     }
     else
     {
-      status = MHD_HTTP_METHOD_NOT_ALLOWED;
+      ctx->m_status = MHD_HTTP_METHOD_NOT_ALLOWED;
     }
   }
   else
   {
-    status = MHD_HTTP_NOT_FOUND;
-    char *nurl = normalizeUrl (url);
-    pthread_mutex_lock (&svr->lock);
-    for (h = svr->handlers; h; h = h->next)
-    {
-      if
-      (
-        (h->url[strlen (h->url) - 1] == '/') ?
-        (strncmp (nurl, h->url, strlen (h->url)) == 0) :
-        (strcmp (nurl, h->url) == 0)
-      )
-      {
-        break;
-      }
-    }
-    pthread_mutex_unlock (&svr->lock);
+    const char *rest;
+    ctx->m_status = MHD_HTTP_NOT_FOUND;
+    h = router_match (router, url, &rest);
     if (h)
     {
-      if (method & h->methods)
+      if (ctx->m_method & h->methods)
       {
-        status = h->handler
-        (
-          h->context,
-          nurl + strlen (h->url),
-          method,
-          ctx->m_data,
-          ctx->m_size,
-          &reply,
-          &reply_type
-        );
+        ctx->m_handler = h;
+
+        /* In pooled mode, handlers which may block run on a worker thread
+         * so as not to hold up the other connections on this thread.
+         */
+        if (h->blocking && svr->workers && http_defer (svr, conn, ctx, rest))
+        {
+          return MHD_YES;
+        }
+
+        /* Handlers may modify the path, so it is copied; usually this
+         * fits in a buffer on the stack.
+         */
+        char buf[REST_PATH_BUFSIZE];
+        size_t len = strlen (rest);
+        char *path = (len < REST_PATH_BUFSIZE) ? buf : malloc (len + 1);
+        copyPath (path, rest);
+        http_invoke (ctx, path);
+        if (path != buf)
+        {
+          free (path);
+        }
       }
       else
       {
-        status = MHD_HTTP_METHOD_NOT_ALLOWED;
+        ctx->m_status = MHD_HTTP_METHOD_NOT_ALLOWED;
       }
     }
-    free (nurl);
   }
 
-  /* Send reply */
+  *context = 0;
+  return http_respond (svr, conn, ctx);
+}
+
+/* Checks whether a socket at the given address was left by a previous run,
+ * so may be removed: that is, whether connecting to it is refused. A socket
+ * in use, or one which cannot be checked, is left alone.
+ */
+
+static bool local_stale (iot_logging_client *lc, struct sockaddr_un *addr)
+{
+  bool result = false;
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
-  if (reply_type == NULL)
+  if (fd == -1)
   {
-    reply_type = "text/plain";
+    iot_log_error (lc, "Unable to create socket: %s", strerror (errno));
+    return false;
   }
-  if (reply == NULL)
+  if (connect (fd, (struct sockaddr *) addr, sizeof (*addr)) == 0)
   {
-    reply = strdup ("");
+    iot_log_error (lc, "Socket %s is in use", addr->sun_path);
   }
-  response = MHD_create_response_from_buffer
-    (strlen (reply), reply, MHD_RESPMEM_MUST_FREE);
-  MHD_add_response_header (response, "Content-Type", reply_type);
-  MHD_queue_response (conn, status, response);
-  MHD_destroy_response (response);
+  else if (errno == ECONNREFUSED)
+  {
+    result = true;
+  }
+  else
+  {
+    iot_log_error
+      (lc, "Unable to check socket %s: %s", addr->sun_path, strerror (errno));
+  }
+  close (fd);
+  return result;
+}
 
-  /* Clean up */
+/* Creates a listening Unix domain socket at the given path. A socket left
+ * there by a previous run is replaced, but one still in use is not, nor are
+ * other files.
+ */
 
-  if (ctx->m_data)
-  { free (ctx->m_data); }
-  free (ctx);
-  return MHD_YES;
+static int listen_local (iot_logging_client *lc, const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    iot_log_error (lc, "Socket path %s is too long", path);
+    return -1;
+  }
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  if (stat (path, &st) == 0 && S_ISSOCK (st.st_mode))
+  {
+    if (!local_stale (lc, &addr))
+    {
+      return -1;
+    }
+    unlink (path);
+  }
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    iot_log_error (lc, "Unable to create socket: %s", strerror (errno));
+    return -1;
+  }
+  if
+  (
+    bind (fd, (struct sockaddr *) &addr, sizeof (addr)) != 0 ||
+    listen (fd, SOMAXCONN) != 0
+  )
+  {
+    iot_log_error
+      (lc, "Unable to listen on socket %s: %s", path, strerror (errno));
+    close (fd);
+    return -1;
+  }
+  return fd;
 }
 
 edgex_rest_server *edgex_rest_server_create
-  (iot_logging_client *lc, uint16_t port, edgex_error *err)
+(
+  iot_logging_client *lc,
+  const edgex_rest_server_options *options,
+  edgex_error *err
+)
 {
   edgex_rest_server *svr;
-  uint16_t flags = MHD_USE_THREAD_PER_CONNECTION;
+  unsigned int flags;
+  struct MHD_OptionItem opts[6];
+  int nopts = 0;
+  uint16_t port = options->port;
   /* config: flags |= MHD_USE_IPv6 ? */
 
+  pthread_once (&rest_pool_once, buffer_pool_init);
+
   svr = malloc (sizeof (edgex_rest_server));
   svr->lc = lc;
+  svr->daemon = NULL;
+  svr->localdaemon = NULL;
+  svr->socket = NULL;
   svr->handlers = NULL;
+  svr->router = router_create (NULL);
+  svr->responses = NULL;
+  svr->empty = response_build ("", "text/plain");
+  svr->pooled = (options->threads != 0);
+  svr->workers = NULL;
+  svr->stopping = false;
+  svr->maxbody = options->maxbody;
+  svr->latency = options->metrics ? edgex_metrics_family_create
+  (
+    options->metrics, EDGEX_METRICS_HISTOGRAM, "edgex_rest_request_seconds",
+    "Time taken to handle REST requests", "route", true
+  ) : NULL;
   pthread_mutex_init (&svr->lock, NULL);
 
+  /* Either a thread per connection, or a fixed pool of threads each polling
+   * its share of the connections (using epoll where available). In pooled
+   * mode, blocking handlers run on a separate pool of worker threads, and
+   * streamed replies suspend their connection while waiting for data.
+   */
+  if (svr->pooled)
+  {
+    flags = MHD_USE_AUTO_INTERNAL_THREAD | MHD_ALLOW_SUSPEND_RESUME;
+    opts[nopts++] = (struct MHD_OptionItem)
+      { MHD_OPTION_THREAD_POOL_SIZE, options->threads, NULL };
+    svr->workers = thpool_init
+      (options->workers ? options->workers : options->threads);
+  }
+  else
+  {
+    flags = MHD_USE_THREAD_PER_CONNECTION;
+  }
+  if (options->maxconns)
+  {
+    opts[nopts++] = (struct MHD_OptionItem)
+      { MHD_OPTION_CONNECTION_LIMIT, options->maxconns, NULL };
+  }
+  opts[nopts++] = (struct MHD_OptionItem)
+    { MHD_OPTION_CONNECTION_TIMEOUT, options->timeout, NULL };
+  opts[nopts++] = (struct MHD_OptionItem)
+    { MHD_OPTION_NOTIFY_COMPLETED, (intptr_t) http_completed, svr };
+  opts[nopts] = (struct MHD_OptionItem) { MHD_OPTION_END, 0, NULL };
+
   /* Start http server */
 
-  iot_log_debug (lc, "Starting HTTP server on port %d", port);
-  svr->daemon =
-    MHD_start_daemon (flags, port, 0, 0, http_handler, svr, MHD_OPTION_END);
+  if (svr->pooled)
+  {
+    iot_log_debug
+    (
+      lc, "Starting HTTP server on port %d with %u threads",
+      port, options->threads
+    );
+  }
+  else
+  {
+    iot_log_debug (lc, "Starting HTTP server on port %d", port);
+  }
+  svr->daemon = MHD_start_daemon
+  (
+    flags, port, 0, 0, http_handler, svr,
+    MHD_OPTION_ARRAY, opts, MHD_OPTION_END
+  );
   if (svr->daemon == NULL)
   {
     *err = EDGEX_HTTP_SERVER_FAIL;
@@ -235,19 +1231,50 @@ edgex_rest_server *edgex_rest_server_create
     edgex_rest_server_destroy (svr);
     return NULL;
   }
-  else
+
+  /* Local clients may also connect via a Unix domain socket. This is served
+   * by a second daemon, as libmicrohttpd listens on one socket per daemon;
+   * it has the same threading and limits as the first.
+   */
+  if (options->socket && *options->socket)
   {
-    return svr;
+    int fd = listen_local (lc, options->socket);
+    if (fd != -1)
+    {
+      svr->socket = strdup (options->socket);
+      opts[nopts++] = (struct MHD_OptionItem)
+        { MHD_OPTION_LISTEN_SOCKET, fd, NULL };
+      opts[nopts] = (struct MHD_OptionItem) { MHD_OPTION_END, 0, NULL };
+      iot_log_debug (lc, "Starting HTTP server on %s", options->socket);
+      svr->localdaemon = MHD_start_daemon
+      (
+        flags, 0, 0, 0, http_handler, svr,
+        MHD_OPTION_ARRAY, opts, MHD_OPTION_END
+      );
+      if (svr->localdaemon == NULL)
+      {
+        close (fd);
+      }
+    }
+    if (svr->localdaemon == NULL)
+    {
+      *err = EDGEX_HTTP_SERVER_FAIL;
+      iot_log_debug (lc, "MHD_start_daemon failed for local socket");
+      edgex_rest_server_destroy (svr);
+      return NULL;
+    }
   }
+  return svr;
 }
 
-void edgex_rest_server_register_handler
+static void register_handler
 (
   edgex_rest_server *svr,
   const char *url,
   uint32_t methods,
   void *context,
-  http_method_handler_fn handler
+  http_method_handler_fn handler,
+  bool blocking
 )
 {
   handler_list *entry = malloc (sizeof (handler_list));
@@ -255,19 +1282,72 @@ void edgex_rest_server_register_handler
   entry->url = url;
   entry->methods = methods;
   entry->context = context;
+  entry->blocking = blocking;
+  entry->latency = edgex_metrics_family_get (svr->latency, url);
   pthread_mutex_lock (&svr->lock);
   entry->next = svr->handlers;
   svr->handlers = entry;
+  rest_router *router = router_create (svr->handlers);
+  router->retired = svr->router;
+  __atomic_store_n (&svr->router, router, __ATOMIC_RELEASE);
   pthread_mutex_unlock (&svr->lock);
 }
 
+void edgex_rest_server_register_handler
+(
+  edgex_rest_server *svr,
+  const char *url,
+  uint32_t methods,
+  void *context,
+  http_method_handler_fn handler
+)
+{
+  register_handler (svr, url, methods, context, handler, false);
+}
+
+void edgex_rest_server_register_blocking_handler
+(
+  edgex_rest_server *svr,
+  const char *url,
+  uint32_t methods,
+  void *context,
+  http_method_handler_fn handler
+)
+{
+  register_handler (svr, url, methods, context, handler, true);
+}
+
 void edgex_rest_server_destroy (edgex_rest_server *svr)
 {
   handler_list *tmp;
+
+  /* Suspended connections must be resumed before the daemons are stopped,
+   * so no more work is handed out and the workers are left to finish.
+   */
+  if (svr->workers)
+  {
+    pthread_mutex_lock (&svr->lock);
+    svr->stopping = true;
+    pthread_mutex_unlock (&svr->lock);
+    thpool_wait (svr->workers);
+  }
   if (svr->daemon)
   {
     MHD_stop_daemon (svr->daemon);
   }
+  if (svr->localdaemon)
+  {
+    MHD_stop_daemon (svr->localdaemon);
+  }
+  if (svr->socket)
+  {
+    unlink (svr->socket);
+    free (svr->socket);
+  }
+  if (svr->workers)
+  {
+    thpool_destroy (svr->workers);
+  }
   pthread_mutex_lock (&svr->lock);
   while (svr->handlers)
   {
@@ -275,6 +1355,20 @@ void edgex_rest_server_destroy (edgex_rest_server *svr)
     free (svr->handlers);
     svr->handlers = tmp;
   }
+  while (svr->router)
+  {
+    rest_router *r = svr->router->retired;
+    router_free (svr->router);
+    svr->router = r;
+  }
+  while (svr->responses)
+  {
+    edgex_rest_response *r = svr->responses->next;
+    MHD_destroy_response (svr->responses->response);
+    free (svr->responses);
+    svr->responses = r;
+  }
+  MHD_destroy_response (svr->empty);
   pthread_mutex_unlock (&svr->lock);
   pthread_mutex_destroy (&svr->lock);
   free (svr);
@@ -12,13 +12,38 @@
 #include "edgex/edgex.h"
 #include "edgex/edgex_logging.h"
 #include "edgex/error.h"
+#include "metrics.h"
 
 struct edgex_rest_server;
 typedef struct edgex_rest_server edgex_rest_server;
 
+/* Per-request data, passed to handlers. This is NULL when a handler is
+ * invoked other than via the REST server, eg by the scheduler.
+ */
+
+struct edgex_rest_request;
+typedef struct edgex_rest_request edgex_rest_request;
+
+/* Streamed replies. The reader function is called to obtain successive blocks
+ * of the reply body. It returns the number of bytes written to buf, zero if
+ * no data is available yet, or -1 at the end of the reply. When no data is
+ * available the server waits for edgex_rest_stream_notify to be called before
+ * trying again (in pooled mode, by suspending the connection). The free
+ * function is called when the reply is complete or the client has gone away;
+ * the notify function must not be called after this.
+ */
+
+struct edgex_rest_stream;
+typedef struct edgex_rest_stream edgex_rest_stream;
+
+typedef ssize_t (*edgex_rest_stream_reader) (void *cls, char *buf, size_t max);
+
+typedef void (*edgex_rest_stream_free) (void *cls);
+
 typedef int (*http_method_handler_fn)
 (
   void *context,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -27,8 +52,36 @@ typedef int (*http_method_handler_fn)
   const char **reply_type
 );
 
+/* Options for the REST server. If threads is zero, each connection is
+ * serviced by a thread of its own; otherwise connections are multiplexed over
+ * a pool of that many threads, and blocking handlers are run on a separate
+ * pool of worker threads, of size workers (or threads, if that is zero). A
+ * maxconns of zero leaves the number of connections at the libmicrohttpd
+ * default, a timeout of zero (seconds) never closes idle connections, and a
+ * maxbody of zero (bytes) does not limit the size of request bodies. If a
+ * metrics registry is given, the time taken by each handler is recorded in
+ * it, by route. If a socket path is given, the server also listens on a Unix
+ * domain socket there, for local clients.
+ */
+
+typedef struct edgex_rest_server_options
+{
+  uint16_t port;
+  uint32_t threads;
+  uint32_t workers;
+  uint32_t maxconns;
+  uint32_t timeout;
+  size_t maxbody;
+  edgex_metrics *metrics;
+  const char *socket;
+} edgex_rest_server_options;
+
 extern edgex_rest_server *edgex_rest_server_create
-  (iot_logging_client *lc, uint16_t port, edgex_error *err);
+(
+  iot_logging_client *lc,
+  const edgex_rest_server_options *options,
+  edgex_error *err
+);
 
 extern void edgex_rest_server_register_handler
 (
@@ -39,6 +92,85 @@ extern void edgex_rest_server_register_handler
   http_method_handler_fn handler
 );
 
+/* As edgex_rest_server_register_handler, for a handler which may block, eg
+ * waiting for a device. In pooled mode such a handler runs on a worker
+ * thread while its connection is suspended, so that it does not hold up the
+ * other connections served by the same thread.
+ */
+
+extern void edgex_rest_server_register_blocking_handler
+(
+  edgex_rest_server *svr,
+  const char *url,
+  edgex_http_method method,
+  void *context,
+  http_method_handler_fn handler
+);
+
+/* Returns the value of a query argument, or NULL if it is not present. */
+
+extern const char *edgex_rest_request_arg
+  (edgex_rest_request *req, const char *name);
+
+/* Returns the value of a request header, or NULL if it is not present. */
+
+extern const char *edgex_rest_request_get_header
+  (edgex_rest_request *req, const char *name);
+
+/* Adds a header to the reply. */
+
+extern void edgex_rest_request_header
+  (edgex_rest_request *req, const char *name, const char *value);
+
+/* Request that the reply is streamed. Any reply set by the handler is then
+ * ignored, but the handler's status code is used. Returns NULL if the request
+ * cannot be streamed.
+ */
+
+extern edgex_rest_stream *edgex_rest_request_stream
+(
+  edgex_rest_request *req,
+  const char *reply_type,
+  edgex_rest_stream_reader reader,
+  edgex_rest_stream_free freefn,
+  void *cls
+);
+
+extern void edgex_rest_stream_notify (edgex_rest_stream *stream);
+
+/* Replies without copying. A handler may give a static reply, which must
+ * remain valid until the server is destroyed, or a prebuilt response, which
+ * is created once and may be sent for any number of requests. Prebuilt
+ * responses belong to the server and are freed with it. Either takes the
+ * place of any reply set by the handler. These have no effect if req is NULL.
+ */
+
+struct edgex_rest_response;
+typedef struct edgex_rest_response edgex_rest_response;
+
+extern void edgex_rest_request_reply_static
+  (edgex_rest_request *req, const char *reply, const char *reply_type);
+
+extern edgex_rest_response *edgex_rest_response_create
+  (edgex_rest_server *svr, const char *reply, const char *reply_type);
+
+extern void edgex_rest_request_response
+  (edgex_rest_request *req, const edgex_rest_response *response);
+
+/* Returns a buffer of at least size bytes in which a handler may build its
+ * reply. If the handler's reply is this buffer, it is recycled once sent
+ * instead of being freed. If req is NULL the buffer is simply allocated, to
+ * be freed by the caller.
+ */
+
+extern char *edgex_rest_request_buffer (edgex_rest_request *req, size_t size);
+
+/* Returns the time (as from edgex_metrics_now) at which the request began
+ * to be received, or zero if req is NULL.
+ */
+
+extern uint64_t edgex_rest_request_started (edgex_rest_request *req);
+
 extern void edgex_rest_server_destroy (edgex_rest_server *svr);
 
 #endif
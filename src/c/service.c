@@ -19,6 +19,7 @@
 #include "rest.h"
 #include "edgex_rest.h"
 #include "edgex_time.h"
+#include "intern.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -31,9 +32,13 @@
 #define EDGEX_DEV_API_DISCOVERY "/api/v1/discovery"
 #define EDGEX_DEV_API_DEVICE "/api/v1/device/"
 #define EDGEX_DEV_API_CALLBACK "/api/v1/callback"
+#define EDGEX_DEV_API_METRICS "/api/v1/metrics"
+#define EDGEX_DEV_API_TRACE "/api/v1/trace"
+#define EDGEX_DEV_API_EVENTS "/api/v1/events"
 #define ADDR_EXT "_addr"
 
 #define POOL_THREADS 8
+#define TIMEOUT_THREADS 2
 
 typedef struct postparams
 {
@@ -47,9 +52,98 @@ typedef struct edgex_device_service_job
 {
   edgex_device_service *svc;
   char *url;
+  uint64_t interval;
+  uint64_t last;
   struct edgex_device_service_job *next;
 } edgex_device_service_job;
 
+static double countDevices (void *p)
+{
+  return edgex_devmap_size (((edgex_device_service *) p)->devices);
+}
+
+static double countProfiles (void *p)
+{
+  return edgex_devmap_nprofiles (((edgex_device_service *) p)->devices);
+}
+
+static double countInterned (void *p)
+{
+  return edgex_intern_count ();
+}
+
+static double countMergedReads (void *p)
+{
+  edgex_device_service *svc = (edgex_device_service *) p;
+  unsigned n;
+  pthread_mutex_lock (&svc->mergelock);
+  n = svc->mergedreads.base.nnodes;
+  pthread_mutex_unlock (&svc->mergelock);
+  return n;
+}
+
+static void createMetrics (edgex_device_service *svc)
+{
+  edgex_metrics *m = edgex_metrics_create ();
+  edgex_metrics_family *queues;
+
+  svc->metrics = m;
+  svc->stats.getlatency = edgex_metrics_family_create
+  (
+    m, EDGEX_METRICS_HISTOGRAM, "edgex_driver_get_seconds",
+    "Time taken by the driver to read from devices", "profile", true
+  );
+  svc->stats.putlatency = edgex_metrics_family_create
+  (
+    m, EDGEX_METRICS_HISTOGRAM, "edgex_driver_put_seconds",
+    "Time taken by the driver to write to devices", "profile", true
+  );
+  svc->stats.uploadlatency = edgex_metrics_metric_create
+  (
+    m, EDGEX_METRICS_HISTOGRAM, "edgex_coredata_upload_seconds",
+    "Time taken to upload events to core-data"
+  );
+  svc->stats.uploadfailures = edgex_metrics_metric_create
+  (
+    m, EDGEX_METRICS_COUNTER, "edgex_coredata_upload_failures_total",
+    "Events which could not be uploaded to core-data"
+  );
+  svc->stats.schedlag = edgex_metrics_metric_create
+  (
+    m, EDGEX_METRICS_HISTOGRAM, "edgex_schedule_lag_seconds",
+    "Lateness of scheduled device commands relative to their interval"
+  );
+  queues = edgex_metrics_family_create
+  (
+    m, EDGEX_METRICS_GAUGE, "edgex_pool_queue_depth",
+    "Work items waiting for a thread", "pool", true
+  );
+  svc->stats.thqueue = edgex_metrics_family_get (queues, "service");
+  svc->stats.cmdqueue = edgex_metrics_family_get (queues, "command");
+  svc->stats.driverqueue = edgex_metrics_family_get (queues, "driver");
+  svc->stats.timeoutqueue = edgex_metrics_family_get (queues, "timeout");
+  edgex_metrics_observe
+  (
+    m, EDGEX_METRICS_GAUGE, "edgex_devices",
+    "Devices in the registry", countDevices, svc
+  );
+  edgex_metrics_observe
+  (
+    m, EDGEX_METRICS_GAUGE, "edgex_profiles",
+    "Device profiles in the registry", countProfiles, svc
+  );
+  edgex_metrics_observe
+  (
+    m, EDGEX_METRICS_GAUGE, "edgex_interned_strings",
+    "Strings held in the intern table", countInterned, NULL
+  );
+  edgex_metrics_observe
+  (
+    m, EDGEX_METRICS_GAUGE, "edgex_merged_reads",
+    "Devices with scheduled reads waiting to be merged", countMergedReads, svc
+  );
+}
+
 edgex_device_service *edgex_device_service_new
 (
   const char *name,
@@ -87,21 +181,12 @@ edgex_device_service *edgex_device_service_new
   result->version = version;
   result->userdata = impldata;
   result->userfns = implfns;
-  pthread_rwlockattr_t rwatt;
-  pthread_rwlockattr_init (&rwatt);
-#ifdef  __GLIBC_PREREQ
-#if __GLIBC_PREREQ(2, 1)
-  /* Avoid heavy readlock use (eg spammed "all" commands) blocking discovery */
-  pthread_rwlockattr_setkind_np
-    (&rwatt, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
-#endif
-#endif
-  pthread_rwlock_init (&result->deviceslock, &rwatt);
+  result->devices = edgex_devmap_alloc ();
   pthread_mutex_init (&result->discolock, NULL);
-  pthread_mutex_init (&result->profileslock, NULL);
-  edgex_map_init (&result->devices);
-  edgex_map_init (&result->name_to_id);
+  pthread_mutex_init (&result->mergelock, NULL);
+  edgex_map_init (&result->mergedreads);
   result->sjobs = NULL;
+  createMetrics (result);
   result->thpool = thpool_init (POOL_THREADS);
   result->scheduler = iot_scheduler_init (&result->thpool);
   return result;
@@ -110,6 +195,7 @@ edgex_device_service *edgex_device_service_new
 static int ping_handler
 (
   void *ctx,
+  edgex_rest_request *req,
   char *url,
   edgex_http_method method,
   const char *upload_data,
@@ -118,20 +204,45 @@ static int ping_handler
   const char **reply_type
 )
 {
-  *reply = strdup ("{\"value\":\"pong\"}\n");
-  *reply_type = "application/json";
+  edgex_rest_request_response (req, (edgex_rest_response *) ctx);
   return MHD_HTTP_OK;
 }
 
+static void subscriber_keepalive (void *p)
+{
+  edgex_eventhub_keepalive ((edgex_eventhub *) p);
+}
+
 static void dev_invoker (void *p)
 {
   int rc;
   char *reply = NULL;
   const char *reply_type;
   edgex_device_service_job *job = (edgex_device_service_job *) p;
+  uint64_t now = edgex_metrics_now ();
+  uint64_t last = __atomic_exchange_n (&job->last, now, __ATOMIC_RELAXED);
+
+  /* Lateness is measured from the previous run, so that it is not affected
+   * by how the scheduler aligns the first run.
+   */
+
+  if (last)
+  {
+    uint64_t elapsed = now - last;
+    edgex_metric_record
+    (
+      job->svc->stats.schedlag,
+      (elapsed > job->interval) ? elapsed - job->interval : 0
+    );
+  }
+
+  if (edgex_device_merge_read (job->svc, job->url))
+  {
+    return;
+  }
 
   rc = edgex_device_handler_device
-    (job->svc, job->url, GET, NULL, 0, &reply, &reply_type);
+    (job->svc, NULL, job->url, GET, NULL, 0, &reply, &reply_type);
 
   if (rc != MHD_HTTP_OK)
   {
@@ -425,21 +536,70 @@ void edgex_device_service_start
     }
   }
 
+  /* Threads for running commands on multiple devices, for synchronous driver
+   * calls which have a deadline, and for delivering timeouts.
+   */
+
+  if (svc->config.device.maxparallelcmds == 0)
+  {
+    svc->config.device.maxparallelcmds = POOL_THREADS;
+  }
+  svc->cmdpool = thpool_init (svc->config.device.maxparallelcmds);
+  svc->driverpool = thpool_init (svc->config.device.maxparallelcmds);
+  svc->timeoutpool = thpool_init (TIMEOUT_THREADS);
+  svc->cmdlimit = edgex_cmdlimit_create (svc->config.device.maxcmdsperaddr);
+  svc->admission = edgex_admission_create
+  (
+    svc->config.device.maxinflightcmds,
+    svc->config.device.maxinflightperdev,
+    svc->config.device.cmdqueuelen,
+    svc->config.device.cmdqueuetimeout,
+    svc->metrics
+  );
+  svc->watchdog = edgex_watchdog_create ();
+  svc->events = edgex_eventhub_create
+  (
+    svc->logger,
+    svc->config.service.maxsubscribers,
+    svc->config.service.subscriberqlen,
+    svc->metrics
+  );
+  svc->tracer = edgex_tracer_create
+    (svc->config.service.tracerate, svc->config.service.tracesize);
+  if (svc->tracer)
+  {
+    iot_log_info
+    (
+      svc->logger, "Tracing one in %u device commands",
+      svc->config.service.tracerate
+    );
+  }
+
   /* Start REST server */
 
-  svc->daemon = edgex_rest_server_create
-    (svc->logger, svc->config.service.port, err);
+  edgex_rest_server_options opts =
+  {
+    .port = svc->config.service.port,
+    .threads = svc->config.service.httpthreads,
+    .workers = svc->config.service.httpworkers,
+    .maxconns = svc->config.service.httpmaxconns,
+    .timeout = svc->config.service.httptimeout,
+    .maxbody = svc->config.service.httpmaxbody,
+    .metrics = svc->metrics,
+    .socket = svc->config.service.socket
+  };
+  svc->daemon = edgex_rest_server_create (svc->logger, &opts, err);
   if (err->code)
   {
     return;
   }
 
-  edgex_rest_server_register_handler
+  edgex_rest_server_register_blocking_handler
   (
     svc->daemon, EDGEX_DEV_API_CALLBACK, PUT /* | POST | DELETE */, svc,
     edgex_device_handler_callback
   );
-  edgex_rest_server_register_handler
+  edgex_rest_server_register_blocking_handler
   (
     svc->daemon, EDGEX_DEV_API_DEVICE, GET | PUT | POST, svc,
     edgex_device_handler_device
@@ -449,6 +609,24 @@ void edgex_device_service_start
     svc->daemon, EDGEX_DEV_API_DISCOVERY, POST, svc,
     edgex_device_handler_discovery
   );
+  edgex_rest_server_register_handler
+  (
+    svc->daemon, EDGEX_DEV_API_METRICS, GET, svc,
+    edgex_device_handler_metrics
+  );
+  edgex_rest_server_register_handler
+  (
+    svc->daemon, EDGEX_DEV_API_EVENTS, GET, svc,
+    edgex_device_handler_events
+  );
+  if (svc->tracer)
+  {
+    edgex_rest_server_register_handler
+    (
+      svc->daemon, EDGEX_DEV_API_TRACE, GET, svc,
+      edgex_device_handler_trace
+    );
+  }
 
   /* Driver configuration */
 
@@ -637,6 +815,8 @@ void edgex_device_service_start
       job->svc = svc;
       job->url =
         strdup (events->addressable->path + strlen (EDGEX_DEV_API_DEVICE));
+      job->interval = IOT_SEC_TO_NS (interval);
+      job->last = 0;
       job->next = svc->sjobs;
       svc->sjobs = job;
       sched = iot_schedule_create
@@ -656,6 +836,22 @@ void edgex_device_service_start
     events = tmp;
   }
 
+  /* Keep event subscriptions alive */
+
+  if (svc->config.service.subscriberkeepalive)
+  {
+    iot_schedule_add
+    (
+      svc->scheduler,
+      iot_schedule_create
+      (
+        svc->scheduler, subscriber_keepalive, svc->events,
+        IOT_SEC_TO_NS ((uint64_t) svc->config.service.subscriberkeepalive),
+        0, 0
+      )
+    );
+  }
+
   /* Start scheduled events */
 
   iot_scheduler_start (svc->scheduler);
@@ -664,7 +860,10 @@ void edgex_device_service_start
 
   edgex_rest_server_register_handler
   (
-    svc->daemon, EDGEX_DEV_API_PING, GET, svc, ping_handler
+    svc->daemon, EDGEX_DEV_API_PING, GET,
+    edgex_rest_response_create
+      (svc->daemon, "{\"value\":\"pong\"}\n", "application/json"),
+    ping_handler
   );
 
   if (useRegistry && svc->config.service.checkinterval)
@@ -695,16 +894,11 @@ void edgex_device_service_start
 static void doPost (void *p)
 {
   postparams *pp = (postparams *) p;
-  edgex_error err = EDGEX_OK;
-  edgex_data_client_add_event
-  (
-    pp->svc->logger,
-    &pp->svc->config.endpoints,
-    pp->name,
-    pp->origin,
-    pp->readings,
-    &err
-  );
+  edgex_device_upload_event (pp->svc, pp->name, pp->origin, pp->readings);
+  for (edgex_reading *r = pp->readings; r; r = r->next)
+  {
+    free (r->value);
+  }
   free (pp->readings);
   free (pp);
 }
@@ -743,7 +937,7 @@ void edgex_device_post_readings
   pp->name = device_name;
   pp->origin = timenow;
   pp->readings = rdgs;
-  thpool_add_work (svc->thpool, doPost, pp);
+  edgex_metrics_add_work (svc->thpool, svc->stats.thqueue, doPost, pp);
 }
 
 void edgex_device_service_stop
@@ -755,12 +949,39 @@ void edgex_device_service_stop
     iot_scheduler_stop (svc->scheduler);
     iot_scheduler_fini (svc->scheduler);
   }
+  if (svc->events)
+  {
+    edgex_eventhub_close (svc->events);
+  }
   if (svc->daemon)
   {
     edgex_rest_server_destroy (svc->daemon);
   }
   svc->userfns.stop (svc->userdata, force);
+  edgex_watchdog_free (svc->watchdog);
   thpool_destroy (svc->thpool);
+  if (svc->cmdpool)
+  {
+    thpool_destroy (svc->driverpool);
+    thpool_destroy (svc->timeoutpool);
+    thpool_destroy (svc->cmdpool);
+  }
+  edgex_cmdlimit_free (svc->cmdlimit);
+  edgex_admission_free (svc->admission);
+  edgex_device_merge_fini (svc);
+  if (svc->tracer && svc->config.service.tracefile)
+  {
+    if (!edgex_tracer_dump (svc->tracer, svc->config.service.tracefile))
+    {
+      iot_log_error
+      (
+        svc->logger, "Unable to write trace to %s",
+        svc->config.service.tracefile
+      );
+    }
+  }
+  edgex_tracer_free (svc->tracer);
+  edgex_eventhub_free (svc->events);
   iot_log_debug (svc->logger, "Stopped device service");
   edgex_device_service_job *j;
   while (svc->sjobs)
@@ -772,21 +993,7 @@ void edgex_device_service_stop
   }
   edgex_device_freeConfig (svc);
   iot_logging_client_destroy (svc->logger);
-  edgex_map_deinit (&svc->name_to_id);
-  edgex_map_iter i = edgex_map_iter (svc->devices);
-  const char *key;
-  while ((key = edgex_map_next (&svc->devices, &i)))
-  {
-    edgex_device **e = edgex_map_get (&svc->devices, key);
-    edgex_device_free (*e);
-  }
-  edgex_map_deinit (&svc->devices);
-  i = edgex_map_iter (svc->profiles);
-  while ((key = edgex_map_next (&svc->profiles, &i)))
-  {
-    edgex_deviceprofile **p = edgex_map_get (&svc->profiles, key);
-    edgex_deviceprofile_free (*p);
-  }
-  edgex_map_deinit (&svc->profiles);
+  edgex_devmap_free (svc->devices);
+  edgex_metrics_free (svc->metrics);
   free (svc);
 }
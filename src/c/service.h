@@ -14,15 +14,39 @@
 #include "config.h"
 #include "state.h"
 #include "map.h"
+#include "devmap.h"
 #include "rest_server.h"
 #include "thpool.h"
+#include "cmdlimit.h"
+#include "admission.h"
+#include "metrics.h"
+#include "trace.h"
+#include "eventhub.h"
+#include "watchdog.h"
 #include "iot/scheduler.h"
 
-typedef edgex_map(edgex_device *) edgex_map_device;
-typedef edgex_map(edgex_deviceprofile *) edgex_map_profile;
+struct mergedread;
+typedef edgex_map(struct mergedread *) edgex_map_mergedread;
 
 struct edgex_device_service_job;
 
+/* Metrics updated by the service, other than those kept by the REST server
+ * and admission control.
+ */
+
+typedef struct edgex_device_metrics
+{
+  edgex_metrics_family *getlatency;
+  edgex_metrics_family *putlatency;
+  edgex_metric *uploadlatency;
+  edgex_metric *uploadfailures;
+  edgex_metric *schedlag;
+  edgex_metric *thqueue;
+  edgex_metric *cmdqueue;
+  edgex_metric *driverqueue;
+  edgex_metric *timeoutqueue;
+} edgex_device_metrics;
+
 struct edgex_device_service
 {
   const char *name;
@@ -35,16 +59,23 @@ struct edgex_device_service
   edgex_device_operatingstate opstate;
   edgex_device_adminstate adminstate;
 
-  edgex_map_device devices;
-  edgex_map_string name_to_id;
-  pthread_rwlock_t deviceslock;
-
-  edgex_map_profile profiles;
-  pthread_mutex_t profileslock;
+  edgex_devmap *devices;
 
   threadpool thpool;
+  threadpool cmdpool;
+  threadpool driverpool;
+  threadpool timeoutpool;
+  edgex_cmdlimit *cmdlimit;
+  edgex_admission *admission;
+  edgex_watchdog *watchdog;
+  edgex_metrics *metrics;
+  edgex_device_metrics stats;
+  edgex_tracer *tracer;
+  edgex_eventhub *events;
   iot_scheduler scheduler;
   struct edgex_device_service_job *sjobs;
+  edgex_map_mergedread mergedreads;
+  pthread_mutex_t mergelock;
   pthread_mutex_t discolock;
 };
 
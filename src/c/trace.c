@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "trace.h"
+#include "metrics.h"
+#include "parson.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define TRACE_DETAIL_LEN 48
+#define TRACE_MIN_SIZE 64
+#define TRACE_DEFAULT_SIZE 16384
+
+/* Each slot carries a sequence number, which is odd while the slot is being
+ * written and is 2 * (position + 1) once the span at that position in the
+ * buffer is complete. Readers copy a slot and then check that its sequence
+ * number is as expected and has not changed, so that spans overwritten while
+ * being read are skipped.
+ */
+
+typedef struct trace_slot
+{
+  uint64_t seq;
+  uint64_t id;
+  uint64_t start;
+  uint64_t end;
+  const char *stage;
+  char detail[TRACE_DETAIL_LEN];
+} trace_slot;
+
+struct edgex_tracer
+{
+  uint32_t rate;
+  uint64_t requests;
+  uint64_t head;
+  uint64_t mask;
+  uint64_t epoch;
+  trace_slot *slots;
+};
+
+edgex_tracer *edgex_tracer_create (uint32_t rate, uint32_t size)
+{
+  edgex_tracer *t = NULL;
+  uint64_t n = TRACE_MIN_SIZE;
+
+  if (rate)
+  {
+    if (size == 0)
+    {
+      size = TRACE_DEFAULT_SIZE;
+    }
+    while (n < size)
+    {
+      n *= 2;
+    }
+    t = malloc (sizeof (edgex_tracer));
+    t->rate = rate;
+    t->requests = 0;
+    t->head = 0;
+    t->mask = n - 1;
+    t->epoch = edgex_metrics_now ();
+    t->slots = calloc (n, sizeof (trace_slot));
+  }
+  return t;
+}
+
+uint64_t edgex_tracer_sample (edgex_tracer *t)
+{
+  uint64_t n;
+
+  if (t == NULL)
+  {
+    return 0;
+  }
+  n = __atomic_add_fetch (&t->requests, 1, __ATOMIC_RELAXED);
+  return (n % t->rate == 0) ? n / t->rate : 0;
+}
+
+void edgex_tracer_span
+(
+  edgex_tracer *t,
+  uint64_t id,
+  const char *stage,
+  const char *detail,
+  uint64_t start,
+  uint64_t end
+)
+{
+  uint64_t pos;
+  trace_slot *s;
+
+  if (t == NULL || id == 0)
+  {
+    return;
+  }
+  pos = __atomic_fetch_add (&t->head, 1, __ATOMIC_RELAXED);
+  s = &t->slots[pos & t->mask];
+  __atomic_store_n (&s->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  s->id = id;
+  s->start = start;
+  s->end = end;
+  s->stage = stage;
+  strncpy (s->detail, detail ? detail : "", TRACE_DETAIL_LEN - 1);
+  s->detail[TRACE_DETAIL_LEN - 1] = '\0';
+  __atomic_store_n (&s->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+}
+
+static JSON_Value *trace_event (edgex_tracer *t, const trace_slot *s)
+{
+  JSON_Value *val = json_value_init_object ();
+  JSON_Object *obj = json_value_get_object (val);
+  JSON_Value *args = json_value_init_object ();
+
+  json_object_set_string (obj, "name", s->stage);
+  json_object_set_string (obj, "cat", "command");
+  json_object_set_string (obj, "ph", "X");
+  json_object_set_number (obj, "ts", (double) (s->start - t->epoch) / 1000);
+  json_object_set_number (obj, "dur", (double) (s->end - s->start) / 1000);
+  json_object_set_number (obj, "pid", getpid ());
+  json_object_set_number (obj, "tid", s->id);
+  if (*s->detail)
+  {
+    json_object_set_string (json_value_get_object (args), "detail", s->detail);
+  }
+  json_object_set_value (obj, "args", args);
+  return val;
+}
+
+char *edgex_tracer_write (edgex_tracer *t)
+{
+  char *result;
+  JSON_Value *val = json_value_init_object ();
+  JSON_Value *events = json_value_init_array ();
+  JSON_Array *arr = json_value_get_array (events);
+
+  if (t)
+  {
+    uint64_t head = __atomic_load_n (&t->head, __ATOMIC_ACQUIRE);
+    uint64_t pos = (head > t->mask) ? head - t->mask - 1 : 0;
+    for (; pos < head; pos++)
+    {
+      trace_slot copy;
+      trace_slot *s = &t->slots[pos & t->mask];
+      uint64_t seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE);
+      if (seq != 2 * pos + 2)
+      {
+        continue;
+      }
+      memcpy (&copy, s, sizeof (trace_slot));
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&s->seq, __ATOMIC_RELAXED) == seq)
+      {
+        json_array_append_value (arr, trace_event (t, &copy));
+      }
+    }
+  }
+  json_object_set_value (json_value_get_object (val), "traceEvents", events);
+  json_object_set_string
+    (json_value_get_object (val), "displayTimeUnit", "ms");
+  result = json_serialize_to_string (val);
+  json_value_free (val);
+  return result;
+}
+
+bool edgex_tracer_dump (edgex_tracer *t, const char *path)
+{
+  bool ok = false;
+  FILE *f = fopen (path, "w");
+  if (f)
+  {
+    char *json = edgex_tracer_write (t);
+    ok = (fputs (json, f) >= 0);
+    ok = (fclose (f) == 0) && ok;
+    json_free_serialized_string (json);
+  }
+  return ok;
+}
+
+void edgex_tracer_free (edgex_tracer *t)
+{
+  if (t)
+  {
+    free (t->slots);
+    free (t);
+  }
+}
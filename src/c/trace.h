@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_TRACE_H_
+#define _EDGEX_DEVICE_TRACE_H_ 1
+
+#include "edgex/os.h"
+
+/* Request tracing. One in every rate requests is sampled, and is given a
+ * trace id. The stages of a sampled request are recorded as spans, with
+ * their start and end times (from edgex_metrics_now), in a ring buffer of a
+ * fixed number of spans; once it is full the oldest spans are overwritten.
+ * Recording a span takes no lock. The buffer may be written out in the
+ * Chrome trace event format, for viewing in chrome://tracing or similar,
+ * where each request appears as a track of its own.
+ */
+
+struct edgex_tracer;
+typedef struct edgex_tracer edgex_tracer;
+
+/* Create a tracer holding at least size spans, or a default number if size
+ * is zero. Returns NULL if rate is zero; the functions below accept NULL.
+ */
+
+extern edgex_tracer *edgex_tracer_create (uint32_t rate, uint32_t size);
+
+/* Returns a trace id if the current request is to be traced, otherwise
+ * zero.
+ */
+
+extern uint64_t edgex_tracer_sample (edgex_tracer *t);
+
+/* Record a span of the given trace. The stage name must be a string
+ * constant; the detail (eg a device name) is copied, and may be truncated.
+ * Nothing is recorded if the id is zero.
+ */
+
+extern void edgex_tracer_span
+(
+  edgex_tracer *t,
+  uint64_t id,
+  const char *stage,
+  const char *detail,
+  uint64_t start,
+  uint64_t end
+);
+
+/* Write out the spans in the buffer as a Chrome trace. The string returned
+ * is to be freed by the caller.
+ */
+
+extern char *edgex_tracer_write (edgex_tracer *t);
+
+/* Write out the spans in the buffer to a file. Returns false on failure. */
+
+extern bool edgex_tracer_dump (edgex_tracer *t, const char *path);
+
+extern void edgex_tracer_free (edgex_tracer *t);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <unistd.h>
+#include "CUnit.h"
+#include "admission.h"
+#include "../src/c/admission.h"
+
+static edgex_metrics *metrics;
+static edgex_admission *adm;
+
+static int suite_init (void)
+{
+  metrics = edgex_metrics_create ();
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  edgex_metrics_free (metrics);
+  return 0;
+}
+
+static void test_limits (void)
+{
+  uint64_t t1, t2, t3, t4;
+
+  adm = edgex_admission_create (3, 2, 0, 0, metrics);
+  CU_ASSERT (edgex_admission_enter (adm, "a", &t1));
+  CU_ASSERT (edgex_admission_enter (adm, "a", &t2));
+
+  /* With no queue, requests over a limit are rejected at once */
+
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, "a", &t3));
+  CU_ASSERT (edgex_admission_enter (adm, "b", &t3));
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, "c", &t4));
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, NULL, &t4));
+  edgex_admission_exit (adm, "a", t1);
+  CU_ASSERT (edgex_admission_enter (adm, "a", &t1));
+  edgex_admission_exit (adm, "a", t1);
+  edgex_admission_exit (adm, "a", t2);
+  edgex_admission_exit (adm, "b", t3);
+  CU_ASSERT (edgex_admission_retry_after (adm) >= 1);
+  edgex_admission_free (adm);
+}
+
+static void test_timeout (void)
+{
+  uint64_t t1, t2;
+  uint64_t start = edgex_metrics_now ();
+
+  adm = edgex_admission_create (1, 0, 1, 50, metrics);
+  CU_ASSERT (edgex_admission_enter (adm, "a", &t1));
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, "b", &t2));
+  CU_ASSERT (edgex_metrics_now () - start >= 50000000);
+  edgex_admission_exit (adm, "a", t1);
+  edgex_admission_free (adm);
+}
+
+static void *release_later (void *p)
+{
+  usleep (20000);
+  edgex_admission_exit (adm, "a", *(uint64_t *) p);
+  return NULL;
+}
+
+static void *queued_enter (void *p)
+{
+  uint64_t t;
+  bool *admitted = (bool *) p;
+  if ((*admitted = edgex_admission_enter (adm, "a", &t)))
+  {
+    edgex_admission_exit (adm, "a", t);
+  }
+  return NULL;
+}
+
+/* A waiting request is admitted when a request completes, and the queue
+ * holds no more than maxqueue requests meanwhile.
+ */
+
+static void test_queue (void)
+{
+  pthread_t releaser, waiter;
+  uint64_t t1, t2;
+  bool admitted = false;
+
+  adm = edgex_admission_create (0, 1, 1, 0, metrics);
+  CU_ASSERT_FATAL (edgex_admission_enter (adm, "a", &t1));
+  pthread_create (&waiter, NULL, queued_enter, &admitted);
+  usleep (10000);
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, "a", &t2));
+  pthread_create (&releaser, NULL, release_later, &t1);
+  pthread_join (waiter, NULL);
+  pthread_join (releaser, NULL);
+  CU_ASSERT (admitted);
+  edgex_admission_free (adm);
+}
+
+#define NWAITERS 4
+
+static pthread_mutex_t order_lock = PTHREAD_MUTEX_INITIALIZER;
+static int order[NWAITERS + 1];
+static int norder;
+
+static void *ordered_enter (void *p)
+{
+  uint64_t t;
+  if (edgex_admission_enter (adm, "a", &t))
+  {
+    pthread_mutex_lock (&order_lock);
+    order[norder++] = (int) (intptr_t) p;
+    pthread_mutex_unlock (&order_lock);
+    usleep (1000);
+    edgex_admission_exit (adm, "a", t);
+  }
+  return NULL;
+}
+
+/* Waiters are admitted in the order in which they arrived, and a new
+ * request does not overtake them.
+ */
+
+static void test_fifo (void)
+{
+  pthread_t threads[NWAITERS];
+  uint64_t t1;
+  bool ok = true;
+
+  adm = edgex_admission_create (1, 0, NWAITERS, 0, metrics);
+  norder = 0;
+  CU_ASSERT_FATAL (edgex_admission_enter (adm, "a", &t1));
+  for (int i = 0; i < NWAITERS; i++)
+  {
+    pthread_create (&threads[i], NULL, ordered_enter, (void *) (intptr_t) i);
+    usleep (20000);
+  }
+  edgex_admission_exit (adm, "a", t1);
+  ordered_enter ((void *) (intptr_t) NWAITERS);
+  for (int i = 0; i < NWAITERS; i++)
+  {
+    pthread_join (threads[i], NULL);
+  }
+  CU_ASSERT_EQUAL (norder, NWAITERS + 1);
+  for (int i = 0; i < norder; i++)
+  {
+    ok &= (order[i] == i);
+  }
+  CU_ASSERT (ok);
+  edgex_admission_free (adm);
+}
+
+/* A request waiting on its key's limit holds up only that key */
+
+static void test_keys (void)
+{
+  pthread_t waiter;
+  uint64_t t1, t2, t3;
+  bool admitted = false;
+
+  adm = edgex_admission_create (0, 1, 2, 50, metrics);
+  CU_ASSERT_FATAL (edgex_admission_enter (adm, "a", &t1));
+  pthread_create (&waiter, NULL, queued_enter, &admitted);
+  usleep (10000);
+  CU_ASSERT (edgex_admission_enter (adm, "b", &t2));
+  CU_ASSERT_FALSE (edgex_admission_enter (adm, "a", &t3));
+  edgex_admission_exit (adm, "b", t2);
+  pthread_join (waiter, NULL);
+  CU_ASSERT_FALSE (admitted);
+  edgex_admission_exit (adm, "a", t1);
+  edgex_admission_free (adm);
+}
+
+/* Claims count against the per-key limit only, and do not wait */
+
+static void test_claim (void)
+{
+  uint64_t t1, t2;
+
+  adm = edgex_admission_create (1, 2, 1, 0, metrics);
+  CU_ASSERT_FATAL (edgex_admission_enter (adm, NULL, &t1));
+  CU_ASSERT (edgex_admission_claim (adm, "a"));
+  CU_ASSERT (edgex_admission_claim (adm, "a"));
+  CU_ASSERT_FALSE (edgex_admission_claim (adm, "a"));
+  CU_ASSERT (edgex_admission_claim (adm, "b"));
+  CU_ASSERT (edgex_admission_claim (adm, NULL));
+  edgex_admission_release (adm, "a");
+  CU_ASSERT (edgex_admission_claim (adm, "a"));
+  edgex_admission_release (adm, "a");
+  edgex_admission_release (adm, "a");
+  edgex_admission_release (adm, "b");
+  edgex_admission_release (adm, NULL);
+  edgex_admission_exit (adm, NULL, t1);
+  CU_ASSERT (edgex_admission_enter (adm, "a", &t2));
+  edgex_admission_exit (adm, "a", t2);
+  edgex_admission_free (adm);
+}
+
+void cunit_admission_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("admission", suite_init, suite_clean);
+  CU_add_test (suite, "test_limits", test_limits);
+  CU_add_test (suite, "test_timeout", test_timeout);
+  CU_add_test (suite, "test_queue", test_queue);
+  CU_add_test (suite, "test_fifo", test_fifo);
+  CU_add_test (suite, "test_keys", test_keys);
+  CU_add_test (suite, "test_claim", test_claim);
+}
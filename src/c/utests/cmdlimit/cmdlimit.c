@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <unistd.h>
+#include "CUnit.h"
+#include "cmdlimit.h"
+#include "../src/c/cmdlimit.h"
+#include "../src/c/edgex_time.h"
+
+#define NWAITERS 4
+
+static edgex_cmdlimit *lim;
+static pthread_mutex_t order_lock = PTHREAD_MUTEX_INITIALIZER;
+static int order[NWAITERS];
+static int norder;
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static void test_unlimited (void)
+{
+  edgex_cmdlimit_slot *s1, *s2;
+  CU_ASSERT_PTR_NULL (edgex_cmdlimit_create (0));
+  CU_ASSERT (edgex_cmdlimit_enter (NULL, "key", 0, &s1));
+  CU_ASSERT (edgex_cmdlimit_enter (NULL, "key", 0, &s2));
+  edgex_cmdlimit_exit (NULL, s1);
+  edgex_cmdlimit_exit (NULL, s2);
+  edgex_cmdlimit_free (NULL);
+}
+
+static void test_limit (void)
+{
+  edgex_cmdlimit_slot *s1, *s2, *s3, *s4;
+  uint64_t soon = edgex_device_millitime () + 50;
+
+  lim = edgex_cmdlimit_create (2);
+  CU_ASSERT (edgex_cmdlimit_enter (lim, "a", 0, &s1));
+  CU_ASSERT (edgex_cmdlimit_enter (lim, "a", 0, &s2));
+
+  /* Other keys are not affected */
+
+  CU_ASSERT (edgex_cmdlimit_enter (lim, "b", 0, &s3));
+  CU_ASSERT_FALSE (edgex_cmdlimit_enter (lim, "a", soon, &s4));
+  CU_ASSERT (edgex_device_millitime () >= soon);
+  edgex_cmdlimit_exit (lim, s1);
+  CU_ASSERT (edgex_cmdlimit_enter (lim, "a", soon, &s4));
+  edgex_cmdlimit_exit (lim, s2);
+  edgex_cmdlimit_exit (lim, s3);
+  edgex_cmdlimit_exit (lim, s4);
+  edgex_cmdlimit_free (lim);
+}
+
+static void *waiter (void *p)
+{
+  edgex_cmdlimit_slot *s;
+  if (edgex_cmdlimit_enter (lim, "a", 0, &s))
+  {
+    pthread_mutex_lock (&order_lock);
+    order[norder++] = (int) (intptr_t) p;
+    pthread_mutex_unlock (&order_lock);
+    edgex_cmdlimit_exit (lim, s);
+  }
+  return NULL;
+}
+
+/* Waiters are admitted in the order in which they arrived */
+
+static void test_fifo (void)
+{
+  pthread_t threads[NWAITERS];
+  edgex_cmdlimit_slot *s;
+  bool ok = true;
+
+  lim = edgex_cmdlimit_create (1);
+  norder = 0;
+  CU_ASSERT_FATAL (edgex_cmdlimit_enter (lim, "a", 0, &s));
+  for (int i = 0; i < NWAITERS; i++)
+  {
+    pthread_create (&threads[i], NULL, waiter, (void *) (intptr_t) i);
+    usleep (20000);
+  }
+  edgex_cmdlimit_exit (lim, s);
+  for (int i = 0; i < NWAITERS; i++)
+  {
+    pthread_join (threads[i], NULL);
+  }
+  CU_ASSERT_EQUAL (norder, NWAITERS);
+  for (int i = 0; i < norder; i++)
+  {
+    ok &= (order[i] == i);
+  }
+  CU_ASSERT (ok);
+  edgex_cmdlimit_free (lim);
+}
+
+void cunit_cmdlimit_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("cmdlimit", suite_init, suite_clean);
+  CU_add_test (suite, "test_unlimited", test_unlimited);
+  CU_add_test (suite, "test_limit", test_limit);
+  CU_add_test (suite, "test_fifo", test_fifo);
+}
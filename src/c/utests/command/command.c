@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <errno.h>
+#include "CUnit.h"
+#include "command.h"
+#include "../src/c/service.h"
+#include "../src/c/device.h"
+#include "../src/c/edgex_time.h"
+#include "microhttpd.h"
+
+#define NDEVICES 3
+#define TIMEOUT 100
+
+static edgex_device_service svc;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool released;
+static uint32_t calls;
+static uint32_t returned;
+
+/* A batch handler which does not return until released, or until well
+ * after the deadline.
+ */
+
+static bool blocking_batch
+  (void *impl, uint32_t nrequests, edgex_device_batchrequest *requests)
+{
+  struct timespec limit;
+
+  clock_gettime (CLOCK_REALTIME, &limit);
+  limit.tv_sec += TIMEOUT * 10 / 1000;
+  pthread_mutex_lock (&lock);
+  calls++;
+  while (!released)
+  {
+    if (pthread_cond_timedwait (&cond, &lock, &limit) == ETIMEDOUT)
+    {
+      break;
+    }
+  }
+  for (uint32_t i = 0; i < nrequests; i++)
+  {
+    requests[i].success = true;
+  }
+  returned++;
+  pthread_cond_broadcast (&cond);
+  pthread_mutex_unlock (&lock);
+  return true;
+}
+
+static edgex_device *device (const char *name)
+{
+  edgex_device *dev = calloc (1, sizeof (edgex_device));
+  edgex_deviceprofile *p = calloc (1, sizeof (edgex_deviceprofile));
+  edgex_profileresource *res = calloc (1, sizeof (edgex_profileresource));
+
+  dev->id = strdup (name);
+  dev->name = strdup (name);
+  dev->adminState = strdup ("UNLOCKED");
+  dev->operatingState = strdup ("ENABLED");
+  dev->addressable = calloc (1, sizeof (edgex_addressable));
+  dev->addressable->name = strdup ("gateway");
+  p->name = strdup ("profile");
+  p->commands = calloc (1, sizeof (edgex_command));
+  p->commands->name = strdup ("cmd");
+  p->commands->get = calloc (1, sizeof (edgex_get));
+  p->commands->put = calloc (1, sizeof (edgex_put));
+  p->device_resources = calloc (1, sizeof (edgex_deviceobject));
+  p->device_resources->name = strdup ("obj");
+  p->device_resources->properties = calloc (1, sizeof (edgex_profileproperty));
+  p->device_resources->properties->value =
+    calloc (1, sizeof (edgex_propertyvalue));
+  p->device_resources->properties->units = calloc (1, sizeof (edgex_units));
+  res->name = strdup ("cmd");
+  res->get = calloc (1, sizeof (edgex_resourceoperation));
+  res->get->object = strdup ("obj");
+  p->resources = res;
+  dev->profile = p;
+  return dev;
+}
+
+static int suite_init (void)
+{
+  char name[16];
+
+  memset (&svc, 0, sizeof (svc));
+  svc.logger = iot_logging_client_create ("command");
+  svc.userfns.gethandler_batch = blocking_batch;
+  svc.config.device.commandtimeout = TIMEOUT;
+  svc.config.device.maxparallelcmds = 2;
+  svc.config.device.maxcmdops = 128;
+  svc.cmdpool = thpool_init (2);
+  svc.driverpool = thpool_init (2);
+  svc.timeoutpool = thpool_init (1);
+  svc.watchdog = edgex_watchdog_create ();
+  svc.devices = edgex_devmap_alloc ();
+  for (int i = 0; i < NDEVICES; i++)
+  {
+    sprintf (name, "dev%d", i);
+    edgex_devmap_replace (svc.devices, device (name));
+  }
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  thpool_wait (svc.driverpool);
+  thpool_wait (svc.cmdpool);
+  thpool_destroy (svc.cmdpool);
+  thpool_destroy (svc.driverpool);
+  thpool_destroy (svc.timeoutpool);
+  edgex_watchdog_free (svc.watchdog);
+  edgex_devmap_free (svc.devices);
+  iot_logging_client_destroy (svc.logger);
+  return 0;
+}
+
+/* A batch handler which blocks past the deadline does not hold up the
+ * request: every device fails with 504, and the late result is discarded.
+ */
+
+static void test_batch_timeout (void)
+{
+  char url[] = "all/cmd";
+  char *reply = NULL;
+  const char *reply_type = NULL;
+  uint64_t start = edgex_device_millitime ();
+
+  int status = edgex_device_handler_device
+    (&svc, NULL, url, GET, NULL, 0, &reply, &reply_type);
+  uint64_t elapsed = edgex_device_millitime () - start;
+
+  CU_ASSERT_EQUAL (status, MHD_HTTP_GATEWAY_TIMEOUT);
+  CU_ASSERT (elapsed >= TIMEOUT);
+  CU_ASSERT (elapsed < TIMEOUT * 5);
+  CU_ASSERT_PTR_NULL (reply);
+
+  pthread_mutex_lock (&lock);
+  CU_ASSERT_EQUAL (calls, 1);
+  released = true;
+  pthread_cond_broadcast (&cond);
+  while (returned < calls)
+  {
+    pthread_cond_wait (&cond, &lock);
+  }
+  pthread_mutex_unlock (&lock);
+  thpool_wait (svc.driverpool);
+}
+
+void cunit_command_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("command", suite_init, suite_clean);
+  CU_add_test (suite, "test_batch_timeout", test_batch_timeout);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "CUnit.h"
+#include "devmap.h"
+#include "../src/c/devmap.h"
+#include "../src/c/edgex_rest.h"
+
+static edgex_devmap *map;
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static edgex_strings *strings (const char *s1, const char *s2)
+{
+  edgex_strings *result = NULL;
+  for (int i = 1; i >= 0; i--)
+  {
+    const char *s = i ? s2 : s1;
+    if (s)
+    {
+      edgex_strings *l = malloc (sizeof (edgex_strings));
+      l->str = strdup (s);
+      l->next = result;
+      result = l;
+    }
+  }
+  return result;
+}
+
+static edgex_deviceprofile *profile (const char *name, uint64_t modified)
+{
+  edgex_deviceprofile *p = malloc (sizeof (edgex_deviceprofile));
+  memset (p, 0, sizeof (edgex_deviceprofile));
+  p->name = strdup (name);
+  p->modified = modified;
+  p->commands = malloc (sizeof (edgex_command));
+  memset (p->commands, 0, sizeof (edgex_command));
+  p->commands->name = strdup (modified > 1 ? "newcmd" : "cmd");
+  p->commands->get = malloc (sizeof (edgex_get));
+  memset (p->commands->get, 0, sizeof (edgex_get));
+  p->commands->put = malloc (sizeof (edgex_put));
+  memset (p->commands->put, 0, sizeof (edgex_put));
+  return p;
+}
+
+static edgex_device *device
+  (const char *id, const char *name, const char *prof, uint64_t modified)
+{
+  edgex_device *dev = malloc (sizeof (edgex_device));
+  memset (dev, 0, sizeof (edgex_device));
+  dev->id = strdup (id);
+  dev->name = strdup (name);
+  dev->adminState = strdup ("UNLOCKED");
+  dev->operatingState = strdup ("ENABLED");
+  dev->labels = strings ("lab", name);
+  dev->addressable = malloc (sizeof (edgex_addressable));
+  memset (dev->addressable, 0, sizeof (edgex_addressable));
+  dev->addressable->name = strdup ("addr");
+  dev->addressable->password = strdup ("secret");
+  dev->profile = profile (prof, modified);
+  return dev;
+}
+
+static uint32_t count_indexed (edgex_devmap_index idx, const char *key)
+{
+  uint32_t n;
+  edgex_devrec **devs = edgex_devmap_copyindexed (map, idx, key, &n);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    edgex_devmap_release (devs[i]);
+  }
+  free (devs);
+  return n;
+}
+
+static void test_replace_lookup (void)
+{
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  edgex_devmap_replace (map, device ("id2", "dev2", "prof", 1));
+  CU_ASSERT_EQUAL (edgex_devmap_size (map), 2);
+  CU_ASSERT_EQUAL (edgex_devmap_nprofiles (map), 1);
+
+  edgex_devrec *e = edgex_devmap_device_byname (map, "dev1");
+  CU_ASSERT_PTR_NOT_NULL_FATAL (e);
+  CU_ASSERT_STRING_EQUAL (e->id, "id1");
+  CU_ASSERT_STRING_EQUAL (e->addressable.password, "secret");
+  CU_ASSERT_EQUAL (e->nlabels, 2);
+  edgex_devrec *f = edgex_devmap_device_byid (map, "id2");
+  CU_ASSERT_PTR_NOT_NULL_FATAL (f);
+  CU_ASSERT_PTR_EQUAL (e->profile, f->profile);
+  edgex_devmap_release (f);
+
+  /* A device with the same name and a new id replaces the old one */
+
+  edgex_devmap_replace (map, device ("id3", "dev1", "prof", 1));
+  CU_ASSERT_EQUAL (edgex_devmap_size (map), 2);
+  CU_ASSERT_PTR_NULL (edgex_devmap_device_byid (map, "id1"));
+  CU_ASSERT_STRING_EQUAL (e->name, "dev1");
+  edgex_devmap_release (e);
+  edgex_devmap_free (map);
+}
+
+static void test_remove (void)
+{
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  edgex_devrec *e = edgex_devmap_remove_byname (map, "dev1");
+  CU_ASSERT_PTR_NOT_NULL_FATAL (e);
+  CU_ASSERT_STRING_EQUAL (e->id, "id1");
+  edgex_devmap_release (e);
+  CU_ASSERT_PTR_NULL (edgex_devmap_remove_byid (map, "id1"));
+  CU_ASSERT_EQUAL (edgex_devmap_size (map), 0);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYPROFILE, "prof"), 0);
+  edgex_devmap_free (map);
+}
+
+static void test_indices (void)
+{
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  edgex_devmap_replace (map, device ("id2", "dev2", "prof", 1));
+  edgex_devmap_replace (map, device ("id3", "dev3", "other", 1));
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYPROFILE, "prof"), 2);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYPROFILE, "other"), 1);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYCOMMAND, "cmd"), 3);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYLABEL, "lab"), 3);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYLABEL, "dev2"), 1);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYLABEL, "none"), 0);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYADDRESS, "addr"), 3);
+  edgex_devrec *e = edgex_devmap_remove_byid (map, "id2");
+  edgex_devmap_release (e);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYPROFILE, "prof"), 1);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYLABEL, "dev2"), 0);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYADDRESS, "addr"), 2);
+  edgex_devmap_free (map);
+}
+
+/* Devices using a profile are switched to a newer version of it */
+
+static void test_profile_update (void)
+{
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  edgex_devmap_replace (map, device ("id2", "dev2", "prof", 0));
+  edgex_devrec *e = edgex_devmap_device_byid (map, "id2");
+  CU_ASSERT_EQUAL (e->profile->modified, 1);
+  edgex_devmap_release (e);
+
+  edgex_devmap_replace (map, device ("id3", "dev3", "prof", 2));
+  CU_ASSERT_EQUAL (edgex_devmap_nprofiles (map), 1);
+  for (int i = 1; i <= 3; i++)
+  {
+    char id[8];
+    sprintf (id, "id%d", i);
+    e = edgex_devmap_device_byid (map, id);
+    CU_ASSERT_PTR_NOT_NULL_FATAL (e);
+    CU_ASSERT_EQUAL (e->profile->modified, 2);
+    edgex_devmap_release (e);
+  }
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYCOMMAND, "cmd"), 0);
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYCOMMAND, "newcmd"), 3);
+
+  edgex_devmap_replace_profile (map, profile ("prof", 1));
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYCOMMAND, "cmd"), 3);
+  edgex_devmap_free (map);
+}
+
+static void test_populate (void)
+{
+  edgex_device *list = device ("id1", "dev1", "prof", 1);
+  list->next = device ("id2", "dev2", "prof", 1);
+
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  CU_ASSERT_EQUAL (edgex_devmap_populate (map, list), 1);
+  CU_ASSERT_EQUAL (edgex_devmap_populate (map, list), 0);
+  CU_ASSERT_EQUAL (edgex_devmap_size (map), 2);
+  edgex_device_free (list);
+  edgex_devmap_free (map);
+}
+
+static void test_adminstate (void)
+{
+  map = edgex_devmap_alloc ();
+  edgex_devmap_replace (map, device ("id1", "dev1", "prof", 1));
+  CU_ASSERT (edgex_devmap_set_adminstate (map, "id1", LOCKED));
+  CU_ASSERT_FALSE (edgex_devmap_set_adminstate (map, "id9", LOCKED));
+  edgex_devrec *e = edgex_devmap_device_byname (map, "dev1");
+  CU_ASSERT_EQUAL (e->adminstate, LOCKED);
+  CU_ASSERT_STRING_EQUAL (e->addressable.password, "secret");
+  CU_ASSERT_EQUAL (count_indexed (DEVMAP_BYLABEL, "lab"), 1);
+  edgex_devmap_release (e);
+  edgex_devmap_free (map);
+}
+
+void cunit_devmap_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("devmap", suite_init, suite_clean);
+  CU_add_test (suite, "test_replace_lookup", test_replace_lookup);
+  CU_add_test (suite, "test_remove", test_remove);
+  CU_add_test (suite, "test_indices", test_indices);
+  CU_add_test (suite, "test_profile_update", test_profile_update);
+  CU_add_test (suite, "test_populate", test_populate);
+  CU_add_test (suite, "test_adminstate", test_adminstate);
+}
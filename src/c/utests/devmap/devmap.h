@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _THRIFT_CUNIT_DEVMAP_H_
+#define _THRIFT_CUNIT_DEVMAP_H_
+
+extern void cunit_devmap_test_init (void);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <unistd.h>
+#include "CUnit.h"
+#include "fanout.h"
+#include "../src/c/fanout.h"
+
+#define NITEMS 40
+#define NTHREADS 4
+
+typedef struct fanout_test
+{
+  pthread_mutex_t lock;
+  uint32_t runs[NITEMS];
+  uint32_t nruns;
+  uint32_t running;
+  uint32_t maxrunning;
+  uint32_t failat;
+  uint32_t pauseat;
+  bool pending;
+} fanout_test;
+
+typedef struct pending_item
+{
+  edgex_fanout *f;
+  fanout_test *t;
+} pending_item;
+
+static threadpool pool;
+
+static int suite_init (void)
+{
+  pool = thpool_init (NTHREADS);
+  return pool ? 0 : 1;
+}
+
+static int suite_clean (void)
+{
+  thpool_destroy (pool);
+  return 0;
+}
+
+static void test_init (fanout_test *t)
+{
+  memset (t, 0, sizeof (fanout_test));
+  pthread_mutex_init (&t->lock, NULL);
+  t->failat = NITEMS;
+  t->pauseat = NITEMS;
+}
+
+static void item_end (fanout_test *t)
+{
+  pthread_mutex_lock (&t->lock);
+  t->running--;
+  pthread_mutex_unlock (&t->lock);
+}
+
+static void complete_later (void *p)
+{
+  pending_item *item = (pending_item *) p;
+  usleep (1000);
+  item_end (item->t);
+  edgex_fanout_done (item->f, true);
+  free (item);
+}
+
+static edgex_fanout_result item_fn
+  (void *ctx, uint32_t index, edgex_fanout *f)
+{
+  fanout_test *t = (fanout_test *) ctx;
+
+  pthread_mutex_lock (&t->lock);
+  t->runs[index]++;
+  t->nruns++;
+  if (++t->running > t->maxrunning)
+  {
+    t->maxrunning = t->running;
+  }
+  pthread_mutex_unlock (&t->lock);
+
+  if (index == t->pauseat)
+  {
+    edgex_fanout_pause (f);
+  }
+  if (t->pending)
+  {
+    pending_item *item = malloc (sizeof (pending_item));
+    item->f = f;
+    item->t = t;
+    thpool_add_work (pool, complete_later, item);
+    return EDGEX_FANOUT_PENDING;
+  }
+  usleep (1000);
+  item_end (t);
+  return (index == t->failat) ? EDGEX_FANOUT_FAILED : EDGEX_FANOUT_OK;
+}
+
+static bool all_ran_once (const fanout_test *t)
+{
+  bool ok = true;
+  for (int i = 0; i < NITEMS; i++)
+  {
+    ok &= (t->runs[i] == 1);
+  }
+  return ok;
+}
+
+static void test_run (void)
+{
+  fanout_test t;
+
+  test_init (&t);
+  CU_ASSERT (edgex_fanout_run (pool, NULL, NITEMS, 3, false, item_fn, &t));
+  CU_ASSERT (all_ran_once (&t));
+  CU_ASSERT (t.maxrunning <= 3);
+  CU_ASSERT (t.maxrunning > 1);
+  CU_ASSERT (edgex_fanout_run (pool, NULL, 0, 3, false, item_fn, &t));
+}
+
+/* With a single item at a time, no item after a failure is started */
+
+static void test_stoponfail (void)
+{
+  fanout_test t;
+
+  test_init (&t);
+  t.failat = 5;
+  CU_ASSERT_FALSE
+    (edgex_fanout_run (pool, NULL, NITEMS, 1, true, item_fn, &t));
+  CU_ASSERT_EQUAL (t.nruns, 6);
+
+  test_init (&t);
+  t.failat = 5;
+  CU_ASSERT (edgex_fanout_run (pool, NULL, NITEMS, 1, false, item_fn, &t));
+  CU_ASSERT (all_ran_once (&t));
+}
+
+static void test_pending (void)
+{
+  fanout_test t;
+
+  test_init (&t);
+  t.pending = true;
+  edgex_fanout *f = edgex_fanout_start
+    (pool, NULL, NITEMS, 2, false, item_fn, &t);
+  CU_ASSERT (edgex_fanout_wait (f));
+  edgex_fanout_free (f);
+  CU_ASSERT (all_ran_once (&t));
+  CU_ASSERT (t.maxrunning <= 2);
+  CU_ASSERT_EQUAL (t.running, 0);
+}
+
+static void test_pause (void)
+{
+  fanout_test t;
+
+  test_init (&t);
+  t.pauseat = 2;
+  edgex_fanout *f = edgex_fanout_start
+    (pool, NULL, NITEMS, 1, false, item_fn, &t);
+  usleep (50000);
+  pthread_mutex_lock (&t.lock);
+  CU_ASSERT_EQUAL (t.nruns, 3);
+  pthread_mutex_unlock (&t.lock);
+  edgex_fanout_resume (f);
+  CU_ASSERT (edgex_fanout_wait (f));
+  edgex_fanout_free (f);
+  CU_ASSERT (all_ran_once (&t));
+}
+
+void cunit_fanout_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("fanout", suite_init, suite_clean);
+  CU_add_test (suite, "test_run", test_run);
+  CU_add_test (suite, "test_stoponfail", test_stoponfail);
+  CU_add_test (suite, "test_pending", test_pending);
+  CU_add_test (suite, "test_pause", test_pause);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "CUnit.h"
+#include "intern.h"
+#include "../src/c/intern.h"
+
+#define NSTRINGS 5000
+#define NTHREADS 4
+
+static const char *results[NTHREADS][NSTRINGS];
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static void test_identity (void)
+{
+  char buf[16];
+  uint32_t count = edgex_intern_count ();
+
+  strcpy (buf, "intern-test");
+  const char *a = edgex_intern (buf);
+  strcpy (buf, "intern-other");
+  const char *b = edgex_intern (buf);
+  strcpy (buf, "intern-test");
+  CU_ASSERT_PTR_EQUAL (edgex_intern (buf), a);
+  CU_ASSERT_PTR_NOT_NULL (b);
+  CU_ASSERT (a != b);
+  CU_ASSERT_STRING_EQUAL (a, "intern-test");
+  CU_ASSERT_EQUAL (edgex_intern_count (), count + 2);
+  CU_ASSERT_PTR_NULL (edgex_intern (NULL));
+}
+
+static void test_replace (void)
+{
+  char *s = strdup ("intern-test");
+  const char *a = edgex_intern ("intern-test");
+  edgex_intern_replace (&s);
+  CU_ASSERT_PTR_EQUAL (s, a);
+  s = NULL;
+  edgex_intern_replace (&s);
+  CU_ASSERT_PTR_NULL (s);
+}
+
+/* Strings remain in place as the table grows */
+
+static void test_growth (void)
+{
+  static const char *first[NSTRINGS];
+  char buf[32];
+  bool ok = true;
+
+  for (int i = 0; i < NSTRINGS; i++)
+  {
+    sprintf (buf, "growth-%d", i);
+    first[i] = edgex_intern (buf);
+  }
+  for (int i = 0; i < NSTRINGS; i++)
+  {
+    sprintf (buf, "growth-%d", i);
+    ok &= (edgex_intern (buf) == first[i]);
+    ok &= (strcmp (first[i], buf) == 0);
+  }
+  CU_ASSERT (ok);
+}
+
+static void *intern_thread (void *p)
+{
+  const char **out = (const char **) p;
+  char buf[32];
+  for (int i = 0; i < NSTRINGS; i++)
+  {
+    sprintf (buf, "thread-%d", i);
+    out[i] = edgex_intern (buf);
+  }
+  return NULL;
+}
+
+static void test_concurrent (void)
+{
+  pthread_t threads[NTHREADS];
+  uint32_t count = edgex_intern_count ();
+  bool ok = true;
+
+  for (int t = 0; t < NTHREADS; t++)
+  {
+    pthread_create (&threads[t], NULL, intern_thread, results[t]);
+  }
+  for (int t = 0; t < NTHREADS; t++)
+  {
+    pthread_join (threads[t], NULL);
+  }
+  for (int i = 0; i < NSTRINGS; i++)
+  {
+    for (int t = 1; t < NTHREADS; t++)
+    {
+      ok &= (results[t][i] == results[0][i]);
+    }
+  }
+  CU_ASSERT (ok);
+  CU_ASSERT_EQUAL (edgex_intern_count (), count + NSTRINGS);
+}
+
+void cunit_intern_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("intern", suite_init, suite_clean);
+  CU_add_test (suite, "test_identity", test_identity);
+  CU_add_test (suite, "test_replace", test_replace);
+  CU_add_test (suite, "test_growth", test_growth);
+  CU_add_test (suite, "test_concurrent", test_concurrent);
+}
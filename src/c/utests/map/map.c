@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "CUnit.h"
+#include "map.h"
+#include "../src/c/map.h"
+
+#define NKEYS 2000
+
+static char keys[NKEYS][16];
+
+static int suite_init (void)
+{
+  for (int i = 0; i < NKEYS; i++)
+  {
+    sprintf (keys[i], "key%d", i);
+  }
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static bool migrating (edgex_map_int *m)
+{
+  return m->base.oldgroups != NULL;
+}
+
+/* Fill a map until the given number of resizes have started and the last
+ * is in progress, returning the number of keys.
+ */
+
+static int fill_until_resize (edgex_map_int *m, int nresizes)
+{
+  int n = 0;
+  unsigned nslots = m->base.nslots;
+  while (nresizes)
+  {
+    edgex_map_set (m, keys[n], n);
+    n++;
+    if (m->base.nslots != nslots)
+    {
+      nslots = m->base.nslots;
+      if (migrating (m))
+      {
+        nresizes--;
+      }
+    }
+  }
+  return n;
+}
+
+static int fill_until_migrating (edgex_map_int *m)
+{
+  return fill_until_resize (m, 1);
+}
+
+static void test_insert_across_resize (void)
+{
+  edgex_map_int m;
+  bool sawmigration = false;
+  bool ok = true;
+
+  edgex_map_init (&m);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    edgex_map_set (&m, keys[i], i);
+    sawmigration |= migrating (&m);
+
+    /* Lookups must search both tables while nodes are being moved */
+
+    for (int j = i % 7; j <= i; j += 7)
+    {
+      int *v = edgex_map_get (&m, keys[j]);
+      ok &= (v && *v == j);
+    }
+  }
+  CU_ASSERT (sawmigration);
+  CU_ASSERT (ok);
+  CU_ASSERT_EQUAL (m.base.nnodes, NKEYS);
+  CU_ASSERT_PTR_NULL (edgex_map_get (&m, "absent"));
+  edgex_map_deinit (&m);
+}
+
+static void test_replace (void)
+{
+  edgex_map_int m;
+
+  edgex_map_init (&m);
+  int n = fill_until_migrating (&m);
+  edgex_map_set (&m, keys[0], -1);
+  CU_ASSERT_EQUAL (m.base.nnodes, n);
+  CU_ASSERT_EQUAL (*edgex_map_get (&m, keys[0]), -1);
+  edgex_map_deinit (&m);
+}
+
+static void test_remove_mid_migration (void)
+{
+  edgex_map_int m;
+  bool ok = true;
+
+  edgex_map_init (&m);
+  int n = fill_until_migrating (&m);
+  for (int i = 0; i < n; i += 2)
+  {
+    edgex_map_remove (&m, keys[i]);
+  }
+  edgex_map_remove (&m, "absent");
+  CU_ASSERT_EQUAL (m.base.nnodes, n / 2);
+  for (int i = 0; i < n; i++)
+  {
+    int *v = edgex_map_get (&m, keys[i]);
+    ok &= (i % 2) ? (v && *v == i) : (v == NULL);
+  }
+  CU_ASSERT (ok);
+
+  /* Further insertions complete the migration */
+
+  for (int i = n; i < 2 * n; i++)
+  {
+    edgex_map_set (&m, keys[i], i);
+  }
+  for (int i = 1; i < 2 * n; i++)
+  {
+    int *v = edgex_map_get (&m, keys[i]);
+    ok &= (i % 2 || i >= n) ? (v && *v == i) : (v == NULL);
+  }
+  CU_ASSERT (ok);
+  edgex_map_deinit (&m);
+}
+
+/* Each key is visited once, whether in the new or the previous table */
+
+static void check_iteration (edgex_map_int *m, int n)
+{
+  static int seen[NKEYS];
+  const char *key;
+  int count = 0;
+  bool ok = true;
+
+  memset (seen, 0, sizeof (seen));
+  edgex_map_iter iter = edgex_map_iter (*m);
+  while ((key = edgex_map_next (m, &iter)))
+  {
+    int i = atoi (key + 3);
+    ok &= (i >= 0 && i < n && *edgex_map_get (m, key) == i);
+    seen[i]++;
+    count++;
+  }
+  CU_ASSERT (ok);
+  CU_ASSERT_EQUAL (count, m->base.nnodes);
+  for (int i = 0; i < n; i++)
+  {
+    ok &= (seen[i] == (edgex_map_get (m, keys[i]) ? 1 : 0));
+  }
+  CU_ASSERT (ok);
+}
+
+static void test_iterate (void)
+{
+  edgex_map_int m;
+
+  edgex_map_init (&m);
+  int n = fill_until_migrating (&m);
+  check_iteration (&m, n);
+  edgex_map_remove (&m, keys[n - 1]);
+  check_iteration (&m, n);
+  for (int i = n; i < NKEYS; i++)
+  {
+    edgex_map_set (&m, keys[i], i);
+  }
+  check_iteration (&m, NKEYS);
+  edgex_map_deinit (&m);
+}
+
+/* Every key is visited when each is removed as it is visited, during any
+ * of several resizes.
+ */
+
+static void test_remove_while_iterating (void)
+{
+  for (int gen = 1; gen <= 6; gen++)
+  {
+    edgex_map_int m;
+    const char *key;
+    char copy[16];
+    int visited = 0;
+    bool ok = true;
+
+    edgex_map_init (&m);
+    int n = fill_until_resize (&m, gen);
+    CU_ASSERT_FATAL (migrating (&m));
+    edgex_map_iter iter = edgex_map_iter (m);
+    while ((key = edgex_map_next (&m, &iter)))
+    {
+      strcpy (copy, key);
+      edgex_map_remove (&m, copy);
+      visited++;
+    }
+    CU_ASSERT_EQUAL (visited, n);
+    CU_ASSERT_EQUAL (m.base.nnodes, 0);
+    for (int i = 0; i < n; i++)
+    {
+      ok &= (edgex_map_get (&m, keys[i]) == NULL);
+    }
+    CU_ASSERT (ok);
+    edgex_map_deinit (&m);
+  }
+}
+
+/* Deleted slots are reused or cleared, so churn on a map of constant size
+ * does not grow it.
+ */
+
+static void test_tombstone_reuse (void)
+{
+  edgex_map_int m;
+  unsigned nslots;
+  bool ok = true;
+
+  edgex_map_init (&m);
+  for (int i = 0; i < 100; i++)
+  {
+    edgex_map_set (&m, keys[i], i);
+  }
+  for (int i = 0; i < 100; i++)
+  {
+    edgex_map_set (&m, keys[NKEYS - 1], 0);
+  }
+  nslots = m.base.nslots;
+  for (int round = 0; round < 20; round++)
+  {
+    for (int i = 100; i < NKEYS - 1; i++)
+    {
+      edgex_map_set (&m, keys[i], i);
+      edgex_map_remove (&m, keys[i]);
+    }
+  }
+  CU_ASSERT_EQUAL (m.base.nnodes, 101);
+  CU_ASSERT (m.base.nslots <= nslots);
+  CU_ASSERT (m.base.ndeleted < m.base.nslots);
+  for (int i = 0; i < 100; i++)
+  {
+    int *v = edgex_map_get (&m, keys[i]);
+    ok &= (v && *v == i);
+  }
+  CU_ASSERT (ok);
+  edgex_map_deinit (&m);
+}
+
+void cunit_map_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("map", suite_init, suite_clean);
+  CU_add_test (suite, "test_insert_across_resize", test_insert_across_resize);
+  CU_add_test (suite, "test_replace", test_replace);
+  CU_add_test (suite, "test_remove_mid_migration", test_remove_mid_migration);
+  CU_add_test (suite, "test_iterate", test_iterate);
+  CU_add_test
+    (suite, "test_remove_while_iterating", test_remove_while_iterating);
+  CU_add_test (suite, "test_tombstone_reuse", test_tombstone_reuse);
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _THRIFT_CUNIT_MAP_H_
+#define _THRIFT_CUNIT_MAP_H_
+
+extern void cunit_map_test_init (void);
+
+#endif
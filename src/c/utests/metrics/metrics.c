@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "CUnit.h"
+#include "metrics.h"
+#include "../src/c/metrics.h"
+#include "../src/c/parson.h"
+
+#define NTHREADS 4
+#define NADDS 10000
+#define NVALUES 100
+
+static edgex_metric *counter;
+
+static int suite_init (void)
+{
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static bool contains (const char *out, const char *line)
+{
+  return strstr (out, line) != NULL;
+}
+
+static void *add_thread (void *p)
+{
+  for (int i = 0; i < NADDS; i++)
+  {
+    edgex_metric_add (counter, 1);
+  }
+  return NULL;
+}
+
+/* Updates from every thread are summed across the shards */
+
+static void test_sharded (void)
+{
+  pthread_t threads[NTHREADS];
+  char expected[64];
+  edgex_metrics *m = edgex_metrics_create ();
+
+  counter = edgex_metrics_metric_create
+    (m, EDGEX_METRICS_COUNTER, "test_total", "Test counter");
+  for (int t = 0; t < NTHREADS; t++)
+  {
+    pthread_create (&threads[t], NULL, add_thread, NULL);
+  }
+  for (int t = 0; t < NTHREADS; t++)
+  {
+    pthread_join (threads[t], NULL);
+  }
+  char *out = edgex_metrics_write_prometheus (m);
+  sprintf (expected, "\ntest_total %d\n", NTHREADS * NADDS);
+  CU_ASSERT (contains (out, "# TYPE test_total counter\n"));
+  CU_ASSERT (contains (out, expected));
+  free (out);
+  edgex_metric_add (NULL, 1);
+  edgex_metrics_free (m);
+}
+
+static void test_labels (void)
+{
+  edgex_metric *metrics[NVALUES];
+  char value[16];
+  bool ok = true;
+  edgex_metrics *m = edgex_metrics_create ();
+  edgex_metrics_family *f = edgex_metrics_family_create
+    (m, EDGEX_METRICS_GAUGE, "test_gauge", "Test gauge", "device", false);
+
+  CU_ASSERT_PTR_EQUAL
+  (
+    edgex_metrics_family_create
+      (m, EDGEX_METRICS_GAUGE, "test_gauge", "Other", "device", false),
+    f
+  );
+  for (int i = 0; i < NVALUES; i++)
+  {
+    sprintf (value, "dev%d", i);
+    metrics[i] = edgex_metrics_family_get (f, value);
+    edgex_metric_add (metrics[i], i);
+  }
+  for (int i = 0; i < NVALUES; i++)
+  {
+    sprintf (value, "dev%d", i);
+    ok &= (edgex_metrics_family_get (f, value) == metrics[i]);
+  }
+  CU_ASSERT (ok);
+  edgex_metric_add (edgex_metrics_family_get (f, "a\"b"), 1);
+
+  char *out = edgex_metrics_write_prometheus (m);
+  CU_ASSERT (contains (out, "test_gauge{device=\"dev42\"} 42\n"));
+  CU_ASSERT (contains (out, "test_gauge{device=\"a\\\"b\"} 1\n"));
+  free (out);
+  edgex_metrics_free (m);
+}
+
+/* Bucket bounds for export are exact: a value equal to a bound is counted
+ * in the next bucket.
+ */
+
+static void test_buckets (void)
+{
+  edgex_metrics *m = edgex_metrics_create ();
+  edgex_metric *h = edgex_metrics_metric_create
+    (m, EDGEX_METRICS_HISTOGRAM, "test_seconds", "Test histogram");
+
+  edgex_metric_record (h, 15000);
+  edgex_metric_record (h, 16000);
+  edgex_metric_record (h, 100000000000ULL);
+  char *out = edgex_metrics_write_prometheus (m);
+  CU_ASSERT (contains (out, "test_seconds_bucket{le=\"1.6e-05\"} 1\n"));
+  CU_ASSERT (contains (out, "test_seconds_bucket{le=\"6.4e-05\"} 2\n"));
+  CU_ASSERT (contains (out, "test_seconds_bucket{le=\"+Inf\"} 3\n"));
+  CU_ASSERT (contains (out, "test_seconds_count 3\n"));
+  CU_ASSERT (contains (out, "test_seconds_sum 100.000031\n"));
+  free (out);
+  edgex_metrics_free (m);
+}
+
+/* Quantiles are the upper bound of their bucket, capped by the maximum */
+
+static void test_quantiles (void)
+{
+  edgex_metrics *m = edgex_metrics_create ();
+  edgex_metric *h = edgex_metrics_metric_create
+    (m, EDGEX_METRICS_HISTOGRAM, "test_seconds", "Test histogram");
+
+  edgex_metric_record (h, 1000000);
+  edgex_metric_record (h, 2000000);
+  char *out = edgex_metrics_write_json (m);
+  JSON_Value *val = json_parse_string (out);
+  JSON_Object *obj = json_value_get_object (val);
+  JSON_Array *arr = json_object_dotget_array (obj, "test_seconds.metrics");
+  JSON_Object *hobj = json_array_get_object (arr, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL (hobj);
+  CU_ASSERT_DOUBLE_EQUAL (json_object_get_number (hobj, "count"), 2, 0);
+  CU_ASSERT_DOUBLE_EQUAL
+    (json_object_get_number (hobj, "p50"), 0.001024, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL (json_object_get_number (hobj, "p99"), 0.002, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL (json_object_get_number (hobj, "max"), 0.002, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL
+    (json_object_get_number (hobj, "mean"), 0.0015, 1e-9);
+  json_value_free (val);
+  free (out);
+  edgex_metrics_free (m);
+}
+
+void cunit_metrics_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("metrics", suite_init, suite_clean);
+  CU_add_test (suite, "test_sharded", test_sharded);
+  CU_add_test (suite, "test_labels", test_labels);
+  CU_add_test (suite, "test_buckets", test_buckets);
+  CU_add_test (suite, "test_quantiles", test_quantiles);
+}
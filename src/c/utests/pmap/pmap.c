@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "CUnit.h"
+#include "pmap.h"
+#include "../src/c/pmap.h"
+
+#define NKEYS 3000
+
+static char keys[NKEYS][16];
+static int values[NKEYS];
+static int refs[NKEYS];
+
+static void value_addref (void *v)
+{
+  refs[(int *) v - values]++;
+}
+
+static void value_release (void *v)
+{
+  refs[(int *) v - values]--;
+}
+
+static const edgex_pmap_ops ops = { value_addref, value_release };
+
+static int suite_init (void)
+{
+  for (int i = 0; i < NKEYS; i++)
+  {
+    sprintf (keys[i], "key%d", i);
+    values[i] = i;
+  }
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  return 0;
+}
+
+static void set (edgex_pmap *map, int i)
+{
+  refs[i]++;
+  edgex_pmap_set (map, keys[i], &values[i], &ops);
+}
+
+static bool contains (const edgex_pmap *map, int i)
+{
+  return edgex_pmap_get (map, keys[i]) == &values[i];
+}
+
+static void test_set_get_remove (void)
+{
+  edgex_pmap map;
+  bool ok = true;
+
+  edgex_pmap_init (&map);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    set (&map, i);
+  }
+  CU_ASSERT_EQUAL (map.size, NKEYS);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= contains (&map, i);
+  }
+  CU_ASSERT (ok);
+  CU_ASSERT_PTR_NULL (edgex_pmap_get (&map, "absent"));
+  for (int i = 0; i < NKEYS; i += 2)
+  {
+    ok &= edgex_pmap_remove (&map, keys[i], &ops);
+  }
+  CU_ASSERT (ok);
+  CU_ASSERT_FALSE (edgex_pmap_remove (&map, keys[0], &ops));
+  CU_ASSERT_EQUAL (map.size, NKEYS / 2);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= (contains (&map, i) == (i % 2 == 1));
+  }
+  CU_ASSERT (ok);
+  edgex_pmap_deinit (&map, &ops);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= (refs[i] == 0);
+  }
+  CU_ASSERT (ok);
+}
+
+/* Updating a copy leaves the original unchanged */
+
+static void test_versions (void)
+{
+  edgex_pmap v1, v2;
+  bool ok = true;
+
+  edgex_pmap_init (&v1);
+  for (int i = 0; i < NKEYS / 2; i++)
+  {
+    set (&v1, i);
+  }
+  edgex_pmap_copy (&v2, &v1);
+  for (int i = 0; i < NKEYS / 4; i++)
+  {
+    edgex_pmap_remove (&v2, keys[i], &ops);
+  }
+  for (int i = NKEYS / 2; i < NKEYS; i++)
+  {
+    set (&v2, i);
+  }
+  CU_ASSERT_EQUAL (v1.size, NKEYS / 2);
+  CU_ASSERT_EQUAL (v2.size, NKEYS - NKEYS / 4);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= (contains (&v1, i) == (i < NKEYS / 2));
+    ok &= (contains (&v2, i) == (i >= NKEYS / 4));
+  }
+  CU_ASSERT (ok);
+
+  /* Values shared by both versions are released with the last of them */
+
+  edgex_pmap_deinit (&v1, &ops);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= ((refs[i] > 0) == (i >= NKEYS / 4));
+  }
+  CU_ASSERT (ok);
+  edgex_pmap_deinit (&v2, &ops);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= (refs[i] == 0);
+  }
+  CU_ASSERT (ok);
+}
+
+static void test_replace (void)
+{
+  edgex_pmap v1, v2;
+
+  edgex_pmap_init (&v1);
+  set (&v1, 0);
+  edgex_pmap_copy (&v2, &v1);
+  refs[1]++;
+  CU_ASSERT_FALSE (edgex_pmap_set (&v2, keys[0], &values[1], &ops));
+  CU_ASSERT_EQUAL (v2.size, 1);
+  CU_ASSERT_PTR_EQUAL (edgex_pmap_get (&v1, keys[0]), &values[0]);
+  CU_ASSERT_PTR_EQUAL (edgex_pmap_get (&v2, keys[0]), &values[1]);
+  edgex_pmap_deinit (&v1, &ops);
+  edgex_pmap_deinit (&v2, &ops);
+  CU_ASSERT_EQUAL (refs[0], 0);
+  CU_ASSERT_EQUAL (refs[1], 0);
+}
+
+/* A value held only by a private path has a single reference */
+
+static void test_private (void)
+{
+  edgex_pmap v1, v2;
+
+  edgex_pmap_init (&v1);
+  for (int i = 0; i < 100; i++)
+  {
+    set (&v1, i);
+  }
+  CU_ASSERT_EQUAL (refs[42], 1);
+  edgex_pmap_copy (&v2, &v1);
+  CU_ASSERT_PTR_EQUAL
+    (edgex_pmap_get_private (&v2, keys[42], &ops), &values[42]);
+  CU_ASSERT_EQUAL (refs[42], 2);
+  CU_ASSERT_PTR_NULL (edgex_pmap_get_private (&v2, "absent", &ops));
+  edgex_pmap_deinit (&v1, &ops);
+  CU_ASSERT_EQUAL (refs[42], 1);
+  edgex_pmap_deinit (&v2, &ops);
+  CU_ASSERT_EQUAL (refs[42], 0);
+}
+
+static void test_iterate (void)
+{
+  static int seen[NKEYS];
+  edgex_pmap_iter iter;
+  edgex_pmap v1, v2;
+  const char *key;
+  void *value;
+  uint32_t count = 0;
+  bool ok = true;
+
+  edgex_pmap_init (&v1);
+  edgex_pmap_iter_init (&v1, &iter);
+  CU_ASSERT_PTR_NULL (edgex_pmap_next (&iter, &value));
+  for (int i = 0; i < NKEYS; i++)
+  {
+    set (&v1, i);
+  }
+  edgex_pmap_copy (&v2, &v1);
+  for (int i = 0; i < NKEYS; i += 3)
+  {
+    edgex_pmap_remove (&v2, keys[i], &ops);
+  }
+  memset (seen, 0, sizeof (seen));
+  edgex_pmap_iter_init (&v2, &iter);
+  while ((key = edgex_pmap_next (&iter, &value)))
+  {
+    int i = *(int *) value;
+    ok &= (strcmp (key, keys[i]) == 0);
+    seen[i]++;
+    count++;
+  }
+  CU_ASSERT (ok);
+  CU_ASSERT_EQUAL (count, v2.size);
+  for (int i = 0; i < NKEYS; i++)
+  {
+    ok &= (seen[i] == (i % 3 ? 1 : 0));
+  }
+  CU_ASSERT (ok);
+  edgex_pmap_deinit (&v1, &ops);
+  edgex_pmap_deinit (&v2, &ops);
+}
+
+void cunit_pmap_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("pmap", suite_init, suite_clean);
+  CU_add_test (suite, "test_set_get_remove", test_set_get_remove);
+  CU_add_test (suite, "test_versions", test_versions);
+  CU_add_test (suite, "test_replace", test_replace);
+  CU_add_test (suite, "test_private", test_private);
+  CU_add_test (suite, "test_iterate", test_iterate);
+}
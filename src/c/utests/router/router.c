@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "CUnit.h"
+#include "router.h"
+#include "../src/c/rest_server.h"
+#include "../src/c/rest.h"
+#include "../src/c/errorlist.h"
+#include "microhttpd.h"
+
+#define TEST_PORT 49979
+
+static iot_logging_client *lc;
+static edgex_rest_server *svr;
+
+/* Replies with the handler's context and the remainder of the url */
+
+static int test_handler
+(
+  void *ctx,
+  edgex_rest_request *req,
+  char *url,
+  edgex_http_method method,
+  const char *upload_data,
+  size_t upload_data_size,
+  char **reply,
+  const char **reply_type
+)
+{
+  *reply = malloc (strlen (ctx) + strlen (url) + 2);
+  sprintf (*reply, "%s:%s", (const char *) ctx, url);
+  return MHD_HTTP_OK;
+}
+
+static void add_route (const char *url, uint32_t methods, const char *name)
+{
+  edgex_rest_server_register_handler
+    (svr, url, methods, (void *) name, test_handler);
+}
+
+static int suite_init (void)
+{
+  edgex_error err = EDGEX_OK;
+  edgex_rest_server_options opts = { .port = TEST_PORT };
+
+  lc = iot_logging_client_create ("router");
+  svr = edgex_rest_server_create (lc, &opts, &err);
+  if (svr == NULL)
+  {
+    return 1;
+  }
+  add_route ("/api/v1/ping", GET, "old");
+  add_route ("/api/v1/ping", GET, "ping");
+  add_route ("/api/v1/dev", GET, "dev");
+  add_route ("/api/v1/device/", GET | PUT, "device");
+  add_route ("/api/v1/device/all/", GET, "all");
+  add_route ("/api/v1/callback", PUT, "callback");
+  return 0;
+}
+
+static int suite_clean (void)
+{
+  if (svr)
+  {
+    edgex_rest_server_destroy (svr);
+  }
+  iot_logging_client_destroy (lc);
+  return 0;
+}
+
+/* Makes a request, returning the status. The reply, if wanted, is to be
+ * freed by the caller.
+ */
+
+static long request (edgex_http_method method, const char *path, char **body)
+{
+  char url[URL_BUF_SIZE];
+  edgex_ctx ctx;
+  edgex_error err = EDGEX_OK;
+  long status = 0;
+
+  memset (&ctx, 0, sizeof (edgex_ctx));
+  snprintf (url, URL_BUF_SIZE, "http://localhost:%d%s", TEST_PORT, path);
+  switch (method)
+  {
+    case GET:
+      status = edgex_http_get (lc, &ctx, url, edgex_http_write_cb, &err);
+      break;
+    case POST:
+      status = edgex_http_post
+        (lc, &ctx, url, "{}", edgex_http_write_cb, &err);
+      break;
+    case PUT:
+      status = edgex_http_put
+        (lc, &ctx, url, "{}", edgex_http_write_cb, &err);
+      break;
+    case DELETE:
+      status = edgex_http_delete (lc, &ctx, url, edgex_http_write_cb, &err);
+      break;
+    default:
+      break;
+  }
+  if (body)
+  {
+    *body = ctx.buff;
+  }
+  else
+  {
+    free (ctx.buff);
+  }
+  return status;
+}
+
+/* Checks that a GET of the path is handled with the given reply */
+
+static bool routed (const char *path, const char *expected)
+{
+  char *body = NULL;
+  bool result =
+    request (GET, path, &body) == MHD_HTTP_OK &&
+    body && strcmp (body, expected) == 0;
+  free (body);
+  return result;
+}
+
+static void test_exact (void)
+{
+  CU_ASSERT (routed ("/api/v1/ping", "ping:"));
+  CU_ASSERT (routed ("/api/v1/dev", "dev:"));
+  CU_ASSERT_EQUAL (request (GET, "/api/v1/pin", NULL), MHD_HTTP_NOT_FOUND);
+  CU_ASSERT_EQUAL (request (GET, "/api/v1/pingx", NULL), MHD_HTTP_NOT_FOUND);
+  CU_ASSERT_EQUAL
+    (request (GET, "/api/v1/ping/x", NULL), MHD_HTTP_NOT_FOUND);
+  CU_ASSERT_EQUAL (request (GET, "/api/v1/devi", NULL), MHD_HTTP_NOT_FOUND);
+}
+
+/* Routes ending in '/' match any longer url, the longest matching */
+
+static void test_prefix (void)
+{
+  CU_ASSERT (routed ("/api/v1/device/", "device:"));
+  CU_ASSERT (routed ("/api/v1/device/dev1/cmd", "device:dev1/cmd"));
+  CU_ASSERT (routed ("/api/v1/device/all/cmd", "all:cmd"));
+  CU_ASSERT (routed ("/api/v1/device/all", "device:all"));
+  CU_ASSERT (routed ("/api/v1/device/allx/cmd", "device:allx/cmd"));
+  CU_ASSERT_EQUAL
+    (request (GET, "/api/v1/device", NULL), MHD_HTTP_NOT_FOUND);
+}
+
+/* Repeated '/' characters match one, and are removed from the path passed
+ * to the handler.
+ */
+
+static void test_slashes (void)
+{
+  CU_ASSERT (routed ("/api/v1//ping", "ping:"));
+  CU_ASSERT (routed ("//api//v1///device//dev1//cmd", "device:dev1/cmd"));
+  CU_ASSERT (routed ("/api/v1/device//all//cmd", "all:cmd"));
+  CU_ASSERT_EQUAL
+    (request (GET, "/api/v1/pi//ng", NULL), MHD_HTTP_NOT_FOUND);
+}
+
+/* A url which is routed, but not for the method, is refused with 405 */
+
+static void test_methods (void)
+{
+  char *body = NULL;
+  CU_ASSERT_EQUAL
+    (request (POST, "/api/v1/ping", NULL), MHD_HTTP_METHOD_NOT_ALLOWED);
+  CU_ASSERT_EQUAL
+    (request (GET, "/api/v1/callback", NULL), MHD_HTTP_METHOD_NOT_ALLOWED);
+  CU_ASSERT_EQUAL
+    (request (DELETE, "/api/v1/device/d", NULL), MHD_HTTP_METHOD_NOT_ALLOWED);
+  CU_ASSERT_EQUAL
+  (
+    request (PUT, "/api/v1/device/all/cmd", NULL),
+    MHD_HTTP_METHOD_NOT_ALLOWED
+  );
+  CU_ASSERT_EQUAL
+    (request (POST, "/api/v1/nothing", NULL), MHD_HTTP_NOT_FOUND);
+  CU_ASSERT_EQUAL (request (PUT, "/api/v1/device/d/cmd", &body), MHD_HTTP_OK);
+  CU_ASSERT_STRING_EQUAL (body, "device:d/cmd");
+  free (body);
+}
+
+/* The latest registration of a url is used, and listed once */
+
+static void test_reregister (void)
+{
+  char *body = NULL;
+  add_route ("/api/v1/dev", GET, "newdev");
+  CU_ASSERT (routed ("/api/v1/dev", "newdev:"));
+  CU_ASSERT (routed ("/api/v1/device/d", "device:d"));
+
+  CU_ASSERT_EQUAL (request (GET, "/", &body), MHD_HTTP_OK);
+  CU_ASSERT_PTR_NOT_NULL_FATAL (body);
+  char *first = strstr (body, "/api/v1/ping\n");
+  CU_ASSERT_PTR_NOT_NULL_FATAL (first);
+  CU_ASSERT_PTR_NULL (strstr (first + 1, "/api/v1/ping\n"));
+  CU_ASSERT_PTR_NOT_NULL (strstr (body, "/api/v1/device/all/\n"));
+  free (body);
+  CU_ASSERT_EQUAL (request (POST, "/", NULL), MHD_HTTP_METHOD_NOT_ALLOWED);
+}
+
+void cunit_router_test_init (void)
+{
+  CU_pSuite suite = CU_add_suite ("router", suite_init, suite_clean);
+  CU_add_test (suite, "test_exact", test_exact);
+  CU_add_test (suite, "test_prefix", test_prefix);
+  CU_add_test (suite, "test_slashes", test_slashes);
+  CU_add_test (suite, "test_methods", test_methods);
+  CU_add_test (suite, "test_reregister", test_reregister);
+}
@@ -2,6 +2,16 @@
 #include "../../cunit/Automated.h"
 
 #include "../base64/base64.h"
+#include "../map/map.h"
+#include "../pmap/pmap.h"
+#include "../devmap/devmap.h"
+#include "../intern/intern.h"
+#include "../cmdlimit/cmdlimit.h"
+#include "../fanout/fanout.h"
+#include "../admission/admission.h"
+#include "../metrics/metrics.h"
+#include "../router/router.h"
+#include "../command/command.h"
 
 #include <stdbool.h>
 
@@ -60,6 +70,16 @@ int main (int argc, char *argv[])
   }
 
   cunit_base64_test_init ();
+  cunit_map_test_init ();
+  cunit_pmap_test_init ();
+  cunit_devmap_test_init ();
+  cunit_intern_test_init ();
+  cunit_cmdlimit_test_init ();
+  cunit_fanout_test_init ();
+  cunit_admission_test_init ();
+  cunit_metrics_test_init ();
+  cunit_router_test_init ();
+  cunit_command_test_init ();
 
   CU_set_error_action (error_action);
 
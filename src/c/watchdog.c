@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "watchdog.h"
+#include "edgex_time.h"
+
+typedef struct edgex_watchdog_timer
+{
+  uint64_t id;
+  uint64_t deadline;
+  edgex_watchdog_fn fn;
+  void *arg;
+  struct edgex_watchdog_timer *next;
+} edgex_watchdog_timer;
+
+struct edgex_watchdog
+{
+  edgex_watchdog_timer *timers;
+  uint64_t nextid;
+  bool running;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Timers are held in order of expiry. The thread waits until the first one
+ * is due, or until it is woken by a change to the list.
+ */
+
+static void *watchdog_thread (void *p)
+{
+  edgex_watchdog *wd = (edgex_watchdog *) p;
+  struct timespec until;
+
+  pthread_mutex_lock (&wd->lock);
+  while (wd->running)
+  {
+    edgex_watchdog_timer *t = wd->timers;
+    if (t == NULL)
+    {
+      pthread_cond_wait (&wd->cond, &wd->lock);
+    }
+    else if (t->deadline > edgex_device_millitime ())
+    {
+      until.tv_sec = t->deadline / EDGEX_MILLIS;
+      until.tv_nsec = (t->deadline % EDGEX_MILLIS) * 1000000;
+      pthread_cond_timedwait (&wd->cond, &wd->lock, &until);
+    }
+    else
+    {
+      wd->timers = t->next;
+      pthread_mutex_unlock (&wd->lock);
+      t->fn (t->arg);
+      free (t);
+      pthread_mutex_lock (&wd->lock);
+    }
+  }
+  pthread_mutex_unlock (&wd->lock);
+  return NULL;
+}
+
+edgex_watchdog *edgex_watchdog_create (void)
+{
+  edgex_watchdog *wd = malloc (sizeof (edgex_watchdog));
+  wd->timers = NULL;
+  wd->nextid = 1;
+  wd->running = true;
+  pthread_mutex_init (&wd->lock, NULL);
+  pthread_cond_init (&wd->cond, NULL);
+  pthread_create (&wd->thread, NULL, watchdog_thread, wd);
+  return wd;
+}
+
+uint64_t edgex_watchdog_add
+  (edgex_watchdog *wd, uint64_t deadline, edgex_watchdog_fn fn, void *arg)
+{
+  edgex_watchdog_timer **pos;
+  edgex_watchdog_timer *t = malloc (sizeof (edgex_watchdog_timer));
+  t->deadline = deadline;
+  t->fn = fn;
+  t->arg = arg;
+
+  pthread_mutex_lock (&wd->lock);
+  t->id = wd->nextid++;
+  pos = &wd->timers;
+  while (*pos && (*pos)->deadline <= deadline)
+  {
+    pos = &(*pos)->next;
+  }
+  t->next = *pos;
+  *pos = t;
+  if (pos == &wd->timers)
+  {
+    pthread_cond_signal (&wd->cond);
+  }
+  pthread_mutex_unlock (&wd->lock);
+  return t->id;
+}
+
+bool edgex_watchdog_cancel (edgex_watchdog *wd, uint64_t id)
+{
+  edgex_watchdog_timer **pos;
+  edgex_watchdog_timer *found = NULL;
+
+  pthread_mutex_lock (&wd->lock);
+  for (pos = &wd->timers; *pos; pos = &(*pos)->next)
+  {
+    if ((*pos)->id == id)
+    {
+      found = *pos;
+      *pos = found->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock (&wd->lock);
+  free (found);
+  return (found != NULL);
+}
+
+void edgex_watchdog_free (edgex_watchdog *wd)
+{
+  if (wd)
+  {
+    pthread_mutex_lock (&wd->lock);
+    wd->running = false;
+    pthread_cond_signal (&wd->cond);
+    pthread_mutex_unlock (&wd->lock);
+    pthread_join (wd->thread, NULL);
+    while (wd->timers)
+    {
+      edgex_watchdog_timer *t = wd->timers;
+      wd->timers = t->next;
+      free (t);
+    }
+    pthread_cond_destroy (&wd->cond);
+    pthread_mutex_destroy (&wd->lock);
+    free (wd);
+  }
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2018
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _EDGEX_DEVICE_WATCHDOG_H_
+#define _EDGEX_DEVICE_WATCHDOG_H_ 1
+
+#include "edgex/os.h"
+
+/* One-shot timers, run by a single thread. Timer functions are called from
+ * that thread and should return promptly.
+ */
+
+struct edgex_watchdog;
+typedef struct edgex_watchdog edgex_watchdog;
+
+typedef void (*edgex_watchdog_fn) (void *arg);
+
+extern edgex_watchdog *edgex_watchdog_create (void);
+
+/* Arrange for fn to be called at the given time (milliseconds since the
+ * epoch, as returned by edgex_device_millitime). Returns an identifier for
+ * the timer.
+ */
+
+extern uint64_t edgex_watchdog_add
+  (edgex_watchdog *wd, uint64_t deadline, edgex_watchdog_fn fn, void *arg);
+
+/* Cancel a timer. Returns true if the timer was cancelled, or false if its
+ * function has already been called (or is being called).
+ */
+
+extern bool edgex_watchdog_cancel (edgex_watchdog *wd, uint64_t id);
+
+/* Stop the watchdog thread. Timers which have not expired are discarded. */
+
+extern void edgex_watchdog_free (edgex_watchdog *wd);
+
+#endif